@@ -218,7 +218,7 @@ void AudioLoaderQueue::queue(sfxinfo_t *sfx, FSoundID soundID, const AudioQueueP
 			qInput.soundID = soundID;
 			qInput.lump = sfx->lumpnum;
 
-			th->queue(qInput);
+			th->queue(soundID.index(), qInput);
 		}
 	}
 }
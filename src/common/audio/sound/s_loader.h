@@ -52,22 +52,18 @@ struct AudioQOutput {
 
 
 
-class AudioLoadThread : public ResourceLoader<AudioQInput, AudioQOutput> {
+// Input is keyed by sound index
+class AudioLoadThread : public ResourceLoader<AudioQInput, AudioQOutput, int> {
 public:
 	std::atomic<int> currentSoundID;		// Used to externally determine if this sound is already being loaded
 
 	// Is this soundID already loading/loaded on this thread?
 	bool existsInQueue(FSoundID soundID) {
 		if (currentSoundID == soundID.index()) return true;
-		
-		bool found = false;
-
-		mInputQ.foreach([&](AudioQInput &i) {
-			if (i.soundID == soundID) found = true;
-		});
-
-		if (found) return true;
+		if (mInputQ.contains(soundID.index())) return true;
 
+		// The output queue is drained every frame so this stays short
+		bool found = false;
 		mOutputQ.foreach([&](AudioQOutput &o) {
 			if (o.soundID == soundID) found = true;
 		});
@@ -80,6 +76,7 @@ protected:
 	bool loadResource(AudioQInput &input, AudioQOutput &output) override;
 	void cancelLoad() override { currentSoundID.store(0); }
 	void completeLoad() override { currentSoundID.store(0); }
+	const char *threadName() const override { return "Audio loader"; }
 };
 
 
@@ -0,0 +1,284 @@
+/*
+** profiler.cpp
+** Per-frame timeline profiler with Chrome trace export
+**
+**---------------------------------------------------------------------------
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see http://www.gnu.org/licenses/
+**
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <memory>
+#include <mutex>
+#include <time.h>
+#include "profiler.h"
+#include "c_dispatch.h"
+#include "cmdlib.h"
+#include "files.h"
+#include "i_specialpaths.h"
+#include "printf.h"
+#include "tarray.h"
+#include "zstring.h"
+
+std::atomic<bool> ProfileActive;
+
+//==========================================================================
+//
+// Each thread owns one event buffer. Only the owning thread writes to it,
+// the count is published with release semantics so that the exporter
+// never sees a partially written event. The event storage is only
+// allocated by the first zone a thread records during a capture, so
+// threads that only get named cost next to nothing. Buffers are never
+// freed because pooled threads can outlive any single capture.
+//
+//==========================================================================
+
+enum
+{
+	MAX_PROFILE_EVENTS = 32768,	// per thread and capture. Excess zones are counted and dropped.
+};
+
+struct FProfileEvent
+{
+	const char *Name;
+	uint64_t Start;
+	uint64_t End;
+};
+
+struct FProfileThread
+{
+	int Index;
+	std::atomic<const char *> Name{};
+	std::atomic<unsigned> Generation{};
+	std::atomic<unsigned> Count{};
+	std::atomic<unsigned> Dropped{};
+	FProfileEvent *Events = nullptr;	// Published by the first Count store
+};
+
+static std::mutex profileThreadLock;
+static TArray<FProfileThread *> profileThreads;
+static thread_local FProfileThread *myProfileThread;
+static std::atomic<unsigned> captureGeneration;
+
+// Capture state. This is only touched by the main thread.
+static int framesRequested;
+static int framesLeft;
+static uint64_t captureStart;
+static uint64_t frameStart;
+static FString captureFile;
+
+static FProfileThread *GetProfileThread()
+{
+	if (myProfileThread == nullptr)
+	{
+		std::lock_guard<std::mutex> lock(profileThreadLock);
+		myProfileThread = new FProfileThread;
+		myProfileThread->Index = profileThreads.Push(myProfileThread) + 1;
+	}
+	return myProfileThread;
+}
+
+//==========================================================================
+//
+// Names the calling thread in the exported trace.
+//
+//==========================================================================
+
+void Profile_SetThreadName(const char *name)
+{
+	auto thread = GetProfileThread();
+	if (thread->Name.load(std::memory_order_relaxed) != name) thread->Name.store(name, std::memory_order_release);
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void Profile_RecordZone(const char *name, uint64_t start, uint64_t end)
+{
+	auto thread = GetProfileThread();
+	unsigned gen = captureGeneration.load(std::memory_order_acquire);
+
+	if (thread->Generation.load(std::memory_order_relaxed) != gen)
+	{
+		// first zone of a new capture on this thread.
+		if (thread->Events == nullptr) thread->Events = new FProfileEvent[MAX_PROFILE_EVENTS];
+		thread->Count.store(0, std::memory_order_relaxed);
+		thread->Dropped.store(0, std::memory_order_relaxed);
+		thread->Generation.store(gen, std::memory_order_release);
+	}
+
+	unsigned count = thread->Count.load(std::memory_order_relaxed);
+	if (count >= MAX_PROFILE_EVENTS)
+	{
+		thread->Dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	thread->Events[count] = { name, start, end };
+	thread->Count.store(count + 1, std::memory_order_release);
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+static void WriteTraceString(FileWriter *fw, const char *str)
+{
+	fw->Write("\"", 1);
+	for (; *str; str++)
+	{
+		if (*str == '"' || *str == '\\') fw->Write("\\", 1);
+		if ((unsigned char)*str >= 32) fw->Write(str, 1);
+	}
+	fw->Write("\"", 1);
+}
+
+static void WriteCapture()
+{
+	std::unique_ptr<FileWriter> fw(FileWriter::Open(captureFile.GetChars()));
+	if (fw == nullptr)
+	{
+		Printf(TEXTCOLOR_RED "Unable to write profile to %s\n", captureFile.GetChars());
+		return;
+	}
+
+	unsigned gen = captureGeneration.load(std::memory_order_relaxed);
+	unsigned numevents = 0, numthreads = 0, dropped = 0;
+	bool first = true;
+
+	fw->Printf("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+	std::lock_guard<std::mutex> lock(profileThreadLock);
+	for (auto thread : profileThreads)
+	{
+		if (thread->Generation.load(std::memory_order_acquire) != gen) continue;
+		unsigned count = thread->Count.load(std::memory_order_acquire);
+		if (count == 0) continue;
+
+		const char *name = thread->Name.load(std::memory_order_acquire);
+		FString defname;
+		if (name == nullptr)
+		{
+			defname.Format("Thread %d", thread->Index);
+			name = defname.GetChars();
+		}
+		fw->Printf("%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n", thread->Index);
+		WriteTraceString(fw.get(), name);
+		fw->Printf("}}");
+		first = false;
+
+		for (unsigned i = 0; i < count; i++)
+		{
+			auto &ev = thread->Events[i];
+			uint64_t start = std::max(ev.Start, captureStart);
+			uint64_t end = std::max(ev.End, start);
+			fw->Printf(",\n{\"name\":");
+			WriteTraceString(fw.get(), ev.Name);
+			fw->Printf(",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", thread->Index, (start - captureStart) / 1000., (end - start) / 1000.);
+		}
+		numevents += count;
+		numthreads++;
+		dropped += thread->Dropped.load(std::memory_order_relaxed);
+	}
+	fw->Printf("\n]}\n");
+
+	Printf("Wrote %u events from %u threads to %s\n", numevents, numthreads, captureFile.GetChars());
+	if (dropped > 0)
+	{
+		Printf(TEXTCOLOR_ORANGE "%u events were dropped because a thread's buffer was full\n", dropped);
+	}
+}
+
+//==========================================================================
+//
+// Called by the main loop after each displayed frame. Captures always
+// start and end on a frame boundary.
+//
+//==========================================================================
+
+void Profile_EndFrame()
+{
+	if (ProfileActive.load(std::memory_order_relaxed))
+	{
+		uint64_t now = I_nsTime();
+		Profile_RecordZone("Frame", frameStart, now);
+		frameStart = now;
+		if (--framesLeft <= 0)
+		{
+			ProfileActive.store(false, std::memory_order_relaxed);
+			WriteCapture();
+		}
+	}
+	else if (framesRequested > 0)
+	{
+		Profile_SetThreadName("Main");
+		framesLeft = framesRequested;
+		framesRequested = 0;
+		captureGeneration.fetch_add(1, std::memory_order_release);
+		captureStart = frameStart = I_nsTime();
+		ProfileActive.store(true, std::memory_order_relaxed);
+	}
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+CCMD(profile_capture)
+{
+	if (argv.argc() < 2)
+	{
+		Printf("Usage: profile_capture <frames> [filename]\n");
+		return;
+	}
+	if (ProfileActive || framesRequested > 0)
+	{
+		Printf("A profile capture is already running\n");
+		return;
+	}
+
+	int frames = (int)strtol(argv[1], nullptr, 10);
+	if (frames <= 0)
+	{
+		Printf("The number of frames must be positive\n");
+		return;
+	}
+
+	if (argv.argc() > 2)
+	{
+		captureFile = argv[2];
+		DefaultExtension(captureFile, ".json");
+	}
+	else
+	{
+		char timestr[32];
+		time_t now = time(nullptr);
+		strftime(timestr, sizeof(timestr), "%Y%m%d_%H%M%S", localtime(&now));
+
+		captureFile = M_GetScreenshotsPath();
+		if (captureFile.IsNotEmpty() && captureFile.Back() != '/' && captureFile.Back() != '\\') captureFile += '/';
+		CreatePath(captureFile.GetChars());
+		captureFile.AppendFormat("profile_%s.json", timestr);
+	}
+	framesRequested = frames;
+	Printf("Capturing %d frames to %s\n", frames, captureFile.GetChars());
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#include "i_time.h"
+
+//==========================================================================
+//
+// Frame timeline profiler
+//
+// Scoped zones record begin/end times into a buffer that belongs to the
+// calling thread, so any thread can use them without locking. Zones only
+// record while 'profile_capture' is running; otherwise each one costs a
+// single relaxed load. The result is written as a Chrome trace JSON file
+// that chrome://tracing and Perfetto can open.
+//
+// Zone names must be string literals or otherwise outlive the capture.
+//
+//==========================================================================
+
+extern std::atomic<bool> ProfileActive;
+
+void Profile_SetThreadName(const char *name);
+void Profile_RecordZone(const char *name, uint64_t start, uint64_t end);
+void Profile_EndFrame();
+
+class FProfileZone
+{
+	const char *Name;
+	uint64_t Start;
+
+public:
+	FProfileZone(const char *name)
+	{
+		Name = ProfileActive.load(std::memory_order_relaxed) ? name : nullptr;
+		Start = Name ? I_nsTime() : 0;
+	}
+
+	~FProfileZone()
+	{
+		if (Name) Profile_RecordZone(Name, Start, I_nsTime());
+	}
+
+	FProfileZone(const FProfileZone &) = delete;
+	FProfileZone &operator=(const FProfileZone &) = delete;
+};
+
+#define PROFILE_ZONE_CAT2(a, b) a##b
+#define PROFILE_ZONE_CAT(a, b) PROFILE_ZONE_CAT2(a, b)
+#define PROFILE_ZONE(name) FProfileZone PROFILE_ZONE_CAT(profileZone_, __LINE__)(name)
@@ -125,12 +125,12 @@ const char *UnicodeToString(const char *cc)
 //
 //==========================================================================
 
-bool FSerializer::OpenWriter(bool pretty)
+bool FSerializer::OpenWriter(bool pretty, bool binary)
 {
 	if (w != nullptr || r != nullptr) return false;
 
 	mErrors = 0;
-	w = new FWriter(pretty);
+	w = new FWriter(pretty, binary);
 	BeginObject(nullptr);
 	return true;
 }
@@ -755,9 +755,9 @@ const char *FSerializer::GetOutput(unsigned *len)
 	EndObject();
 	if (len != nullptr)
 	{
-		*len = (unsigned)w->mOutString.GetSize();
+		*len = (unsigned)w->GetOutputSize();
 	}
-	return w->mOutString.GetString();
+	return w->GetOutput();
 }
 
 //==========================================================================
@@ -767,21 +767,48 @@ const char *FSerializer::GetOutput(unsigned *len)
 //==========================================================================
 
 FCompressedBuffer FSerializer::GetCompressedOutput()
+{
+	if (isReading()) return{ 0,0,0,0,0,nullptr };
+	FCompressedBuffer buff = GetUncompressedOutput();
+	CompressOutput(buff);
+	return buff;
+}
+
+//==========================================================================
+//
+// Returns a copy of the output as a stored buffer without CRC.
+// CompressOutput can finish it later, even on another thread, so that the
+// serializer itself can be discarded right away.
+//
+//==========================================================================
+
+FCompressedBuffer FSerializer::GetUncompressedOutput()
 {
 	if (isReading()) return{ 0,0,0,0,0,nullptr };
 	FCompressedBuffer buff;
 	WriteObjects();
 	EndObject();
 	buff.filename = nullptr;
-	buff.mSize = (unsigned)w->mOutString.GetSize();
-	buff.mCRC32 = crc32(0, (const Bytef*)w->mOutString.GetString(), buff.mSize);
+	buff.mSize = buff.mCompressedSize = (unsigned)w->GetOutputSize();
+	buff.mMethod = METHOD_STORED;
+	buff.mCRC32 = 0;
+	buff.mBuffer = new char[buff.mSize + 1];
+	memcpy(buff.mBuffer, w->GetOutput(), buff.mSize);
+	buff.mBuffer[buff.mSize] = 0;
+	return buff;
+}
+
+void FSerializer::CompressOutput(FCompressedBuffer& buff)
+{
+	if (buff.mBuffer == nullptr || buff.mMethod != METHOD_STORED) return;
+	buff.mCRC32 = crc32(0, (const Bytef*)buff.mBuffer, buff.mSize);
 
 	uint8_t *compressbuf = new uint8_t[buff.mSize+1];
 
 	z_stream stream;
 	int err;
 
-	stream.next_in = (Bytef *)w->mOutString.GetString();
+	stream.next_in = (Bytef *)buff.mBuffer;
 	stream.avail_in = (unsigned)buff.mSize;
 	stream.next_out = (Bytef*)compressbuf;
 	stream.avail_out = (unsigned)buff.mSize;
@@ -807,18 +834,18 @@ FCompressedBuffer FSerializer::GetCompressedOutput()
 	err = deflateEnd(&stream);
 	if (err == Z_OK)
 	{
+		delete[] buff.mBuffer;
 		buff.mBuffer = new char[buff.mCompressedSize];
 		buff.mMethod = METHOD_DEFLATE;
 		memcpy(buff.mBuffer, compressbuf, buff.mCompressedSize);
 		delete[] compressbuf;
-		return buff;
+		return;
 	}
 
 error:
-	memcpy(compressbuf, w->mOutString.GetString(), buff.mSize + 1);
+	// keep the stored data.
+	delete[] compressbuf;
 	buff.mCompressedSize = buff.mSize;
-	buff.mMethod = METHOD_STORED;
-	return buff;
 }
 
 //==========================================================================
@@ -84,7 +84,7 @@ public:
 		Close();
 	}
 	void SetUniqueSoundNames() { soundNamesAreUnique = true; }
-	bool OpenWriter(bool pretty = true);
+	bool OpenWriter(bool pretty = true, bool binary = false);	// binary output is a compact alternative to JSON. OpenReader accepts both.
 	bool OpenReader(const char *buffer, size_t length);
 	bool OpenReader(FileSys::FCompressedBuffer *input);
 	void Close();
@@ -99,6 +99,8 @@ public:
 	const char *GetKey();
 	const char *GetOutput(unsigned *len = nullptr);
 	FileSys::FCompressedBuffer GetCompressedOutput();
+	FileSys::FCompressedBuffer GetUncompressedOutput();
+	static void CompressOutput(FileSys::FCompressedBuffer& buff);
 	// The sprite serializer is a special case because it is needed by the VM to handle its 'spriteid' type.
 	virtual FSerializer &Sprite(const char *key, int32_t &spritenum, int32_t *def);
 	// This is only needed by the type system.
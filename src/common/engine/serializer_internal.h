@@ -1,4 +1,9 @@
 #pragma once
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
 const char* UnicodeToString(const char* cc);
 const char* StringToUnicode(const char* cc, int size = -1);
 
@@ -25,6 +30,306 @@ struct FJSONObject
 	}
 };
 
+//==========================================================================
+//
+// Binary serializer format
+//
+// This is a compact alternative to the JSON text. It is written from the
+// same stream of events and reads back into the same DOM, so nothing beyond
+// FWriter and FReader needs to know which format a buffer uses.
+//
+// Keys are interned: the first use of a key stores its text and every later
+// use only stores its index. Objects and arrays are prefixed with their
+// payload size and element count so that the reader can validate them
+// without scanning ahead.
+//
+//==========================================================================
+
+enum
+{
+	BIN_NULL,
+	BIN_FALSE,
+	BIN_TRUE,
+	BIN_INT,		// zigzag varint
+	BIN_UINT,		// varint
+	BIN_INT64,		// zigzag varint
+	BIN_UINT64,		// varint
+	BIN_DOUBLE,		// 8 bytes, little endian
+	BIN_STRING,		// varint length + data
+	BIN_OBJECT,		// 32 bit payload size + 32 bit member count + members
+	BIN_ARRAY,		// 32 bit payload size + 32 bit element count + elements
+	BIN_KEYDEF,		// varint length + data, assigns the next key index
+	BIN_KEY,		// varint key index
+};
+
+static const char BinarySaveSig[] = { 'G', 'Z', 'B', 'S', 1 };
+
+struct FBinaryWriter
+{
+	TArray<uint8_t> mData;
+	TArray<unsigned> mContainers;	// offsets of the open containers' size fields
+	TArray<uint32_t> mCounts;
+	std::unordered_map<std::string_view, uint32_t> mKeyMap;
+	std::deque<std::string> mKeyStore;
+
+	FBinaryWriter()
+	{
+		mData.Grow(0x10000);
+		for (auto c : BinarySaveSig) mData.Push((uint8_t)c);
+	}
+
+	void PutVarint(uint64_t v)
+	{
+		while (v >= 0x80)
+		{
+			mData.Push(uint8_t(v | 0x80));
+			v >>= 7;
+		}
+		mData.Push(uint8_t(v));
+	}
+
+	void PutZigzag(int64_t v)
+	{
+		PutVarint((uint64_t(v) << 1) ^ uint64_t(v >> 63));
+	}
+
+	void PutBytes(const char *s, size_t len)
+	{
+		PutVarint(len);
+		if (len == 0) return;
+		unsigned pos = mData.Reserve(len);
+		memcpy(&mData[pos], s, len);
+	}
+
+	void PutUInt32(unsigned pos, uint32_t v)
+	{
+		mData[pos] = uint8_t(v);
+		mData[pos + 1] = uint8_t(v >> 8);
+		mData[pos + 2] = uint8_t(v >> 16);
+		mData[pos + 3] = uint8_t(v >> 24);
+	}
+
+	void Value(uint8_t tag)
+	{
+		if (mCounts.Size() > 0) mCounts.Last()++;
+		mData.Push(tag);
+	}
+
+	void StartContainer(uint8_t tag)
+	{
+		Value(tag);
+		mContainers.Push(mData.Reserve(8));
+		mCounts.Push(0);
+	}
+
+	void EndContainer()
+	{
+		unsigned pos = mContainers.Last();
+		PutUInt32(pos, mData.Size() - pos - 8);
+		PutUInt32(pos + 4, mCounts.Last());
+		mContainers.Pop();
+		mCounts.Pop();
+	}
+
+	void StartObject() { StartContainer(BIN_OBJECT); }
+	void EndObject() { EndContainer(); }
+	void StartArray() { StartContainer(BIN_ARRAY); }
+	void EndArray() { EndContainer(); }
+
+	void Key(const char *k)
+	{
+		std::string_view key(k);
+		auto it = mKeyMap.find(key);
+		if (it != mKeyMap.end())
+		{
+			mData.Push(BIN_KEY);
+			PutVarint(it->second);
+		}
+		else
+		{
+			mKeyStore.emplace_back(key);
+			mKeyMap.emplace(mKeyStore.back(), (uint32_t)mKeyMap.size());
+			mData.Push(BIN_KEYDEF);
+			PutBytes(k, key.size());
+		}
+	}
+
+	void Null() { Value(BIN_NULL); }
+	void Bool(bool k) { Value(k ? BIN_TRUE : BIN_FALSE); }
+	void Int(int32_t k) { Value(BIN_INT); PutZigzag(k); }
+	void Int64(int64_t k) { Value(BIN_INT64); PutZigzag(k); }
+	void Uint(uint32_t k) { Value(BIN_UINT); PutVarint(k); }
+	void Uint64(uint64_t k) { Value(BIN_UINT64); PutVarint(k); }
+
+	void Double(double k)
+	{
+		uint64_t bits;
+		memcpy(&bits, &k, 8);
+		Value(BIN_DOUBLE);
+		for (int i = 0; i < 8; i++, bits >>= 8) mData.Push(uint8_t(bits));
+	}
+
+	void String(const char *k)
+	{
+		Value(BIN_STRING);
+		PutBytes(k, strlen(k));
+	}
+};
+
+//==========================================================================
+//
+// Feeds a binary buffer into a rapidjson handler as SAX events.
+// Any malformed data makes it fail, which leaves the document empty,
+// just like a JSON parse error would.
+//
+//==========================================================================
+
+struct FBinaryReader
+{
+	const uint8_t *p, *end;
+	TArray<std::string_view> mKeys;
+
+	FBinaryReader(const char *buffer, size_t length)
+	{
+		p = (const uint8_t*)buffer + sizeof(BinarySaveSig);
+		end = (const uint8_t*)buffer + length;
+	}
+
+	static bool IsBinary(const char *buffer, size_t length)
+	{
+		return length >= sizeof(BinarySaveSig) && !memcmp(buffer, BinarySaveSig, sizeof(BinarySaveSig));
+	}
+
+	bool GetVarint(uint64_t &v)
+	{
+		v = 0;
+		for (int shift = 0; shift < 64 && p < end; shift += 7)
+		{
+			uint8_t b = *p++;
+			v |= uint64_t(b & 0x7f) << shift;
+			if (!(b & 0x80)) return true;
+		}
+		return false;
+	}
+
+	bool GetZigzag(int64_t &v)
+	{
+		uint64_t u;
+		if (!GetVarint(u)) return false;
+		v = int64_t(u >> 1) ^ -int64_t(u & 1);
+		return true;
+	}
+
+	bool GetBytes(std::string_view &s)
+	{
+		uint64_t len;
+		if (!GetVarint(len) || len > uint64_t(end - p)) return false;
+		s = std::string_view((const char*)p, (size_t)len);
+		p += len;
+		return true;
+	}
+
+	bool GetUInt32(uint32_t &v)
+	{
+		if (end - p < 4) return false;
+		v = p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24);
+		p += 4;
+		return true;
+	}
+
+	template<class Handler>
+	bool GetKey(Handler &handler)
+	{
+		if (p >= end) return false;
+		uint8_t tag = *p++;
+		std::string_view key;
+		if (tag == BIN_KEYDEF)
+		{
+			if (!GetBytes(key)) return false;
+			mKeys.Push(key);
+		}
+		else if (tag == BIN_KEY)
+		{
+			uint64_t index;
+			if (!GetVarint(index) || index >= mKeys.Size()) return false;
+			key = mKeys[(unsigned)index];
+		}
+		else return false;
+		return handler.Key(key.data(), (rapidjson::SizeType)key.size(), true);
+	}
+
+	template<class Handler>
+	bool GetValue(Handler &handler)
+	{
+		if (p >= end) return false;
+		uint8_t tag = *p++;
+		uint64_t u;
+		int64_t i;
+		std::string_view s;
+		switch (tag)
+		{
+		case BIN_NULL:
+			return handler.Null();
+
+		case BIN_FALSE:
+		case BIN_TRUE:
+			return handler.Bool(tag == BIN_TRUE);
+
+		case BIN_INT:
+			return GetZigzag(i) && handler.Int((int)i);
+
+		case BIN_UINT:
+			return GetVarint(u) && handler.Uint((unsigned)u);
+
+		case BIN_INT64:
+			return GetZigzag(i) && handler.Int64(i);
+
+		case BIN_UINT64:
+			return GetVarint(u) && handler.Uint64(u);
+
+		case BIN_DOUBLE:
+		{
+			if (end - p < 8) return false;
+			uint64_t bits = 0;
+			for (int b = 7; b >= 0; b--) bits = (bits << 8) | p[b];
+			p += 8;
+			double d;
+			memcpy(&d, &bits, 8);
+			return handler.Double(d);
+		}
+
+		case BIN_STRING:
+			return GetBytes(s) && handler.String(s.data(), (rapidjson::SizeType)s.size(), true);
+
+		case BIN_OBJECT:
+		case BIN_ARRAY:
+		{
+			uint32_t size, count;
+			if (!GetUInt32(size) || !GetUInt32(count) || size > uint64_t(end - p)) return false;
+			auto containerend = p + size;
+			bool isobject = tag == BIN_OBJECT;
+			if (!(isobject ? handler.StartObject() : handler.StartArray())) return false;
+			for (uint32_t n = 0; n < count; n++)
+			{
+				if (isobject && !GetKey(handler)) return false;
+				if (!GetValue(handler)) return false;
+			}
+			if (p != containerend) return false;
+			return isobject ? handler.EndObject(count) : handler.EndArray(count);
+		}
+
+		default:
+			return false;
+		}
+	}
+
+	template<class Handler>
+	bool operator()(Handler &handler)
+	{
+		return GetValue(handler) && p == end;
+	}
+};
+
 //==========================================================================
 //
 // some wrapper stuff to keep the RapidJSON dependencies out of the global headers.
@@ -39,21 +344,27 @@ struct FWriter
 
 	Writer *mWriter1;
 	PrettyWriter *mWriter2;
+	FBinaryWriter *mWriter3;
 	TArray<bool> mInObject;
 	rapidjson::StringBuffer mOutString;
 	TArray<DObject *> mDObjects;
 	TMap<DObject *, int> mObjectMap;
 
-	FWriter(bool pretty)
+	FWriter(bool pretty, bool binary = false)
 	{
-		if (!pretty)
+		mWriter1 = nullptr;
+		mWriter2 = nullptr;
+		mWriter3 = nullptr;
+		if (binary)
+		{
+			mWriter3 = new FBinaryWriter;
+		}
+		else if (!pretty)
 		{
 			mWriter1 = new Writer(mOutString);
-			mWriter2 = nullptr;
 		}
 		else
 		{
-			mWriter1 = nullptr;
 			mWriter2 = new PrettyWriter(mOutString);
 		}
 	}
@@ -62,6 +373,19 @@ struct FWriter
 	{
 		if (mWriter1) delete mWriter1;
 		if (mWriter2) delete mWriter2;
+		if (mWriter3) delete mWriter3;
+	}
+
+	const char *GetOutput() const
+	{
+		if (mWriter3) return (const char*)mWriter3->mData.Data();
+		return mOutString.GetString();
+	}
+
+	size_t GetOutputSize() const
+	{
+		if (mWriter3) return mWriter3->mData.Size();
+		return mOutString.GetSize();
 	}
 
 
@@ -74,36 +398,42 @@ struct FWriter
 	{
 		if (mWriter1) mWriter1->StartObject();
 		else if (mWriter2) mWriter2->StartObject();
+		else if (mWriter3) mWriter3->StartObject();
 	}
 
 	void EndObject()
 	{
 		if (mWriter1) mWriter1->EndObject();
 		else if (mWriter2) mWriter2->EndObject();
+		else if (mWriter3) mWriter3->EndObject();
 	}
 
 	void StartArray()
 	{
 		if (mWriter1) mWriter1->StartArray();
 		else if (mWriter2) mWriter2->StartArray();
+		else if (mWriter3) mWriter3->StartArray();
 	}
 
 	void EndArray()
 	{
 		if (mWriter1) mWriter1->EndArray();
 		else if (mWriter2) mWriter2->EndArray();
+		else if (mWriter3) mWriter3->EndArray();
 	}
 
 	void Key(const char *k)
 	{
 		if (mWriter1) mWriter1->Key(k);
 		else if (mWriter2) mWriter2->Key(k);
+		else if (mWriter3) mWriter3->Key(k);
 	}
 
 	void Null()
 	{
 		if (mWriter1) mWriter1->Null();
 		else if (mWriter2) mWriter2->Null();
+		else if (mWriter3) mWriter3->Null();
 	}
 
 	void StringU(const char *k, bool encode)
@@ -111,6 +441,7 @@ struct FWriter
 		if (encode) k = StringToUnicode(k);
 		if (mWriter1) mWriter1->String(k);
 		else if (mWriter2) mWriter2->String(k);
+		else if (mWriter3) mWriter3->String(k);
 	}
 
 	void String(const char *k)
@@ -118,6 +449,7 @@ struct FWriter
 		k = StringToUnicode(k);
 		if (mWriter1) mWriter1->String(k);
 		else if (mWriter2) mWriter2->String(k);
+		else if (mWriter3) mWriter3->String(k);
 	}
 
 	void String(const char *k, int size)
@@ -125,36 +457,42 @@ struct FWriter
 		k = StringToUnicode(k, size);
 		if (mWriter1) mWriter1->String(k);
 		else if (mWriter2) mWriter2->String(k);
+		else if (mWriter3) mWriter3->String(k);
 	}
 
 	void Bool(bool k)
 	{
 		if (mWriter1) mWriter1->Bool(k);
 		else if (mWriter2) mWriter2->Bool(k);
+		else if (mWriter3) mWriter3->Bool(k);
 	}
 
 	void Int(int32_t k)
 	{
 		if (mWriter1) mWriter1->Int(k);
 		else if (mWriter2) mWriter2->Int(k);
+		else if (mWriter3) mWriter3->Int(k);
 	}
 
 	void Int64(int64_t k)
 	{
 		if (mWriter1) mWriter1->Int64(k);
 		else if (mWriter2) mWriter2->Int64(k);
+		else if (mWriter3) mWriter3->Int64(k);
 	}
 
 	void Uint(uint32_t k)
 	{
 		if (mWriter1) mWriter1->Uint(k);
 		else if (mWriter2) mWriter2->Uint(k);
+		else if (mWriter3) mWriter3->Uint(k);
 	}
 
 	void Uint64(int64_t k)
 	{
 		if (mWriter1) mWriter1->Uint64(k);
 		else if (mWriter2) mWriter2->Uint64(k);
+		else if (mWriter3) mWriter3->Uint64(k);
 	}
 
 	void Double(double k)
@@ -167,6 +505,10 @@ struct FWriter
 		{
 			mWriter2->Double(k);
 		}
+		else if (mWriter3)
+		{
+			mWriter3->Double(k);
+		}
 	}
 
 };
@@ -187,7 +529,12 @@ struct FReader
 
 	FReader(const char *buffer, size_t length)
 	{
-		mDoc.Parse(buffer, length);
+		if (FBinaryReader::IsBinary(buffer, length))
+		{
+			FBinaryReader reader(buffer, length);
+			mDoc.Populate(reader);
+		}
+		else mDoc.Parse(buffer, length);
 		mObjects.Push(FJSONObject(&mDoc));
 	}
 
@@ -43,6 +43,7 @@
 #include <string.h>
 #include <functional>
 #include <vector>
+#include <memory>
 #include "fs_swap.h"
 
 namespace FileSys {
@@ -74,11 +75,13 @@ public:
 class FileReader;
 
 // an opaque memory buffer to the file's content. Can either own the memory or just point to an external buffer.
+// An external buffer can optionally be kept alive by a shared owner, e.g. a memory mapped file.
 class FileData
 {
 	void* memory;
 	size_t length;
 	bool owned;
+	std::shared_ptr<const void> keepalive;
 
 public:
 	using value_type = uint8_t;
@@ -99,6 +102,13 @@ public:
 			owned = false;
 		}
 	}
+	FileData(const void* memory_, size_t len, std::shared_ptr<const void> owner)
+	{
+		memory = (void*)memory_;
+		length = len;
+		owned = false;
+		keepalive = std::move(owner);
+	}
 	uint8_t* writable() const { return owned? (uint8_t*)memory : nullptr; }
 	const void* data() const { return memory; }
 	size_t size() const { return length; }
@@ -110,6 +120,7 @@ public:
 		if (owned && memory) free(memory);
 		length = copy.length;
 		owned = copy.owned;
+		keepalive = copy.keepalive;
 		if (owned)
 		{
 			memory = malloc(length);
@@ -125,6 +136,7 @@ public:
 		length = copy.length;
 		owned = copy.owned;
 		memory = copy.memory;
+		keepalive = std::move(copy.keepalive);
 		copy.memory = nullptr;
 		copy.length = 0;
 		copy.owned = true;
@@ -145,6 +157,7 @@ public:
 	void* allocate(size_t len)
 	{
 		if (!owned) memory = nullptr;
+		keepalive.reset();
 		length = len;
 		owned = true;
 		memory = realloc(memory, length);
@@ -156,6 +169,7 @@ public:
 		memory = (void*)mem;
 		length = len;
 		owned = false;
+		keepalive.reset();
 	}
 
 	void clear()
@@ -164,6 +178,7 @@ public:
 		memory = nullptr;
 		length = 0;
 		owned = true;
+		keepalive.reset();
 	}
 };
 
@@ -178,6 +193,7 @@ public:
 	virtual ptrdiff_t Read (void *buffer, ptrdiff_t len) = 0;
 	virtual char *Gets(char *strbuf, ptrdiff_t len) = 0;
 	virtual const char *GetBuffer() const { return nullptr; }
+	virtual std::shared_ptr<const void> GetBufferOwner() const { return nullptr; }	// keeps GetBuffer's memory valid if it is not owned by the reader alone.
 	ptrdiff_t GetLength () const { return Length; }
 
 	virtual void ShiftStart(ptrdiff_t offset) {};
@@ -252,6 +268,7 @@ public:
 	}
 
 	bool OpenFile(const char *filename, Size start = 0, Size length = -1, bool buffered = false);
+	bool OpenMappedFile(const char *filename);	// maps the entire file into memory, falls back to OpenFile if that is not possible.
 	bool OpenFilePart(FileReader &parent, Size start, Size length);
 	bool OpenMemory(const void *mem, Size length);	// read directly from the buffer
 	bool OpenMemoryArray(FileData& data);	// take the given array
@@ -290,6 +307,11 @@ public:
 		return mReader->GetBuffer();
 	}
 
+	std::shared_ptr<const void> GetBufferOwner()
+	{
+		return mReader->GetBufferOwner();
+	}
+
 	Size GetLength() const
 	{
 		return mReader->GetLength();
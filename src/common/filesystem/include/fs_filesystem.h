@@ -28,6 +28,8 @@ struct FolderEntry
 	unsigned lumpnum;
 };
 
+struct FOpenedFile;
+
 class FileSystem
 {
 public:
@@ -46,6 +48,7 @@ public:
 	bool InitSingleFile(const char *filename, FileSystemMessageFunc Printf = nullptr);
 	bool InitMultipleFiles (std::vector<std::string>& filenames, LumpFilterInfo* filter = nullptr, FileSystemMessageFunc Printf = nullptr, bool allowduplicates = false, FILE* hashfile = nullptr);
 	void AddFile (const char *filename, FileReader *wadinfo, LumpFilterInfo* filter, FileSystemMessageFunc Printf, FILE* hashfile);
+	void AddResourceFile(const char* filename, FResourceFile* resfile, LumpFilterInfo* filter, FileSystemMessageFunc Printf, FILE* hashfile);
 	int CheckIfResourceFileLoaded (const char *name) noexcept;
 	void AddAdditionalFile(const char* filename, FileReader* wadinfo = NULL) {}
 
@@ -159,7 +162,9 @@ protected:
 	struct LumpRecord;
 
 	std::vector<FResourceFile *> Files;
+	std::vector<std::pair<int, int>> FileOrigins;	// containing file and entry for embedded files, -1 otherwise.
 	std::vector<LumpRecord> FileInfo;
+	FileData DirectoryCache;	// the lump names point into this if the lump directory cache was used.
 
 	std::vector<uint32_t> Hashes;	// one allocation for all hash lists.
 	uint32_t *FirstLumpIndex = nullptr;	// [RH] Hashing stuff moved out of lumpinfo structure
@@ -183,6 +188,11 @@ protected:
 	StringPool* stringpool = nullptr;
 
 private:
+	static FResourceFile* OpenFileForAdding(const char* filename, FileReader* filer, LumpFilterInfo* filter, FileSystemMessageFunc Printf, StringPool* sp);
+	static std::vector<FOpenedFile> OpenFilesInParallel(const std::vector<std::string>& filenames, LumpFilterInfo* filter, FileSystemMessageFunc Printf);
+	bool LoadDirectoryCache(const std::vector<std::string>& filenames, LumpFilterInfo* filter, FileSystemMessageFunc Printf);
+	void SaveDirectoryCache(const std::vector<std::string>& filenames, LumpFilterInfo* filter, FileSystemMessageFunc Printf);
+	void SetHashPointers();
 	void DeleteAll();
 	void MoveLumpsInFolder(const char *);
 
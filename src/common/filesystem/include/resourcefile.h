@@ -27,6 +27,7 @@ struct LumpFilterInfo
 	std::vector<std::string> blockednames;			// File names that will never be accepted (e.g. dehacked.exe for Doom)
 	std::function<bool(const char*, const char*)> filenamecheck;	// for scanning directories, this allows to eliminate unwanted content.
 	std::function<void()> postprocessFunc;
+	std::string cachePath;	// if set, the resulting lump directory gets cached in this folder so that it can be reused on the next start.
 };
 
 enum class FSMessageLevel
@@ -63,6 +63,7 @@ public:
 	FDirectory(const char * dirname, StringPool* sp, bool nosubdirflag = false);
 	bool Open(LumpFilterInfo* filter, FileSystemMessageFunc Printf);
 	FileReader GetEntryReader(uint32_t entry, int, int) override;
+	FileData Read(uint32_t entry) override;
 };
 
 
@@ -187,6 +188,33 @@ FileReader FDirectory::GetEntryReader(uint32_t entry, int readertype, int)
 	return fr;
 }
 
+//==========================================================================
+//
+// Large files get mapped into memory instead of being copied into a buffer.
+// For small ones the mapping costs more than it saves.
+//
+//==========================================================================
+
+FileData FDirectory::Read(uint32_t entry)
+{
+	enum { MIN_MAPPED_SIZE = 65536 };
+
+	if (entry < NumLumps && Entries[entry].Length >= MIN_MAPPED_SIZE)
+	{
+		std::string fn = mBasePath;
+		fn += SystemFilePath[Entries[entry].Position];
+		FileReader fr;
+		if (fr.OpenMappedFile(fn.c_str()))
+		{
+			auto buf = fr.GetBuffer();
+			if (buf != nullptr) return FileData(buf, fr.GetLength(), fr.GetBufferOwner());
+			return fr.Read();
+		}
+		return FileData();
+	}
+	return FResourceFile::Read(entry);
+}
+
 //==========================================================================
 //
 // File open
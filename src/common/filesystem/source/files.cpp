@@ -41,6 +41,18 @@
 #include "zstring.h"
 #include "files_internal.h"
 
+#ifdef _WIN32
+#ifndef _WINNT_
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 namespace FileSys {
 	
 #ifdef _WIN32
@@ -197,6 +209,102 @@ private:
 	}
 };
 
+//==========================================================================
+//
+// FileMapping
+//
+// A read-only view of an entire file. Shared between the reader and all
+// FileData objects that reference parts of it, so that it stays valid as
+// long as anything looks into it.
+//
+//==========================================================================
+
+class FileMapping
+{
+public:
+	const char* Memory = nullptr;
+	size_t Size = 0;
+
+	~FileMapping()
+	{
+		if (Memory == nullptr) return;
+#ifdef _WIN32
+		UnmapViewOfFile(Memory);
+#else
+		munmap((void*)Memory, Size);
+#endif
+	}
+
+	static std::shared_ptr<FileMapping> Create(const char* filename)
+	{
+		// On 32 bit systems the address space is too small to map multi-hundred-MB archives.
+		if (sizeof(void*) < 8) return nullptr;
+
+		auto map = std::make_shared<FileMapping>();
+#ifdef _WIN32
+		auto widename = toWide(filename);
+		HANDLE file = CreateFileW(widename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+		if (file == INVALID_HANDLE_VALUE) return nullptr;
+
+		LARGE_INTEGER size;
+		if (GetFileSizeEx(file, &size) && size.QuadPart > 0)
+		{
+			// The view keeps the file open by itself, so the handles can be closed right away.
+			HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+			if (mapping != nullptr)
+			{
+				map->Memory = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				map->Size = (size_t)size.QuadPart;
+				CloseHandle(mapping);
+			}
+		}
+		CloseHandle(file);
+#else
+		int fd = open(filename, O_RDONLY);
+		if (fd < 0) return nullptr;
+
+		struct stat info;
+		if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+		{
+			void* mem = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mem != MAP_FAILED)
+			{
+				map->Memory = (const char*)mem;
+				map->Size = (size_t)info.st_size;
+			}
+		}
+		close(fd);
+#endif
+		if (map->Memory == nullptr) return nullptr;
+		return map;
+	}
+};
+
+//==========================================================================
+//
+// MappedFileReader
+//
+// reads data from a memory mapped file. Since GetBuffer exposes the mapping,
+// uncompressed lumps can be handed out as views without copying anything.
+//
+//==========================================================================
+
+class MappedFileReader : public MemoryReader
+{
+	std::shared_ptr<FileMapping> Mapping;
+
+public:
+	MappedFileReader(std::shared_ptr<FileMapping>&& map)
+		: MemoryReader(map->Memory, (ptrdiff_t)map->Size), Mapping(std::move(map))
+	{
+	}
+
+	std::shared_ptr<const void> GetBufferOwner() const override
+	{
+		return Mapping;
+	}
+};
+
 //==========================================================================
 //
 // FileReaderRedirect
@@ -407,6 +515,15 @@ bool FileReader::OpenFile(const char *filename, FileReader::Size start, FileRead
 	return true;
 }
 
+bool FileReader::OpenMappedFile(const char *filename)
+{
+	auto map = FileMapping::Create(filename);
+	if (map == nullptr) return OpenFile(filename);
+	Close();
+	mReader = new MappedFileReader(std::move(map));
+	return true;
+}
+
 bool FileReader::OpenFilePart(FileReader &parent, FileReader::Size start, FileReader::Size length)
 {
 	auto reader = new FileReaderRedirect(parent, start, length);
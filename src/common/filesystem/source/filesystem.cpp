@@ -37,16 +37,23 @@
 // HEADER FILES ------------------------------------------------------------
 
 #include <miniz.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <ctype.h>
 #include <string.h>
 #include <inttypes.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
 
 #include "resourcefile.h"
 #include "fs_filesystem.h"
 #include "fs_findfile.h"
 #include "md5.hpp"
 #include "fs_stringpool.h"
+#include "ctpl.h"
+#include "7zCrc.h"
 
 namespace FileSys {
 	
@@ -195,8 +202,92 @@ static void PrintLastError (FileSystemMessageFunc Printf);
 
 // PUBLIC DATA DEFINITIONS -------------------------------------------------
 
+// PRIVATE DATA DEFINITIONS ------------------------------------------------
+
+enum
+{
+	MAX_FS_THREADS = 8,
+};
+
+static ctpl::thread_pool fsThreadPool;
+
+// Messages from resource files being opened on a worker thread are collected
+// per file and printed in order once the file gets added.
+struct FDeferredMessage
+{
+	FSMessageLevel level;
+	std::string text;
+};
+
+static thread_local std::vector<FDeferredMessage>* deferredMessages;
+
+struct FOpenedFile
+{
+	FResourceFile* resfile = nullptr;
+	std::vector<FDeferredMessage> messages;
+	std::exception_ptr exception;
+};
+
 // CODE --------------------------------------------------------------------
 
+//==========================================================================
+//
+// ParallelFor
+//
+// Calls func(i) for all i < count, distributed across the file system's
+// worker pool. The calling thread participates as well. Do not use this
+// for anything that needs a shared file reader, those are restricted to
+// the main thread.
+//
+//==========================================================================
+
+template<class Func>
+static void ParallelFor(size_t count, size_t minPerThread, Func&& func)
+{
+	size_t numThreads = std::min<size_t>(std::thread::hardware_concurrency(), MAX_FS_THREADS);
+	numThreads = std::min<size_t>(numThreads, count / std::max<size_t>(minPerThread, 1));
+
+	if (numThreads <= 1)
+	{
+		for (size_t i = 0; i < count; i++) func(i);
+		return;
+	}
+
+	if (fsThreadPool.size() < (int)numThreads - 1) fsThreadPool.resize((int)numThreads - 1);
+
+	std::atomic<size_t> next = 0;
+	auto worker = [&]()
+	{
+		for (size_t i = next++; i < count; i = next++) func(i);
+	};
+
+	std::vector<std::future<void>> futures(numThreads - 1);
+	for (auto& f : futures) f = fsThreadPool.push([&](int) { worker(); });
+	worker();
+	for (auto& f : futures) f.wait();
+}
+
+static int DeferredPrintf(FSMessageLevel level, const char* format, ...)
+{
+	va_list ap;
+	va_start(ap, format);
+	va_list ap2;
+	va_copy(ap2, ap);
+	int len = vsnprintf(nullptr, 0, format, ap);
+	va_end(ap);
+
+	std::string text;
+	if (len > 0)
+	{
+		text.resize(len + 1);
+		vsnprintf(&text[0], len + 1, format, ap2);
+		text.resize(len);
+	}
+	va_end(ap2);
+	if (deferredMessages) deferredMessages->push_back({ level, std::move(text) });
+	return len;
+}
+
 FileSystem::FileSystem()
 {
 }
@@ -217,6 +308,8 @@ void FileSystem::DeleteAll ()
 		delete Files[i];
 	}
 	Files.clear();
+	FileOrigins.clear();
+	DirectoryCache.clear();
 	if (stringpool != nullptr) delete stringpool;
 	stringpool = nullptr;
 }
@@ -267,14 +360,44 @@ bool FileSystem::InitMultipleFiles (std::vector<std::string>& filenames, LumpFil
 		}
 	}
 
-	for(size_t i=0;i<filenames.size(); i++)
+	if (filter && !filter->cachePath.empty() && !hashfile)
 	{
-		AddFile(filenames[i].c_str(), nullptr, filter, Printf, hashfile);
+		if (LoadDirectoryCache(filenames, filter, Printf)) return true;
+	}
+
+	// Open the files and read their directories in parallel. They still get added
+	// one by one below so that the lump table is the same as if this was done serially.
+	std::vector<FOpenedFile> opened;
+	if (filenames.size() > 1) opened = OpenFilesInParallel(filenames, filter, Printf);
 
-		if (i == (unsigned)MaxIwadIndex) MoveLumpsInFolder("after_iwad/");
-		std::string path = "filter/%s";
-		path += Files.back()->GetHash();
-		MoveLumpsInFolder(path.c_str());
+	try
+	{
+		for(size_t i=0;i<filenames.size(); i++)
+		{
+			if (filenames.size() > 1)
+			{
+				for (auto& msg : opened[i].messages) Printf(msg.level, "%s", msg.text.c_str());
+				if (opened[i].exception) std::rethrow_exception(opened[i].exception);
+				auto resfile = opened[i].resfile;
+				opened[i].resfile = nullptr;
+				AddResourceFile(filenames[i].c_str(), resfile, filter, Printf, hashfile);
+			}
+			else
+			{
+				AddFile(filenames[i].c_str(), nullptr, filter, Printf, hashfile);
+			}
+
+			if (i == (unsigned)MaxIwadIndex) MoveLumpsInFolder("after_iwad/");
+			std::string path = "filter/%s";
+			path += Files.back()->GetHash();
+			MoveLumpsInFolder(path.c_str());
+		}
+	}
+	catch (...)
+	{
+		// The files after the failing one were opened but never added.
+		for (auto& file : opened) delete file.resfile;
+		throw;
 	}
 
 	NumEntries = (uint32_t)FileInfo.size();
@@ -286,9 +409,47 @@ bool FileSystem::InitMultipleFiles (std::vector<std::string>& filenames, LumpFil
 
 	// [RH] Set up hash table
 	InitHashChains ();
+
+	if (filter && !filter->cachePath.empty() && !hashfile)
+	{
+		SaveDirectoryCache(filenames, filter, Printf);
+	}
 	return true;
 }
 
+//==========================================================================
+//
+// OpenFilesInParallel
+//
+// Opens the given files and reads their directories on the worker pool.
+// Nothing gets added to the lump table here.
+//
+//==========================================================================
+
+std::vector<FOpenedFile> FileSystem::OpenFilesInParallel(const std::vector<std::string>& filenames, LumpFilterInfo* filter, FileSystemMessageFunc Printf)
+{
+	std::vector<FOpenedFile> opened(filenames.size());
+
+	// 7z lazily sets up this table, which must not happen on several threads at once.
+	if (g_CrcTable[1] == 0) CrcGenerateTable();
+
+	ParallelFor(filenames.size(), 1, [&](size_t i)
+	{
+		deferredMessages = &opened[i].messages;
+		try
+		{
+			// Each file gets its own string pool because the shared one is not thread safe.
+			opened[i].resfile = OpenFileForAdding(filenames[i].c_str(), nullptr, filter, Printf ? DeferredPrintf : nullptr, nullptr);
+		}
+		catch (...)
+		{
+			opened[i].exception = std::current_exception();
+		}
+		deferredMessages = nullptr;
+	});
+	return opened;
+}
+
 //==========================================================================
 //
 // AddFromBuffer
@@ -311,6 +472,7 @@ int FileSystem::AddFromBuffer(const char* name, char* data, int size, int id, in
 	Entries[0].Length = size;
 
 	Files.push_back(rf);
+	FileOrigins.push_back({ -1, -1 });
 	FileInfo.resize(FileInfo.size() + 1);
 	FileSystem::LumpRecord* lump_p = &FileInfo.back();
 	lump_p->SetFromLump(rf, 0, (int)Files.size() - 1, stringpool);
@@ -327,9 +489,8 @@ int FileSystem::AddFromBuffer(const char* name, char* data, int size, int id, in
 // [RH] Removed reload hack
 //==========================================================================
 
-void FileSystem::AddFile (const char *filename, FileReader *filer, LumpFilterInfo* filter, FileSystemMessageFunc Printf, FILE* hashfile)
+FResourceFile* FileSystem::OpenFileForAdding(const char *filename, FileReader *filer, LumpFilterInfo* filter, FileSystemMessageFunc Printf, StringPool* sp)
 {
-	int startlump;
 	bool isdir = false;
 	FileReader filereader;
 
@@ -343,34 +504,45 @@ void FileSystem::AddFile (const char *filename, FileReader *filer, LumpFilterInf
 				Printf(FSMessageLevel::Error, "%s: File or Directory not found\n", filename);
 				PrintLastError(Printf);
 			}
-			return;
+			return nullptr;
 		}
 
 		if (!isdir)
 		{
-			if (!filereader.OpenFile(filename))
+			if (!filereader.OpenMappedFile(filename))
 			{ // Didn't find file
 				if (Printf)
 				{
 					Printf(FSMessageLevel::Error, "%s: File not found\n", filename);
 					PrintLastError(Printf);
 				}
-				return;
+				return nullptr;
 			}
 		}
 	}
 	else filereader = std::move(*filer);
 
-	startlump = NumEntries;
-
-	FResourceFile *resfile;
-
-
 	if (!isdir)
-		resfile = FResourceFile::OpenResourceFile(filename, filereader, false, filter, Printf, stringpool);
+		return FResourceFile::OpenResourceFile(filename, filereader, false, filter, Printf, sp);
 	else
-		resfile = FResourceFile::OpenDirectory(filename, filter, Printf, stringpool);
+		return FResourceFile::OpenDirectory(filename, filter, Printf, sp);
+}
+
+void FileSystem::AddFile (const char *filename, FileReader *filer, LumpFilterInfo* filter, FileSystemMessageFunc Printf, FILE* hashfile)
+{
+	AddResourceFile(filename, OpenFileForAdding(filename, filer, filter, Printf, stringpool), filter, Printf, hashfile);
+}
+
+//==========================================================================
+//
+// AddResourceFile
+//
+// Adds an already opened resource file's lumps to the lump table.
+//
+//==========================================================================
 
+void FileSystem::AddResourceFile(const char *filename, FResourceFile *resfile, LumpFilterInfo* filter, FileSystemMessageFunc Printf, FILE* hashfile)
+{
 	if (resfile != NULL)
 	{
 		if (Printf) 
@@ -380,6 +552,8 @@ void FileSystem::AddFile (const char *filename, FileReader *filer, LumpFilterInf
 
 		resfile->SetFirstLump(lumpstart);
 		Files.push_back(resfile);
+		FileOrigins.push_back({ -1, -1 });
+		int fileindex = (int)Files.size() - 1;
 		for (int i = 0; i < resfile->EntryCount(); i++)
 		{
 			FileInfo.resize(FileInfo.size() + 1);
@@ -396,7 +570,9 @@ void FileSystem::AddFile (const char *filename, FileReader *filer, LumpFilterInf
 				path += ':';
 				path += resfile->getName(i);
 				auto embedded = resfile->GetEntryReader(i, READER_CACHED);
+				size_t index = Files.size();
 				AddFile(path.c_str(), &embedded, filter, Printf, hashfile);
+				if (Files.size() > index) FileOrigins[index] = { fileindex, i };
 			}
 		}
 
@@ -406,17 +582,19 @@ void FileSystem::AddFile (const char *filename, FileReader *filer, LumpFilterInf
 			char cksumout[33];
 			memset(cksumout, 0, sizeof(cksumout));
 
-			if (filereader.isOpen())
+			// The opened file's reader now belongs to the resource file.
+			auto filereader = resfile->GetContainerReader();
+			if (filereader)
 			{
-				filereader.Seek(0, FileReader::SeekSet);
-				md5Hash(filereader, cksum);
+				filereader->Seek(0, FileReader::SeekSet);
+				md5Hash(*filereader, cksum);
 
 				for (size_t j = 0; j < sizeof(cksum); ++j)
 				{
 					snprintf(cksumout + (j * 2), 3, "%02X", cksum[j]);
 				}
 
-				fprintf(hashfile, "file: %s, hash: %s, size: %td\n", filename, cksumout, filereader.GetLength());
+				fprintf(hashfile, "file: %s, hash: %s, size: %td\n", filename, cksumout, filereader->GetLength());
 			}
 
 			else
@@ -428,7 +606,7 @@ void FileSystem::AddFile (const char *filename, FileReader *filer, LumpFilterInf
 				if (!(flags & RESFF_EMBEDDED))
 				{
 					auto reader = resfile->GetEntryReader(i, READER_SHARED, 0);
-					md5Hash(filereader, cksum);
+					md5Hash(reader, cksum);
 
 					for (size_t j = 0; j < sizeof(cksum); ++j)
 					{
@@ -816,36 +994,48 @@ void FileSystem::InitHashChains (void)
 	Hashes.resize(8 * NumEntries);
 	// Mark all buckets as empty
 	memset(Hashes.data(), -1, Hashes.size() * sizeof(Hashes[0]));
-	FirstLumpIndex = &Hashes[0];
-	NextLumpIndex = &Hashes[NumEntries];
-	FirstLumpIndex_FullName = &Hashes[NumEntries * 2];
-	NextLumpIndex_FullName = &Hashes[NumEntries * 3];
-	FirstLumpIndex_NoExt = &Hashes[NumEntries * 4];
-	NextLumpIndex_NoExt = &Hashes[NumEntries * 5];
-	FirstLumpIndex_ResId = &Hashes[NumEntries * 6];
-	NextLumpIndex_ResId = &Hashes[NumEntries * 7];
+	SetHashPointers();
 
+	// The hashing itself is independent for each lump so it can be done in parallel.
+	// Only the linking has to be done in order.
+	struct FLumpHashes
+	{
+		uint32_t shortName, fullName, noExt;
+	};
+	std::vector<FLumpHashes> lumpHashes(NumEntries);
+
+	ParallelFor(NumEntries, 4096, [&](size_t i)
+	{
+		auto& h = lumpHashes[i];
+		h.shortName = MakeHash(FileInfo[i].shortName.String, 8) % NumEntries;
+		if (FileInfo[i].LongName[0] != 0)
+		{
+			const char* name = FileInfo[i].LongName;
+			h.fullName = MakeHash(name) % NumEntries;
+
+			// same as the full name, up to the extension's dot if there is one.
+			const char* dot = strrchr(name, '.');
+			const char* slash = strrchr(name, '/');
+			size_t len = (dot != nullptr && (slash == nullptr || dot > slash)) ? size_t(dot - name) : SIZE_MAX;
+			h.noExt = MakeHash(name, len) % NumEntries;
+		}
+	});
 
 	// Now set up the chains
 	for (i = 0; i < (unsigned)NumEntries; i++)
 	{
-		j = MakeHash (FileInfo[i].shortName.String, 8) % NumEntries;
+		j = lumpHashes[i].shortName;
 		NextLumpIndex[i] = FirstLumpIndex[j];
 		FirstLumpIndex[j] = i;
 
 		// Do the same for the full paths
 		if (FileInfo[i].LongName[0] != 0)
 		{
-			j = MakeHash(FileInfo[i].LongName) % NumEntries;
+			j = lumpHashes[i].fullName;
 			NextLumpIndex_FullName[i] = FirstLumpIndex_FullName[j];
 			FirstLumpIndex_FullName[j] = i;
 
-			std::string nameNoExt = FileInfo[i].LongName;
-			auto dot = nameNoExt.find_last_of('.');
-			auto slash = nameNoExt.find_last_of('/');
-			if ((dot > slash || slash == std::string::npos) && dot != std::string::npos) nameNoExt.resize(dot);
-
-			j = MakeHash(nameNoExt.c_str()) % NumEntries;
+			j = lumpHashes[i].noExt;
 			NextLumpIndex_NoExt[i] = FirstLumpIndex_NoExt[j];
 			FirstLumpIndex_NoExt[j] = i;
 
@@ -859,6 +1049,332 @@ void FileSystem::InitHashChains (void)
 	Files.shrink_to_fit();
 }
 
+void FileSystem::SetHashPointers()
+{
+	FirstLumpIndex = &Hashes[0];
+	NextLumpIndex = &Hashes[NumEntries];
+	FirstLumpIndex_FullName = &Hashes[NumEntries * 2];
+	NextLumpIndex_FullName = &Hashes[NumEntries * 3];
+	FirstLumpIndex_NoExt = &Hashes[NumEntries * 4];
+	NextLumpIndex_NoExt = &Hashes[NumEntries * 5];
+	FirstLumpIndex_ResId = &Hashes[NumEntries * 6];
+	NextLumpIndex_ResId = &Hashes[NumEntries * 7];
+}
+
+//==========================================================================
+//
+// Lump directory cache
+//
+// Stores the final lump table and hash chains of a file set, so that a
+// later start with the same files can skip setting them up, including
+// all the folder moving and post processing. The archives themselves
+// still need to be opened because their readers are needed anyway.
+//
+// The file is a flat dump that gets mapped into memory. The long names
+// point directly into it so it has to stay around as long as the lump
+// table.
+//
+//==========================================================================
+
+static const char DIRCACHE_MAGIC[4] = { 'L', 'D', 'C', 'F' };
+static const uint32_t DIRCACHE_VERSION = 1;
+static const char* DIRCACHE_NAME = "lumpdir.cache";
+
+struct FDirCacheHeader
+{
+	char Magic[4];
+	uint32_t Version;
+	uint8_t Key[16];
+	uint32_t NumFiles;
+	uint32_t NumLumps;
+	uint32_t StringSize;
+	uint32_t TotalSize;
+};
+
+struct FDirCacheFile
+{
+	int32_t Parent;			// index of the containing file for embedded ones, otherwise -1
+	int32_t ParentEntry;
+	int32_t FileNameIndex;	// index into the list of files passed to InitMultipleFiles, -1 for embedded ones.
+	uint32_t FirstLump;
+	uint32_t EntryCount;
+	char Hash[48];
+};
+
+struct FDirCacheLump
+{
+	uint32_t File;
+	int32_t ResIndex;
+	char ShortName[8];
+	uint32_t LongName;		// offset into the string table
+	int16_t RFNum;
+	int16_t Namespace;
+	int32_t ResourceId;
+	int32_t Flags;
+};
+
+//==========================================================================
+//
+// Everything that can change the outcome of InitMultipleFiles without
+// being visible in the opened archives' directories goes in here.
+//
+//==========================================================================
+
+static void DirCacheKey(const std::vector<std::string>& filenames, LumpFilterInfo* filter, int iwadindex, int maxiwadindex, uint8_t* digest)
+{
+	using namespace md5;
+
+	md5_state_t state;
+	md5_init(&state);
+	auto addint = [&](int64_t v) { md5_append(&state, (const uint8_t*)&v, sizeof(v)); };
+	auto addstr = [&](const std::string& str) { md5_append(&state, (const uint8_t*)str.c_str(), (unsigned)str.size() + 1); };
+	auto addlist = [&](const std::vector<std::string>& list)
+	{
+		addint(list.size());
+		for (auto& str : list) addstr(str);
+	};
+
+	addint(DIRCACHE_VERSION);
+	addint(sizeof(void*));
+	addint(iwadindex);
+	addint(maxiwadindex);
+	addint(filenames.size());
+	for (auto& name : filenames)
+	{
+		uint64_t size = 0;
+		int64_t mtime = 0;
+		FS_GetFileStats(name.c_str(), &size, &mtime);
+		addstr(name);
+		addint((int64_t)size);
+		addint(mtime);
+	}
+	addlist(filter->gameTypeFilter);
+	addlist(filter->reservedFolders);
+	addlist(filter->requiredPrefixes);
+	addlist(filter->embeddings);
+	addlist(filter->blockednames);
+	md5_finish(&state, digest);
+}
+
+//==========================================================================
+//
+// SaveDirectoryCache
+//
+//==========================================================================
+
+void FileSystem::SaveDirectoryCache(const std::vector<std::string>& filenames, LumpFilterInfo* filter, FileSystemMessageFunc Printf)
+{
+	FDirCacheHeader header = {};
+	memcpy(header.Magic, DIRCACHE_MAGIC, 4);
+	header.Version = DIRCACHE_VERSION;
+	DirCacheKey(filenames, filter, IwadIndex, MaxIwadIndex, header.Key);
+	header.NumFiles = (uint32_t)Files.size();
+	header.NumLumps = NumEntries;
+
+	std::vector<FDirCacheFile> files(Files.size());
+	for (size_t i = 0; i < Files.size(); i++)
+	{
+		auto& f = files[i];
+		// Directories can change without any of their attributes we check changing so they cannot be cached.
+		if (Files[i]->GetContainerReader() == nullptr) return;
+
+		f.Parent = FileOrigins[i].first;
+		f.ParentEntry = FileOrigins[i].second;
+		f.FileNameIndex = -1;
+		if (f.Parent < 0)
+		{
+			for (size_t j = 0; j < filenames.size(); j++)
+			{
+				if (filenames[j] == Files[i]->GetFileName()) f.FileNameIndex = (int)j;
+			}
+			if (f.FileNameIndex < 0) return;	// added some other way.
+		}
+		f.FirstLump = Files[i]->GetFirstEntry();
+		f.EntryCount = Files[i]->EntryCount();
+		memcpy(f.Hash, Files[i]->GetHash(), sizeof(f.Hash));
+	}
+
+	std::vector<FDirCacheLump> lumps(NumEntries);
+	std::string strings;
+	for (uint32_t i = 0; i < NumEntries; i++)
+	{
+		auto& li = FileInfo[i];
+		auto& l = lumps[i];
+		auto it = std::find(Files.begin(), Files.end(), li.resfile);
+		if (it == Files.end()) return;
+		l.File = uint32_t(it - Files.begin());
+		l.ResIndex = li.resindex;
+		memcpy(l.ShortName, li.shortName.String, 8);
+		l.LongName = (uint32_t)strings.size();
+		strings.append(li.LongName);
+		strings.push_back(0);
+		l.RFNum = li.rfnum;
+		l.Namespace = li.Namespace;
+		l.ResourceId = li.resourceId;
+		l.Flags = li.flags;
+	}
+
+	header.StringSize = (uint32_t)strings.size();
+	header.TotalSize = uint32_t(sizeof(header) + files.size() * sizeof(FDirCacheFile) + lumps.size() * sizeof(FDirCacheLump) + Hashes.size() * sizeof(uint32_t) + strings.size());
+
+	// Written under a temporary name first, so that the old cache stays intact until the new one is complete.
+	// This may run while another instance has the old file mapped.
+	std::string path = filter->cachePath + DIRCACHE_NAME;
+	std::string temp = path + ".tmp";
+	std::unique_ptr<FileWriter> fw(FileWriter::Open(temp.c_str()));
+	if (!fw)
+	{
+		if (Printf) Printf(FSMessageLevel::DebugWarn, "Unable to write lump directory cache %s\n", path.c_str());
+		return;
+	}
+	size_t written = fw->Write(&header, sizeof(header));
+	written += fw->Write(files.data(), files.size() * sizeof(FDirCacheFile));
+	written += fw->Write(lumps.data(), lumps.size() * sizeof(FDirCacheLump));
+	written += fw->Write(Hashes.data(), Hashes.size() * sizeof(uint32_t));
+	written += fw->Write(strings.data(), strings.size());
+	fw.reset();
+
+	bool ok = written == header.TotalSize;
+	if (ok && rename(temp.c_str(), path.c_str()) != 0)
+	{
+		// Windows' rename does not replace an existing file.
+		remove(path.c_str());
+		ok = rename(temp.c_str(), path.c_str()) == 0;
+	}
+	if (!ok)
+	{
+		remove(temp.c_str());
+		if (Printf) Printf(FSMessageLevel::DebugWarn, "Unable to write lump directory cache %s\n", path.c_str());
+	}
+}
+
+//==========================================================================
+//
+// LoadDirectoryCache
+//
+// Returns false if there is no valid cache for this file set, in that
+// case nothing has been changed.
+//
+//==========================================================================
+
+bool FileSystem::LoadDirectoryCache(const std::vector<std::string>& filenames, LumpFilterInfo* filter, FileSystemMessageFunc Printf)
+{
+	std::string path = filter->cachePath + DIRCACHE_NAME;
+	FileReader fr;
+	if (!FS_DirEntryExists(path.c_str(), nullptr) || !fr.OpenMappedFile(path.c_str())) return false;
+
+	FileData cache;
+	if (fr.GetBuffer()) cache = FileData(fr.GetBuffer(), fr.GetLength(), fr.GetBufferOwner());
+	else cache = fr.Read();
+	fr.Close();
+
+	if (cache.size() < sizeof(FDirCacheHeader)) return false;
+	auto header = (const FDirCacheHeader*)cache.data();
+	uint8_t key[16];
+	DirCacheKey(filenames, filter, IwadIndex, MaxIwadIndex, key);
+	if (memcmp(header->Magic, DIRCACHE_MAGIC, 4) || header->Version != DIRCACHE_VERSION || memcmp(header->Key, key, 16) || header->TotalSize != cache.size())
+	{
+		return false;
+	}
+
+	auto files = (const FDirCacheFile*)(header + 1);
+	auto lumps = (const FDirCacheLump*)(files + header->NumFiles);
+	auto hashes = (const uint32_t*)(lumps + header->NumLumps);
+	auto strings = (const char*)(hashes + 8 * header->NumLumps);
+	if (header->NumLumps == 0 || strings + header->StringSize != cache.string() + cache.size() || strings[header->StringSize - 1] != 0)
+	{
+		return false;
+	}
+
+	// The archives' directories are still needed for reading their content.
+	// Messages are held back until it is clear that the cache can be used.
+	auto opened = OpenFilesInParallel(filenames, filter, Printf);
+	std::vector<FDeferredMessage> messages;
+	std::vector<FResourceFile*> resfiles;
+	bool valid = true;
+
+	for (uint32_t i = 0; i < header->NumFiles && valid; i++)
+	{
+		auto& f = files[i];
+		FResourceFile* resfile = nullptr;
+		std::string name;
+		if (f.Parent < 0)
+		{
+			if (f.FileNameIndex < 0 || f.FileNameIndex >= (int)filenames.size()) break;
+			auto& o = opened[f.FileNameIndex];
+			messages.insert(messages.end(), o.messages.begin(), o.messages.end());
+			resfile = o.resfile;
+			o.resfile = nullptr;
+			if (o.exception) break;
+			name = filenames[f.FileNameIndex];
+		}
+		else
+		{
+			if (f.Parent >= (int)i) break;
+			auto parent = resfiles[f.Parent];
+			if (f.ParentEntry < 0 || f.ParentEntry >= parent->EntryCount()) break;
+			name = std::string(parent->GetFileName()) + ':' + parent->getName(f.ParentEntry);
+			auto embedded = parent->GetEntryReader(f.ParentEntry, READER_CACHED);
+			deferredMessages = &messages;
+			try
+			{
+				resfile = OpenFileForAdding(name.c_str(), &embedded, filter, Printf ? DeferredPrintf : nullptr, stringpool);
+			}
+			catch (...)
+			{
+				resfile = nullptr;
+			}
+			deferredMessages = nullptr;
+		}
+		if (resfile == nullptr) break;
+
+		resfiles.push_back(resfile);
+		valid = resfile->EntryCount() == (int)f.EntryCount && !memcmp(resfile->GetHash(), f.Hash, sizeof(f.Hash));
+		resfile->SetFirstLump(f.FirstLump);
+		messages.push_back({ FSMessageLevel::Message, std::string("adding ") + name + ", " + std::to_string(resfile->EntryCount()) + " lumps\n" });
+	}
+
+	for (auto& o : opened) delete o.resfile;
+	if (!valid || resfiles.size() != header->NumFiles)
+	{
+		for (auto resfile : resfiles) delete resfile;
+		return false;
+	}
+
+	for (uint32_t i = 0; i < header->NumFiles; i++)
+	{
+		Files.push_back(resfiles[i]);
+		FileOrigins.push_back({ files[i].Parent, files[i].ParentEntry });
+	}
+
+	NumEntries = header->NumLumps;
+	FileInfo.resize(NumEntries);
+	for (uint32_t i = 0; i < NumEntries; i++)
+	{
+		auto& l = lumps[i];
+		auto& li = FileInfo[i];
+		li.resfile = Files[l.File < Files.size() ? l.File : 0];
+		li.resindex = l.ResIndex;
+		memcpy(li.shortName.String, l.ShortName, 8);
+		li.shortName.String[8] = 0;
+		li.LongName = strings + (l.LongName < header->StringSize ? l.LongName : header->StringSize - 1);
+		li.rfnum = l.RFNum;
+		li.Namespace = l.Namespace;
+		li.resourceId = l.ResourceId;
+		li.flags = l.Flags;
+	}
+	Hashes.assign(hashes, hashes + 8 * NumEntries);
+	SetHashPointers();
+	DirectoryCache = std::move(cache);
+
+	if (Printf)
+	{
+		for (auto& msg : messages) Printf(msg.level, "%s", msg.text.c_str());
+		Printf(FSMessageLevel::DebugNotify, "Using lump directory cache %s\n", path.c_str());
+	}
+	return true;
+}
+
 //==========================================================================
 //
 // should only be called before the hash chains are set up.
@@ -424,4 +424,34 @@ bool FS_DirEntryExists(const char* pathname, bool* isdir)
 	return res;
 }
 
+//==========================================================================
+//
+// FS_GetFileStats
+//
+// Gets a file's size and modification time. Both are 0 if the file
+// does not exist.
+//
+//==========================================================================
+
+bool FS_GetFileStats(const char* pathname, uint64_t* size, int64_t* mtime)
+{
+	*size = 0;
+	*mtime = 0;
+	if (pathname == NULL || *pathname == 0)
+		return false;
+
+#ifndef _WIN32
+	struct stat info;
+	bool res = stat(pathname, &info) == 0;
+#else
+	auto wstr = toWide(pathname);
+	struct _stat64 info;
+	bool res = _wstat64(wstr.c_str(), &info) == 0;
+#endif
+	if (!res) return false;
+	*size = (uint64_t)info.st_size;
+	*mtime = (int64_t)info.st_mtime;
+	return true;
+}
+
 }
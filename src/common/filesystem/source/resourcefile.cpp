@@ -181,7 +181,7 @@ FResourceFile *FResourceFile::OpenResourceFile(const char *filename, FileReader
 FResourceFile *FResourceFile::OpenResourceFile(const char *filename, bool containeronly, LumpFilterInfo* filter, FileSystemMessageFunc Printf, StringPool* sp)
 {
 	FileReader file;
-	if (!file.OpenFile(filename)) return nullptr;
+	if (!file.OpenMappedFile(filename)) return nullptr;
 	return DoOpenResourceFile(filename, file, containeronly, filter, Printf, sp);
 }
 
@@ -675,7 +675,8 @@ FileReader FResourceFile::GetEntryReader(uint32_t entry, int readertype, int rea
 		{
 			auto buf = Reader.GetBuffer();
 			// if this is backed by a memory buffer, create a new reader directly referencing it.
-			if (buf != nullptr)
+			// Off the main thread the entry's position may not be known yet so this has to take the regular path.
+			if (buf != nullptr && !(Entries[entry].Flags & RESFF_NEEDFILESTART))
 			{
 				fr.OpenMemory(buf + Entries[entry].Position, Entries[entry].Length);
 			}
@@ -730,13 +731,17 @@ void FResourceFile::SkipHeader(FileReader& fr) {
 
 FileData FResourceFile::Read(uint32_t entry)
 {
-	if (!(Entries[entry].Flags & RESFF_COMPRESSED) && Reader.isOpen())
+	if (entry < NumLumps && !(Entries[entry].Flags & RESFF_COMPRESSED) && Reader.isOpen())
 	{
 		auto buf = Reader.GetBuffer();
 		// if this is backed by a memory buffer, we can just return a reference to the backing store.
+		// For a memory mapped archive the view also keeps the mapping alive.
 		if (buf != nullptr)
 		{
-			return FileData(buf + Entries[entry].Position, Entries[entry].Length, false);
+			if ((Entries[entry].Flags & RESFF_NEEDFILESTART) && mainThread)
+				SetEntryAddress(entry);
+			if (!(Entries[entry].Flags & RESFF_NEEDFILESTART))
+				return FileData(buf + Entries[entry].Position, Entries[entry].Length, Reader.GetBufferOwner());
 		}
 	}
 
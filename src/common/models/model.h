@@ -27,6 +27,25 @@ extern TMap<void*, FSpriteModelFrame> BaseSpriteModelFrames;
 #define MD3_MAX_SURFACES	32
 #define MIN_MODELS	4
 
+// Everything the bone matrices of an animated model depend on, besides the model itself.
+// Instances that share all of this share their bones.
+struct FBonePose
+{
+	const TArray<TRS>* animationData;
+	int frame1, frame2;
+	float inter;
+	int frame1_prev;
+	float inter1_prev;
+	int frame2_prev;
+	float inter2_prev;
+
+	bool operator==(const FBonePose& other) const
+	{
+		return animationData == other.animationData && frame1 == other.frame1 && frame2 == other.frame2 && inter == other.inter &&
+			frame1_prev == other.frame1_prev && inter1_prev == other.inter1_prev && frame2_prev == other.frame2_prev && inter2_prev == other.inter2_prev;
+	}
+};
+
 struct FSpriteModelFrame
 {
 	uint8_t modelsAmount = 0;
@@ -101,7 +120,8 @@ public:
 	virtual void AddSkins(uint8_t *hitlist, const FTextureID* surfaceskinids) = 0;
 	virtual float getAspectFactor(float vscale) { return 1.f; }
 	virtual const TArray<TRS>* AttachAnimationData() { return nullptr; };
-	virtual const TArray<VSMatrix> CalculateBones(int frame1, int frame2, float inter, int frame1_prev, float inter1_prev, int frame2_prev, float inter2_prev, const TArray<TRS>* animationData, DBoneComponents* bones, int index) { return {}; };
+	// Returns the bone matrices kept in bones for this model index, or nullptr if the model has no bones
+	virtual const TArray<VSMatrix>* CalculateBones(const FBonePose& pose, DBoneComponents* bones, int index) { return nullptr; };
 
 	void SetVertexBuffer(int type, IModelVertexBuffer *buffer) { mVBuf[type] = buffer; }
 	IModelVertexBuffer *GetVertexBuffer(int type) const { return mVBuf[type]; }
@@ -25,5 +25,9 @@ public:
 	virtual void DrawArrays(int start, int count) = 0;
 	virtual void DrawElements(int numIndices, size_t offset) = 0;
 	virtual int SetupFrame(FModel* model, unsigned int frame1, unsigned int frame2, unsigned int size, const TArray<VSMatrix>& bones, int boneStartIndex) { return -1; };
+
+	// Bones uploaded earlier in the frame for the same model and pose, -1 if there are none
+	virtual int FindBonePose(FModel* model, const FBonePose& pose) { return -1; }
+	virtual void StoreBonePose(FModel* model, const FBonePose& pose, int boneStartIndex) {}
 };
 
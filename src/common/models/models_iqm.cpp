@@ -8,6 +8,11 @@
 #include "dobject.h"
 #include "bonecomponents.h"
 
+#if !defined(NO_SSE) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#include <emmintrin.h>
+#define BONES_SSE2
+#endif
+
 IMPLEMENT_CLASS(DBoneComponents, false, false);
 
 
@@ -541,125 +546,169 @@ const TArray<TRS>* IQMModel::AttachAnimationData()
 	return &TRSData;
 }
 
-static TRS InterpolateBone(const TRS &from, const TRS &to, float t, float invt)
+// The blend runs over the whole skeleton as one float array, so every
+// SIMD lane does useful work no matter where the bone boundaries fall.
+static_assert(sizeof(TRS) == 10 * sizeof(float), "TRS must be tightly packed floats");
+
+static void LerpFloats(const float* from, const float* to, float* dest, size_t count, float t, float invt)
 {
-	TRS bone;
+	size_t i = 0;
+#ifdef BONES_SSE2
+	__m128 mt = _mm_set1_ps(t);
+	__m128 minvt = _mm_set1_ps(invt);
+	for (; i + 4 <= count; i += 4)
+	{
+		_mm_storeu_ps(dest + i, _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(from + i), minvt), _mm_mul_ps(_mm_loadu_ps(to + i), mt)));
+	}
+#endif
+	for (; i < count; i++)
+	{
+		dest[i] = from[i] * invt + to[i] * t;
+	}
+}
 
-	bone.translation = from.translation * invt + to.translation * t;
-	bone.rotation = from.rotation * invt;
+static const TRS* InterpolatePose(const TRS* from, const TRS* to, float t, TArray<TRS>& dest, int numbones)
+{
+	if (dest.SSize() < numbones) dest.Resize(numbones);
 
-	if ((bone.rotation | to.rotation * t) < 0)
+	float invt = 1.0f - t;
+	LerpFloats(&from->translation.X, &to->translation.X, &dest[0].translation.X, numbones * sizeof(TRS) / sizeof(float), t, invt);
+
+	for (int i = 0; i < numbones; i++)
 	{
-		bone.rotation.X *= -1; bone.rotation.Y *= -1; bone.rotation.Z *= -1; bone.rotation.W *= -1;
+		// Rotations on opposite hemispheres have to go the short way around
+		FVector4& rotation = dest[i].rotation;
+		if ((from[i].rotation * invt | to[i].rotation * t) < 0)
+		{
+			rotation = to[i].rotation * t - from[i].rotation * invt;
+		}
+		rotation.MakeUnit();
 	}
+	return dest.Data();
+}
 
-	bone.rotation += to.rotation * t;
-	bone.rotation.MakeUnit();
-	bone.scaling = from.scaling * invt + to.scaling * t;
-
-	return bone;
+static const TRS* DefaultPose(TArray<TRS>& dest, int numbones)
+{
+	dest.Resize(numbones);
+	for (auto& bone : dest) bone = TRS();
+	return dest.Data();
 }
 
-const TArray<VSMatrix> IQMModel::CalculateBones(int frame1, int frame2, float inter, int frame1_prev, float inter1_prev, int frame2_prev, float inter2_prev, const TArray<TRS>* animationData, DBoneComponents* boneComponentData, int index)
+const TArray<VSMatrix>* IQMModel::CalculateBones(const FBonePose& pose, DBoneComponents* boneComponentData, int index)
 {
-	const TArray<TRS>& animationFrames = animationData ? *animationData : TRSData;
-	if (Joints.Size() > 0)
-	{
-		int numbones = Joints.SSize();
+	const TArray<TRS>& animationFrames = pose.animationData ? *pose.animationData : TRSData;
+	if (Joints.Size() == 0) return nullptr;
 
-		if (boneComponentData->trscomponents[index].SSize() != numbones)
-			boneComponentData->trscomponents[index].Resize(numbones);
-		if (boneComponentData->trsmatrix[index].SSize() != numbones)
-			boneComponentData->trsmatrix[index].Resize(numbones);
+	int numbones = Joints.SSize();
 
-		frame1 = clamp(frame1, 0, (animationFrames.SSize() - 1) / numbones);
-		frame2 = clamp(frame2, 0, (animationFrames.SSize() - 1) / numbones);
+	auto& components = boneComponentData->trscomponents[index];
+	auto& bones = boneComponentData->trsmatrix[index];
+	if (components.SSize() != numbones)
+		components.Resize(numbones);
+	if (bones.SSize() != numbones)
+		bones.Resize(numbones);
 
-		int offset1 = frame1 * numbones;
-		int offset2 = frame2 * numbones;
+	int frame1 = clamp(pose.frame1, 0, (animationFrames.SSize() - 1) / numbones);
+	int frame2 = clamp(pose.frame2, 0, (animationFrames.SSize() - 1) / numbones);
 
-		int offset1_1 = frame1_prev * numbones;
-		int offset2_1 = frame2_prev * numbones;
+	int offset1 = frame1 * numbones;
+	int offset2 = frame2 * numbones;
 
-		float invt = 1.0f - inter;
-		float invt1 = 1.0f - inter1_prev;
-		float invt2 = 1.0f - inter2_prev;
+	int offset1_1 = pose.frame1_prev * numbones;
+	int offset2_1 = pose.frame2_prev * numbones;
 
-		float swapYZ[16] = { 0.0f };
-		swapYZ[0 + 0 * 4] = 1.0f;
-		swapYZ[1 + 2 * 4] = 1.0f;
-		swapYZ[2 + 1 * 4] = 1.0f;
-		swapYZ[3 + 3 * 4] = 1.0f;
+	// Scratch space, reused between calls so that nothing gets allocated per model
+	thread_local TArray<TRS> prevPose, nextPose, blendPose, emptyPose;
+	thread_local TArray<bool> modifiedBone;
 
-		TArray<VSMatrix> bones(numbones, true);
-		TArray<bool> modifiedBone(numbones, true);
-		for (int i = 0; i < numbones; i++)
-		{
-			TRS prev;
+	const TRS* prev = nullptr;
+	const TRS* next = nullptr;
+	const TRS* blend;
 
-			if(frame1 >= 0 && (frame1_prev >= 0 || inter1_prev < 0))
-			{
-				prev = inter1_prev <= 0 ? animationFrames[offset1 + i] : InterpolateBone(animationFrames[offset1_1 + i], animationFrames[offset1 + i], inter1_prev, invt1);
-			}
+	if (frame1 >= 0 && (pose.frame1_prev >= 0 || pose.inter1_prev < 0))
+	{
+		prev = pose.inter1_prev <= 0 ? &animationFrames[offset1] : InterpolatePose(&animationFrames[offset1_1], &animationFrames[offset1], pose.inter1_prev, prevPose, numbones);
+	}
 
-			TRS next;
+	if (frame2 >= 0 && (pose.frame2_prev >= 0 || pose.inter2_prev < 0))
+	{
+		next = pose.inter2_prev <= 0 ? &animationFrames[offset2] : InterpolatePose(&animationFrames[offset2_1], &animationFrames[offset2], pose.inter2_prev, nextPose, numbones);
+	}
 
-			if(frame2 >= 0 && (frame2_prev >= 0 || inter2_prev < 0))
+	if (frame1 >= 0 || pose.inter < 0)
+	{
+		if (pose.inter < 0)
+		{
+			blend = &animationFrames[offset1];
+		}
+		else
+		{
+			if (prev == nullptr || next == nullptr)
 			{
-				next = inter2_prev <= 0 ? animationFrames[offset2 + i] : InterpolateBone(animationFrames[offset2_1 + i], animationFrames[offset2 + i], inter2_prev, invt2);
+				const TRS* empty = DefaultPose(emptyPose, numbones);
+				if (prev == nullptr) prev = empty;
+				if (next == nullptr) next = empty;
 			}
+			blend = InterpolatePose(prev, next, pose.inter, blendPose, numbones);
+		}
+	}
+	else
+	{
+		blend = DefaultPose(emptyPose, numbones);
+	}
 
-			TRS bone;
+	float swapYZ[16] = { 0.0f };
+	swapYZ[0 + 0 * 4] = 1.0f;
+	swapYZ[1 + 2 * 4] = 1.0f;
+	swapYZ[2 + 1 * 4] = 1.0f;
+	swapYZ[3 + 3 * 4] = 1.0f;
 
-			if(frame1 >= 0 || inter < 0)
-			{
-				bone = inter < 0 ? animationFrames[offset1 + i] : InterpolateBone(prev, next , inter, invt);
-			}
+	// The matrices are built in place. Bones whose TRS did not change since
+	// the last call keep theirs, unless their parent moved.
+	if (modifiedBone.SSize() < numbones) modifiedBone.Resize(numbones);
+	for (int i = 0; i < numbones; i++)
+	{
+		const TRS& bone = blend[i];
 
-			if (Joints[i].Parent >= 0 && modifiedBone[Joints[i].Parent])
-			{
-				boneComponentData->trscomponents[index][i] = bone;
-				modifiedBone[i] = true;
-			}
-			else if (boneComponentData->trscomponents[index][i].Equals(bone))
-			{
-				bones[i] = boneComponentData->trsmatrix[index][i];
-				modifiedBone[i] = false;
-				continue;
-			}
-			else
-			{
-				boneComponentData->trscomponents[index][i] = bone;
-				modifiedBone[i] = true;
-			}
+		if (Joints[i].Parent >= 0 && modifiedBone[Joints[i].Parent])
+		{
+			components[i] = bone;
+			modifiedBone[i] = true;
+		}
+		else if (components[i].Equals(bone))
+		{
+			modifiedBone[i] = false;
+			continue;
+		}
+		else
+		{
+			components[i] = bone;
+			modifiedBone[i] = true;
+		}
 
-			VSMatrix m;
-			m.loadIdentity();
-			m.translate(bone.translation.X, bone.translation.Y, bone.translation.Z);
-			m.multQuaternion(bone.rotation);
-			m.scale(bone.scaling.X, bone.scaling.Y, bone.scaling.Z);
+		VSMatrix m;
+		m.loadIdentity();
+		m.translate(bone.translation.X, bone.translation.Y, bone.translation.Z);
+		m.multQuaternion(bone.rotation);
+		m.scale(bone.scaling.X, bone.scaling.Y, bone.scaling.Z);
 
-			VSMatrix& result = bones[i];
-			if (Joints[i].Parent >= 0)
-			{
-				result = bones[Joints[i].Parent];
-				result.multMatrix(swapYZ);
-				result.multMatrix(baseframe[Joints[i].Parent]);
-				result.multMatrix(m);
-				result.multMatrix(inversebaseframe[i]);
-			}
-			else
-			{
-				result.loadMatrix(swapYZ);
-				result.multMatrix(m);
-				result.multMatrix(inversebaseframe[i]);
-			}
+		VSMatrix& result = bones[i];
+		if (Joints[i].Parent >= 0)
+		{
+			result = bones[Joints[i].Parent];
 			result.multMatrix(swapYZ);
+			result.multMatrix(baseframe[Joints[i].Parent]);
+			result.multMatrix(m);
+			result.multMatrix(inversebaseframe[i]);
 		}
-
-		boneComponentData->trsmatrix[index] = bones;
-
-		return bones;
+		else
+		{
+			result.loadMatrix(swapYZ);
+			result.multMatrix(m);
+			result.multMatrix(inversebaseframe[i]);
+		}
+		result.multMatrix(swapYZ);
 	}
-	return {};
+
+	return &bones;
 }
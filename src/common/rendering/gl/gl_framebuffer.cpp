@@ -61,6 +61,7 @@
 #include "v_draw.h"
 #include "printf.h"
 #include "gl_hwtexture.h"
+#include "hw_texcache.h"
 #include "model.h"
 
 #include "flatvertices.h"
@@ -77,6 +78,8 @@ EXTERN_CVAR(Bool, gl_texture_thread)
 EXTERN_CVAR(Int, gl_max_transfer_threads)
 EXTERN_CVAR(Int, gl_background_flush_count)
 EXTERN_CVAR(Bool, gl_texture_thread_upload)
+EXTERN_CVAR(Int, gl_texture_decode_threads)
+EXTERN_CVAR(Int, gl_texture_decode_queue)
 
 void gl_LoadExtensions();
 void gl_PrintStartupLog();
@@ -107,6 +110,8 @@ ADD_STAT(glloader)
 	static int maxQueue = 0, maxSecondaryQueue = 0, queue, secQueue, total, collisions, outSize, models;
 	static double minLoad = 0, maxLoad = 0, avgLoad = 0;
 	static double minFG = 0, maxFG = 0, avgFG = 0;
+	static int decodeThreads, decodeQueued, decodeTotal;
+	static double decodeAvg = 0, decodeMax = 0;
 
 	auto sc = dynamic_cast<OpenGLRenderer::OpenGLFrameBuffer*>(screen);
 
@@ -117,6 +122,7 @@ ADD_STAT(glloader)
 		sc->GetBGQueueSize(queue, secQueue, collisions, maxQueue, maxSecondaryQueue, total, outSize, models);
 		sc->GetBGStats(minLoad, maxLoad, avgLoad);
 		sc->GetBGStats2(minFG, maxFG, avgFG);
+		sc->GetDecodeStats(decodeThreads, decodeQueued, decodeTotal, decodeAvg, decodeMax);
 
 		FString out;
 		out.AppendFormat(
@@ -124,8 +130,10 @@ ADD_STAT(glloader)
 			"Models: %d\n"
 			"Min: %.3fms  FG: %.3fms\n"
 			"Max: %.3fms  FG: %.3fms\n"
-			"Avg: %.3fms  FG: %.3fms\n",
-			sc->GetNumThreads(), queue, secQueue, outSize, collisions, maxQueue, maxSecondaryQueue, total, models, minLoad, minFG, maxLoad, maxFG, avgLoad, avgFG
+			"Avg: %.3fms  FG: %.3fms\n"
+			"Decode: [%d Threads] Waiting: %d Tot: %d Avg: %.3fms Max: %.3fms\n",
+			sc->GetNumThreads(), queue, secQueue, outSize, collisions, maxQueue, maxSecondaryQueue, total, models, minLoad, minFG, maxLoad, maxFG, avgLoad, avgFG,
+			decodeThreads, decodeQueued, decodeTotal, decodeAvg, decodeMax
 		);
 		return out;
 	}
@@ -155,7 +163,13 @@ void GlTexLoadThread::prepareLoad() {
 	//gl_setAUXContext(auxContext);
 }
 
-bool GlTexLoadThread::loadResource(GlTexLoadIn & input, GlTexLoadOut & output) {
+// Decoded textures hold their pixels until they are uploaded, so don't let them pile up
+bool GlTexDecodeThread::canLoad() {
+	return mDecodedQ->size() < gl_texture_decode_queue;
+}
+
+// Decode stage, runs on the decoder pool without a GL context
+bool GlTexDecodeThread::loadResource(GlTexLoadIn & input, GlTexLoadOut & output) {
 	FImageLoadParams* params = input.params;
 
 	output.conversion = params->conversion;
@@ -172,12 +186,7 @@ bool GlTexLoadThread::loadResource(GlTexLoadIn & input, GlTexLoadOut & output) {
 
 	// Load pixels directly with the reader we copied on the main thread
 	auto* src = input.imgSource;
-	FBitmap pixels;
 
-	const bool uploadPossible = auxContext >= 0;
-	const bool allowMips = input.flags.AllowMips;
-	const bool indexed = false;	// TODO: Determine this properly
-	bool mipmap = !indexed && allowMips;
 	const bool gpu = src->IsGPUOnly();
 	const int exx = input.spi.shouldExpand && !gpu;
 	const int srcWidth = src->GetWidth();
@@ -186,9 +195,18 @@ bool GlTexLoadThread::loadResource(GlTexLoadIn & input, GlTexLoadOut & output) {
 	const int buffHeight = src->GetHeight() + 2 * exx;
 	unsigned char* pixelData = nullptr;
 	size_t pixelDataSize = 0;
-	
 
-	if (exx && !gpu) {
+	output.flags.Compressed = gpu;
+
+	int translucent, numMipLevels;
+
+	if (input.flags.Transcode && TexTranscodeCache.Read(params->lump, params->conversion, srcWidth, srcHeight, &pixelData, output.totalDataSize, pixelDataSize, numMipLevels, translucent)) {
+		// Transcoded on an earlier load, upload it like a DDS file
+		output.flags.Compressed = true;
+		output.flags.OutputIsTranslucent = translucent;
+		output.mipLevels = numMipLevels;
+	}
+	else if (exx && !gpu) {
 		pixelDataSize = 4u * (size_t)buffWidth * (size_t)buffHeight;
 		pixelData = (unsigned char*)malloc(pixelDataSize);
 		memset(pixelData, 0, pixelDataSize);
@@ -211,16 +229,11 @@ bool GlTexLoadThread::loadResource(GlTexLoadIn & input, GlTexLoadOut & output) {
 	}
 	else {
 		if (gpu) {
-			int numMipLevels;
 			FileReader reader = fileSystem.OpenFileReader(params->lump, FileSys::EReaderType::READER_NEW, FileSys::EReaderType::READERFLAG_SEEKABLE);
 			output.flags.OutputIsTranslucent = src->ReadCompressedPixels(&reader, &pixelData, output.totalDataSize, pixelDataSize, numMipLevels);
 			output.mipLevels = numMipLevels;
 			reader.Close();
 
-			if (uploadPossible) {
-				output.tex->BackgroundCreateCompressedTexture(pixelData, (uint32_t)pixelDataSize, (uint32_t)output.totalDataSize, buffWidth, buffHeight, input.texUnit, numMipLevels, "GlTexLoadThread::loadResource(Compressed)", !allowMips, input.flags.AllowQualityReduction);
-			}
-
 			if (input.spi.generateSpi) {
 				FGameTexture::GenerateEmptySpriteData(output.spi.info, buffWidth, buffHeight);
 			}
@@ -238,32 +251,48 @@ bool GlTexLoadThread::loadResource(GlTexLoadIn & input, GlTexLoadOut & output) {
 			if (input.spi.generateSpi) {
 				FGameTexture::GenerateInitialSpriteData(output.spi.info, &pixels, input.spi.shouldExpand, input.spi.notrimming);
 			}
+
+			if (input.flags.Transcode) {
+				TexTranscodeCache.Submit(params->lump, params->conversion, pixelData, buffWidth, buffHeight, output.flags.OutputIsTranslucent);
+			}
 		}
 	}
 
 	delete input.params;
 
+	output.pixels = pixelData;
 	output.pixelsSize = pixelDataSize;
 	output.pixelW = buffWidth;
 	output.pixelH = buffHeight;
-	output.flags.CreateMips = mipmap && allowMips;
 
-	if (!uploadPossible) {
-		output.flags.CreateMips = mipmap;
-		output.pixels = pixelData;
-	}
-	else {
-		output.flags.CreateMips = mipmap;
+	// TODO: Mark failed images as unloadable so they don't keep coming back to the queue
+	return true;
+}
+
+
+// Upload stage, takes decoded pixels from the decoder pool
+bool GlTexLoadThread::loadResource(GlTexLoadOut & input, GlTexLoadOut & output) {
+	output = input;
+
+	const bool uploadPossible = auxContext >= 0;
+	const bool allowMips = input.flags.AllowMips;
+	const bool indexed = false;	// TODO: Determine this properly
+	const bool mipmap = !indexed && allowMips;
+	unsigned char* pixelData = input.pixels;
+
+	output.flags.CreateMips = mipmap;
+
+	if (uploadPossible) {
 		output.pixels = nullptr;
 
-		if (!gpu)
-			output.tex->BackgroundCreateTexture(pixelData, buffWidth, buffHeight, input.texUnit, mipmap, indexed, "GlTexLoadThread::loadResource()", !allowMips);
+		if (input.flags.Compressed)
+			output.tex->BackgroundCreateCompressedTexture(pixelData, (uint32_t)input.pixelsSize, (uint32_t)input.totalDataSize, input.pixelW, input.pixelH, input.texUnit, input.mipLevels, "GlTexLoadThread::loadResource(Compressed)", !allowMips, input.flags.AllowQualityReduction);
+		else
+			output.tex->BackgroundCreateTexture(pixelData, input.pixelW, input.pixelH, input.texUnit, mipmap, indexed, "GlTexLoadThread::loadResource()", !allowMips);
 
 		free(pixelData);
 	}
 
-	
-	// TODO: Mark failed images as unloadable so they don't keep coming back to the queue
 	return true;
 }
 
@@ -285,8 +314,8 @@ bool GLModelLoadThread::loadResource(GLModelLoadIn& input, GLModelLoadOut& outpu
 // ==================================================================================
 void OpenGLFrameBuffer::GetBGQueueSize(int& current, int &secCurrent, int& collisions, int& max, int& maxSec, int& total, int &outSize, int &models) {
 	max = maxSec = total = 0;
-	current = primaryTexQueue.size();
-	secCurrent = secondaryTexQueue.size();
+	current = texQueue.size(QUEUE_Visible);
+	secCurrent = texQueue.size(QUEUE_Precache);
 	max = statMaxQueued;
 	maxSec = statMaxQueuedSecondary;
 	collisions = statCollisions;
@@ -311,6 +340,21 @@ void OpenGLFrameBuffer::GetBGStats(double& min, double& max, double& avg) {
 	avg /= (double)bgTransferThreads.size();
 }
 
+void OpenGLFrameBuffer::GetDecodeStats(int& threads, int& queued, int& total, double& avg, double& max) {
+	threads = (int)bgDecodeThreads.size();
+	queued = decodedTexQueue.size();
+	total = 0;
+	avg = max = 0;
+
+	for (auto& dec : bgDecodeThreads) {
+		total += dec->statTotalLoaded();
+		max = std::max(dec->statMaxLoadTime(), max);
+		avg += dec->statAvgLoadTime();
+	}
+
+	if (threads > 0) avg /= (double)threads;
+}
+
 void OpenGLFrameBuffer::GetBGStats2(double& min, double& max, double& avg) {
 	min = 99999998;
 	max = avg = 0;
@@ -323,6 +367,7 @@ void OpenGLFrameBuffer::GetBGStats2(double& min, double& max, double& avg) {
 void OpenGLFrameBuffer::ResetBGStats() {
 	statMaxQueued = statMaxQueuedSecondary = 0;
 	for (auto& tfr : bgTransferThreads) tfr->resetStats();
+	for (auto& dec : bgDecodeThreads) dec->resetStats();
 	statCollisions = 0;
 	fgTotalTime = fgTotalCount = fgMin = fgMax = 0;
 	statModelsLoaded = 0;
@@ -345,7 +390,7 @@ bool OpenGLFrameBuffer::BackgroundLoadModel(FModel* model) {
 	GLModelLoadIn modelLoad;
 	modelLoad.model = model;
 	modelLoad.lump = model->GetLumpNum();
-	modelInQueue.queue(modelLoad);
+	modelInQueue.queue(model, modelLoad);
 
 	return true;
 }
@@ -390,12 +435,8 @@ bool OpenGLFrameBuffer::BackgroundCacheMaterial(FMaterial* mat, FTranslationID t
 
 	// If the texture is already submitted to the cache, find it and move it to the normal queue to reprioritize it
 	if (lumpExists && !secondary && systex->GetState(0) == IHardwareTexture::HardwareState::CACHING) {
-		GlTexLoadIn in;
-		if (secondaryTexQueue.dequeueSearch(in, systex,
-			[](void* a, GlTexLoadIn& b)
-		{ return (FHardwareTexture*)a == b.tex; })) {
+		if (texQueue.reprioritize(systex, QUEUE_Visible) || decodedTexQueue.reprioritize(systex, QUEUE_Visible)) {
 			systex->SetHardwareState(IHardwareTexture::HardwareState::LOADING, 0);
-			primaryTexQueue.queue(in);
 			return true;
 		}
 	}
@@ -416,6 +457,9 @@ bool OpenGLFrameBuffer::BackgroundCacheMaterial(FMaterial* mat, FTranslationID t
 			spi.notrimming = mat->sourcetex->GetNoTrimming();
 			spi.shouldExpand = shouldExpand;
 
+			GLTexLoadField layerFlags = flags;
+			layerFlags.Transcode = TexTranscodeCache.CanTranscode(layer->layerTexture->GetImage(), translation.index(), shouldExpand, spi.generateSpi);
+
 			GlTexLoadIn in = {
 				layer->layerTexture->GetImage(),
 				params,
@@ -423,11 +467,10 @@ bool OpenGLFrameBuffer::BackgroundCacheMaterial(FMaterial* mat, FTranslationID t
 				systex,
 				mat->sourcetex,
 				0,
-				flags
+				layerFlags
 			};
 
-			if (secondary) secondaryTexQueue.queue(in);
-			else primaryTexQueue.queue(in);
+			texQueue.queue(in.tex, in, secondary ? QUEUE_Precache : QUEUE_Visible);
 		}
 		else {
 			systex->SetHardwareState(IHardwareTexture::HardwareState::READY, 0); // TODO: Set state to a special "unloadable" state
@@ -447,12 +490,8 @@ bool OpenGLFrameBuffer::BackgroundCacheMaterial(FMaterial* mat, FTranslationID t
 		bool lumpExists = fileSystem.FileLength(lump) >= 0;
 
 		if (lumpExists && !secondary && syslayer->GetState(i) == IHardwareTexture::HardwareState::CACHING) {
-			GlTexLoadIn in;
-			if (secondaryTexQueue.dequeueSearch(in, syslayer,
-				[](void* a, GlTexLoadIn& b)
-			{ return (FHardwareTexture*)a == b.tex; })) {
+			if (texQueue.reprioritize(syslayer, QUEUE_Visible) || decodedTexQueue.reprioritize(syslayer, QUEUE_Visible)) {
 				syslayer->SetHardwareState(IHardwareTexture::HardwareState::LOADING, i);
-				primaryTexQueue.queue(in);
 				return true;
 			}
 		}
@@ -469,6 +508,9 @@ bool OpenGLFrameBuffer::BackgroundCacheMaterial(FMaterial* mat, FTranslationID t
 			if (params != nullptr) {
 				assert(syslayer->GetTextureHandle() == 0);
 
+				GLTexLoadField layerFlags = flags;
+				layerFlags.Transcode = TexTranscodeCache.CanTranscode(layer->layerTexture->GetImage(), 0, shouldExpand, false);
+
 				GlTexLoadIn in = {
 					layer->layerTexture->GetImage(),
 					params,
@@ -478,11 +520,10 @@ bool OpenGLFrameBuffer::BackgroundCacheMaterial(FMaterial* mat, FTranslationID t
 					syslayer,
 					nullptr,
 					i,
-					flags
+					layerFlags
 				};
 
-				if (secondary) secondaryTexQueue.queue(in);
-				else primaryTexQueue.queue(in);
+				texQueue.queue(in.tex, in, secondary ? QUEUE_Precache : QUEUE_Visible);
 			}
 			else {
 				syslayer->SetHardwareState(IHardwareTexture::HardwareState::READY, i); // TODO: Set state to a special "unloadable" state
@@ -490,23 +531,34 @@ bool OpenGLFrameBuffer::BackgroundCacheMaterial(FMaterial* mat, FTranslationID t
 		}
 	}
 
-	statMaxQueued = max(statMaxQueued, primaryTexQueue.size());
-	statMaxQueuedSecondary = max(statMaxQueuedSecondary, secondaryTexQueue.size());
+	statMaxQueued = max(statMaxQueued, texQueue.size(QUEUE_Visible));
+	statMaxQueuedSecondary = max(statMaxQueuedSecondary, texQueue.size(QUEUE_Precache));
 
 	return true;
 }
 
 
 void OpenGLFrameBuffer::StopBackgroundCache() {
-	primaryTexQueue.clear();
-	secondaryTexQueue.clear();
+	texQueue.clear();
 	patchQueue.clear();
 	modelInQueue.clear();
 
+	// Stop the decoders first so nothing new lands in the decoded queue
+	for (auto& dec : bgDecodeThreads) {
+		dec->stop();
+	}
+
 	for (auto& tfr : bgTransferThreads) {
 		tfr->stop();
 	}
 
+	TexTranscodeCache.Shutdown();
+
+	GlTexLoadOut decoded;
+	while (decodedTexQueue.dequeue(decoded)) {
+		if (decoded.pixels) free(decoded.pixels);
+	}
+
 	modelThread->stop();
 	modelOutQueue.clear();
 	outputTexQueue.clear();
@@ -514,11 +566,13 @@ void OpenGLFrameBuffer::StopBackgroundCache() {
 
 
 void OpenGLFrameBuffer::FlushBackground() {
-	int nq = primaryTexQueue.size() + secondaryTexQueue.size();
+	int nq = texQueue.size() + decodedTexQueue.size();
 	bool active = nq;
 
-	if (!active)
+	if (!active) {
+		for (auto& dec : bgDecodeThreads) active = active || dec->isActive();
 		for (auto& tfr : bgTransferThreads) active = active || tfr->isActive();
+	}
 
 	Printf(TEXTCOLOR_GREEN"OpenGLFrameBuffer[%s]: Flushing [%d + %d] = %d texture load ops\n", active ? "active" : "inactive", nq, patchQueue.size(), nq + patchQueue.size());
 	Printf(TEXTCOLOR_GREEN"\tFlushing %d - %d Model Reads\n", modelInQueue.size(), modelOutQueue.size());
@@ -538,7 +592,9 @@ void OpenGLFrameBuffer::FlushBackground() {
 
 		UpdateBackgroundCache(true);
 
-		active = false;
+		active = texQueue.size() > 0 || decodedTexQueue.size() > 0;
+		for (auto& dec : bgDecodeThreads)
+			active = active || dec->isActive();
 		for (auto& tfr : bgTransferThreads)
 			active = active || tfr->isActive();
 		active = active || modelThread->isActive();
@@ -587,7 +643,7 @@ void OpenGLFrameBuffer::UpdateBackgroundCache(bool flush) {
 		else {
 			// If we have pixels to upload, upload them here
 			if (loaded.pixels) {
-				if (loaded.imgSource->IsGPUOnly()) {
+				if (loaded.flags.Compressed) {
 					loaded.tex->BackgroundCreateCompressedTexture(loaded.pixels, loaded.pixelsSize, loaded.totalDataSize, loaded.pixelW, loaded.pixelH, loaded.texUnit, loaded.mipLevels, "OpenGLFrameBuffer::UpdateBackgroundCache()", !loaded.flags.CreateMips, loaded.flags.AllowQualityReduction);
 				}
 				else {
@@ -668,6 +724,7 @@ OpenGLFrameBuffer::~OpenGLFrameBuffer()
 {
 	PPResource::ResetAll();
 
+	bgDecodeThreads.clear();
 	bgTransferThreads.clear();
 
 	if (mVertexData != nullptr) delete mVertexData;
@@ -758,15 +815,25 @@ void OpenGLFrameBuffer::InitializeState()
 	mDebug->Update();
 
 	bgTransferThreads.clear();
+	bgDecodeThreads.clear();
 	if (gl_texture_thread) {
 		int numThreads = 1;
 		bool canUpload = gl_texture_thread_upload && gl_numAUXContexts() > 0;
+		TexTranscodeCache.Init(hwcaps & RFL_TEXTURE_COMPRESSION_BPTC);
+
+		// Decoding needs no context, so it gets its own pool that feeds the upload threads
+		int numDecodeThreads = ResourceWorkerThreadCount(gl_texture_decode_threads);
+		for (int x = 0; x < numDecodeThreads; x++) {
+			std::unique_ptr<GlTexDecodeThread> ptr(new GlTexDecodeThread(&texQueue, &decodedTexQueue));
+			ptr->start();
+			bgDecodeThreads.push_back(std::move(ptr));
+		}
 
 		if(canUpload)
 			numThreads = min(4, min((int)gl_max_transfer_threads, gl_numAUXContexts()));
 		
 		for (int x = 0; x < numThreads; x++) {
-			std::unique_ptr<GlTexLoadThread> ptr(new GlTexLoadThread(this, canUpload ? x : -1, &primaryTexQueue, &secondaryTexQueue, &outputTexQueue));
+			std::unique_ptr<GlTexLoadThread> ptr(new GlTexLoadThread(this, canUpload ? x : -1, &decodedTexQueue, &outputTexQueue));
 			ptr->start();
 			bgTransferThreads.push_back(std::move(ptr));
 		}
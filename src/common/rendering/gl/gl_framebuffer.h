@@ -17,7 +17,7 @@ class FHardwareTexture;
 class FGLDebug;
 
 
-/* Background loader classes: TODO: Split GPU and File loading. */
+/* Background loader classes */
 struct GlTexLoadSpiFull {
 	bool generateSpi, shouldExpand, notrimming;
 	SpritePositioningInfo info[2];
@@ -33,7 +33,9 @@ enum GLTexLoadFlags {
 	GL_TEXLOAD_ALLOWMIPS		= 1,		// Mipmaps allowed at all (IN)
 	GL_TEXLOAD_CREATEMIPS		= 1 << 1,	// Create mipmaps in main thread (OUT)
 	GL_TEXLOAD_ALLOWQUALITY		= 1 << 2,	// Allow quality reduction from gl_texture_quality (IN/OUT)
-	GL_TEXLOAD_ISTRANSLUCENT	= 1 << 3	// Texture loaded was translucent (OUT)
+	GL_TEXLOAD_ISTRANSLUCENT	= 1 << 3,	// Texture loaded was translucent (OUT)
+	GL_TEXLOAD_COMPRESSED		= 1 << 4,	// Pixels are GPU only data read as is (decode -> upload)
+	GL_TEXLOAD_TRANSCODE		= 1 << 5	// Image may be read from or added to the transcode cache (IN)
 };
 
 
@@ -43,8 +45,8 @@ union GLTexLoadField {
 		bool CreateMips					: 1;
 		bool AllowQualityReduction		: 1;
 		bool OutputIsTranslucent		: 1;
-		bool Unused1 : 1;
-		bool Unused2 : 1;
+		bool Compressed					: 1;
+		bool Transcode					: 1;
 		bool Unused3 : 1;
 		bool Unused4 : 1;
 	};
@@ -97,10 +99,27 @@ struct GLModelLoadOut {
 
 class OpenGLFrameBuffer;
 
+// Reads and decodes texture data on the CPU, then hands it to the upload threads
+class GlTexDecodeThread : public ResourceLoader2<GlTexLoadIn, GlTexLoadOut> {
+public:
+	GlTexDecodeThread(TSResourceQueue<GlTexLoadIn>* inQueue, TSResourceQueue<GlTexLoadOut>* decodedQueue) : ResourceLoader2(inQueue, nullptr) {
+		mDecodedQ = decodedQueue;
+	}
+
+protected:
+	TSResourceQueue<GlTexLoadOut>* mDecodedQ;
+
+	bool loadResource(GlTexLoadIn& input, GlTexLoadOut& output) override;
+	void submitOutput(GlTexLoadOut& output) override { mDecodedQ->queue(output.tex, output, mLoadPriority); }
+	bool canLoad() override;
+	const char *threadName() const override { return "GL texture decoder"; }
+};
+
+
 // @Cockatrice - Background loader thread to handle transfer of texture data
-class GlTexLoadThread : public ResourceLoader2<GlTexLoadIn, GlTexLoadOut> {
+class GlTexLoadThread : public ResourceLoader2<GlTexLoadOut, GlTexLoadOut> {
 public:
-	GlTexLoadThread(OpenGLFrameBuffer *buffer, int contextIndex, TSQueue<GlTexLoadIn> *inQueue, TSQueue<GlTexLoadIn>* secondaryQueue, TSQueue<GlTexLoadOut>* outQueue) : ResourceLoader2(inQueue, secondaryQueue, outQueue) {
+	GlTexLoadThread(OpenGLFrameBuffer *buffer, int contextIndex, TSResourceQueue<GlTexLoadOut> *inQueue, TSQueue<GlTexLoadOut>* outQueue) : ResourceLoader2(inQueue, outQueue) {
 		auxContext = contextIndex;
 		submits = 0;
 		cmd = buffer;
@@ -117,10 +136,11 @@ protected:
 
 	std::atomic<int> maxQueue;
 
-	bool loadResource(GlTexLoadIn& input, GlTexLoadOut& output) override;
+	bool loadResource(GlTexLoadOut& input, GlTexLoadOut& output) override;
 	void cancelLoad() override {  }		// TODO: Actually finish this
 	void completeLoad() override {  }	// TODO: Same
 	void prepareLoad() override;
+	const char *threadName() const override { return "GL texture loader"; }
 
 	void bgproc() override;
 };
@@ -128,7 +148,7 @@ protected:
 
 class GLModelLoadThread : public ResourceLoader2<GLModelLoadIn, GLModelLoadOut> {
 public:
-	GLModelLoadThread(TSQueue<GLModelLoadIn>* inQueue, TSQueue<GLModelLoadOut>* outQueue) : ResourceLoader2(inQueue, nullptr, outQueue) {
+	GLModelLoadThread(TSResourceQueue<GLModelLoadIn>* inQueue, TSQueue<GLModelLoadOut>* outQueue) : ResourceLoader2(inQueue, outQueue) {
 
 	}
 
@@ -136,6 +156,7 @@ protected:
 	std::atomic<int> maxQueue;
 
 	bool loadResource(GLModelLoadIn& input, GLModelLoadOut& output) override;
+	const char *threadName() const override { return "GL model loader"; }
 };
 
 
@@ -175,7 +196,7 @@ public:
 	bool BackgroundLoadModel(FModel* model) override;
 	bool BackgroundCacheMaterial(FMaterial* mat, FTranslationID translation, bool makeSPI = false, bool secondary = false) override;
 	bool BackgroundCacheTextureMaterial(FGameTexture* tex, FTranslationID translation, int scaleFlags, bool makeSPI = false) override;
-	bool CachingActive() override { return secondaryTexQueue.size() > 0; }
+	bool CachingActive() override { return texQueue.size(QUEUE_Precache) > 0; }
 	bool SupportsBackgroundCache() override { return bgTransferThreads.size() > 0; }
 	void StopBackgroundCache() override;
 	void FlushBackground() override;
@@ -216,6 +237,7 @@ public:
 	void GetBGStats(double& min, double& max, double& avg);
 	void GetBGStats2(double& min, double& max, double& avg);
 	int GetNumThreads() { return (int)bgTransferThreads.size(); }
+	void GetDecodeStats(int& threads, int& queued, int& total, double& avg, double& max);
 	void ResetBGStats();
 
 	int camtexcount = 0;
@@ -229,12 +251,14 @@ private:
 	};
 
 	int statMaxQueued = 0, statMaxQueuedSecondary = 0, statCollisions = 0, statModelsLoaded = 0;
-	TSQueue<GlTexLoadIn> primaryTexQueue, secondaryTexQueue;
+	TSResourceQueue<GlTexLoadIn> texQueue;									// Keyed by hardware texture, precaching goes in at QUEUE_Precache
+	TSResourceQueue<GlTexLoadOut> decodedTexQueue;								// Decoded textures waiting for upload
 	TSQueue<GlTexLoadOut> outputTexQueue;
-	TSQueue<GLModelLoadIn> modelInQueue;
+	TSResourceQueue<GLModelLoadIn> modelInQueue;
 	TSQueue<GLModelLoadOut> modelOutQueue;
 	TSQueue<QueuedPatch> patchQueue;									// @Cockatrice - Thread safe queue of textures to create materials for and submit to the bg thread
 	std::vector<std::unique_ptr<GlTexLoadThread>> bgTransferThreads;	// @Cockatrice - Threads that handle the background transfers
+	std::vector<std::unique_ptr<GlTexDecodeThread>> bgDecodeThreads;	// CPU side of the background transfers
 	std::unique_ptr<GLModelLoadThread> modelThread;						// Loads models, always 1 thread
 
 	double fgTotalTime = 0, fgTotalCount = 0, fgMin = 0, fgMax = 0;		// Foreground integration time stats
@@ -237,7 +237,8 @@ unsigned int FHardwareTexture::BackgroundCreateCompressedTexture(unsigned char*
 
 	uint32_t mipWidth = w, mipHeight = h;
 	size_t mipSize = dataSize, dataPos = 0;
-	const int startMip = allowQualityReduction ? min((int)gl_texture_quality, (int)numMips - 1) : 0;
+	const int startMip = GetStartMip((int)numMips, allowQualityReduction);
+	SetCompressed(true);
 	int mipCnt = 0, maxMips = mipmap ? numMips - startMip : 1;
 
 	for (uint32_t x = 0; x < numMips && mipCnt < maxMips; x++) {
@@ -357,7 +358,8 @@ unsigned int FHardwareTexture::CreateCompressedTexture(unsigned char* buffer, ui
 
 	uint32_t mipWidth = w, mipHeight = h;
 	size_t mipSize = dataSize, dataPos = 0;
-	const int startMip = allowQualityReduction ? min((int)gl_texture_quality, (int)numMips - 1) : 0;
+	const int startMip = GetStartMip((int)numMips, allowQualityReduction);
+	SetCompressed(true);
 	int mipCnt = 0, maxMips = mipmap ? numMips - startMip : 1;
 
 	for (uint32_t x = 0; x < numMips && mipCnt < maxMips; x++) {
@@ -35,6 +35,7 @@
 **
 */
 
+#include <atomic>
 #include "gl_system.h"
 #include "gl_renderer.h"
 #include "gl_renderbuffers.h"
@@ -57,8 +58,9 @@ EXTERN_CVAR(Int, gl_dither_bpc)
 int flatVerticesPerEye;
 int wallVerticesPerEye;
 int portalsPerEye;
-int lightsFlatPerEye;
-int lightsWallPerEye;
+// Light caps are claimed by all BSP workers at once
+std::atomic<int> lightsFlatPerEye;
+std::atomic<int> lightsWallPerEye;
 
 #ifdef _WIN32
 EXTERN_CVAR(Bool, vr_enable_quadbuffered)
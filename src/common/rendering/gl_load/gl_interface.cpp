@@ -160,6 +160,7 @@ void gl_LoadExtensions()
 	// first test for optional features
 	if (CheckExtension("GL_ARB_texture_compression")) gl.flags |= RFL_TEXTURE_COMPRESSION;
 	if (CheckExtension("GL_EXT_texture_compression_s3tc")) gl.flags |= RFL_TEXTURE_COMPRESSION_S3TC;
+	if (gl_version >= 4.2f || CheckExtension("GL_ARB_texture_compression_bptc")) gl.flags |= RFL_TEXTURE_COMPRESSION_BPTC;
 	if (CheckExtension("GL_EXT_clip_cull_distance")) gl.flags &= ~RFL_NO_CLIP_PLANES;
 
 	if (gl_version < 4.f)
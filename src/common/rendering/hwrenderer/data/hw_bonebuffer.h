@@ -22,6 +22,7 @@ class BoneBuffer
 	unsigned int mBufferSize;
 	unsigned int mByteSize;
     unsigned int mMaxUploadSize;
+	unsigned int mGeneration = 0;
 
 public:
 	BoneBuffer(int pipelineNbr = 1);
@@ -35,6 +36,9 @@ public:
 	bool GetBufferType() const { return mBufferType; }
 	int GetBinding(unsigned int index, size_t* pOffset, size_t* pSize);
 
+	// Changes whenever Clear() makes previously uploaded bones invalid
+	unsigned int GetGeneration() const { return mGeneration; }
+
 	// Only for GLES to determin how much data is in the buffer
 	int GetCurrentIndex() { return mIndex; };
 
@@ -51,10 +51,11 @@ glcycle_t Dirty;
 glcycle_t drawcalls;
 glcycle_t twoD, Flush3D;
 glcycle_t MTWait, WTTotal;
-int vertexcount, flatvertices, flatprimitives;
+std::atomic<int> vertexcount, flatvertices, flatprimitives;
 
-int rendered_lines,rendered_flats,rendered_sprites,render_vertexsplit,render_texsplit,rendered_decals, rendered_portals, rendered_commandbuffers;
-int iter_dlightf, iter_dlight, draw_dlight, draw_dlightf;
+std::atomic<int> rendered_lines,rendered_flats,rendered_sprites,render_vertexsplit,render_texsplit,rendered_decals, rendered_portals;
+int rendered_commandbuffers;
+std::atomic<int> iter_dlightf, iter_dlight, draw_dlight, draw_dlightf;
 int lightbuffer_curindex, vertexbuffer_curindex, bonebuffer_curindex;
 
 void ResetProfilingData()
@@ -118,13 +119,13 @@ static void AppendRenderStats(FString &out)
 	out.AppendFormat("Walls: %d (%d splits, %d t-splits, %d vertices)\n"
 		"Flats: %d (%d primitives, %d vertices)\n"
 		"Sprites: %d, Decals=%d, Portals: %d, Command buffers: %d\n",
-		rendered_lines, render_vertexsplit, render_texsplit, vertexcount, rendered_flats, flatprimitives, flatvertices, rendered_sprites,rendered_decals, rendered_portals, rendered_commandbuffers );
+		rendered_lines.load(), render_vertexsplit.load(), render_texsplit.load(), vertexcount.load(), rendered_flats.load(), flatprimitives.load(), flatvertices.load(), rendered_sprites.load(), rendered_decals.load(), rendered_portals.load(), rendered_commandbuffers );
 }
 
 static void AppendLightStats(FString &out)
 {
-	out.AppendFormat("DLight - Walls: %d processed, %d rendered\n", iter_dlight, draw_dlight);
-	out.AppendFormat("DLight - Flats: %d processed, %d rendered\n", iter_dlightf, draw_dlightf);
+	out.AppendFormat("DLight - Walls: %d processed, %d rendered\n", iter_dlight.load(), draw_dlight.load());
+	out.AppendFormat("DLight - Flats: %d processed, %d rendered\n", iter_dlightf.load(), draw_dlightf.load());
 }
 
 static void AppendBufferStats(FString &out)
@@ -56,6 +56,19 @@ CVAR(Bool, gl_texture_thread, true, CVAR_GLOBALCONFIG | CVAR_ARCHIVE)
 // @Cockatrice - Enable upload inside the texture thread (when available), or force upload to happen in main thread (debugging, old hardware etc)
 CVAR(Bool, gl_texture_thread_upload, true, CVAR_GLOBALCONFIG | CVAR_ARCHIVE)
 
+// Number of threads that decode textures for the background loader before they are handed to the upload threads
+// 0 = pick from the number of cores. Takes effect when the renderer is restarted
+CUSTOM_CVAR(Int, gl_texture_decode_threads, 0, CVAR_GLOBALCONFIG | CVAR_ARCHIVE | CVAR_NOINITCALL) {
+	if (self < 0) self = 0;
+	if (self > 16) self = 16;
+}
+
+// Number of decoded textures that may wait for upload. The decoders hold off while it is full,
+// each of them keeps its pixels in memory until it has been uploaded
+CUSTOM_CVAR(Int, gl_texture_decode_queue, 64, CVAR_GLOBALCONFIG | CVAR_ARCHIVE) {
+	if (self < 4) self = 4;
+}
+
 // @Cockatrice - Controls how many background loaded textures are re-integrated every tick
 // Especially on cards that have to create mipmaps in the main thread, this number can't be too high
 // or we get choppy when too many things are loading at once
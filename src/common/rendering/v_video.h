@@ -76,6 +76,7 @@ enum EHWCaps
 
 	RFL_INVALIDATE_BUFFER = 64,
 	RFL_DEBUG = 128,
+	RFL_TEXTURE_COMPRESSION_BPTC = 256,	// BC7 textures can be sampled
 };
 
 
@@ -66,6 +66,7 @@
 #include "engineerrors.h"
 #include "c_dispatch.h"
 #include "image.h"
+#include "hw_texcache.h"
 #include "model.h"
 
 
@@ -78,6 +79,8 @@ EXTERN_CVAR(Int, vk_max_transfer_threads)
 EXTERN_CVAR(Bool, gl_texture_thread)
 EXTERN_CVAR(Int, gl_background_flush_count)
 EXTERN_CVAR(Bool, gl_texture_thread_upload)
+EXTERN_CVAR(Int, gl_texture_decode_threads)
+EXTERN_CVAR(Int, gl_texture_decode_queue)
 
 CVAR(Bool, vk_raytrace, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
 
@@ -145,6 +148,8 @@ ADD_STAT(vkloader)
 	static int maxQueue = 0, maxSecondaryQueue = 0, queue, secQueue, total, collisions, outSize, models;
 	static double minLoad = 0, maxLoad = 0, avgLoad = 0;
 	static double minFG = 0, maxFG = 0, avgFG = 0;
+	static int decodeThreads, decodeQueued, decodeTotal;
+	static double decodeAvg = 0, decodeMax = 0;
 
 	auto sc = dynamic_cast<VulkanRenderDevice *>(screen);
 
@@ -155,6 +160,7 @@ ADD_STAT(vkloader)
 		sc->GetBGQueueSize(queue, secQueue, collisions, maxQueue, maxSecondaryQueue, total, outSize, models);
 		sc->GetBGStats(minLoad, maxLoad, avgLoad);
 		sc->GetBGStats2(minFG, maxFG, avgFG);
+		sc->GetDecodeStats(decodeThreads, decodeQueued, decodeTotal, decodeAvg, decodeMax);
 
 		static VmaBudget budgets[10] = {};
 		VkDeviceSize a = 0, b = 0;
@@ -172,8 +178,10 @@ ADD_STAT(vkloader)
 			"Models: %d\n"
 			"Min: %.3fms  FG: %.3fms\n"
 			"Max: %.3fms  FG: %.3fms\n"
-			"Avg: %.3fms  FG: %.3fms\n",
-			a / 1024 / 1024, b / 1024 / 1024, sc->GetNumThreads(), queue, secQueue, outSize, collisions, maxQueue, maxSecondaryQueue, total, models, minLoad, minFG, maxLoad, maxFG, avgLoad, avgFG
+			"Avg: %.3fms  FG: %.3fms\n"
+			"Decode: [%d Threads] Waiting: %d Tot: %d Avg: %.3fms Max: %.3fms\n",
+			a / 1024 / 1024, b / 1024 / 1024, sc->GetNumThreads(), queue, secQueue, outSize, collisions, maxQueue, maxSecondaryQueue, total, models, minLoad, minFG, maxLoad, maxFG, avgLoad, avgFG,
+			decodeThreads, decodeQueued, decodeTotal, decodeAvg, decodeMax
 		);
 		return out;
 	}
@@ -189,8 +197,8 @@ CCMD(vk_rstbgstats) {
 
 void VulkanRenderDevice::GetBGQueueSize(int& current, int& secCurrent, int& collisions, int& max, int& maxSec, int& total, int& outSize, int& models) {
 	max = maxSec = total = 0;
-	current = primaryTexQueue.size();
-	secCurrent = secondaryTexQueue.size();
+	current = texQueue.size(QUEUE_Visible);
+	secCurrent = texQueue.size(QUEUE_Precache);
 	max = statMaxQueued;
 	maxSec = statMaxQueuedSecondary;
 	collisions = statCollisions;
@@ -218,6 +226,22 @@ void VulkanRenderDevice::GetBGStats(double &min, double &max, double &avg) {
 }
 
 
+void VulkanRenderDevice::GetDecodeStats(int& threads, int& queued, int& total, double& avg, double& max) {
+	threads = (int)bgDecodeThreads.size();
+	queued = decodedTexQueue.size();
+	total = 0;
+	avg = max = 0;
+
+	for (auto& dec : bgDecodeThreads) {
+		total += dec->statTotalLoaded();
+		max = std::max(dec->statMaxLoadTime(), max);
+		avg += dec->statAvgLoadTime();
+	}
+
+	if (threads > 0) avg /= (double)threads;
+}
+
+
 void VulkanRenderDevice::GetBGStats2(double& min, double& max, double& avg) {
 	min = 99999998;
 	max = avg = 0;
@@ -232,20 +256,21 @@ void VulkanRenderDevice::GetBGStats2(double& min, double& max, double& avg) {
 void VulkanRenderDevice::ResetBGStats() {
 	statMaxQueued = statMaxQueuedSecondary = 0;
 	for (auto& tfr : bgTransferThreads) tfr->resetStats();
+	for (auto& dec : bgDecodeThreads) dec->resetStats();
 	statCollisions = 0;
 	fgTotalTime = fgTotalCount = fgMin = fgMax = fgCurTime = 0;
 	statModelsLoaded = 0;
 }
 
 bool VulkanRenderDevice::CachingActive() {
-	return secondaryTexQueue.size() > 0;
+	return texQueue.size(QUEUE_Precache) > 0;
 }
 
 // TODO: Change this to report the actual progress once we have a way to mark the total number of objects to load
 float VulkanRenderDevice::CacheProgress() {
 	float total = 0;
 
-	return (float)secondaryTexQueue.size();
+	return (float)texQueue.size(QUEUE_Precache);
 }
 
 
@@ -268,7 +293,8 @@ static void TempUploadTexture(VkCommandBufferManager *cmd, VkHardwareTexture *te
 		uint32_t numMipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(buffWidth, buffHeight)))) + 1;
 		uint32_t mipWidth = buffWidth, mipHeight = buffHeight;
 		size_t mipSize = pixelDataSize, dataPos = 0;
-		const int startMip = allowQualityReduction ? min((int)gl_texture_quality, (int)numMipLevels - 1) : 0;
+		const int startMip = tex->GetStartMip((int)numMipLevels, allowQualityReduction);
+		tex->SetCompressed(true);
 		int mipCnt = 0, maxMips = mipmap ? numMipLevels - startMip : 1;
 		
 
@@ -302,10 +328,13 @@ static void TempUploadTexture(VkCommandBufferManager *cmd, VkHardwareTexture *te
 	}
 }
 
-// @Cockatrice - TODO: Separate 
-bool VkTexLoadThread::loadResource(VkTexLoadIn &input, VkTexLoadOut &output) {
-	currentImageID.store(input.imgSource->GetId());
+// Decoded textures hold their pixels until they are uploaded, so don't let them pile up
+bool VkTexDecodeThread::canLoad() {
+	return mDecodedQ->size() < gl_texture_decode_queue;
+}
 
+// Decode stage, runs on the decoder pool. No GPU access here
+bool VkTexDecodeThread::loadResource(VkTexLoadIn &input, VkTexLoadOut &output) {
 	FImageLoadParams *params = input.params;
 
 	output.conversion = params->conversion;
@@ -318,6 +347,8 @@ bool VkTexLoadThread::loadResource(VkTexLoadIn &input, VkTexLoadOut &output) {
 	output.gtex = input.gtex;
 	output.releaseSemaphore = nullptr;
 	output.flags = input.flags;
+	output.createMipmaps = false;
+	output.mipLevels = 0;
 
 	auto *src = input.imgSource;
 	bool gpu = src->IsGPUOnly();
@@ -326,16 +357,24 @@ bool VkTexLoadThread::loadResource(VkTexLoadIn &input, VkTexLoadOut &output) {
 	int srcHeight = src->GetHeight();
 	int buffWidth = src->GetWidth() + 2 * exx;
 	int buffHeight = src->GetHeight() + 2 * exx;
-	bool indexed = false;	// TODO: Determine this properly
-	bool allowMips = (input.flags & TEXLOAD_ALLOWMIPS);
-	bool mipmap = !indexed && allowMips;
-	VkFormat fmt = indexed ? VK_FORMAT_R8_UNORM : VK_FORMAT_B8G8R8A8_UNORM;
-	VulkanDevice* device = cmd != nullptr ? cmd->GetRenderDevice()->device.get() : nullptr;
 
 	unsigned char* pixelData = nullptr;
 	size_t pixelDataSize = 0;
 
-	if (exx && !gpu) {
+	output.compressed = gpu;
+
+	int translucent;
+	size_t totalSize;
+	int numMipLevels;
+
+	if ((input.flags & TEXLOAD_TRANSCODE) && TexTranscodeCache.Read(params->lump, params->conversion, srcWidth, srcHeight, &pixelData, totalSize, pixelDataSize, numMipLevels, translucent)) {
+		// Transcoded on an earlier load, upload it like a DDS file
+		output.compressed = true;
+		output.isTranslucent = translucent;
+		output.totalDataSize = totalSize;
+		output.mipLevels = numMipLevels;
+	}
+	else if (exx && !gpu) {
 		pixelDataSize = 4u * (size_t)buffWidth * (size_t)buffHeight;
 		pixelData = (unsigned char*)malloc(pixelDataSize);
 		memset(pixelData, 0, pixelDataSize);
@@ -359,28 +398,13 @@ bool VkTexLoadThread::loadResource(VkTexLoadIn &input, VkTexLoadOut &output) {
 	else {
 		if (gpu) {
 			// GPU only textures cannot be trimmed or translated, so just do a straight read
-			size_t totalSize;
-			int numMipLevels;
-
 			assert(params->lump > 0);
 			FileReader reader = fileSystem.OpenFileReader(params->lump, FileSys::EReaderType::READER_NEW, 0);
 			output.isTranslucent = src->ReadCompressedPixels(&reader, &pixelData, totalSize, pixelDataSize, numMipLevels);
 			reader.Close();
-			mipmap = false;
-			fmt = VK_FORMAT_BC7_UNORM_BLOCK;
 
 			output.totalDataSize = totalSize;
-
-			uint32_t expectedMipLevels = static_cast<uint32_t>(floor(log2(std::max(buffWidth, buffHeight)))) + 1;
-
-			// Only perform upload if we have a command buffer
-			if (cmd) {
-				mipmap = false;	// Don't generate mipmaps past this point
-				TempUploadTexture(cmd, output.tex, fmt, buffWidth, buffHeight, pixelData, pixelDataSize, totalSize, allowMips && numMipLevels == (int)expectedMipLevels && numMipLevels > 0, true, indexed, input.flags & TEXLOAD_ALLOWQUALITY);
-			}
-			else {
-				mipmap = allowMips && numMipLevels == (int)expectedMipLevels && numMipLevels > 0;	// Upload mipmaps if the science is correct
-			}
+			output.mipLevels = numMipLevels;
 
 			if (input.spi.generateSpi) {
 				// Generate sprite data without pixel data, since no trimming should occur
@@ -400,15 +424,59 @@ bool VkTexLoadThread::loadResource(VkTexLoadIn &input, VkTexLoadOut &output) {
 			if (input.spi.generateSpi) {
 				FGameTexture::GenerateInitialSpriteData(output.spi.info, &pixels, input.spi.shouldExpand, input.spi.notrimming);
 			}
+
+			if (input.flags & TEXLOAD_TRANSCODE) {
+				TexTranscodeCache.Submit(params->lump, params->conversion, pixelData, buffWidth, buffHeight, output.isTranslucent);
+			}
 		}
 	}
 
 	delete input.params;
 
+	output.pixels = pixelData;
 	output.pixelsSize = pixelDataSize;
 	output.pixelW = buffWidth;
 	output.pixelH = buffHeight;
 
+	// Always return true, because failed images need to be marked as unloadable
+	// TODO: Mark failed images as unloadable so they don't keep coming back to the queue
+	return true;
+}
+
+
+// Upload stage, takes decoded pixels from the decoder pool
+bool VkTexLoadThread::loadResource(VkTexLoadOut &input, VkTexLoadOut &output) {
+	currentImageID.store(input.imgSource->GetId());
+
+	output = input;
+
+	int buffWidth = input.pixelW;
+	int buffHeight = input.pixelH;
+	bool indexed = false;	// TODO: Determine this properly
+	bool allowMips = (input.flags & TEXLOAD_ALLOWMIPS);
+	bool mipmap = !indexed && allowMips;
+	VkFormat fmt = indexed ? VK_FORMAT_R8_UNORM : VK_FORMAT_B8G8R8A8_UNORM;
+	VulkanDevice* device = cmd != nullptr ? cmd->GetRenderDevice()->device.get() : nullptr;
+
+	unsigned char* pixelData = input.pixels;
+	size_t pixelDataSize = input.pixelsSize;
+
+	if (input.compressed) {
+		mipmap = false;
+		fmt = VK_FORMAT_BC7_UNORM_BLOCK;
+
+		uint32_t expectedMipLevels = static_cast<uint32_t>(floor(log2(std::max(buffWidth, buffHeight)))) + 1;
+		bool hasMips = allowMips && input.mipLevels == (int)expectedMipLevels && input.mipLevels > 0;
+
+		// Only perform upload if we have a command buffer
+		if (cmd) {
+			TempUploadTexture(cmd, output.tex, fmt, buffWidth, buffHeight, pixelData, pixelDataSize, input.totalDataSize, hasMips, true, indexed, input.flags & TEXLOAD_ALLOWQUALITY);
+		}
+		else {
+			mipmap = hasMips;	// Upload mipmaps if the science is correct
+		}
+	}
+
 	// If there is no command buffer we have to do the upload in the main thread
 	// Transfer data if necessary
 	if (!cmd) {
@@ -420,7 +488,7 @@ bool VkTexLoadThread::loadResource(VkTexLoadIn &input, VkTexLoadOut &output) {
 		output.pixels = nullptr;
 
 		// Upload non-gpu only textures
-		if (!gpu) {
+		if (!input.compressed) {
 			output.tex->BackgroundCreateTexture(cmd, buffWidth, buffHeight, indexed ? 1 : 4, fmt, pixelData, mipmap ? -1 : 0, mipmap, (int)pixelDataSize);
 		}
 
@@ -464,8 +532,6 @@ bool VkTexLoadThread::loadResource(VkTexLoadIn &input, VkTexLoadOut &output) {
 		}
 	}
 
-	// Always return true, because failed images need to be marked as unloadable
-	// TODO: Mark failed images as unloadable so they don't keep coming back to the queue
 	return true;
 }
 
@@ -488,11 +554,13 @@ bool VkModelLoadThread::loadResource(VkModelLoadIn& input, VkModelLoadOut& outpu
 // END Background Loader Stuff =====================================================
 
 void VulkanRenderDevice::FlushBackground() {
-	int nq = primaryTexQueue.size() + secondaryTexQueue.size();
+	int nq = texQueue.size() + decodedTexQueue.size();
 	bool active = nq;
 
-	if(!active)
+	if(!active) {
+		for (auto& dec : bgDecodeThreads) active = active || dec->isActive();
 		for (auto& tfr : bgTransferThreads) active = active || tfr->isActive();
+	}
 
 	Printf(TEXTCOLOR_GREEN"VulkanFrameBuffer[%s]: Flushing [%d + %d + %d] texture load ops\n", active ? "active" : "inactive", nq, patchQueue.size(), nq + patchQueue.size());
 	Printf(TEXTCOLOR_GREEN"\tFlushing %d - %d Model Reads\n", modelInQueue.size(), modelOutQueue.size());
@@ -512,7 +580,9 @@ void VulkanRenderDevice::FlushBackground() {
 
 		UpdateBackgroundCache(true);
 
-		active = false;
+		active = texQueue.size() > 0 || decodedTexQueue.size() > 0;
+		for (auto& dec : bgDecodeThreads)
+			active = active || dec->isActive();
 		for (auto& tfr : bgTransferThreads) 
 			active = active || tfr->isActive();
 		active = active || modelThread->isActive();
@@ -732,7 +802,7 @@ void VulkanRenderDevice::UploadLoadedTextures(bool flush) {
 	for (auto& loaded : bgtUploads) {
 		if (!flush && bytesUploaded > 20971520) break;	// Limit to ~20mb per call unless flushing
 
-		bool gpuOnly = loaded.imgSource->IsGPUOnly();
+		bool gpuOnly = loaded.compressed;
 		VkFormat fmt = gpuOnly ? VK_FORMAT_BC7_UNORM_BLOCK : VK_FORMAT_B8G8R8A8_UNORM;
 
 		assert(loaded.pixels);
@@ -829,14 +899,25 @@ VulkanRenderDevice::~VulkanRenderDevice()
 
 void VulkanRenderDevice::StopBackgroundCache() {
 	FlushBackground();
-	primaryTexQueue.clear();
-	secondaryTexQueue.clear();
+	texQueue.clear();
 	modelInQueue.clear();
 
+	// Stop the decoders first so nothing new lands in the decoded queue
+	for (auto& dec : bgDecodeThreads) {
+		dec->stop();
+	}
+
 	for (auto& tfr : bgTransferThreads) {
 		tfr->stop();
 	}
 
+	TexTranscodeCache.Shutdown();
+
+	VkTexLoadOut decoded;
+	while (decodedTexQueue.dequeue(decoded)) {
+		if (decoded.pixels) free(decoded.pixels);
+	}
+
 	modelThread->stop();
 
 	modelOutQueue.clear();
@@ -862,6 +943,7 @@ void VulkanRenderDevice::InitializeState()
 	}
 
 	hwcaps = RFL_SHADER_STORAGE_BUFFER | RFL_BUFFER_STORAGE;
+	if (device->EnabledFeatures.Features.textureCompressionBC) hwcaps |= RFL_TEXTURE_COMPRESSION_BPTC;
 	glslversion = 4.50f;
 	uniformblockalignment = (unsigned int)device->PhysicalDevice.Properties.Properties.limits.minUniformBufferOffsetAlignment;
 	maxuniformblock = device->PhysicalDevice.Properties.Properties.limits.maxUniformBufferRange;
@@ -899,10 +981,20 @@ void VulkanRenderDevice::InitializeState()
 
 	// @Cockatrice - Init the background loader
 	bgTransferThreads.clear();
+	bgDecodeThreads.clear();
 	if (gl_texture_thread && vk_max_transfer_threads >= 0) {
 		int numThreads = 1;
 
 		bgTransferEnabled = true;
+		TexTranscodeCache.Init(hwcaps & RFL_TEXTURE_COMPRESSION_BPTC);
+
+		// Decoding is CPU only, so it gets its own pool that feeds the upload threads
+		int numDecodeThreads = ResourceWorkerThreadCount(gl_texture_decode_threads);
+		for (int x = 0; x < numDecodeThreads; x++) {
+			std::unique_ptr<VkTexDecodeThread> ptr(new VkTexDecodeThread(&texQueue, &decodedTexQueue));
+			ptr->start();
+			bgDecodeThreads.push_back(std::move(ptr));
+		}
 
 		if (device->uploadQueues.size() > 0 && gl_texture_thread_upload) {
 			// Init upload queues with GPU upload enabled in the thread
@@ -911,7 +1003,7 @@ void VulkanRenderDevice::InitializeState()
 
 			for (int q = 0; q < numThreads; q++) {
 				std::unique_ptr<VkCommandBufferManager> cmds(new VkCommandBufferManager(this, &device->uploadQueues[q].queue, device->uploadQueues[q].queueFamily, true));
-				std::unique_ptr<VkTexLoadThread> ptr(new VkTexLoadThread(cmds.get(), device.get(), q, &primaryTexQueue, &secondaryTexQueue, &outputTexQueue));
+				std::unique_ptr<VkTexLoadThread> ptr(new VkTexLoadThread(cmds.get(), device.get(), q, &decodedTexQueue, &outputTexQueue));
 				ptr->start();
 				mBGTransferCommands.push_back(std::move(cmds));
 				bgTransferThreads.push_back(std::move(ptr));
@@ -922,7 +1014,7 @@ void VulkanRenderDevice::InitializeState()
 			bgUploadEnabled = false;
 
 			for (int x = 0; x < numThreads; x++) {
-				std::unique_ptr<VkTexLoadThread> ptr(new VkTexLoadThread(nullptr, device.get(), -1, &primaryTexQueue, &secondaryTexQueue, &outputTexQueue));
+				std::unique_ptr<VkTexLoadThread> ptr(new VkTexLoadThread(nullptr, device.get(), -1, &decodedTexQueue, &outputTexQueue));
 				ptr->start();
 				bgTransferThreads.push_back(std::move(ptr));
 			}
@@ -1049,7 +1141,7 @@ bool VulkanRenderDevice::BackgroundLoadModel(FModel* model) {
 	VkModelLoadIn modelLoad;
 	modelLoad.model = model;
 	modelLoad.lump = model->GetLumpNum();
-	modelInQueue.queue(modelLoad);
+	modelInQueue.queue(model, modelLoad);
 
 	return true;
 }
@@ -1102,13 +1194,8 @@ bool VulkanRenderDevice::BackgroundCacheMaterial(FMaterial *mat, FTranslationID
 
 	// If the texture is already submitted to the cache, find it and move it to the normal queue to reprioritize it
 	if (lumpExists && !secondary && systex->GetState() == IHardwareTexture::HardwareState::CACHING) {
-		// Move from secondary queue to primary
-		VkTexLoadIn in;
-		if (secondaryTexQueue.dequeueSearch(in, systex,
-			[](void* a, VkTexLoadIn& b)
-		{ return (VkHardwareTexture*)a == b.tex; })) {
+		if (texQueue.reprioritize(systex, QUEUE_Visible) || decodedTexQueue.reprioritize(systex, QUEUE_Visible)) {
 			systex->SetHardwareState(IHardwareTexture::HardwareState::LOADING, 0);
-			primaryTexQueue.queue(in);
 			return true;
 		}
 	} else if (lumpExists && systex->GetState() == IHardwareTexture::HardwareState::NONE) {
@@ -1127,17 +1214,20 @@ bool VulkanRenderDevice::BackgroundCacheMaterial(FMaterial *mat, FTranslationID
 			spi.notrimming = mat->sourcetex->GetNoTrimming();
 			spi.shouldExpand = shouldExpand;
 
+			int8_t layerFlags = flags;
+			if (TexTranscodeCache.CanTranscode(layer->layerTexture->GetImage(), translation.index(), shouldExpand, spi.generateSpi))
+				layerFlags |= TEXLOAD_TRANSCODE;
+
 			VkTexLoadIn in = {
 				layer->layerTexture->GetImage(),
 				params,
 				spi,
 				systex,
 				mat->sourcetex,
-				flags
+				layerFlags
 			};
 
-			if (secondary) secondaryTexQueue.queue(in);
-			else primaryTexQueue.queue(in);
+			texQueue.queue(in.tex, in, secondary ? QUEUE_Precache : QUEUE_Visible);
 		}
 		else {
 			systex->SetHardwareState(IHardwareTexture::HardwareState::READY); // TODO: Set state to a special "unloadable" state
@@ -1157,13 +1247,8 @@ bool VulkanRenderDevice::BackgroundCacheMaterial(FMaterial *mat, FTranslationID
 		if (lump == 0) 
 			continue;
 		if (lumpExists && syslayer->GetState() == IHardwareTexture::HardwareState::CACHING) {
-			// Move from secondary queue to primary
-			VkTexLoadIn in;
-			if (secondaryTexQueue.dequeueSearch(in, syslayer,
-				[](void* a, VkTexLoadIn& b)
-			{ return (VkHardwareTexture*)a == b.tex; })) {
+			if (texQueue.reprioritize(syslayer, QUEUE_Visible) || decodedTexQueue.reprioritize(syslayer, QUEUE_Visible)) {
 				syslayer->SetHardwareState(IHardwareTexture::HardwareState::LOADING, 0);
-				primaryTexQueue.queue(in);
 				return true;
 			}
 		} else if (lumpExists && syslayer->GetState() == IHardwareTexture::HardwareState::NONE) {
@@ -1177,6 +1262,10 @@ bool VulkanRenderDevice::BackgroundCacheMaterial(FMaterial *mat, FTranslationID
 			);
 			
 			if (params) {
+				int8_t layerFlags = flags;
+				if (TexTranscodeCache.CanTranscode(layer->layerTexture->GetImage(), 0, shouldExpand, false))
+					layerFlags |= TEXLOAD_TRANSCODE;
+
 				VkTexLoadIn in = {
 					layer->layerTexture->GetImage(),
 					params,
@@ -1185,11 +1274,10 @@ bool VulkanRenderDevice::BackgroundCacheMaterial(FMaterial *mat, FTranslationID
 					},
 					syslayer,
 					nullptr,
-					flags
+					layerFlags
 				};
 
-				if (secondary) secondaryTexQueue.queue(in);
-				else primaryTexQueue.queue(in);
+				texQueue.queue(in.tex, in, secondary ? QUEUE_Precache : QUEUE_Visible);
 			}
 			else {
 				syslayer->SetHardwareState(IHardwareTexture::HardwareState::READY); // TODO: Set state to a special "unloadable" state
@@ -1198,8 +1286,8 @@ bool VulkanRenderDevice::BackgroundCacheMaterial(FMaterial *mat, FTranslationID
 		}
 	}
 
-	statMaxQueued = max(statMaxQueued, primaryTexQueue.size());
-	statMaxQueuedSecondary = max(statMaxQueuedSecondary, secondaryTexQueue.size());
+	statMaxQueued = max(statMaxQueued, texQueue.size(QUEUE_Visible));
+	statMaxQueuedSecondary = max(statMaxQueuedSecondary, texQueue.size(QUEUE_Precache));
 
 	return true;
 }
@@ -39,7 +39,8 @@ struct VkTexLoadSpi {
 
 enum VkTexLoadInFlags {
 	TEXLOAD_ALLOWMIPS		= 1,
-	TEXLOAD_ALLOWQUALITY	= 1 << 1
+	TEXLOAD_ALLOWQUALITY	= 1 << 1,
+	TEXLOAD_TRANSCODE		= 1 << 2	// Image may be read from or added to the transcode cache
 };
 
 struct VkTexLoadIn {
@@ -58,6 +59,8 @@ struct VkTexLoadOut {
 	VkTexLoadSpiFull spi;
 	int conversion, translation;
 	bool isTranslucent, createMipmaps;
+	bool compressed;						// pixels holds GPU only data read as is
+	int mipLevels;							// Mip levels contained in compressed data
 	FImageSource *imgSource;
 	VulkanSemaphore *releaseSemaphore;		// Only used to release the resource when we have to transfer ownership (IE: Not using a graphics queue for upload)
 	unsigned char* pixels = nullptr;		// Returned when we can't upload in the backghround thread
@@ -78,11 +81,28 @@ struct VkModelLoadOut {
 };
 
 
+// Reads and decodes texture data on the CPU, then hands it to the upload threads
+// Several of these run at once, the input keeps its priority in the decoded queue
+class VkTexDecodeThread : public ResourceLoader2<VkTexLoadIn, VkTexLoadOut> {
+public:
+	VkTexDecodeThread(TSResourceQueue<VkTexLoadIn>* inQueue, TSResourceQueue<VkTexLoadOut>* decodedQueue) : ResourceLoader2(inQueue, nullptr) {
+		mDecodedQ = decodedQueue;
+	}
+
+protected:
+	TSResourceQueue<VkTexLoadOut>* mDecodedQ;
+
+	bool loadResource(VkTexLoadIn& input, VkTexLoadOut& output) override;
+	void submitOutput(VkTexLoadOut& output) override { mDecodedQ->queue(output.tex, output, mLoadPriority); }
+	bool canLoad() override;
+	const char *threadName() const override { return "Vulkan texture decoder"; }
+};
+
+
 // @Cockatrice - Background loader thread to handle transfer of texture data
-// TODO: Move the queue outside of the object and have each thread pull from a central queue
-class VkTexLoadThread : public ResourceLoader2<VkTexLoadIn, VkTexLoadOut> {
+class VkTexLoadThread : public ResourceLoader2<VkTexLoadOut, VkTexLoadOut> {
 public:
-	VkTexLoadThread(VkCommandBufferManager* bgCmd, VulkanDevice* device, int uploadQueueIndex, TSQueue<VkTexLoadIn>* inQueue, TSQueue<VkTexLoadIn>* secondaryQueue, TSQueue<VkTexLoadOut>* outQueue) : ResourceLoader2(inQueue, secondaryQueue, outQueue) {
+	VkTexLoadThread(VkCommandBufferManager* bgCmd, VulkanDevice* device, int uploadQueueIndex, TSResourceQueue<VkTexLoadOut>* inQueue, TSQueue<VkTexLoadOut>* outQueue) : ResourceLoader2(inQueue, outQueue) {
 		cmd = bgCmd;
 		submits = 0;
 		if (uploadQueueIndex >= 0) uploadQueue = device->uploadQueues[uploadQueueIndex];
@@ -118,15 +138,16 @@ protected:
 	std::atomic<int> currentImageID;
 	std::atomic<int> maxQueue;
 
-	bool loadResource(VkTexLoadIn &input, VkTexLoadOut &output) override;
+	bool loadResource(VkTexLoadOut &input, VkTexLoadOut &output) override;
 	void cancelLoad() override;
 	void completeLoad() override;
+	const char *threadName() const override { return "Vulkan texture loader"; }
 };
 
 
 class VkModelLoadThread : public ResourceLoader2<VkModelLoadIn, VkModelLoadOut> {
 public:
-	VkModelLoadThread(TSQueue<VkModelLoadIn>* inQueue, TSQueue<VkModelLoadOut>* outQueue) : ResourceLoader2(inQueue, nullptr, outQueue) {
+	VkModelLoadThread(TSResourceQueue<VkModelLoadIn>* inQueue, TSQueue<VkModelLoadOut>* outQueue) : ResourceLoader2(inQueue, outQueue) {
 		
 	}
 
@@ -134,6 +155,7 @@ protected:
 	std::atomic<int> maxQueue;
 
 	bool loadResource(VkModelLoadIn& input, VkModelLoadOut& output) override;
+	const char *threadName() const override { return "Vulkan model loader"; }
 };
 
 
@@ -227,6 +249,7 @@ public:
 	void GetBGStats2(double& min, double& max, double& avg);
 	void ResetBGStats();
 	int GetNumThreads() { return (int)bgTransferThreads.size(); }
+	void GetDecodeStats(int& threads, int& queued, int& total, double& avg, double& max);
 
 private:
 	void RenderTextureView(FCanvasTexture* tex, std::function<void(IntRect &)> renderFunc) override;
@@ -245,13 +268,15 @@ private:
 	// BG Thread management
 	// TODO: Move these into their own manager object
 	int statMaxQueued = 0, statMaxQueuedSecondary = 0, statCollisions = 0, statModelsLoaded = 0;
-	TSQueue<VkTexLoadIn> primaryTexQueue, secondaryTexQueue;
+	TSResourceQueue<VkTexLoadIn> texQueue;									// Keyed by hardware texture, precaching goes in at QUEUE_Precache
+	TSResourceQueue<VkTexLoadOut> decodedTexQueue;								// Decoded textures waiting for upload
 	TSQueue<VkTexLoadOut> outputTexQueue;
 	TSQueue<QueuedPatch> patchQueue;									// @Cockatrice - Queue of textures to create materials for and submit to the bg thread
-	TSQueue<VkModelLoadIn> modelInQueue;
+	TSResourceQueue<VkModelLoadIn> modelInQueue;
 	TSQueue<VkModelLoadOut> modelOutQueue;
 	std::unique_ptr<VkModelLoadThread> modelThread;						// Loads models, always 1 thread
 	std::vector<std::unique_ptr<VkTexLoadThread>> bgTransferThreads;	// @Cockatrice - Threads that handle the background transfers
+	std::vector<std::unique_ptr<VkTexDecodeThread>> bgDecodeThreads;	// CPU side of the background transfers
 	std::unique_ptr<VulkanFence> bgtFence;								// @Cockatrice - Used to block for tranferring resources between queues
 	std::vector<std::unique_ptr<VulkanSemaphore>> bgtSm4List;			// Semaphores to release after queue resource transfers
 	std::unique_ptr<VulkanCommandBuffer> bgtCmds;
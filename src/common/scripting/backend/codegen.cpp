@@ -7469,6 +7469,36 @@ FxExpression *FxCVar::Resolve(FCompileContext &ctx)
 	return this;
 }
 
+const void *FxCVar::ValueAddress(FBaseCVar *cvar, size_t &size)
+{
+	switch (cvar->GetRealType())
+	{
+	case CVAR_Int:
+		size = sizeof(int);
+		return &static_cast<FIntCVar *>(cvar)->Value;
+
+	case CVAR_Color:
+		size = sizeof(uint32_t);
+		return &static_cast<FColorCVar *>(cvar)->Value;
+
+	case CVAR_Float:
+		size = sizeof(float);
+		return &static_cast<FFloatCVar *>(cvar)->Value;
+
+	case CVAR_Bool:
+		size = sizeof(bool);
+		return &static_cast<FBoolCVar *>(cvar)->Value;
+
+	case CVAR_String:
+		size = sizeof(FString);
+		return &static_cast<FStringCVar *>(cvar)->mValue;
+
+	default:
+		size = 0;
+		return nullptr;
+	}
+}
+
 ExpEmit FxCVar::Emit(VMFunctionBuilder *build)
 {
 	ExpEmit dest(build, CVar->GetRealType() == CVAR_String ? REGT_STRING : ValueType->GetRegType());
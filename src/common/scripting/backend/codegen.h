@@ -1479,6 +1479,9 @@ public:
 	FxCVar(FBaseCVar*, const FScriptPosition&);
 	FxExpression *Resolve(FCompileContext&);
 	ExpEmit Emit(VMFunctionBuilder *build);
+
+	// The memory Emit reads the value from, nullptr for CVars that combine another CVar's value
+	static const void *ValueAddress(FBaseCVar *cvar, size_t &size);
 };
 
 
@@ -0,0 +1,975 @@
+/*
+** scriptcache.cpp
+** Keeps the compiled bytecode of all script functions in the cache directory
+**
+**---------------------------------------------------------------------------
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see http://www.gnu.org/licenses/
+**
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <stdio.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+#include <algorithm>
+#include "printf.h"
+#include "files.h"
+#include "filesystem.h"
+#include "cmdlib.h"
+#include "i_specialpaths.h"
+#include "c_cvars.h"
+#include "md5.h"
+#include "fs_findfile.h"
+#include "version.h"
+#include "texturemanager.h"
+#include "vmbuilder.h"
+#include "codegen.h"
+#include "scriptcache.h"
+
+EXTERN_CVAR(Bool, vm_optimize)
+EXTERN_CVAR(Bool, vm_inline)
+EXTERN_CVAR(Int, vm_inline_size)
+
+CVARD(Bool, vm_script_cache, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG, "keeps compiled script code in the cache directory, so that later starts can skip the code generator")
+
+FScriptCache ScriptCache;
+
+static const char CacheMagic[4] = { 'Z', 'S', 'C', 'C' };
+static const uint32_t CacheVersion = 1;		// Bump when the file layout changes
+
+enum ERefKind : uint8_t
+{
+	REF_Null,
+	REF_Int,			// Field offsets are emitted as address constants
+	REF_Function,
+	REF_Class,
+	REF_Type,
+	REF_Range,
+	REF_VarargInfo,
+};
+
+enum ECachedType : uint8_t
+{
+	CT_Named,
+	CT_Class,
+	CT_Pointer,
+	CT_ClassPointer,
+	CT_Array,
+	CT_StaticArray,
+	CT_DynArray,
+	CT_Map,
+	CT_MapIterator,
+	CT_Prototype,
+};
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+class FScriptCache::Writer
+{
+public:
+	TArray<uint8_t> Data;
+
+	void Bytes(const void *src, size_t size)
+	{
+		if (size > 0) memcpy(&Data[Data.Reserve((unsigned)size)], src, size);
+	}
+	void U8(uint8_t v) { Bytes(&v, 1); }
+	void U32(uint32_t v) { Bytes(&v, 4); }
+	void U64(uint64_t v) { Bytes(&v, 8); }
+	void String(const char *str)
+	{
+		size_t len = str ? strlen(str) : 0;
+		U32((uint32_t)len);
+		Bytes(str, len);
+	}
+	void Append(const Writer &other) { Bytes(other.Data.Data(), other.Data.Size()); }
+};
+
+class FScriptCache::Reader
+{
+	const uint8_t *Pos, *End;
+
+public:
+	bool Ok = true;
+
+	Reader(const void *data, size_t size) : Pos((const uint8_t *)data), End((const uint8_t *)data + size) {}
+
+	bool Bytes(void *dest, size_t size)
+	{
+		if (!Ok || size > size_t(End - Pos)) return Ok = false;
+		if (size > 0) memcpy(dest, Pos, size);
+		Pos += size;
+		return true;
+	}
+	uint8_t U8() { uint8_t v = 0; Bytes(&v, 1); return v; }
+	uint32_t U32() { uint32_t v = 0; Bytes(&v, 4); return v; }
+	uint64_t U64() { uint64_t v = 0; Bytes(&v, 8); return v; }
+	FString String()
+	{
+		uint32_t len = U32();
+		if (!Ok || len > size_t(End - Pos)) { Ok = false; return FString(); }
+		FString str((const char *)Pos, len);
+		Pos += len;
+		return str;
+	}
+	// Guards array sizes read from the file before they get allocated
+	bool Fits(uint32_t count, size_t elementSize) { return Ok && count <= size_t(End - Pos) / elementSize; }
+	bool AtEnd() const { return Pos == End; }
+};
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void FScriptCache::AddSource(int lump)
+{
+	if (lump >= 0) mSources.Push(lump);
+}
+
+void FScriptCache::AddAddressRange(const FString &name, const void *start, size_t size)
+{
+	if (start != nullptr && size > 0) mRanges.Push({ name, (const uint8_t *)start, size });
+}
+
+//==========================================================================
+//
+// Static fields and CVars are the native memory every build can point
+// at. Game specific ranges have been added by the caller.
+//
+//==========================================================================
+
+void FScriptCache::CollectRanges()
+{
+	auto addFields = [&](PSymbolTable &symbols, const char *owner)
+	{
+		auto it = symbols.GetIterator();
+		PSymbolTable::MapType::Pair *pair;
+		while (it.NextPair(pair))
+		{
+			auto field = dyn_cast<PField>(pair->Value);
+			if (field == nullptr || (field->Flags & (VARF_Static | VARF_Meta)) != VARF_Static) continue;
+			AddAddressRange(FStringf("field:%s.%s", owner, field->SymbolName.GetChars()), (const void *)field->Offset, max(field->Type->Size, 1u));
+		}
+	};
+
+	for (auto ns : Namespaces.AllNamespaces)
+	{
+		addFields(ns->Symbols, "");
+	}
+	for (size_t i = 0; i < countof(TypeTable.TypeHash); ++i)
+	{
+		for (PType *ty = TypeTable.TypeHash[i]; ty != nullptr; ty = ty->HashNext)
+		{
+			if (ty->isContainer()) addFields(ty->Symbols, ty->DescriptiveName());
+		}
+	}
+
+	decltype(cvarMap)::Iterator it(cvarMap);
+	decltype(cvarMap)::Pair *pair;
+	while (it.NextPair(pair))
+	{
+		size_t size;
+		auto addr = FxCVar::ValueAddress(pair->Value, size);
+		if (addr != nullptr) AddAddressRange(FStringf("cvar:%s", pair->Value->GetName()), addr, size);
+	}
+
+	// The texture index bounds check reads the texture count directly
+	auto textures = (FArray *)&TexMan.Textures;
+	AddAddressRange("TexMan.Textures.Count", &textures->Count, sizeof(textures->Count));
+
+	std::sort(mRanges.begin(), mRanges.end(), [](const Range &a, const Range &b) { return a.Start < b.Start; });
+
+	for (unsigned i = 0; i < mRanges.Size(); i++)
+	{
+		auto found = mRangeNames.CheckKey(mRanges[i].Name);
+		mRangeNames[mRanges[i].Name] = found ? -1 : (int)i;
+	}
+}
+
+//==========================================================================
+//
+// Types that can't be described by how they are made are looked up by
+// their name. Only those that already exist before the code generator runs
+// can be, as a later start needs to find them before it would run.
+//
+//==========================================================================
+
+void FScriptCache::CollectTypes()
+{
+	for (size_t i = 0; i < countof(TypeTable.TypeHash); ++i)
+	{
+		for (PType *ty = TypeTable.TypeHash[i]; ty != nullptr; ty = ty->HashNext)
+		{
+			FString key = FStringf("%s/%s", ty->TypeTableType.GetChars(), ty->DescriptiveName());
+			auto found = mNamedTypes.CheckKey(key);
+			mNamedTypes[key] = found ? nullptr : ty;
+		}
+	}
+
+	TMap<FString, PType *>::Iterator it(mNamedTypes);
+	TMap<FString, PType *>::Pair *pair;
+	while (it.NextPair(pair))
+	{
+		if (pair->Value != nullptr) mTypeNames[pair->Value] = pair->Key;
+	}
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+bool FScriptCache::BeginBuild()
+{
+	mActive = false;
+	if (!vm_script_cache || mSources.Size() == 0) return false;
+
+	MD5Context md5;
+	auto add = [&](const void *data, size_t size) { md5.Update((const uint8_t *)data, (unsigned)size); };
+	auto addString = [&](const char *str) { add(str, strlen(str) + 1); };
+
+	addString(GetVersionString());
+	addString(GetGitHash());
+	addString(GetGitTime());
+	uint32_t pointerSize = sizeof(void *);
+	add(&pointerSize, sizeof(pointerSize));
+	bool optimize = vm_optimize;
+	add(&optimize, sizeof(optimize));
+	int inlineSize = vm_inline ? *vm_inline_size : 0;
+	add(&inlineSize, sizeof(inlineSize));
+
+	// The script lumps themselves, in the order they were parsed
+	for (int lump : mSources)
+	{
+		addString(fileSystem.GetFileFullName(lump, false));
+		auto data = fileSystem.ReadFile(lump);
+		add(data.data(), data.size());
+	}
+
+	// Other definitions end up in the code as well. Any change to the set of files invalidates the cache,
+	// and the contents count for the lumps the code generator folds into constants: sound indices,
+	// custom translations and color names.
+	static const char *const foldedLumps[] = { "SNDINFO", "TRNSLATE", "X11R6RGB" };
+	for (int i = 0; i < fileSystem.GetNumEntries(); i++)
+	{
+		addString(fileSystem.GetFileFullName(i, false));
+		uint64_t size = fileSystem.FileLength(i);
+		add(&size, sizeof(size));
+
+		for (auto name : foldedLumps)
+		{
+			if (stricmp(fileSystem.GetFileShortName(i), name) != 0) continue;
+			auto data = fileSystem.ReadFile(i);
+			add(data.data(), data.size());
+			break;
+		}
+	}
+	md5.Final(mKey);
+
+	// The bytecode contains name indices, so the name table must be the same up to here.
+	// The names the code generator creates are stored in the cache and recreated in order.
+	MD5Context names;
+	mNumNames = FName::GetNumNames();
+	for (int i = 0; i < mNumNames; i++)
+	{
+		const char *name = FName(ENamedName(i)).GetChars();
+		names.Update((const uint8_t *)name, (unsigned)strlen(name) + 1);
+	}
+	names.Final(mNamesDigest);
+
+	mNumFunctions = VMFunction::AllFunctions.Size();
+
+	CollectRanges();
+	CollectTypes();
+	mActive = true;
+	return true;
+}
+
+void FScriptCache::EndBuild()
+{
+	mSources.Clear();
+	mRanges.Clear();
+	mRangeNames.Clear();
+	mNamedTypes.Clear();
+	mTypeNames.Clear();
+	mActive = false;
+}
+
+FString FScriptCache::CacheDirectory()
+{
+	FString path = M_GetCachePath(true);
+	path << "/scriptcache/";
+	CreatePath(path.GetChars());
+	return path;
+}
+
+FString FScriptCache::CacheFileName()
+{
+	FString path = CacheDirectory();
+	for (auto b : mKey) path.AppendFormat("%02x", b);
+	path << ".bin";
+	return path;
+}
+
+//==========================================================================
+//
+// Every change to the engine, the loaded files or the compile options gets
+// a new cache file, so only the few most recently used ones are kept. Loads
+// touch their file so that switching between a few mods keeps all of them.
+//
+//==========================================================================
+
+enum { MAX_CACHE_FILES = 4 };
+
+void FScriptCache::RemoveOldFiles()
+{
+	struct CacheFile
+	{
+		std::string Path;
+		time_t Time;
+	};
+	TArray<CacheFile> files;
+
+	FileSys::FileList list;
+	FileSys::ScanDirectory(list, CacheDirectory().GetChars(), "*.bin", true);
+	for (auto &entry : list)
+	{
+		if (entry.isDirectory) continue;
+
+		CacheFile file = { entry.FilePath, 0 };
+		size_t size;
+		GetFileInfo(file.Path.c_str(), &size, &file.Time);
+		files.Push(file);
+	}
+	if (files.Size() <= MAX_CACHE_FILES) return;
+
+	// Newest first, which includes the file that was just saved
+	std::sort(files.begin(), files.end(), [](const CacheFile &a, const CacheFile &b) { return a.Time > b.Time; });
+	for (unsigned i = MAX_CACHE_FILES; i < files.Size(); i++)
+	{
+		remove(files[i].Path.c_str());
+	}
+}
+
+//==========================================================================
+//
+// Types are described by the factory that makes them, so that types the
+// code generator created get created again.
+//
+//==========================================================================
+
+bool FScriptCache::WriteType(Writer &w, PType *type, int depth)
+{
+	if (type == nullptr || depth > 16) return false;
+
+	Writer desc;
+	bool ok = true;
+	if (type->isClass())
+	{
+		desc.U8(CT_Class);
+		desc.String(static_cast<PClassType *>(type)->Descriptor->TypeName.GetChars());
+	}
+	else if (type->isFunctionPointer())
+	{
+		ok = false;
+	}
+	else if (type->isClassPointer())
+	{
+		auto cls = static_cast<PClassPointer *>(type)->ClassRestriction;
+		desc.U8(CT_ClassPointer);
+		desc.String(cls ? cls->TypeName.GetChars() : nullptr);
+		ok = cls != nullptr;
+	}
+	else if (type->isPointer())
+	{
+		auto ptr = static_cast<PPointer *>(type);
+		desc.U8(CT_Pointer);
+		ok = WriteType(desc, ptr->PointedType, depth + 1);
+		desc.U8(ptr->IsConst);
+	}
+	else if (type->isStaticArray())
+	{
+		desc.U8(CT_StaticArray);
+		ok = WriteType(desc, static_cast<PStaticArray *>(type)->ElementType, depth + 1);
+	}
+	else if (type->isArray())
+	{
+		auto arr = static_cast<PArray *>(type);
+		desc.U8(CT_Array);
+		ok = WriteType(desc, arr->ElementType, depth + 1);
+		desc.U32(arr->ElementCount);
+	}
+	else if (type->isDynArray())
+	{
+		desc.U8(CT_DynArray);
+		ok = WriteType(desc, static_cast<PDynArray *>(type)->ElementType, depth + 1);
+	}
+	else if (type->isMap())
+	{
+		auto map = static_cast<PMap *>(type);
+		desc.U8(CT_Map);
+		ok = WriteType(desc, map->KeyType, depth + 1) && WriteType(desc, map->ValueType, depth + 1);
+	}
+	else if (type->isMapIterator())
+	{
+		auto map = static_cast<PMapIterator *>(type);
+		desc.U8(CT_MapIterator);
+		ok = WriteType(desc, map->KeyType, depth + 1) && WriteType(desc, map->ValueType, depth + 1);
+	}
+	else if (type->isPrototype())
+	{
+		auto proto = static_cast<PPrototype *>(type);
+		desc.U8(CT_Prototype);
+		desc.U32(proto->ReturnTypes.Size());
+		for (auto t : proto->ReturnTypes) ok = ok && WriteType(desc, t, depth + 1);
+		desc.U32(proto->ArgumentTypes.Size());
+		for (auto t : proto->ArgumentTypes) ok = ok && WriteType(desc, t, depth + 1);
+	}
+	else ok = false;
+
+	// Only use the description if it leads back to this very type
+	if (ok)
+	{
+		Reader r(desc.Data.Data(), desc.Data.Size());
+		PType *check;
+		if (ReadType(r, check, depth) && r.AtEnd() && check == type)
+		{
+			w.Append(desc);
+			return true;
+		}
+	}
+
+	auto name = mTypeNames.CheckKey(type);
+	if (name == nullptr) return false;
+	w.U8(CT_Named);
+	w.String(name->GetChars());
+	return true;
+}
+
+bool FScriptCache::ReadType(Reader &r, PType *&type, int depth)
+{
+	type = nullptr;
+	if (depth > 16) return false;
+
+	PType *t1, *t2;
+	switch (r.U8())
+	{
+	case CT_Named:
+	{
+		auto found = mNamedTypes.CheckKey(r.String());
+		if (found != nullptr) type = *found;
+		break;
+	}
+
+	case CT_Class:
+	{
+		auto cls = PClass::FindClass(r.String());
+		if (cls != nullptr) type = cls->VMType;
+		break;
+	}
+
+	case CT_ClassPointer:
+	{
+		auto cls = PClass::FindClass(r.String());
+		if (cls != nullptr) type = NewClassPointer(cls);
+		break;
+	}
+
+	case CT_Pointer:
+		if (ReadType(r, t1, depth + 1))
+		{
+			bool isconst = r.U8() != 0;
+			if (r.Ok) type = NewPointer(t1, isconst);
+		}
+		break;
+
+	case CT_StaticArray:
+		if (ReadType(r, t1, depth + 1)) type = NewStaticArray(t1);
+		break;
+
+	case CT_Array:
+		if (ReadType(r, t1, depth + 1))
+		{
+			unsigned count = r.U32();
+			if (r.Ok) type = NewArray(t1, count);
+		}
+		break;
+
+	case CT_DynArray:
+		if (ReadType(r, t1, depth + 1)) type = NewDynArray(t1);
+		break;
+
+	case CT_Map:
+		if (ReadType(r, t1, depth + 1) && ReadType(r, t2, depth + 1)) type = NewMap(t1, t2);
+		break;
+
+	case CT_MapIterator:
+		if (ReadType(r, t1, depth + 1) && ReadType(r, t2, depth + 1)) type = NewMapIterator(t1, t2);
+		break;
+
+	case CT_Prototype:
+	{
+		TArray<PType *> rets, args;
+		uint32_t count = r.U32();
+		if (!r.Fits(count, 1)) break;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (!ReadType(r, t1, depth + 1)) return false;
+			rets.Push(t1);
+		}
+		count = r.U32();
+		if (!r.Fits(count, 1)) break;
+		for (uint32_t i = 0; i < count; i++)
+		{
+			if (!ReadType(r, t1, depth + 1)) return false;
+			args.Push(t1);
+		}
+		type = NewPrototype(rets, args);
+		break;
+	}
+
+	default:
+		break;
+	}
+	return r.Ok && type != nullptr;
+}
+
+//==========================================================================
+//
+// Address constants. What a pointer refers to is found by looking it up
+// in everything it can point at, and the reference is checked to resolve
+// back to the same address.
+//
+//==========================================================================
+
+bool FScriptCache::ReadRef(Reader &r, void *&ptr)
+{
+	ptr = nullptr;
+	switch (r.U8())
+	{
+	case REF_Null:
+		return r.Ok;
+
+	case REF_Int:
+		ptr = (void *)(uintptr_t)r.U64();
+		return r.Ok;
+
+	case REF_Function:
+	{
+		uint32_t index = r.U32();
+		FString name = r.String();
+		if (!r.Ok || index >= mNumFunctions) return false;
+		auto func = VMFunction::AllFunctions[index];
+		if (name.Compare(func->QualifiedName ? func->QualifiedName : "") != 0) return false;
+		ptr = func;
+		return true;
+	}
+
+	case REF_Class:
+		ptr = PClass::FindClass(r.String());
+		return r.Ok && ptr != nullptr;
+
+	case REF_Type:
+	{
+		PType *type;
+		if (!ReadType(r, type)) return false;
+		ptr = type;
+		return true;
+	}
+
+	case REF_Range:
+	{
+		FString name = r.String();
+		uint64_t offset = r.U64();
+		auto index = mRangeNames.CheckKey(name);
+		if (!r.Ok || index == nullptr || *index < 0 || offset >= mRanges[*index].Size) return false;
+		ptr = (void *)(mRanges[*index].Start + offset);
+		return true;
+	}
+
+	case REF_VarargInfo:
+	{
+		uint32_t count = r.U32();
+		if (!r.Fits(count, 1)) return false;
+		TArray<uint8_t> reginfo(count, true);
+		r.Bytes(reginfo.Data(), count);
+		ptr = (void *)GetVarargRegInfo(reginfo.Data(), count);
+		return r.Ok;
+	}
+
+	default:
+		return false;
+	}
+}
+
+bool FScriptCache::WriteRef(Writer &w, void *ptr)
+{
+	Writer ref;
+	TArray<uint8_t> reginfo;
+
+	if (ptr == nullptr)
+	{
+		ref.U8(REF_Null);
+	}
+	else if ((uintptr_t)ptr < 65536)
+	{
+		ref.U8(REF_Int);
+		ref.U64((uintptr_t)ptr);
+	}
+	else if (auto index = mFunctionIndex.CheckKey(ptr))
+	{
+		auto func = VMFunction::AllFunctions[*index];
+		ref.U8(REF_Function);
+		ref.U32(*index);
+		ref.String(func->QualifiedName);
+	}
+	else if (auto cls = mClasses.CheckKey(ptr))
+	{
+		ref.U8(REF_Class);
+		ref.String((*cls)->TypeName.GetChars());
+	}
+	else if (auto type = mTypes.CheckKey(ptr))
+	{
+		ref.U8(REF_Type);
+		if (!WriteType(ref, *type)) return false;
+	}
+	else if (FindVarargRegInfo(ptr, reginfo))
+	{
+		ref.U8(REF_VarargInfo);
+		ref.U32(reginfo.Size());
+		ref.Bytes(reginfo.Data(), reginfo.Size());
+	}
+	else
+	{
+		// The ranges may overlap (e.g. a struct and one of its members), look at a few of them
+		auto p = (const uint8_t *)ptr;
+		auto it = std::upper_bound(mRanges.begin(), mRanges.end(), p, [](const uint8_t *p, const Range &range) { return p < range.Start; });
+		const Range *found = nullptr;
+		for (int i = 0; i < 8 && it != mRanges.begin(); i++)
+		{
+			--it;
+			if (p < it->Start + it->Size)
+			{
+				auto index = mRangeNames.CheckKey(it->Name);
+				if (index != nullptr && *index >= 0)
+				{
+					found = &*it;
+					break;
+				}
+			}
+		}
+		if (found == nullptr) return false;
+		ref.U8(REF_Range);
+		ref.String(found->Name.GetChars());
+		ref.U64(uint64_t(p - found->Start));
+	}
+
+	Reader r(ref.Data.Data(), ref.Data.Size());
+	void *check;
+	if (!ReadRef(r, check) || !r.AtEnd() || check != ptr) return false;
+
+	w.Append(ref);
+	return true;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+struct FCachedFunction
+{
+	TArray<VMOP> Code;
+	TArray<FStatementInfo> LineInfo;
+	TArray<int> KonstD;
+	TArray<double> KonstF;
+	TArray<FString> KonstS;
+	TArray<void *> KonstA;
+	TArray<FTypeAndOffset> SpecialInits;
+	PPrototype *Proto = nullptr;
+	TArray<uint32_t> ArgFlags;
+	FString SourceFileName;
+	int ExtraSpace = 0;
+	uint8_t NumRegD = 0, NumRegF = 0, NumRegS = 0, NumRegA = 0;
+	uint16_t MaxParam = 0;
+	uint8_t NumArgs = 0;
+	bool Unsafe = false, BlockJit = false;
+};
+
+template<class T>
+static bool ReadArray(FScriptCache::Reader &r, TArray<T> &array, uint32_t maxCount = 65535)
+{
+	uint32_t count = r.U32();
+	if (count > maxCount || !r.Fits(count, sizeof(T))) return r.Ok = false;
+	array.Resize(count);
+	return r.Bytes(array.Data(), count * sizeof(T));
+}
+
+//==========================================================================
+//
+// Nothing is changed until the whole file has been read and every
+// reference in it was found.
+//
+//==========================================================================
+
+bool FScriptCache::Load(const TArray<FScriptCacheItem> &items)
+{
+	if (!mActive) return false;
+
+	FileReader fr;
+	if (!fr.OpenFile(CacheFileName().GetChars())) return false;
+	auto data = fr.Read();
+	Reader r(data.data(), data.size());
+
+	char magic[4];
+	uint8_t key[16], namesDigest[16];
+	if (!r.Bytes(magic, 4) || memcmp(magic, CacheMagic, 4) != 0 || r.U32() != CacheVersion) return false;
+	if (!r.Bytes(key, 16) || memcmp(key, mKey, 16) != 0) return false;
+
+	int numNames = (int)r.U32();
+	if (!r.Bytes(namesDigest, 16) || numNames != mNumNames || memcmp(namesDigest, mNamesDigest, 16) != 0 || r.U32() != mNumFunctions)
+	{
+		DPrintf(DMSG_NOTIFY, "Script cache is out of date\n");
+		return false;
+	}
+
+	// Recreate the names the code generator made, so that they get the same indices.
+	// These would have been created anyway, so a failure below leaves nothing broken.
+	uint32_t newNames = r.U32();
+	for (uint32_t i = 0; i < newNames && r.Ok; i++)
+	{
+		FName name(r.String());
+		if (name.GetIndex() != mNumNames + (int)i) return false;
+	}
+
+	uint32_t count = r.U32();
+	if (!r.Ok || count != items.Size()) return false;
+
+	TArray<FCachedFunction> functions(count, true);
+	for (uint32_t i = 0; i < count && r.Ok; i++)
+	{
+		auto &func = functions[i];
+		auto sfunc = items[i].Function;
+		if (r.String().Compare(sfunc->PrintableName) != 0) return false;
+
+		if (r.U8() != 0)
+		{
+			PType *proto;
+			if (!ReadType(r, proto) || !proto->isPrototype()) return false;
+			func.Proto = static_cast<PPrototype *>(proto);
+			ReadArray(r, func.ArgFlags);
+		}
+
+		ReadArray(r, func.Code);
+		ReadArray(r, func.LineInfo);
+		ReadArray(r, func.KonstD);
+		ReadArray(r, func.KonstF);
+
+		uint32_t numKonst = r.U32();
+		if (numKonst > 65535 || !r.Fits(numKonst, 4)) return false;
+		func.KonstS.Resize(numKonst);
+		for (auto &str : func.KonstS) str = r.String();
+
+		numKonst = r.U32();
+		if (numKonst > 65535 || !r.Fits(numKonst, 1)) return false;
+		func.KonstA.Resize(numKonst);
+		for (auto &ptr : func.KonstA)
+		{
+			if (!ReadRef(r, ptr)) return false;
+		}
+
+		uint32_t numInits = r.U32();
+		if (!r.Fits(numInits, 5)) return false;
+		for (uint32_t j = 0; j < numInits; j++)
+		{
+			PType *type;
+			if (!ReadType(r, type)) return false;
+			func.SpecialInits.Push({ type, r.U32() });
+		}
+
+		func.SourceFileName = r.String();
+		func.ExtraSpace = (int)r.U32();
+		func.NumRegD = r.U8();
+		func.NumRegF = r.U8();
+		func.NumRegS = r.U8();
+		func.NumRegA = r.U8();
+		func.MaxParam = (uint16_t)r.U32();
+		func.NumArgs = r.U8();
+		func.Unsafe = r.U8() != 0;
+		func.BlockJit = r.U8() != 0;
+
+		if (func.Code.Size() == 0 || (items[i].Anonymous && func.Proto == nullptr)) return false;
+	}
+	if (!r.Ok || !r.AtEnd()) return false;
+
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &func = functions[i];
+		auto sfunc = items[i].Function;
+
+		sfunc->Alloc(func.Code.Size(), func.KonstD.Size(), func.KonstF.Size(), func.KonstS.Size(), func.KonstA.Size(), func.LineInfo.Size());
+		memcpy(sfunc->Code, func.Code.Data(), func.Code.Size() * sizeof(VMOP));
+		if (func.LineInfo.Size() > 0) memcpy(sfunc->LineInfo, func.LineInfo.Data(), func.LineInfo.Size() * sizeof(FStatementInfo));
+		if (func.KonstD.Size() > 0) memcpy(sfunc->KonstD, func.KonstD.Data(), func.KonstD.Size() * sizeof(int));
+		if (func.KonstF.Size() > 0) memcpy(sfunc->KonstF, func.KonstF.Data(), func.KonstF.Size() * sizeof(double));
+		for (unsigned j = 0; j < func.KonstS.Size(); j++) sfunc->KonstS[j] = func.KonstS[j];
+		for (unsigned j = 0; j < func.KonstA.Size(); j++) sfunc->KonstA[j].v = func.KonstA[j];
+
+		if (func.Proto != nullptr)
+		{
+			sfunc->Proto = func.Proto;
+			sfunc->ArgFlags = std::move(func.ArgFlags);
+		}
+		sfunc->SpecialInits = std::move(func.SpecialInits);
+		sfunc->SourceFileName = func.SourceFileName;
+		sfunc->ExtraSpace = func.ExtraSpace;
+		sfunc->NumRegD = func.NumRegD;
+		sfunc->NumRegF = func.NumRegF;
+		sfunc->NumRegS = func.NumRegS;
+		sfunc->NumRegA = func.NumRegA;
+		sfunc->MaxParam = func.MaxParam;
+		sfunc->NumArgs = func.NumArgs;
+		sfunc->Unsafe = func.Unsafe;
+		sfunc->blockJit = func.BlockJit;
+		sfunc->StackSize = VMFrame::FrameSize(sfunc->NumRegD, sfunc->NumRegF, sfunc->NumRegS, sfunc->NumRegA, sfunc->MaxParam, sfunc->ExtraSpace);
+	}
+
+#ifdef _WIN32
+	_wutime(CacheFileName().WideString().c_str(), nullptr);
+#else
+	utime(CacheFileName().GetChars(), nullptr);
+#endif
+	DPrintf(DMSG_NOTIFY, "Loaded %u script functions from the cache\n", count);
+	return true;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void FScriptCache::Save(const TArray<FScriptCacheItem> &items)
+{
+	if (!mActive) return;
+
+	for (unsigned i = 0; i < mNumFunctions; i++) mFunctionIndex[VMFunction::AllFunctions[i]] = i;
+	for (auto cls : PClass::AllClasses) mClasses[cls] = cls;
+	for (size_t i = 0; i < countof(TypeTable.TypeHash); ++i)
+	{
+		for (PType *ty = TypeTable.TypeHash[i]; ty != nullptr; ty = ty->HashNext) mTypes[ty] = ty;
+	}
+
+	Writer w;
+	w.Bytes(CacheMagic, 4);
+	w.U32(CacheVersion);
+	w.Bytes(mKey, 16);
+	w.U32(mNumNames);
+	w.Bytes(mNamesDigest, 16);
+	w.U32(mNumFunctions);
+
+	int numNames = FName::GetNumNames();
+	w.U32(numNames - mNumNames);
+	for (int i = mNumNames; i < numNames; i++) w.String(FName(ENamedName(i)).GetChars());
+
+	w.U32(items.Size());
+	for (auto &item : items)
+	{
+		auto sfunc = item.Function;
+		bool ok = true;
+
+		w.String(sfunc->PrintableName);
+		w.U8(item.Anonymous);
+		if (item.Anonymous)
+		{
+			ok = WriteType(w, sfunc->Proto);
+			w.U32(sfunc->ArgFlags.Size());
+			w.Bytes(sfunc->ArgFlags.Data(), sfunc->ArgFlags.Size() * sizeof(uint32_t));
+		}
+
+		w.U32(sfunc->CodeSize);
+		w.Bytes(sfunc->Code, sfunc->CodeSize * sizeof(VMOP));
+		w.U32(sfunc->LineInfoCount);
+		w.Bytes(sfunc->LineInfo, sfunc->LineInfoCount * sizeof(FStatementInfo));
+		w.U32(sfunc->NumKonstD);
+		w.Bytes(sfunc->KonstD, sfunc->NumKonstD * sizeof(int));
+		w.U32(sfunc->NumKonstF);
+		w.Bytes(sfunc->KonstF, sfunc->NumKonstF * sizeof(double));
+		w.U32(sfunc->NumKonstS);
+		for (unsigned i = 0; i < sfunc->NumKonstS; i++) w.String(sfunc->KonstS[i].GetChars());
+		w.U32(sfunc->NumKonstA);
+		for (unsigned i = 0; i < sfunc->NumKonstA && ok; i++) ok = WriteRef(w, sfunc->KonstA[i].v);
+
+		w.U32(sfunc->SpecialInits.Size());
+		for (auto &init : sfunc->SpecialInits)
+		{
+			ok = ok && WriteType(w, const_cast<PType *>(init.first));
+			w.U32(init.second);
+		}
+
+		w.String(sfunc->SourceFileName.GetChars());
+		w.U32(sfunc->ExtraSpace);
+		w.U8(sfunc->NumRegD);
+		w.U8(sfunc->NumRegF);
+		w.U8(sfunc->NumRegS);
+		w.U8(sfunc->NumRegA);
+		w.U32(sfunc->MaxParam);
+		w.U8(sfunc->NumArgs);
+		w.U8(sfunc->Unsafe);
+		w.U8(sfunc->blockJit);
+
+		if (!ok)
+		{
+			DPrintf(DMSG_NOTIFY, "Scripts not cached: %s has a constant the cache can't restore\n", sfunc->PrintableName);
+			mFunctionIndex.Clear();
+			mClasses.Clear();
+			mTypes.Clear();
+			return;
+		}
+	}
+	mFunctionIndex.Clear();
+	mClasses.Clear();
+	mTypes.Clear();
+
+	// Written under a temporary name first, so that a half written file is never read
+	FString path = CacheFileName();
+	FString temp = path + ".tmp";
+	std::unique_ptr<FileWriter> fw(FileWriter::Open(temp.GetChars()));
+	if (!fw) return;
+
+	bool ok = fw->Write(w.Data.Data(), w.Data.Size()) == w.Data.Size();
+	fw.reset();
+
+	if (!ok || rename(temp.GetChars(), path.GetChars()) != 0)
+	{
+		remove(temp.GetChars());
+		return;
+	}
+	RemoveOldFiles();
+	DPrintf(DMSG_NOTIFY, "Saved %u script functions to the cache\n", items.Size());
+}
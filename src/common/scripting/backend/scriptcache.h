@@ -0,0 +1,91 @@
+#pragma once
+
+#include "tarray.h"
+#include "zstring.h"
+
+class VMScriptFunction;
+class PType;
+class PClass;
+
+//==========================================================================
+//
+// Compiled script cache
+//
+// The code generator's output for all script functions is stored in the
+// cache directory, keyed by the engine version and the contents of every
+// script lump the parsers read. Later starts load the bytecode from there
+// instead of resolving and emitting each function again. The frontend
+// still runs every time, the bytecode refers to the classes, types and
+// functions it creates.
+//
+// Address constants are stored as references to what they point at. Every
+// reference must resolve back to the same address before anything is
+// written; if a single one can't, the build is not cached.
+//
+//==========================================================================
+
+struct FScriptCacheItem
+{
+	VMScriptFunction *Function;
+	bool Anonymous;		// The prototype comes from the code generator
+};
+
+class FScriptCache
+{
+public:
+	// Called by the parsers for every script lump they read
+	void AddSource(int lump);
+
+	// Native memory compiled code may point into, e.g. the state tables of actor classes.
+	// Only valid for the current build.
+	void AddAddressRange(const FString &name, const void *start, size_t size);
+
+	// Returns false if the cache is not used for this build
+	bool BeginBuild();
+
+	// Fills in all functions from the cache. If this fails, nothing was changed.
+	bool Load(const TArray<FScriptCacheItem> &items);
+	void Save(const TArray<FScriptCacheItem> &items);
+
+	void EndBuild();
+
+	class Writer;
+	class Reader;
+
+private:
+	struct Range
+	{
+		FString Name;
+		const uint8_t *Start;
+		size_t Size;
+	};
+
+	void CollectRanges();
+	void CollectTypes();
+	bool WriteRef(Writer &w, void *ptr);
+	bool ReadRef(Reader &r, void *&ptr);
+	bool WriteType(Writer &w, PType *type, int depth = 0);
+	bool ReadType(Reader &r, PType *&type, int depth = 0);
+	FString CacheDirectory();
+	FString CacheFileName();
+	void RemoveOldFiles();
+
+	TArray<int> mSources;
+	TArray<Range> mRanges;					// Sorted by address
+	TMap<FString, int> mRangeNames;			// -1 for names that are used more than once
+	TMap<FString, PType *> mNamedTypes;		// nullptr for names that are used more than once
+	TMap<PType *, FString> mTypeNames;
+
+	// What address constants can point at, only while saving
+	TMap<void *, unsigned> mFunctionIndex;
+	TMap<void *, PClass *> mClasses;
+	TMap<void *, PType *> mTypes;
+
+	uint8_t mKey[16];
+	uint8_t mNamesDigest[16];
+	int mNumNames = 0;
+	unsigned mNumFunctions = 0;
+	bool mActive = false;
+};
+
+extern FScriptCache ScriptCache;
@@ -38,8 +38,12 @@
 #include "c_cvars.h"
 #include "jit.h"
 #include "filesystem.h"
+#include "scriptcache.h"
 
 CVAR(Bool, strictdecorate, false, CVAR_GLOBALCONFIG | CVAR_ARCHIVE)
+CVARD(Bool, vm_optimize, false, CVAR_GLOBALCONFIG | CVAR_ARCHIVE, "removes redundant moves, jumps and dead code from compiled script functions")
+CVARD(Bool, vm_inline, false, CVAR_GLOBALCONFIG | CVAR_ARCHIVE, "replaces calls to small non-virtual script functions with their code")
+CVARD(Int, vm_inline_size, 24, CVAR_GLOBALCONFIG | CVAR_ARCHIVE, "largest script function, in instructions, that gets inlined")
 
 EXTERN_CVAR(Bool, vm_jit)
 EXTERN_CVAR(Bool, vm_jit_aot)
@@ -115,6 +119,8 @@ void VMFunctionBuilder::EndStatement()
 
 void VMFunctionBuilder::MakeFunction(VMScriptFunction *func)
 {
+	if (vm_optimize) Optimize();
+
 	func->Alloc(Code.Size(), IntConstantList.Size(), FloatConstantList.Size(), StringConstantList.Size(), AddressConstantList.Size(), LineNumbers.Size());
 
 	// Copy code block.
@@ -835,9 +841,27 @@ VMFunction *FFunctionBuildList::AddFunction(PNamespace *gnspc, const VersionInfo
 }
 
 
+static TMap<FString, uint8_t *> VarargRegInfo;
+static TMap<const void *, FString> VarargRegInfoKeys;
+
 void FFunctionBuildList::Build()
 {
 	VMDisassemblyDumper disasmdump(VMDisassemblyDumper::Overwrite);
+	TArray<VMScriptFunction*> aotFunctions;
+	TArray<FScriptCacheItem> cacheItems;
+
+	// The arena may have been freed since the last build.
+	VarargRegInfo.Clear();
+	VarargRegInfoKeys.Clear();
+
+	for (auto &item : mItems)
+	{
+		bool isAbstract = item.Func->Variants[0].Implementation->VarFlags & VARF_Abstract;
+		if (!isAbstract) cacheItems.Push({ item.Function, item.Func->SymbolName == NAME_None });
+	}
+	bool useCache = !Args->CheckParm("-dumpdisasm") && ScriptCache.BeginBuild();
+	bool cached = useCache && ScriptCache.Load(cacheItems);
+	int warnings = FScriptPosition::WarnCounter;
 
 	for (auto &item : mItems)
 	{
@@ -847,6 +871,18 @@ void FFunctionBuildList::Build()
 
 		assert(item.Code != NULL);
 
+		if (cached)
+		{
+			#if HAVE_VM_JIT
+				if (vm_jit && vm_jit_aot)
+				{
+					aotFunctions.Push(item.Function);
+				}
+			#endif
+			delete item.Code;
+			continue;
+		}
+
 		// We don't know the return type in advance for anonymous functions.
 		FCompileContext ctx(item.CurGlobals, item.Func, item.Func->SymbolName == NAME_None ? nullptr : item.Func->Variants[0].Proto, item.FromDecorate, item.StateIndex, item.StateCount, item.Lump, item.Version);
 
@@ -943,7 +979,7 @@ void FFunctionBuildList::Build()
 				#if HAVE_VM_JIT
 					if(vm_jit && vm_jit_aot)
 					{
-						sfunc->JitCompile();
+						aotFunctions.Push(sfunc);
 					}
 				#endif
 			}
@@ -956,6 +992,27 @@ void FFunctionBuildList::Build()
 		delete item.Code;
 		disasmdump.Flush();
 	}
+	// Inlining needs the callees' final code, so it can only be done once everything is compiled.
+	if (!cached && vm_inline && FScriptPosition::ErrorCounter == 0)
+	{
+		TArray<VMScriptFunction *> functions;
+		for (auto &item : mItems)
+		{
+			if (item.Function->Code != nullptr) functions.Push(item.Function);
+		}
+		VMFunctionBuilder::InlineCalls(functions);
+	}
+
+	// Only a clean build is cached, warnings would not be shown again on the next start.
+	if (useCache && !cached && FScriptPosition::ErrorCounter == 0 && FScriptPosition::WarnCounter == warnings)
+	{
+		ScriptCache.Save(cacheItems);
+	}
+	ScriptCache.EndBuild();
+
+	// Compiled in one go, so that the JIT can use several threads
+	if (aotFunctions.Size() > 0) VMScriptFunction::JitCompileAll(aotFunctions);
+
 	VMFunction::CreateRegUseInfo();
 	FScriptPosition::StrictErrors = strictdecorate;
 
@@ -1112,6 +1169,41 @@ void FunctionCallEmitter::AddParameterStringConst(const FString &konst)
 	});
 }
 
+//==========================================================================
+//
+// The buffers live in the class data arena, so they are only valid until
+// the next build.
+//
+//==========================================================================
+
+const uint8_t *GetVarargRegInfo(const uint8_t *reginfo, unsigned count)
+{
+	FString key;
+	for (unsigned i = 0; i < count; i++) key.AppendFormat("%02x", reginfo[i]);
+
+	auto found = VarargRegInfo.CheckKey(key);
+	if (found != nullptr) return *found;
+
+	uint8_t *regbuffer = (uint8_t*)ClassDataAllocator.Alloc(max(count, 1u));	// Allocate in the arena so that the pointer does not need to be maintained.
+	if (count > 0) memcpy(regbuffer, reginfo, count);
+	VarargRegInfo[key] = regbuffer;
+	VarargRegInfoKeys[regbuffer] = key;
+	return regbuffer;
+}
+
+bool FindVarargRegInfo(const void *ptr, TArray<uint8_t> &reginfo)
+{
+	auto key = VarargRegInfoKeys.CheckKey(ptr);
+	if (key == nullptr) return false;
+
+	reginfo.Resize(unsigned(key->Len() / 2));
+	for (unsigned i = 0; i < reginfo.Size(); i++)
+	{
+		reginfo[i] = (uint8_t)strtoul(FString(key->GetChars() + i * 2, 2).GetChars(), nullptr, 16);
+	}
+	return true;
+}
+
 ExpEmit FunctionCallEmitter::EmitCall(VMFunctionBuilder *build, TArray<ExpEmit> *ReturnRegs)
 {
 	unsigned paramcount = 0;
@@ -1124,9 +1216,8 @@ ExpEmit FunctionCallEmitter::EmitCall(VMFunctionBuilder *build, TArray<ExpEmit>
 	{
 		// Pass a hidden type information parameter to vararg functions.
 		// It would really be nicer to actually pass real types but that'd require a far more complex interface on the compiler side than what we have.
-		uint8_t *regbuffer = (uint8_t*)ClassDataAllocator.Alloc(reginfo.Size());	// Allocate in the arena so that the pointer does not need to be maintained.
-		memcpy(regbuffer, reginfo.Data(), reginfo.Size());
-		build->Emit(OP_PARAM, REGT_POINTER | REGT_KONST, build->GetConstantAddress(regbuffer));
+		auto regbuffer = GetVarargRegInfo(reginfo.Data(), reginfo.Size());
+		build->Emit(OP_PARAM, REGT_POINTER | REGT_KONST, build->GetConstantAddress((void*)regbuffer));
 		paramcount++;
 	}
 
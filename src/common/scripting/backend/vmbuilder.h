@@ -59,6 +59,9 @@ public:
 	void EndStatement();
 	void MakeFunction(VMScriptFunction *func);
 
+	// Replaces calls to small script functions with their code, see vmoptimizer.cpp
+	static void InlineCalls(const TArray<VMScriptFunction *> &functions);
+
 	// Returns the constant register holding the value.
 	unsigned GetConstantInt(int val);
 	unsigned GetConstantFloat(double val);
@@ -111,6 +114,9 @@ public:
 	TArray<FxLocalVariableDeclaration *> ConstructedStructs;
 
 private:
+	// Cleans up the emitted code, see vmoptimizer.cpp
+	void Optimize();
+
 	TArray<FStatementInfo> LineNumbers;
 	TArray<FxExpression *> StatementStack;
 
@@ -129,6 +135,8 @@ private:
 
 	TArray<VMOP> Code;
 
+	friend class FBytecodeInliner;
+	friend class FBytecodeSelfCheck;
 };
 
 void DumpFunction(FILE *dump, VMScriptFunction *sfunc, const char *label, int labellen);
@@ -177,6 +185,10 @@ extern FFunctionBuildList FunctionBuildList;
 //==========================================================================
 extern int EncodeRegType(ExpEmit reg);
 
+// Type info passed to vararg functions. Calls with the same argument types share one copy.
+const uint8_t *GetVarargRegInfo(const uint8_t *reginfo, unsigned count);
+bool FindVarargRegInfo(const void *ptr, TArray<uint8_t> &reginfo);
+
 class FunctionCallEmitter
 {
 	// std::function and TArray are not compatible so this has to use std::vector instead.
@@ -0,0 +1,2074 @@
+/*
+** vmoptimizer.cpp
+** Register level optimizations on the output of the code generator
+**
+**---------------------------------------------------------------------------
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see http://www.gnu.org/licenses/
+**
+**---------------------------------------------------------------------------
+**
+** The code generator emits every expression into its own registers and
+** leaves it to MOVEs to get the results where they belong. This cleans up
+** after it before the function is finalized:
+**
+** - Jumps to jumps go straight to the final target, jumps to the next
+**   instruction and unreachable code are removed.
+** - Within a basic block, uses of a copied register read the original and
+**   registers that hold a constant are replaced by the constant operand.
+** - With liveness over the control flow graph, instructions whose results
+**   are never read are removed, and an instruction whose result is only
+**   moved somewhere else writes it there directly.
+**
+** Only the registers are looked at, memory is never assumed to be
+** unchanged. String registers and registers whose address is passed to a
+** function are left alone.
+**
+*/
+
+#include "vmbuilder.h"
+#include "printf.h"
+#include "c_cvars.h"
+#include "types.h"
+#include "c_dispatch.h"
+#include "i_time.h"
+#include "v_text.h"
+
+//==========================================================================
+//
+// Register accesses of an instruction
+//
+//==========================================================================
+
+enum EOperandField : uint8_t
+{
+	FIELD_A,
+	FIELD_B,
+	FIELD_C,
+	FIELD_BC,
+};
+
+struct FRegAccess
+{
+	uint8_t Type;		// REGT_INT, REGT_FLOAT, REGT_STRING or REGT_POINTER
+	uint8_t Count;		// Vectors span several float registers
+	uint8_t Field;
+	bool Def;
+	int Reg;
+};
+
+struct FInstrAccess
+{
+	FRegAccess Regs[4];
+	int Count = 0;
+	bool AddrOf = false;	// PARAM passing a register's address
+
+	void Use(int type, int reg, int field, int count = 1) { Regs[Count++] = { (uint8_t)type, (uint8_t)count, (uint8_t)field, false, reg }; }
+	void Def(int type, int reg, int field, int count = 1) { Regs[Count++] = { (uint8_t)type, (uint8_t)count, (uint8_t)field, true, reg }; }
+
+	bool AllScalar() const
+	{
+		for (int i = 0; i < Count; i++) if (Regs[i].Count != 1) return false;
+		return true;
+	}
+};
+
+static int MultiRegCount(int regtype)
+{
+	switch (regtype & REGT_MULTIREG)
+	{
+	case REGT_MULTIREG2: return 2;
+	case REGT_MULTIREG3: return 3;
+	case REGT_MULTIREG4: return 4;
+	default: return 1;
+	}
+}
+
+// Returns false for instructions the optimizer does not know. Functions containing any are left as they are.
+static bool GetAccess(const VMOP &op, FInstrAccess &acc)
+{
+	acc.Count = 0;
+	acc.AddrOf = false;
+
+	constexpr int I = REGT_INT, F = REGT_FLOAT, S = REGT_STRING, P = REGT_POINTER;
+	auto binary = [&](int type, int count = 1) { acc.Def(type, op.a, FIELD_A, count); acc.Use(type, op.b, FIELD_B, count); acc.Use(type, op.c, FIELD_C, count); };
+	auto unary = [&](int type, int count = 1) { acc.Def(type, op.a, FIELD_A, count); acc.Use(type, op.b, FIELD_B, count); };
+
+	switch (op.op)
+	{
+	case OP_NOP:
+	case OP_JMP:
+	case OP_PARAMI:
+	case OP_CALL_K:
+	case OP_RETI:
+		return true;
+
+	case OP_LI:
+	case OP_LK:		acc.Def(I, op.a, FIELD_A); return true;
+	case OP_LKF:	acc.Def(F, op.a, FIELD_A); return true;
+	case OP_LKS:	acc.Def(S, op.a, FIELD_A); return true;
+	case OP_LKP:
+	case OP_LFP:	acc.Def(P, op.a, FIELD_A); return true;
+	case OP_LK_R:	acc.Def(I, op.a, FIELD_A); acc.Use(I, op.b, FIELD_B); return true;
+	case OP_LKF_R:	acc.Def(F, op.a, FIELD_A); acc.Use(I, op.b, FIELD_B); return true;
+	case OP_LKS_R:	acc.Def(S, op.a, FIELD_A); acc.Use(I, op.b, FIELD_B); return true;
+	case OP_LKP_R:	acc.Def(P, op.a, FIELD_A); acc.Use(I, op.b, FIELD_B); return true;
+	case OP_META:
+	case OP_CLSS:	unary(P); return true;
+
+	// Loads: rA = *(pB + rkC)
+	case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU: case OP_LBIT:
+		acc.Def(I, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); return true;
+	case OP_LB_R: case OP_LH_R: case OP_LW_R: case OP_LBU_R: case OP_LHU_R:
+		acc.Def(I, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_LSP: case OP_LDP:
+		acc.Def(F, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); return true;
+	case OP_LSP_R: case OP_LDP_R:
+		acc.Def(F, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_LS: case OP_LCS:
+		acc.Def(S, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); return true;
+	case OP_LS_R: case OP_LCS_R:
+		acc.Def(S, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_LO: case OP_LP:
+		acc.Def(P, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); return true;
+	case OP_LO_R: case OP_LP_R:
+		acc.Def(P, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_LV2: case OP_LFV2:
+		acc.Def(F, op.a, FIELD_A, 2); acc.Use(P, op.b, FIELD_B); return true;
+	case OP_LV3: case OP_LFV3:
+		acc.Def(F, op.a, FIELD_A, 3); acc.Use(P, op.b, FIELD_B); return true;
+	case OP_LV4: case OP_LFV4:
+		acc.Def(F, op.a, FIELD_A, 4); acc.Use(P, op.b, FIELD_B); return true;
+	case OP_LV2_R: case OP_LFV2_R:
+		acc.Def(F, op.a, FIELD_A, 2); acc.Use(P, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_LV3_R: case OP_LFV3_R:
+		acc.Def(F, op.a, FIELD_A, 3); acc.Use(P, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_LV4_R: case OP_LFV4_R:
+		acc.Def(F, op.a, FIELD_A, 4); acc.Use(P, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+
+	// Stores: *(pA + rkC) = rB
+	case OP_SB: case OP_SH: case OP_SW: case OP_SBIT:
+		acc.Use(P, op.a, FIELD_A); acc.Use(I, op.b, FIELD_B); return true;
+	case OP_SB_R: case OP_SH_R: case OP_SW_R:
+		acc.Use(P, op.a, FIELD_A); acc.Use(I, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_SSP: case OP_SDP:
+		acc.Use(P, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B); return true;
+	case OP_SSP_R: case OP_SDP_R:
+		acc.Use(P, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_SS:
+		acc.Use(P, op.a, FIELD_A); acc.Use(S, op.b, FIELD_B); return true;
+	case OP_SS_R:
+		acc.Use(P, op.a, FIELD_A); acc.Use(S, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_SP: case OP_SO:
+		acc.Use(P, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); return true;
+	case OP_SP_R: case OP_SO_R:
+		acc.Use(P, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_SV2: case OP_SFV2:
+		acc.Use(P, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 2); return true;
+	case OP_SV3: case OP_SFV3:
+		acc.Use(P, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 3); return true;
+	case OP_SV4: case OP_SFV4:
+		acc.Use(P, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 4); return true;
+	case OP_SV2_R: case OP_SFV2_R:
+		acc.Use(P, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 2); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_SV3_R: case OP_SFV3_R:
+		acc.Use(P, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 3); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_SV4_R: case OP_SFV4_R:
+		acc.Use(P, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 4); acc.Use(I, op.c, FIELD_C); return true;
+
+	case OP_MOVE:	unary(I); return true;
+	case OP_MOVEF:	unary(F); return true;
+	case OP_MOVES:	unary(S); return true;
+	case OP_MOVEA:	unary(P); return true;
+	case OP_MOVEV2:	unary(F, 2); return true;
+	case OP_MOVEV3:	unary(F, 3); return true;
+	case OP_MOVEV4:	unary(F, 4); return true;
+
+	case OP_CAST:
+		switch (op.c)
+		{
+		case CAST_I2F: case CAST_U2F:	acc.Def(F, op.a, FIELD_A); acc.Use(I, op.b, FIELD_B); return true;
+		case CAST_F2I: case CAST_F2U:	acc.Def(I, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B); return true;
+		case CAST_I2S: case CAST_U2S: case CAST_N2S: case CAST_Co2S: case CAST_So2S: case CAST_SID2S: case CAST_TID2S:
+			acc.Def(S, op.a, FIELD_A); acc.Use(I, op.b, FIELD_B); return true;
+		case CAST_F2S:	acc.Def(S, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B); return true;
+		case CAST_V22S:	acc.Def(S, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 2); return true;
+		case CAST_V32S:	acc.Def(S, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 3); return true;
+		case CAST_V42S:	acc.Def(S, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 4); return true;
+		case CAST_P2S:	acc.Def(S, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); return true;
+		case CAST_S2I: case CAST_S2N: case CAST_S2Co: case CAST_S2So:
+			acc.Def(I, op.a, FIELD_A); acc.Use(S, op.b, FIELD_B); return true;
+		case CAST_S2F:	acc.Def(F, op.a, FIELD_A); acc.Use(S, op.b, FIELD_B); return true;
+		default:		return false;
+		}
+
+	case OP_CASTB:
+		switch (op.c)
+		{
+		case CASTB_I:	acc.Def(I, op.a, FIELD_A); acc.Use(I, op.b, FIELD_B); return true;
+		case CASTB_F:	acc.Def(I, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B); return true;
+		case CASTB_A:	acc.Def(I, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); return true;
+		case CASTB_S:	acc.Def(I, op.a, FIELD_A); acc.Use(S, op.b, FIELD_B); return true;
+		default:		return false;
+		}
+
+	case OP_DYNCAST_R:
+	case OP_DYNCASTC_R:	binary(P); return true;
+	case OP_DYNCAST_K:
+	case OP_DYNCASTC_K:	unary(P); return true;
+
+	case OP_TEST:
+	case OP_TESTN:
+	case OP_IJMP:
+	case OP_BOUND:
+	case OP_BOUND_K:	acc.Use(I, op.a, FIELD_A); return true;
+	case OP_BOUND_R:	acc.Use(I, op.a, FIELD_A); acc.Use(I, op.b, FIELD_B); return true;
+
+	case OP_PARAM:
+		if (op.a == REGT_NIL || (op.a & REGT_KONST)) return true;
+		acc.Use(op.a & REGT_TYPE, op.i16u, FIELD_BC, MultiRegCount(op.a));
+		acc.AddrOf = !!(op.a & REGT_ADDROF);
+		return true;
+
+	case OP_CALL:
+	case OP_SCOPE:
+	case OP_NULLCHECK:	acc.Use(P, op.a, FIELD_A); return true;
+	case OP_VTBL:		unary(P); return true;
+
+	case OP_RESULT:
+		acc.Def(op.b & REGT_TYPE, op.c, FIELD_C, MultiRegCount(op.b));
+		return true;
+
+	case OP_RET:
+		if (op.b == REGT_NIL || (op.b & REGT_KONST)) return true;
+		acc.Use(op.b & REGT_TYPE, op.c, FIELD_C, MultiRegCount(op.b));
+		return true;
+
+	case OP_THROW:
+		if (op.a == 0) acc.Use(P, op.b, FIELD_B);
+		return true;
+
+	case OP_CONCAT:		binary(S); return true;
+	case OP_LENS:		acc.Def(I, op.a, FIELD_A); acc.Use(S, op.b, FIELD_B); return true;
+	case OP_CMPS:
+		if (!(op.a & CMP_BK)) acc.Use(S, op.b, FIELD_B);
+		if (!(op.a & CMP_CK)) acc.Use(S, op.c, FIELD_C);
+		return true;
+
+	// Integer math
+	case OP_SLL_RR: case OP_SRL_RR: case OP_SRA_RR: case OP_ADD_RR: case OP_SUB_RR: case OP_MUL_RR:
+	case OP_DIV_RR: case OP_DIVU_RR: case OP_MOD_RR: case OP_MODU_RR: case OP_AND_RR: case OP_OR_RR:
+	case OP_XOR_RR: case OP_MIN_RR: case OP_MAX_RR: case OP_MINU_RR: case OP_MAXU_RR:
+		binary(I); return true;
+	case OP_SLL_RI: case OP_SRL_RI: case OP_SRA_RI: case OP_ADD_RK: case OP_ADDI: case OP_SUB_RK:
+	case OP_MUL_RK: case OP_DIV_RK: case OP_DIVU_RK: case OP_MOD_RK: case OP_MODU_RK: case OP_AND_RK:
+	case OP_OR_RK: case OP_XOR_RK: case OP_MIN_RK: case OP_MAX_RK: case OP_MINU_RK: case OP_MAXU_RK:
+	case OP_ABS: case OP_NEG: case OP_NOT:
+		unary(I); return true;
+	case OP_SLL_KR: case OP_SRL_KR: case OP_SRA_KR: case OP_SUB_KR: case OP_DIV_KR: case OP_DIVU_KR:
+	case OP_MOD_KR: case OP_MODU_KR:
+		acc.Def(I, op.a, FIELD_A); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_EQ_R: case OP_LT_RR: case OP_LE_RR: case OP_LTU_RR: case OP_LEU_RR:
+		acc.Use(I, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_EQ_K: case OP_LT_RK: case OP_LE_RK: case OP_LTU_RK: case OP_LEU_RK:
+		acc.Use(I, op.b, FIELD_B); return true;
+	case OP_LT_KR: case OP_LE_KR: case OP_LTU_KR: case OP_LEU_KR:
+		acc.Use(I, op.c, FIELD_C); return true;
+
+	// Floating point math
+	case OP_ADDF_RR: case OP_SUBF_RR: case OP_MULF_RR: case OP_DIVF_RR: case OP_MODF_RR: case OP_POWF_RR:
+	case OP_MINF_RR: case OP_MAXF_RR: case OP_ATAN2:
+		binary(F); return true;
+	case OP_ADDF_RK: case OP_SUBF_RK: case OP_MULF_RK: case OP_DIVF_RK: case OP_MODF_RK: case OP_POWF_RK:
+	case OP_MINF_RK: case OP_MAXF_RK: case OP_FLOP:
+		unary(F); return true;
+	case OP_SUBF_KR: case OP_DIVF_KR: case OP_MODF_KR: case OP_POWF_KR:
+		acc.Def(F, op.a, FIELD_A); acc.Use(F, op.c, FIELD_C); return true;
+	case OP_EQF_R: case OP_LTF_RR: case OP_LEF_RR:
+		acc.Use(F, op.b, FIELD_B); acc.Use(F, op.c, FIELD_C); return true;
+	case OP_EQF_K: case OP_LTF_RK: case OP_LEF_RK:
+		acc.Use(F, op.b, FIELD_B); return true;
+	case OP_LTF_KR: case OP_LEF_KR:
+		acc.Use(F, op.c, FIELD_C); return true;
+
+	// Vector math
+	case OP_NEGV2:		unary(F, 2); return true;
+	case OP_NEGV3:		unary(F, 3); return true;
+	case OP_NEGV4:		unary(F, 4); return true;
+	case OP_ADDV2_RR: case OP_SUBV2_RR:	binary(F, 2); return true;
+	case OP_ADDV3_RR: case OP_SUBV3_RR: case OP_CROSSV_RR:	binary(F, 3); return true;
+	case OP_ADDV4_RR: case OP_SUBV4_RR: case OP_MULQQ_RR:	binary(F, 4); return true;
+	case OP_DOTV2_RR:	acc.Def(F, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 2); acc.Use(F, op.c, FIELD_C, 2); return true;
+	case OP_DOTV3_RR:	acc.Def(F, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 3); acc.Use(F, op.c, FIELD_C, 3); return true;
+	case OP_DOTV4_RR:	acc.Def(F, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 4); acc.Use(F, op.c, FIELD_C, 4); return true;
+	case OP_MULVF2_RR: case OP_DIVVF2_RR:	acc.Def(F, op.a, FIELD_A, 2); acc.Use(F, op.b, FIELD_B, 2); acc.Use(F, op.c, FIELD_C); return true;
+	case OP_MULVF3_RR: case OP_DIVVF3_RR:	acc.Def(F, op.a, FIELD_A, 3); acc.Use(F, op.b, FIELD_B, 3); acc.Use(F, op.c, FIELD_C); return true;
+	case OP_MULVF4_RR: case OP_DIVVF4_RR:	acc.Def(F, op.a, FIELD_A, 4); acc.Use(F, op.b, FIELD_B, 4); acc.Use(F, op.c, FIELD_C); return true;
+	case OP_MULVF2_RK: case OP_DIVVF2_RK:	unary(F, 2); return true;
+	case OP_MULVF3_RK: case OP_DIVVF3_RK:	unary(F, 3); return true;
+	case OP_MULVF4_RK: case OP_DIVVF4_RK:	unary(F, 4); return true;
+	case OP_LENV2:		acc.Def(F, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 2); return true;
+	case OP_LENV3:		acc.Def(F, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 3); return true;
+	case OP_LENV4:		acc.Def(F, op.a, FIELD_A); acc.Use(F, op.b, FIELD_B, 4); return true;
+	case OP_EQV2_R:		acc.Use(F, op.b, FIELD_B, 2); acc.Use(F, op.c, FIELD_C, 2); return true;
+	case OP_EQV3_R:		acc.Use(F, op.b, FIELD_B, 3); acc.Use(F, op.c, FIELD_C, 3); return true;
+	case OP_EQV4_R:		acc.Use(F, op.b, FIELD_B, 4); acc.Use(F, op.c, FIELD_C, 4); return true;
+	case OP_MULQV3_RR:	acc.Def(F, op.a, FIELD_A, 3); acc.Use(F, op.b, FIELD_B, 4); acc.Use(F, op.c, FIELD_C, 3); return true;
+
+	// Pointer math
+	case OP_ADDA_RR:	acc.Def(P, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); acc.Use(I, op.c, FIELD_C); return true;
+	case OP_ADDA_RK:	unary(P); return true;
+	case OP_SUBA:		acc.Def(I, op.a, FIELD_A); acc.Use(P, op.b, FIELD_B); acc.Use(P, op.c, FIELD_C); return true;
+	case OP_EQA_R:		acc.Use(P, op.b, FIELD_B); acc.Use(P, op.c, FIELD_C); return true;
+	case OP_EQA_K:		acc.Use(P, op.b, FIELD_B); return true;
+
+	default:
+		return false;
+	}
+}
+
+static void SetOperand(VMOP &op, int field, int value)
+{
+	switch (field)
+	{
+	case FIELD_A: op.a = value; break;
+	case FIELD_B: op.b = value; break;
+	case FIELD_C: op.c = value; break;
+	default: op.i16u = value; break;
+	}
+}
+
+// Instructions that skip the next one if the test fails. The next one is always a JMP.
+static bool IsConditional(int op)
+{
+	switch (op)
+	{
+	case OP_TEST: case OP_TESTN: case OP_CMPS:
+	case OP_EQ_R: case OP_EQ_K: case OP_LT_RR: case OP_LT_RK: case OP_LT_KR: case OP_LE_RR: case OP_LE_RK: case OP_LE_KR:
+	case OP_LTU_RR: case OP_LTU_RK: case OP_LTU_KR: case OP_LEU_RR: case OP_LEU_RK: case OP_LEU_KR:
+	case OP_EQF_R: case OP_EQF_K: case OP_LTF_RR: case OP_LTF_RK: case OP_LTF_KR: case OP_LEF_RR: case OP_LEF_RK: case OP_LEF_KR:
+	case OP_EQV2_R: case OP_EQV3_R: case OP_EQV4_R: case OP_EQA_R: case OP_EQA_K:
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool IsExit(const VMOP &op)
+{
+	switch (op.op)
+	{
+	case OP_RET:	return op.b == REGT_NIL || (op.a & RET_FINAL);
+	case OP_RETI:	return !!(op.a & RET_FINAL);
+	case OP_THROW:	return true;
+	default:		return false;
+	}
+}
+
+// Instructions that only write their result registers and can't throw
+static bool IsPure(const VMOP &op)
+{
+	switch (op.op)
+	{
+	case OP_LI: case OP_LK: case OP_LKF: case OP_LKP: case OP_LK_R: case OP_LKF_R: case OP_LKP_R: case OP_LFP:
+	case OP_MOVE: case OP_MOVEF: case OP_MOVEA: case OP_MOVEV2: case OP_MOVEV3: case OP_MOVEV4:
+	case OP_SLL_RR: case OP_SLL_RI: case OP_SLL_KR: case OP_SRL_RR: case OP_SRL_RI: case OP_SRL_KR: case OP_SRA_RR: case OP_SRA_RI: case OP_SRA_KR:
+	case OP_ADD_RR: case OP_ADD_RK: case OP_ADDI: case OP_SUB_RR: case OP_SUB_RK: case OP_SUB_KR: case OP_MUL_RR: case OP_MUL_RK:
+	case OP_AND_RR: case OP_AND_RK: case OP_OR_RR: case OP_OR_RK: case OP_XOR_RR: case OP_XOR_RK:
+	case OP_MIN_RR: case OP_MIN_RK: case OP_MAX_RR: case OP_MAX_RK: case OP_MINU_RR: case OP_MINU_RK: case OP_MAXU_RR: case OP_MAXU_RK:
+	case OP_ABS: case OP_NEG: case OP_NOT:
+	case OP_ADDF_RR: case OP_ADDF_RK: case OP_SUBF_RR: case OP_SUBF_RK: case OP_SUBF_KR: case OP_MULF_RR: case OP_MULF_RK:
+	case OP_POWF_RR: case OP_POWF_RK: case OP_POWF_KR: case OP_MINF_RR: case OP_MINF_RK: case OP_MAXF_RR: case OP_MAXF_RK:
+	case OP_ATAN2: case OP_FLOP:
+	case OP_NEGV2: case OP_ADDV2_RR: case OP_SUBV2_RR: case OP_DOTV2_RR: case OP_MULVF2_RR: case OP_MULVF2_RK: case OP_LENV2:
+	case OP_NEGV3: case OP_ADDV3_RR: case OP_SUBV3_RR: case OP_DOTV3_RR: case OP_CROSSV_RR: case OP_MULVF3_RR: case OP_MULVF3_RK: case OP_LENV3:
+	case OP_NEGV4: case OP_ADDV4_RR: case OP_SUBV4_RR: case OP_DOTV4_RR: case OP_MULVF4_RR: case OP_MULVF4_RK: case OP_LENV4:
+	case OP_MULQQ_RR: case OP_MULQV3_RR:
+	case OP_ADDA_RR: case OP_ADDA_RK: case OP_SUBA:
+		return true;
+
+	case OP_CAST:
+		return op.c == CAST_I2F || op.c == CAST_U2F || op.c == CAST_F2I || op.c == CAST_F2U;
+
+	case OP_CASTB:
+		return op.c != CASTB_S;
+
+	default:
+		return false;
+	}
+}
+
+//==========================================================================
+//
+// Instructions with a constant operand form
+//
+//==========================================================================
+
+struct FKonstForm
+{
+	uint8_t RR, RK, KR;		// RK has the constant in C, KR in B
+	uint8_t KonstType;
+	bool Commutative;
+};
+
+static const FKonstForm KonstForms[] =
+{
+	{ OP_SLL_RR,	OP_NOP,		OP_SLL_KR,	REGT_INT,	false },
+	{ OP_SRL_RR,	OP_NOP,		OP_SRL_KR,	REGT_INT,	false },
+	{ OP_SRA_RR,	OP_NOP,		OP_SRA_KR,	REGT_INT,	false },
+	{ OP_ADD_RR,	OP_ADD_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_SUB_RR,	OP_SUB_RK,	OP_SUB_KR,	REGT_INT,	false },
+	{ OP_MUL_RR,	OP_MUL_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_DIV_RR,	OP_DIV_RK,	OP_DIV_KR,	REGT_INT,	false },
+	{ OP_DIVU_RR,	OP_DIVU_RK,	OP_DIVU_KR,	REGT_INT,	false },
+	{ OP_MOD_RR,	OP_MOD_RK,	OP_MOD_KR,	REGT_INT,	false },
+	{ OP_MODU_RR,	OP_MODU_RK,	OP_MODU_KR,	REGT_INT,	false },
+	{ OP_AND_RR,	OP_AND_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_OR_RR,		OP_OR_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_XOR_RR,	OP_XOR_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_MIN_RR,	OP_MIN_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_MAX_RR,	OP_MAX_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_MINU_RR,	OP_MINU_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_MAXU_RR,	OP_MAXU_RK,	OP_NOP,		REGT_INT,	true },
+	{ OP_EQ_R,		OP_EQ_K,	OP_NOP,		REGT_INT,	true },
+	{ OP_LT_RR,		OP_LT_RK,	OP_LT_KR,	REGT_INT,	false },
+	{ OP_LE_RR,		OP_LE_RK,	OP_LE_KR,	REGT_INT,	false },
+	{ OP_LTU_RR,	OP_LTU_RK,	OP_LTU_KR,	REGT_INT,	false },
+	{ OP_LEU_RR,	OP_LEU_RK,	OP_LEU_KR,	REGT_INT,	false },
+	{ OP_ADDF_RR,	OP_ADDF_RK,	OP_NOP,		REGT_FLOAT,	true },
+	{ OP_SUBF_RR,	OP_SUBF_RK,	OP_SUBF_KR,	REGT_FLOAT,	false },
+	{ OP_MULF_RR,	OP_MULF_RK,	OP_NOP,		REGT_FLOAT,	true },
+	{ OP_DIVF_RR,	OP_DIVF_RK,	OP_DIVF_KR,	REGT_FLOAT,	false },
+	{ OP_MODF_RR,	OP_MODF_RK,	OP_MODF_KR,	REGT_FLOAT,	false },
+	{ OP_POWF_RR,	OP_POWF_RK,	OP_POWF_KR,	REGT_FLOAT,	false },
+	{ OP_MINF_RR,	OP_MINF_RK,	OP_NOP,		REGT_FLOAT,	true },
+	{ OP_MAXF_RR,	OP_MAXF_RK,	OP_NOP,		REGT_FLOAT,	true },
+	{ OP_EQF_R,		OP_EQF_K,	OP_NOP,		REGT_FLOAT,	true },
+	{ OP_LTF_RR,	OP_LTF_RK,	OP_LTF_KR,	REGT_FLOAT,	false },
+	{ OP_LEF_RR,	OP_LEF_RK,	OP_LEF_KR,	REGT_FLOAT,	false },
+	{ OP_MULVF2_RR,	OP_MULVF2_RK, OP_NOP,	REGT_FLOAT,	false },
+	{ OP_DIVVF2_RR,	OP_DIVVF2_RK, OP_NOP,	REGT_FLOAT,	false },
+	{ OP_MULVF3_RR,	OP_MULVF3_RK, OP_NOP,	REGT_FLOAT,	false },
+	{ OP_DIVVF3_RR,	OP_DIVVF3_RK, OP_NOP,	REGT_FLOAT,	false },
+	{ OP_MULVF4_RR,	OP_MULVF4_RK, OP_NOP,	REGT_FLOAT,	false },
+	{ OP_DIVVF4_RR,	OP_DIVVF4_RK, OP_NOP,	REGT_FLOAT,	false },
+	{ OP_ADDA_RR,	OP_ADDA_RK,	OP_NOP,		REGT_INT,	false },
+	{ OP_EQA_R,		OP_EQA_K,	OP_NOP,		REGT_POINTER, true },
+};
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+struct FRegSet
+{
+	uint64_t Bits[4][4] = {};
+
+	bool Test(int type, int reg) const { return !!(Bits[type][reg >> 6] & (1ull << (reg & 63))); }
+	void Set(int type, int reg) { Bits[type][reg >> 6] |= 1ull << (reg & 63); }
+	void Clear(int type, int reg) { Bits[type][reg >> 6] &= ~(1ull << (reg & 63)); }
+
+	// Returns true if anything was added
+	bool Merge(const FRegSet &other)
+	{
+		bool changed = false;
+		for (int t = 0; t < 4; t++)
+		{
+			for (int w = 0; w < 4; w++)
+			{
+				uint64_t merged = Bits[t][w] | other.Bits[t][w];
+				changed |= merged != Bits[t][w];
+				Bits[t][w] = merged;
+			}
+		}
+		return changed;
+	}
+};
+
+class FBytecodeOptimizer
+{
+public:
+	FBytecodeOptimizer(TArray<VMOP> &code, TArray<FStatementInfo> &lines, VMFunctionBuilder *build) : Code(code), Lines(lines), Build(build) {}
+	bool Run();
+	bool LiveOnEntry(FRegSet &live);
+
+private:
+	struct Block
+	{
+		unsigned Start, End;		// End is exclusive
+		TArray<unsigned> Succ;
+		FRegSet LiveOut;
+		FRegSet Uses, Defs;			// Read before written in this block, written in this block
+	};
+
+	struct FKonstValue
+	{
+		uint8_t Op;		// OP_NOP if the register holds no known constant
+		int Value;		// Immediate for LI, constant index otherwise
+	};
+
+	TArray<VMOP> &Code;
+	TArray<FStatementInfo> &Lines;
+	VMFunctionBuilder *Build;
+
+	TArray<bool> Deleted;
+	TArray<Block> Blocks;
+	TArray<int> BlockOf;
+	FRegSet Pinned;
+
+	int JumpTarget(unsigned i) const { return int(i) + 1 + Code[i].i24; }
+	void SetJumpTarget(unsigned i, int target) { Code[i].i24 = target - int(i) - 1; }
+	bool IsJumpSlot(unsigned i) const { return i > 0 && IsConditional(Code[i - 1].op); }
+
+	void FindPinned();
+	bool ThreadJumps();
+	void BuildBlocks();
+	bool RemoveUnreachable();
+	bool PropagateCopies(Block &block);
+	void ComputeLiveness();
+	bool RemoveDeadCode(Block &block);
+	bool Compact();
+	bool Validate() const;
+};
+
+//==========================================================================
+//
+// Strings are reference counted and passed by address, and registers
+// whose address gets passed can be written by the callee.
+//
+//==========================================================================
+
+void FBytecodeOptimizer::FindPinned()
+{
+	for (int reg = 0; reg < 256; reg++) Pinned.Set(REGT_STRING, reg);
+
+	FInstrAccess acc;
+	for (auto &op : Code)
+	{
+		if (GetAccess(op, acc) && acc.AddrOf)
+		{
+			for (int i = 0; i < acc.Regs[0].Count; i++) Pinned.Set(acc.Regs[0].Type, acc.Regs[0].Reg + i);
+		}
+	}
+}
+
+//==========================================================================
+//
+// Jumps to jumps go directly to the last one's target, jumps to the next
+// instruction go away unless an instruction depends on them being there.
+//
+//==========================================================================
+
+bool FBytecodeOptimizer::ThreadJumps()
+{
+	bool changed = false;
+	TArray<bool> inTable(Code.Size(), true);
+	for (auto &b : inTable) b = false;
+	for (unsigned i = 0; i < Code.Size(); i++)
+	{
+		if (Code[i].op == OP_IJMP)
+		{
+			for (unsigned j = 1; j <= Code[i].i16u && i + j < Code.Size(); j++) inTable[i + j] = true;
+		}
+	}
+
+	for (unsigned i = 0; i < Code.Size(); i++)
+	{
+		if (Code[i].op != OP_JMP) continue;
+
+		int target = JumpTarget(i);
+		for (int hops = 0; hops < 16 && target != int(i) && Code[target].op == OP_JMP; hops++)
+		{
+			target = JumpTarget(target);
+		}
+		if (target != JumpTarget(i))
+		{
+			SetJumpTarget(i, target);
+			changed = true;
+		}
+		if (target == int(i) + 1 && !IsJumpSlot(i) && !inTable[i])
+		{
+			Deleted[i] = true;
+			changed = true;
+		}
+	}
+	return changed;
+}
+
+//==========================================================================
+//
+// Control flow graph
+//
+//==========================================================================
+
+void FBytecodeOptimizer::BuildBlocks()
+{
+	unsigned count = Code.Size();
+	TArray<bool> leader(count + 1, true);
+	for (auto &b : leader) b = false;
+
+	leader[0] = true;
+	for (unsigned i = 0; i < count; i++)
+	{
+		auto &op = Code[i];
+		if (op.op == OP_JMP)
+		{
+			leader[JumpTarget(i)] = true;
+			leader[i + 1] = true;
+		}
+		else if (op.op == OP_IJMP)
+		{
+			// Every table entry is a jump target
+			for (unsigned j = 1; j <= op.i16u + 1u && i + j <= count; j++) leader[i + j] = true;
+		}
+		else if (IsConditional(op.op) || IsExit(op))
+		{
+			leader[i + 1] = true;
+		}
+	}
+
+	Blocks.Clear();
+	BlockOf.Resize(count);
+	for (unsigned i = 0; i < count; i++)
+	{
+		if (leader[i])
+		{
+			Blocks.Reserve(1);
+			Blocks.Last().Start = i;
+		}
+		Blocks.Last().End = i + 1;
+		BlockOf[i] = Blocks.Size() - 1;
+	}
+
+	for (auto &block : Blocks)
+	{
+		unsigned last = block.End - 1;
+		auto &op = Code[last];
+		block.Succ.Clear();
+
+		if (op.op == OP_JMP)
+		{
+			block.Succ.Push(BlockOf[JumpTarget(last)]);
+		}
+		else if (op.op == OP_IJMP)
+		{
+			for (unsigned j = 1; j <= op.i16u && last + j < count; j++) block.Succ.Push(BlockOf[last + j]);
+		}
+		else if (IsConditional(op.op))
+		{
+			if (last + 1 < count) block.Succ.Push(BlockOf[last + 1]);
+			if (last + 2 < count) block.Succ.Push(BlockOf[last + 2]);
+		}
+		else if (!IsExit(op) && block.End < count)
+		{
+			block.Succ.Push(BlockOf[block.End]);
+		}
+	}
+}
+
+bool FBytecodeOptimizer::RemoveUnreachable()
+{
+	TArray<bool> reached(Blocks.Size(), true);
+	for (auto &b : reached) b = false;
+
+	TArray<unsigned> stack;
+	stack.Push(0);
+	reached[0] = true;
+	while (stack.Size() > 0)
+	{
+		unsigned b;
+		stack.Pop(b);
+		for (auto s : Blocks[b].Succ)
+		{
+			if (!reached[s])
+			{
+				reached[s] = true;
+				stack.Push(s);
+			}
+		}
+	}
+
+	bool changed = false;
+	for (unsigned b = 0; b < Blocks.Size(); b++)
+	{
+		if (reached[b]) continue;
+		for (unsigned i = Blocks[b].Start; i < Blocks[b].End; i++) Deleted[i] = true;
+		changed = true;
+	}
+	return changed;
+}
+
+//==========================================================================
+//
+// Forward through a block: copies and constants held in registers
+//
+//==========================================================================
+
+bool FBytecodeOptimizer::PropagateCopies(Block &block)
+{
+	bool changed = false;
+	int copyOf[4][256];
+	FKonstValue konst[4][256];
+	for (int t = 0; t < 4; t++)
+	{
+		for (int r = 0; r < 256; r++)
+		{
+			copyOf[t][r] = -1;
+			konst[t][r].Op = OP_NOP;
+		}
+	}
+
+	// Constant table index for a register known to hold a constant, -1 if there is none that fits into 8 bits
+	auto konstIndex = [&](int type, int reg) -> int
+	{
+		auto &k = konst[type][reg];
+		if (k.Op == OP_NOP) return -1;
+		if (k.Op == OP_LI)
+		{
+			if (type != REGT_INT) return -1;
+			unsigned index = Build->GetConstantInt(k.Value);
+			return index < 256 ? index : -1;
+		}
+		return k.Value < 256 ? k.Value : -1;
+	};
+
+	FInstrAccess acc;
+	for (unsigned i = block.Start; i < block.End; i++)
+	{
+		if (Deleted[i]) continue;
+		auto &op = Code[i];
+		GetAccess(op, acc);
+
+		// Read the original instead of the copy. PARAM is left alone, the JIT reads its register when the function gets called.
+		if (op.op != OP_PARAM)
+		{
+			for (int j = 0; j < acc.Count; j++)
+			{
+				auto &r = acc.Regs[j];
+				if (r.Def || r.Count != 1 || Pinned.Test(r.Type, r.Reg)) continue;
+				int source = copyOf[r.Type][r.Reg];
+				if (source < 0 || Pinned.Test(r.Type, source)) continue;
+
+				bool overlaps = false;
+				if (!acc.AllScalar())
+				{
+					for (int k = 0; k < acc.Count; k++)
+					{
+						auto &d = acc.Regs[k];
+						if (d.Def && d.Type == r.Type && source >= d.Reg && source < d.Reg + d.Count) overlaps = true;
+					}
+				}
+				if (!overlaps)
+				{
+					SetOperand(op, r.Field, source);
+					changed = true;
+				}
+			}
+		}
+
+		// Use the constant operand forms
+		switch (op.op)
+		{
+		case OP_MOVE:
+			if (konst[REGT_INT][op.b].Op != OP_NOP)
+			{
+				auto &k = konst[REGT_INT][op.b];
+				op.op = k.Op;
+				if (k.Op == OP_LI) op.i16 = k.Value;
+				else op.i16u = k.Value;
+				changed = true;
+			}
+			break;
+
+		case OP_MOVEF:
+		case OP_MOVEA:
+		{
+			int type = op.op == OP_MOVEF ? REGT_FLOAT : REGT_POINTER;
+			if (konst[type][op.b].Op != OP_NOP)
+			{
+				auto &k = konst[type][op.b];
+				op.op = k.Op;
+				op.i16u = k.Value;
+				changed = true;
+			}
+			break;
+		}
+
+		case OP_PARAM:
+		{
+			int type = op.a;
+			if (type != REGT_INT && type != REGT_FLOAT && type != REGT_POINTER) break;
+			auto &k = konst[type][op.i16u];
+			if (k.Op == OP_LI)
+			{
+				op.op = OP_PARAMI;
+				op.i24 = k.Value;
+				changed = true;
+			}
+			else if (k.Op != OP_NOP)
+			{
+				op.a = type | REGT_KONST;
+				op.i16u = k.Value;
+				changed = true;
+			}
+			break;
+		}
+
+		case OP_RET:
+		{
+			int type = op.b;
+			if (type != REGT_INT && type != REGT_FLOAT && type != REGT_POINTER) break;
+			auto &k = konst[type][op.c];
+			if (k.Op == OP_LI)
+			{
+				op.op = OP_RETI;
+				op.i16 = k.Value;
+				changed = true;
+			}
+			else if (k.Op != OP_NOP && k.Value < 256)
+			{
+				op.b = type | REGT_KONST;
+				op.c = k.Value;
+				changed = true;
+			}
+			break;
+		}
+
+		case OP_ADD_RR:
+		case OP_SUB_RR:
+			// Small immediates don't need a constant
+			if (konst[REGT_INT][op.c].Op == OP_LI)
+			{
+				int value = konst[REGT_INT][op.c].Value * (op.op == OP_SUB_RR ? -1 : 1);
+				if (value >= -128 && value <= 127)
+				{
+					op.op = OP_ADDI;
+					op.cs = value;
+					changed = true;
+					break;
+				}
+			}
+			if (op.op == OP_ADD_RR && konst[REGT_INT][op.b].Op == OP_LI)
+			{
+				int value = konst[REGT_INT][op.b].Value;
+				if (value >= -128 && value <= 127)
+				{
+					op.op = OP_ADDI;
+					op.b = op.c;
+					op.cs = value;
+					changed = true;
+					break;
+				}
+			}
+			[[fallthrough]];
+
+		default:
+			for (auto &form : KonstForms)
+			{
+				if (form.RR != op.op) continue;
+
+				// B is a different kind of register for vector and pointer math
+				bool bIsKonstType = form.KR != OP_NOP || form.Commutative;
+				int kc = form.RK != OP_NOP ? konstIndex(form.KonstType, op.c) : -1;
+				int kb = kc < 0 && bIsKonstType ? konstIndex(form.KonstType, op.b) : -1;
+				if (kc >= 0)
+				{
+					op.op = form.RK;
+					op.c = kc;
+					changed = true;
+				}
+				else if (kb >= 0 && form.KR != OP_NOP)
+				{
+					op.op = form.KR;
+					op.b = kb;
+					changed = true;
+				}
+				else if (kb >= 0 && form.Commutative)
+				{
+					op.op = form.RK;
+					op.b = op.c;
+					op.c = kb;
+					changed = true;
+				}
+				break;
+			}
+			break;
+		}
+
+		// Writes end what was known about the written registers
+		GetAccess(op, acc);
+		for (int j = 0; j < acc.Count; j++)
+		{
+			auto &r = acc.Regs[j];
+			if (!r.Def) continue;
+			for (int reg = r.Reg; reg < r.Reg + r.Count && reg < 256; reg++)
+			{
+				copyOf[r.Type][reg] = -1;
+				konst[r.Type][reg].Op = OP_NOP;
+				for (int other = 0; other < 256; other++)
+				{
+					if (copyOf[r.Type][other] == reg) copyOf[r.Type][other] = -1;
+				}
+			}
+		}
+
+		switch (op.op)
+		{
+		case OP_MOVE:
+		case OP_MOVEF:
+		case OP_MOVEA:
+		{
+			int type = op.op == OP_MOVE ? REGT_INT : op.op == OP_MOVEF ? REGT_FLOAT : REGT_POINTER;
+			if (op.a == op.b)
+			{
+				Deleted[i] = true;
+				changed = true;
+			}
+			else if (!Pinned.Test(type, op.a) && !Pinned.Test(type, op.b))
+			{
+				copyOf[type][op.a] = op.b;
+			}
+			break;
+		}
+
+		case OP_LI:
+		case OP_LK:
+			if (!Pinned.Test(REGT_INT, op.a)) konst[REGT_INT][op.a] = { op.op, op.op == OP_LI ? (int)op.i16 : (int)op.i16u };
+			break;
+
+		case OP_LKF:
+			if (!Pinned.Test(REGT_FLOAT, op.a)) konst[REGT_FLOAT][op.a] = { op.op, (int)op.i16u };
+			break;
+
+		case OP_LKP:
+			if (!Pinned.Test(REGT_POINTER, op.a)) konst[REGT_POINTER][op.a] = { op.op, (int)op.i16u };
+			break;
+		}
+	}
+	return changed;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void FBytecodeOptimizer::ComputeLiveness()
+{
+	FInstrAccess acc;
+	for (auto &block : Blocks)
+	{
+		block.Uses = {};
+		block.Defs = {};
+		block.LiveOut = {};
+		for (unsigned i = block.Start; i < block.End; i++)
+		{
+			if (Deleted[i]) continue;
+			GetAccess(Code[i], acc);
+			// An instruction reads its operands before it writes its result
+			for (int j = 0; j < acc.Count; j++)
+			{
+				auto &r = acc.Regs[j];
+				if (r.Def) continue;
+				for (int reg = r.Reg; reg < r.Reg + r.Count && reg < 256; reg++)
+				{
+					if (!block.Defs.Test(r.Type, reg)) block.Uses.Set(r.Type, reg);
+				}
+			}
+			for (int j = 0; j < acc.Count; j++)
+			{
+				auto &r = acc.Regs[j];
+				if (!r.Def) continue;
+				for (int reg = r.Reg; reg < r.Reg + r.Count && reg < 256; reg++) block.Defs.Set(r.Type, reg);
+			}
+		}
+	}
+
+	// LiveIn = Uses | (LiveOut & ~Defs)
+	bool changed = true;
+	while (changed)
+	{
+		changed = false;
+		for (int b = Blocks.Size() - 1; b >= 0; b--)
+		{
+			auto &block = Blocks[b];
+			for (auto s : block.Succ)
+			{
+				auto &succ = Blocks[s];
+				FRegSet liveIn = succ.Uses;
+				for (int t = 0; t < 4; t++)
+				{
+					for (int w = 0; w < 4; w++) liveIn.Bits[t][w] |= succ.LiveOut.Bits[t][w] & ~succ.Defs.Bits[t][w];
+				}
+				changed |= block.LiveOut.Merge(liveIn);
+			}
+		}
+	}
+}
+
+//==========================================================================
+//
+// Backward through a block: results nobody reads, and results that are
+// only moved somewhere else
+//
+//==========================================================================
+
+bool FBytecodeOptimizer::RemoveDeadCode(Block &block)
+{
+	bool changed = false;
+	FRegSet live = block.LiveOut;
+	live.Merge(Pinned);
+
+	FInstrAccess acc;
+	for (int i = block.End - 1; i >= int(block.Start); i--)
+	{
+		if (Deleted[i]) continue;
+		auto &op = Code[i];
+		GetAccess(op, acc);
+
+		if (IsPure(op))
+		{
+			bool dead = true;
+			for (int j = 0; j < acc.Count && dead; j++)
+			{
+				auto &r = acc.Regs[j];
+				if (!r.Def) continue;
+				for (int reg = r.Reg; reg < r.Reg + r.Count; reg++)
+				{
+					if (reg >= 256 || live.Test(r.Type, reg)) dead = false;
+				}
+			}
+			if (dead)
+			{
+				Deleted[i] = true;
+				changed = true;
+				continue;
+			}
+		}
+
+		// MOVE x, t right after the instruction that computed t: compute it into x directly.
+		if ((op.op == OP_MOVE || op.op == OP_MOVEF || op.op == OP_MOVEA) && !live.Test(acc.Regs[1].Type, op.b) && !Pinned.Test(acc.Regs[1].Type, op.a))
+		{
+			int prev = i - 1;
+			while (prev >= int(block.Start) && Deleted[prev]) prev--;
+
+			FInstrAccess pacc;
+			if (prev >= int(block.Start) && !IsConditional(Code[prev].op) && GetAccess(Code[prev], pacc) && pacc.AllScalar())
+			{
+				int defs = 0;
+				bool match = false;
+				for (int j = 0; j < pacc.Count; j++)
+				{
+					auto &r = pacc.Regs[j];
+					if (!r.Def) continue;
+					defs++;
+					match = r.Field == FIELD_A && r.Type == acc.Regs[1].Type && r.Reg == op.b;
+				}
+				if (defs == 1 && match && Code[prev].op != OP_RESULT)
+				{
+					Code[prev].a = op.a;
+					Deleted[i] = true;
+					changed = true;
+					continue;
+				}
+			}
+		}
+
+		for (int j = 0; j < acc.Count; j++)
+		{
+			auto &r = acc.Regs[j];
+			if (!r.Def) continue;
+			for (int reg = r.Reg; reg < r.Reg + r.Count && reg < 256; reg++)
+			{
+				if (!Pinned.Test(r.Type, reg)) live.Clear(r.Type, reg);
+			}
+		}
+		for (int j = 0; j < acc.Count; j++)
+		{
+			auto &r = acc.Regs[j];
+			if (r.Def) continue;
+			for (int reg = r.Reg; reg < r.Reg + r.Count && reg < 256; reg++) live.Set(r.Type, reg);
+		}
+	}
+	return changed;
+}
+
+//==========================================================================
+//
+// Removes the deleted instructions and moves jump targets and line
+// numbers along with the rest
+//
+//==========================================================================
+
+bool FBytecodeOptimizer::Compact()
+{
+	unsigned count = Code.Size();
+	TArray<int> newIndex(count + 1, true);
+	int kept = 0;
+	for (unsigned i = 0; i < count; i++)
+	{
+		newIndex[i] = kept;
+		if (!Deleted[i]) kept++;
+	}
+	newIndex[count] = kept;
+	if (kept == (int)count) return false;
+
+	TArray<VMOP> code(kept);
+	for (unsigned i = 0; i < count; i++)
+	{
+		if (Deleted[i]) continue;
+		VMOP op = Code[i];
+		if (op.op == OP_JMP) op.i24 = newIndex[JumpTarget(i)] - newIndex[i] - 1;
+		code.Push(op);
+	}
+	Code = std::move(code);
+
+	// Where several entries end up on the same instruction, the last one is the line it belongs to
+	TArray<FStatementInfo> lines(Lines.Size());
+	for (auto line : Lines)
+	{
+		line.InstructionIndex = (uint16_t)newIndex[min<unsigned>(line.InstructionIndex, count)];
+		if (line.InstructionIndex >= Code.Size()) continue;
+		if (lines.Size() > 0 && lines.Last().InstructionIndex == line.InstructionIndex) lines.Last() = line;
+		else lines.Push(line);
+	}
+	Lines = std::move(lines);
+
+	Deleted.Resize(kept);
+	for (auto &d : Deleted) d = false;
+	return true;
+}
+
+bool FBytecodeOptimizer::Validate() const
+{
+	if (Code.Size() == 0 || (!IsExit(Code.Last()) && Code.Last().op != OP_JMP)) return false;
+	for (unsigned i = 0; i < Code.Size(); i++)
+	{
+		auto &op = Code[i];
+		if (op.op == OP_JMP && (JumpTarget(i) < 0 || JumpTarget(i) >= (int)Code.Size())) return false;
+		if (IsConditional(op.op) && (i + 1 >= Code.Size() || Code[i + 1].op != OP_JMP)) return false;
+		if (op.op == OP_IJMP)
+		{
+			for (unsigned j = 1; j <= op.i16u; j++)
+			{
+				if (i + j >= Code.Size() || Code[i + j].op != OP_JMP) return false;
+			}
+		}
+		if (op.op == OP_CALL || op.op == OP_CALL_K)
+		{
+			for (unsigned j = 1; j <= op.c; j++)
+			{
+				if (i + j >= Code.Size() || Code[i + j].op != OP_RESULT) return false;
+			}
+		}
+	}
+	return true;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+bool FBytecodeOptimizer::Run()
+{
+	FInstrAccess acc;
+	for (auto &op : Code)
+	{
+		if (!GetAccess(op, acc)) return false;
+	}
+	if (!Validate()) return false;
+
+	TArray<VMOP> original = Code;
+	TArray<FStatementInfo> originalLines = Lines;
+
+	FindPinned();
+	Deleted.Resize(Code.Size());
+	for (auto &d : Deleted) d = false;
+
+	for (int pass = 0; pass < 4; pass++)
+	{
+		bool changed = ThreadJumps();
+		Compact();
+
+		BuildBlocks();
+		changed |= RemoveUnreachable();
+		Compact();
+
+		BuildBlocks();
+		for (auto &block : Blocks) changed |= PropagateCopies(block);
+		ComputeLiveness();
+		for (auto &block : Blocks) changed |= RemoveDeadCode(block);
+		Compact();
+
+		if (!changed) break;
+	}
+
+	if (!Validate())
+	{
+		DPrintf(DMSG_ERROR, "Bytecode optimizer produced invalid code, using the unoptimized version\n");
+		Code = std::move(original);
+		Lines = std::move(originalLines);
+		return false;
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// Registers the code may read before it writes them
+//
+//==========================================================================
+
+bool FBytecodeOptimizer::LiveOnEntry(FRegSet &live)
+{
+	FInstrAccess acc;
+	for (auto &op : Code)
+	{
+		if (!GetAccess(op, acc)) return false;
+	}
+	if (!Validate()) return false;
+
+	Deleted.Resize(Code.Size());
+	for (auto &d : Deleted) d = false;
+	BuildBlocks();
+	ComputeLiveness();
+
+	auto &entry = Blocks[0];
+	live = entry.Uses;
+	for (int t = 0; t < 4; t++)
+	{
+		for (int w = 0; w < 4; w++) live.Bits[t][w] |= entry.LiveOut.Bits[t][w] & ~entry.Defs.Bits[t][w];
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// VMFunctionBuilder :: Optimize
+//
+//==========================================================================
+
+void VMFunctionBuilder::Optimize()
+{
+	FBytecodeOptimizer(Code, LineNumbers, this).Run();
+}
+
+//==========================================================================
+//
+// Inlining
+//
+// A CALL_K to a small script function is replaced by the function's code.
+// The callee's registers are placed after the caller's, the PARAMs become
+// moves into the registers VMFillParams would have copied them to, and
+// RETs become moves into the RESULT registers plus a jump past the
+// inlined code.
+//
+// This runs on the finished functions, so it does not depend on the order
+// they were compiled in. Callees are done before their callers, so calls
+// a callee inlined itself are carried along.
+//
+//==========================================================================
+
+EXTERN_CVAR(Int, vm_inline_size)
+
+struct FKonstAccess
+{
+	uint8_t Field;
+	uint8_t Type;
+};
+
+// Constant table operands of an instruction. Returns -1 for instructions that can't be moved to another function.
+static int GetKonstAccess(const VMOP &op, FKonstAccess *k)
+{
+	switch (op.op)
+	{
+	case OP_LK_R: case OP_LKF_R: case OP_LKS_R: case OP_LKP_R:	// Index a range of the table
+	case OP_LFP:	// Needs the function's own frame
+	case OP_THROW:
+		return -1;
+
+	case OP_PARAM:
+		if (op.a == REGT_NIL || !(op.a & REGT_KONST)) return 0;
+		if (op.a & REGT_MULTIREG) return -1;
+		k[0] = { FIELD_BC, uint8_t(op.a & REGT_TYPE) };
+		return 1;
+
+	case OP_RET:
+		if (op.b == REGT_NIL || !(op.b & REGT_KONST)) return 0;
+		if (op.b & REGT_MULTIREG) return -1;
+		k[0] = { FIELD_C, uint8_t(op.b & REGT_TYPE) };
+		return 1;
+
+	case OP_CMPS:
+	{
+		int n = 0;
+		if (op.a & CMP_BK) k[n++] = { FIELD_B, REGT_STRING };
+		if (op.a & CMP_CK) k[n++] = { FIELD_C, REGT_STRING };
+		return n;
+	}
+
+	case OP_SCOPE:	// Not in the mode table
+		k[0] = { FIELD_C, REGT_POINTER };
+		return 1;
+
+	default:
+		break;
+	}
+
+	static const uint8_t fields[] = { FIELD_A, FIELD_B, FIELD_C, FIELD_BC };
+	static const int masks[] = { MODE_ATYPE, MODE_BTYPE, MODE_CTYPE, MODE_BCTYPE };
+	static const int shifts[] = { MODE_ASHIFT, MODE_BSHIFT, MODE_CSHIFT, MODE_BCSHIFT };
+
+	int mode = OpInfo[op.op].Mode;
+	int n = 0;
+	for (int i = 0; i < 4; i++)
+	{
+		switch ((mode & masks[i]) >> shifts[i])
+		{
+		case MODE_KI:	k[n++] = { fields[i], REGT_INT }; break;
+		case MODE_KF:	k[n++] = { fields[i], REGT_FLOAT }; break;
+		case MODE_KS:	k[n++] = { fields[i], REGT_STRING }; break;
+		case MODE_KP:	k[n++] = { fields[i], REGT_POINTER }; break;
+		case MODE_KV:	return -1;
+		default:		break;
+		}
+	}
+	return n;
+}
+
+static int GetOperand(const VMOP &op, int field)
+{
+	switch (field)
+	{
+	case FIELD_A: return op.a;
+	case FIELD_B: return op.b;
+	case FIELD_C: return op.c;
+	default: return op.i16u;
+	}
+}
+
+static int MoveOp(int type, int count)
+{
+	static const uint8_t floatMoves[] = { OP_MOVEF, OP_MOVEF, OP_MOVEV2, OP_MOVEV3, OP_MOVEV4 };
+	switch (type)
+	{
+	case REGT_INT:		return OP_MOVE;
+	case REGT_FLOAT:	return floatMoves[count];
+	case REGT_STRING:	return OP_MOVES;
+	default:			return OP_MOVEA;
+	}
+}
+
+static int NumRegs(VMScriptFunction *func, int type)
+{
+	switch (type)
+	{
+	case REGT_INT:		return func->NumRegD;
+	case REGT_FLOAT:	return func->NumRegF;
+	case REGT_STRING:	return func->NumRegS;
+	default:			return func->NumRegA;
+	}
+}
+
+// The constants keep their indices
+static void CopyKonsts(VMFunctionBuilder &build, VMScriptFunction *func)
+{
+	if (func->NumKonstD > 0) build.AllocConstantsInt(func->NumKonstD, func->KonstD);
+	if (func->NumKonstF > 0) build.AllocConstantsFloat(func->NumKonstF, func->KonstF);
+	if (func->NumKonstS > 0) build.AllocConstantsString(func->NumKonstS, func->KonstS);
+	if (func->NumKonstA > 0)
+	{
+		TArray<void *> ptrs(func->NumKonstA, true);
+		for (int i = 0; i < func->NumKonstA; i++) ptrs[i] = func->KonstA[i].v;
+		build.AllocConstantsAddress(ptrs.Size(), ptrs.Data());
+	}
+}
+
+static const uint8_t KonstLoadOps[] = { OP_LK, OP_LKF, OP_LKS, OP_LKP };
+
+class FBytecodeInliner
+{
+public:
+	void Process(VMScriptFunction *func);
+
+	int NumInlined = 0;
+	bool Recurse = true;		// Process the callees first. The self check works on a copy and leaves them alone
+
+private:
+	struct FCallee
+	{
+		bool Inlinable;
+		FRegSet LiveOnEntry;
+	};
+
+	struct FCallSite
+	{
+		unsigned First, Call;		// First PARAM and the CALL_K
+		VMScriptFunction *Callee;
+	};
+
+	// Where the callee's constants are in the caller's tables, empty if one doesn't fit into its operand
+	struct FKonstMap
+	{
+		bool Fits;
+		TArray<unsigned> Index[4];
+	};
+
+	static VMScriptFunction *CallTarget(VMScriptFunction *func, const VMOP &op);
+	FCallee &GetCallee(VMScriptFunction *callee);
+	bool CheckSite(VMScriptFunction *func, unsigned call, const TArray<bool> &targets, FCallSite &site);
+	FKonstMap &MapKonsts(VMFunctionBuilder &build, VMScriptFunction *callee, TMap<VMScriptFunction *, FKonstMap> &maps);
+	void EmitInline(VMFunctionBuilder &build, VMScriptFunction *func, const FCallSite &site, const int *base, const FKonstMap &konsts);
+	int Rebuild(VMScriptFunction *func, const TArray<FCallSite> &sites);
+
+	TMap<VMScriptFunction *, int> State;	// 1 while the callees are processed, 2 when done
+	TMap<VMScriptFunction *, FCallee> Callees;
+};
+
+VMScriptFunction *FBytecodeInliner::CallTarget(VMScriptFunction *func, const VMOP &op)
+{
+	if (op.op != OP_CALL_K) return nullptr;
+	auto target = (VMFunction *)func->KonstA[op.a].v;
+	if (target == nullptr || (target->VarFlags & VARF_Native)) return nullptr;
+	return static_cast<VMScriptFunction *>(target);
+}
+
+FBytecodeInliner::FCallee &FBytecodeInliner::GetCallee(VMScriptFunction *callee)
+{
+	auto found = Callees.CheckKey(callee);
+	if (found != nullptr) return *found;
+
+	auto &info = Callees[callee];
+	info.Inlinable = false;
+	if (callee->Code == nullptr || callee->CodeSize > vm_inline_size || callee->ExtraSpace > 0 || (callee->VarFlags & VARF_VarArg)) return info;
+
+	FInstrAccess acc;
+	FKonstAccess konst[4];
+	for (int i = 0; i < callee->CodeSize; i++)
+	{
+		if (!GetAccess(callee->Code[i], acc) || GetKonstAccess(callee->Code[i], konst) < 0) return info;
+	}
+
+	TArray<VMOP> code(callee->CodeSize, true);
+	memcpy(code.Data(), callee->Code, callee->CodeSize * sizeof(VMOP));
+	TArray<FStatementInfo> lines;
+	info.Inlinable = FBytecodeOptimizer(code, lines, nullptr).LiveOnEntry(info.LiveOnEntry);
+	return info;
+}
+
+//==========================================================================
+//
+// A call can be inlined if it is a plain call with its PARAMs right before
+// it, and the callee reads no register it didn't get as an argument before
+// writing it. The callee's registers are reused between inlined calls.
+//
+//==========================================================================
+
+bool FBytecodeInliner::CheckSite(VMScriptFunction *func, unsigned call, const TArray<bool> &targets, FCallSite &site)
+{
+	auto &op = func->Code[call];
+	auto callee = CallTarget(func, op);
+	if (callee == nullptr || callee == func) return false;
+	auto state = State.CheckKey(callee);
+	if (state == nullptr || *state != 2) return false;
+	auto &info = GetCallee(callee);
+	if (!info.Inlinable) return false;
+
+	// Each type must still fit into an operand, and the function must not lose its native code.
+	int total = 0;
+	for (int t = 0; t < 4; t++)
+	{
+		if (NumRegs(func, t) + NumRegs(callee, t) > 240) return false;
+		total += NumRegs(func, t) + NumRegs(callee, t);
+	}
+	if (total >= JIT_MAX_REGISTERS) return false;
+
+	if (call + op.c >= (unsigned)func->CodeSize) return false;
+	for (unsigned i = 1; i <= op.c; i++)
+	{
+		if (func->Code[call + i].op != OP_RESULT) return false;
+	}
+
+	unsigned first = call;
+	int slots = 0;
+	while (slots < op.b)
+	{
+		if (first == 0) return false;
+		auto &param = func->Code[--first];
+		if (param.op == OP_PARAMI) slots++;
+		else if (param.op == OP_PARAM && !(param.a & (REGT_NIL | REGT_ADDROF))) slots += MultiRegCount(param.a);
+		else return false;
+	}
+	if (slots != op.b || slots != callee->NumArgs) return false;
+	for (unsigned i = first + 1; i <= call + op.c; i++)
+	{
+		if (targets[i]) return false;
+	}
+
+	FRegSet args;
+	int next[4] = {};
+	for (unsigned i = first; i < call; i++)
+	{
+		auto &param = func->Code[i];
+		int type = param.op == OP_PARAMI ? REGT_INT : param.a & REGT_TYPE;
+		int count = param.op == OP_PARAMI ? 1 : MultiRegCount(param.a);
+		if (param.op == OP_PARAM && (param.a & REGT_KONST) && count > 1) return false;
+		for (int j = 0; j < count; j++) args.Set(type, next[type]++);
+		if (next[type] > NumRegs(callee, type)) return false;
+	}
+	for (int t = 0; t < 4; t++)
+	{
+		for (int w = 0; w < 4; w++)
+		{
+			if (info.LiveOnEntry.Bits[t][w] & ~args.Bits[t][w]) return false;
+		}
+	}
+
+	site.First = first;
+	site.Call = call;
+	site.Callee = callee;
+	return true;
+}
+
+FBytecodeInliner::FKonstMap &FBytecodeInliner::MapKonsts(VMFunctionBuilder &build, VMScriptFunction *callee, TMap<VMScriptFunction *, FKonstMap> &maps)
+{
+	auto found = maps.CheckKey(callee);
+	if (found != nullptr) return *found;
+
+	auto &map = maps[callee];
+	for (int i = 0; i < callee->NumKonstD; i++) map.Index[REGT_INT].Push(build.GetConstantInt(callee->KonstD[i]));
+	for (int i = 0; i < callee->NumKonstF; i++) map.Index[REGT_FLOAT].Push(build.GetConstantFloat(callee->KonstF[i]));
+	for (int i = 0; i < callee->NumKonstS; i++) map.Index[REGT_STRING].Push(build.GetConstantString(callee->KonstS[i]));
+	for (int i = 0; i < callee->NumKonstA; i++) map.Index[REGT_POINTER].Push(build.GetConstantAddress(callee->KonstA[i].v));
+
+	// Operands outside BC only have 8 bits
+	map.Fits = true;
+	FKonstAccess konst[4];
+	for (int i = 0; i < callee->CodeSize; i++)
+	{
+		auto &op = callee->Code[i];
+		int count = GetKonstAccess(op, konst);
+		for (int j = 0; j < count; j++)
+		{
+			if (konst[j].Field != FIELD_BC && map.Index[konst[j].Type][GetOperand(op, konst[j].Field)] > 255) map.Fits = false;
+		}
+	}
+	return map;
+}
+
+void FBytecodeInliner::EmitInline(VMFunctionBuilder &build, VMScriptFunction *func, const FCallSite &site, const int *base, const FKonstMap &konsts)
+{
+	auto callee = site.Callee;
+	auto &call = func->Code[site.Call];
+
+	// Arguments go where VMFillParams would have put them
+	int next[4] = {};
+	for (unsigned i = site.First; i < site.Call; i++)
+	{
+		auto &param = func->Code[i];
+		if (param.op == OP_PARAMI)
+		{
+			build.EmitLoadInt(base[REGT_INT] + next[REGT_INT]++, param.i24);
+			continue;
+		}
+		int type = param.a & REGT_TYPE;
+		int count = MultiRegCount(param.a);
+		int reg = base[type] + next[type];
+		next[type] += count;
+		if (param.a & REGT_KONST) build.Emit(KonstLoadOps[type], reg, (VM_SHALF)param.i16u);
+		else build.Emit(MoveOp(type, count), reg, param.i16u, 0);
+	}
+
+	TArray<unsigned> start(callee->CodeSize + 1, true);
+	TArray<std::pair<unsigned, int>> jumps;		// Position of the jump, target in the callee's code
+	FInstrAccess acc;
+	FKonstAccess konst[4];
+	for (int i = 0; i < callee->CodeSize; i++)
+	{
+		VMOP op = callee->Code[i];
+		start[i] = build.Code.Size();
+
+		if (op.op == OP_RET || op.op == OP_RETI)
+		{
+			int retnum = op.a & ~RET_FINAL;
+			bool none = op.op == OP_RET && op.b == REGT_NIL;
+			if (!none && retnum < call.c)
+			{
+				int result = func->Code[site.Call + 1 + retnum].c;
+				int type = op.b & REGT_TYPE;
+				if (op.op == OP_RETI) build.EmitLoadInt(result, op.i16);
+				else if (op.b & REGT_KONST) build.Emit(KonstLoadOps[type], result, (VM_SHALF)konsts.Index[type][op.c]);
+				else build.Emit(MoveOp(type, MultiRegCount(op.b)), result, base[type] + op.c, 0);
+			}
+			if ((none || (op.a & RET_FINAL)) && i < callee->CodeSize - 1)
+			{
+				jumps.Push({ build.Code.Size(), callee->CodeSize });
+				build.Emit(OP_JMP, 0);
+			}
+			continue;
+		}
+
+		if (op.op == OP_JMP)
+		{
+			jumps.Push({ build.Code.Size(), i + 1 + op.i24 });
+			build.Emit(OP_JMP, 0);
+			continue;
+		}
+
+		GetAccess(op, acc);
+		for (int j = 0; j < acc.Count; j++)
+		{
+			SetOperand(op, acc.Regs[j].Field, base[acc.Regs[j].Type] + acc.Regs[j].Reg);
+		}
+		int count = GetKonstAccess(op, konst);
+		for (int j = 0; j < count; j++)
+		{
+			SetOperand(op, konst[j].Field, konsts.Index[konst[j].Type][GetOperand(op, konst[j].Field)]);
+		}
+		// Pushed as is, so that PARAMs and CALLs inside don't count towards the PARAMs in flight
+		build.Code.Push(op);
+	}
+
+	start[callee->CodeSize] = build.Code.Size();
+	for (auto &jump : jumps) build.Backpatch(jump.first, start[jump.second]);
+}
+
+//==========================================================================
+//
+// Returns the number of calls that were inlined
+//
+//==========================================================================
+
+int FBytecodeInliner::Rebuild(VMScriptFunction *func, const TArray<FCallSite> &sites)
+{
+	VMFunctionBuilder build(0);
+	CopyKonsts(build, func);
+
+	TMap<VMScriptFunction *, FKonstMap> konsts;
+	TArray<const FCallSite *> inlined;
+	int base[4], regs[4];
+	int maxParam = func->MaxParam;
+	for (int t = 0; t < 4; t++) base[t] = regs[t] = NumRegs(func, t);
+	for (auto &site : sites)
+	{
+		// The sites passed CheckSite one by one, but the callees' registers of different types add up.
+		int grown[4], total = 0;
+		for (int t = 0; t < 4; t++)
+		{
+			grown[t] = max(regs[t], base[t] + NumRegs(site.Callee, t));
+			total += grown[t];
+		}
+		if (total >= JIT_MAX_REGISTERS) continue;
+
+		if (!MapKonsts(build, site.Callee, konsts).Fits) continue;
+		inlined.Push(&site);
+		for (int t = 0; t < 4; t++) regs[t] = grown[t];
+		maxParam = max<int>(maxParam, site.Callee->MaxParam);
+	}
+	if (inlined.Size() == 0) return 0;
+
+	for (int t = 0; t < 4; t++)
+	{
+		for (int i = 0; i < regs[t]; i++) build.Registers[t].Get(1);
+	}
+
+	TArray<unsigned> newIndex(func->CodeSize + 1, true);
+	TArray<std::pair<unsigned, int>> jumps;
+	unsigned next = 0;
+	for (int i = 0; i < func->CodeSize; )
+	{
+		if (next < inlined.Size() && inlined[next]->First == (unsigned)i)
+		{
+			auto &site = *inlined[next++];
+			unsigned last = site.Call + func->Code[site.Call].c;
+			for (unsigned j = i; j <= last; j++) newIndex[j] = build.Code.Size();
+			EmitInline(build, func, site, base, *konsts.CheckKey(site.Callee));
+			i = last + 1;
+			continue;
+		}
+
+		auto &op = func->Code[i];
+		newIndex[i] = build.Code.Size();
+		if (op.op == OP_JMP) jumps.Push({ build.Code.Size(), i + 1 + op.i24 });
+		build.Code.Push(op);
+		i++;
+	}
+	newIndex[func->CodeSize] = build.Code.Size();
+	for (auto &jump : jumps) build.Backpatch(jump.first, newIndex[jump.second]);
+
+	// The inlined code belongs to the line of the call
+	auto &lines = build.LineNumbers;
+	for (unsigned i = 0; i < func->LineInfoCount; i++)
+	{
+		auto line = func->LineInfo[i];
+		line.InstructionIndex = (uint16_t)newIndex[min<unsigned>(line.InstructionIndex, func->CodeSize)];
+		if (lines.Size() > 0 && lines.Last().InstructionIndex == line.InstructionIndex) lines.Last() = line;
+		else lines.Push(line);
+	}
+	build.MaxParam = maxParam;
+
+	// The old code stays in the arena until the next build
+	for (int i = 0; i < func->NumKonstS; i++) func->KonstS[i].~FString();
+	func->Code = nullptr;
+	build.MakeFunction(func);
+	return inlined.Size();
+}
+
+void FBytecodeInliner::Process(VMScriptFunction *func)
+{
+	if (func->Code == nullptr || State.CheckKey(func) != nullptr) return;
+	State[func] = 1;
+
+	TArray<bool> targets(func->CodeSize + 1, true);
+	for (auto &t : targets) t = false;
+	for (int i = 0; i < func->CodeSize; i++)
+	{
+		auto &op = func->Code[i];
+		if (op.op == OP_JMP) targets[i + 1 + op.i24] = true;
+
+		auto callee = CallTarget(func, op);
+		if (callee != nullptr && Recurse) Process(callee);
+	}
+
+	TArray<FCallSite> sites;
+	FCallSite site;
+	int size = func->CodeSize;
+	for (int i = 0; i < func->CodeSize; i++)
+	{
+		if (CheckSite(func, i, targets, site))
+		{
+			// Line numbers are 16 bits
+			size += site.Callee->CodeSize * 2;
+			if (size > 32767) break;
+			sites.Push(site);
+		}
+	}
+	if (sites.Size() > 0) NumInlined += Rebuild(func, sites);
+	State[func] = 2;
+}
+
+//==========================================================================
+//
+// VMFunctionBuilder :: InlineCalls
+//
+//==========================================================================
+
+void VMFunctionBuilder::InlineCalls(const TArray<VMScriptFunction *> &functions)
+{
+	FBytecodeInliner inliner;
+	for (auto func : functions) inliner.Process(func);
+	DPrintf(DMSG_NOTIFY, "%d script function calls inlined\n", inliner.NumInlined);
+}
+
+//==========================================================================
+//
+// Self check
+//
+// Static functions that only take and return ints and floats, and whose
+// code and that of every script function they call never stores to
+// memory or calls native code, can be run on sample arguments without
+// touching the game. Each one is copied, the copy is optimized or has
+// its calls inlined, and both are run and timed on the same arguments.
+//
+// Everything runs in the interpreter, so the JIT never sees the copies
+// and both versions are timed the same way.
+//
+//==========================================================================
+
+class FBytecodeSelfCheck
+{
+public:
+	FBytecodeSelfCheck(int iterations) : Iterations(iterations) {}
+	void Run();
+
+private:
+	enum { NUM_SAMPLES = 8 };
+
+	struct FResult
+	{
+		bool Aborted;
+		uint64_t Values[MAX_RETURNS];
+	};
+
+	struct FTransform
+	{
+		const char *Name;
+		int Changed = 0, Failed = 0;
+		double Before = 0, After = 0;
+	};
+
+	static bool IsCallable(VMScriptFunction *func);
+	bool IsPure(VMScriptFunction *func);
+	static VMScriptFunction *Copy(VMScriptFunction *func, bool optimize);
+	static void Delete(VMScriptFunction *copy);
+	static void SetReturns(VMScriptFunction *func, VMReturn *ret, uint64_t *values);
+	void MakeParams(VMScriptFunction *func);
+	bool Call(VMScriptFunction *func, int sample, FResult &result);
+	double Time(VMScriptFunction *func, const TArray<int> &samples);
+	void Compare(VMScriptFunction *func, VMScriptFunction *copy, FTransform &transform);
+
+	int Iterations;
+	TMap<VMScriptFunction *, bool> Pure;
+	TArray<VMValue> Params[NUM_SAMPLES];
+};
+
+bool FBytecodeSelfCheck::IsCallable(VMScriptFunction *func)
+{
+	if (func->Code == nullptr || func->Proto == nullptr || func->RegTypes == nullptr) return false;
+	if (func->ImplicitArgs != 0 || (func->VarFlags & (VARF_Method | VARF_VarArg)) || func->ExtraSpace > 0) return false;
+
+	for (int i = 0; i < func->NumArgs; i++)
+	{
+		if (func->RegTypes[i] != REGT_INT && func->RegTypes[i] != REGT_FLOAT) return false;
+	}
+	auto &returns = func->Proto->ReturnTypes;
+	if (returns.Size() > MAX_RETURNS) return false;
+	for (auto type : returns)
+	{
+		if (type->GetRegCount() != 1 || (type->GetRegType() != REGT_INT && type->GetRegType() != REGT_FLOAT)) return false;
+	}
+	return true;
+}
+
+// Recursive functions are not checked
+bool FBytecodeSelfCheck::IsPure(VMScriptFunction *func)
+{
+	auto found = Pure.CheckKey(func);
+	if (found != nullptr) return *found;
+	Pure[func] = false;
+
+	bool pure = func->Code != nullptr;
+	for (int i = 0; pure && i < func->CodeSize; i++)
+	{
+		auto &op = func->Code[i];
+		if ((op.op >= OP_SB && op.op <= OP_SBIT) || op.op == OP_CALL || op.op == OP_VTBL || op.op == OP_SCOPE)
+		{
+			pure = false;
+		}
+		else if (op.op == OP_CALL_K)
+		{
+			auto target = (VMFunction *)func->KonstA[op.a].v;
+			pure = target != nullptr && !(target->VarFlags & (VARF_Native | VARF_Abstract)) && IsPure(static_cast<VMScriptFunction *>(target));
+		}
+	}
+	Pure[func] = pure;
+	return pure;
+}
+
+VMScriptFunction *FBytecodeSelfCheck::Copy(VMScriptFunction *func, bool optimize)
+{
+	auto copy = new VMScriptFunction(func->Name);
+	copy->ImplicitArgs = func->ImplicitArgs;
+	copy->VarFlags = func->VarFlags;
+	copy->QualifiedName = func->QualifiedName;
+	copy->PrintableName = func->PrintableName;
+	copy->Proto = func->Proto;
+	copy->ArgFlags = func->ArgFlags;
+	copy->RegTypes = func->RegTypes;
+	copy->NumArgs = func->NumArgs;
+	copy->SourceFileName = func->SourceFileName;
+	copy->ScriptCall = VMExec;
+
+	VMFunctionBuilder build(0);
+	CopyKonsts(build, func);
+	for (int t = 0; t < 4; t++)
+	{
+		for (int i = NumRegs(func, t); i > 0; i--) build.Registers[t].Get(1);
+	}
+	build.Code.Resize(func->CodeSize);
+	memcpy(build.Code.Data(), func->Code, func->CodeSize * sizeof(VMOP));
+	build.LineNumbers.Resize(func->LineInfoCount);
+	if (func->LineInfoCount > 0) memcpy(build.LineNumbers.Data(), func->LineInfo, func->LineInfoCount * sizeof(FStatementInfo));
+	build.MaxParam = func->MaxParam;
+
+	if (optimize) FBytecodeOptimizer(build.Code, build.LineNumbers, &build).Run();
+	build.MakeFunction(copy);
+	return copy;
+}
+
+// The code stays in the arena, like that of every other function
+void FBytecodeSelfCheck::Delete(VMScriptFunction *copy)
+{
+	auto &all = VMFunction::AllFunctions;
+	if (all.Size() > 0 && all.Last() == copy) all.Pop();
+	copy->~VMScriptFunction();
+}
+
+// Fixed arguments. Loops are run by the arguments, so they stay small.
+void FBytecodeSelfCheck::MakeParams(VMScriptFunction *func)
+{
+	static const int ints[] = { 1, 2, 3, -1, 5, 16, -4, 7 };
+	static const double floats[] = { 1., 0.5, -2.25, 3., 90., -45., 0.1, 10. };
+
+	for (int s = 0; s < NUM_SAMPLES; s++)
+	{
+		Params[s].Clear();
+		for (int i = 0; i < func->NumArgs; i++)
+		{
+			if (func->RegTypes[i] == REGT_INT) Params[s].Push(VMValue(ints[(s * 3 + i * 5) % NUM_SAMPLES]));
+			else Params[s].Push(VMValue(floats[(s * 5 + i * 3) % NUM_SAMPLES]));
+		}
+	}
+}
+
+void FBytecodeSelfCheck::SetReturns(VMScriptFunction *func, VMReturn *ret, uint64_t *values)
+{
+	auto &returns = func->Proto->ReturnTypes;
+	for (unsigned i = 0; i < returns.Size(); i++)
+	{
+		values[i] = 0;
+		if (returns[i]->GetRegType() == REGT_INT) ret[i].IntAt((int *)&values[i]);
+		else ret[i].FloatAt((double *)&values[i]);
+	}
+}
+
+bool FBytecodeSelfCheck::Call(VMScriptFunction *func, int sample, FResult &result)
+{
+	VMReturn ret[MAX_RETURNS];
+	SetReturns(func, ret, result.Values);
+	try
+	{
+		VMExec(func, Params[sample].Data(), func->NumArgs, ret, func->Proto->ReturnTypes.Size());
+		result.Aborted = false;
+	}
+	catch (CVMAbortException &err)
+	{
+		err.stacktrace = "";
+		result.Aborted = true;
+	}
+	return !result.Aborted;
+}
+
+double FBytecodeSelfCheck::Time(VMScriptFunction *func, const TArray<int> &samples)
+{
+	VMReturn ret[MAX_RETURNS];
+	uint64_t values[MAX_RETURNS];
+	SetReturns(func, ret, values);
+	int numret = func->Proto->ReturnTypes.Size();
+
+	uint64_t start = I_nsTime();
+	for (int i = 0; i < Iterations; i++)
+	{
+		for (auto s : samples) VMExec(func, Params[s].Data(), func->NumArgs, ret, numret);
+	}
+	return (I_nsTime() - start) / 1e6;
+}
+
+//==========================================================================
+//
+// Samples that abort have to abort in both versions. Only the ones that
+// don't are timed.
+//
+//==========================================================================
+
+void FBytecodeSelfCheck::Compare(VMScriptFunction *func, VMScriptFunction *copy, FTransform &transform)
+{
+	if (copy->CodeSize == func->CodeSize && memcmp(copy->Code, func->Code, func->CodeSize * sizeof(VMOP)) == 0) return;
+	transform.Changed++;
+
+	auto &returns = func->Proto->ReturnTypes;
+	TArray<int> samples;
+	for (int s = 0; s < NUM_SAMPLES; s++)
+	{
+		FResult before, after;
+		bool same = Call(func, s, before) == Call(copy, s, after);
+		for (unsigned i = 0; same && !before.Aborted && i < returns.Size(); i++)
+		{
+			if (before.Values[i] == after.Values[i]) continue;
+			// NaNs don't have to have the same bits
+			double a, b;
+			memcpy(&a, &before.Values[i], sizeof(double));
+			memcpy(&b, &after.Values[i], sizeof(double));
+			same = returns[i]->GetRegType() == REGT_FLOAT && a != a && b != b;
+		}
+		if (!same)
+		{
+			Printf(TEXTCOLOR_RED "  %s: results differ after %s\n", func->PrintableName, transform.Name);
+			transform.Failed++;
+			return;
+		}
+		if (!before.Aborted) samples.Push(s);
+	}
+	if (samples.Size() == 0) return;
+
+	transform.Before += Time(func, samples);
+	transform.After += Time(copy, samples);
+}
+
+void FBytecodeSelfCheck::Run()
+{
+	TArray<VMScriptFunction *> functions;
+	TArray<JitFuncPtr> calls;
+	for (auto f : VMFunction::AllFunctions)
+	{
+		if (f->VarFlags & (VARF_Native | VARF_Abstract)) continue;
+		auto func = static_cast<VMScriptFunction *>(f);
+		if (func->Code == nullptr) continue;
+		functions.Push(func);
+		calls.Push(func->ScriptCall);
+		func->ScriptCall = VMExec;
+	}
+
+	FTransform optimize, inlining;
+	optimize.Name = "optimizing";
+	inlining.Name = "inlining";
+	int checked = 0;
+	for (auto func : functions)
+	{
+		if (!IsCallable(func) || !IsPure(func)) continue;
+		checked++;
+		MakeParams(func);
+
+		auto copy = Copy(func, true);
+		Compare(func, copy, optimize);
+		Delete(copy);
+
+		copy = Copy(func, false);
+		FBytecodeInliner inliner;
+		inliner.Recurse = false;
+		inliner.Process(copy);
+		if (inliner.NumInlined > 0) Compare(func, copy, inlining);
+		Delete(copy);
+	}
+
+	for (unsigned i = 0; i < functions.Size(); i++) functions[i]->ScriptCall = calls[i];
+
+	Printf("%d script functions checked, %d runs of %d samples:\n", checked, Iterations, (int)NUM_SAMPLES);
+	for (auto transform : { &optimize, &inlining })
+	{
+		double change = transform->Before > 0 ? (transform->After / transform->Before - 1) * 100 : 0;
+		Printf("  %-10s %5d changed %8.3f ms -> %8.3f ms (%+.1f%%)%s\n", transform->Name, transform->Changed, transform->Before, transform->After, change,
+			transform->Failed ? FStringf(TEXTCOLOR_RED " (%d differ)", transform->Failed).GetChars() : "");
+	}
+}
+
+//==========================================================================
+//
+// vm_selfcheck [iterations]
+//
+// Checks the optimizer and the inliner against the code as it was loaded,
+// so it is best run with vm_optimize and vm_inline off.
+//
+//==========================================================================
+
+CCMD(vm_selfcheck)
+{
+	int iterations = argv.argc() > 1 ? max(atoi(argv[1]), 1) : 1000;
+	FBytecodeSelfCheck(iterations).Run();
+}
@@ -40,6 +40,7 @@
 #include "version.h"
 #include "zcc_parser.h"
 #include "zcc_compile.h"
+#include "scriptcache.h"
 
 
 TArray<FString> Includes;
@@ -323,6 +324,7 @@ static void ParseSingleFile(FScanner *pSC, const char *filename, int lump, void
 	FScanner &sc = *pSC;
 	sc.SetParseVersion(state.ParseVersion);
 	state.sc = &sc;
+	ScriptCache.AddSource(lump);
 
 	while (sc.GetToken())
 	{
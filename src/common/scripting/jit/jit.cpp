@@ -12,7 +12,7 @@ extern PStruct* TypeFQuaternion;
 
 static void OutputJitLog(const asmjit::StringLogger &logger);
 
-JitFuncPtr JitCompile(VMScriptFunction *sfunc)
+JitFuncPtr JitCompile(VMScriptFunction *sfunc, FString *errorLog)
 {
 #if 0
 	if (strcmp(sfunc->PrintableName, "StatusScreen.drawNum") != 0)
@@ -34,6 +34,11 @@ JitFuncPtr JitCompile(VMScriptFunction *sfunc)
 	}
 	catch (const CRecoverableError &e)
 	{
+		if (errorLog)
+		{
+			errorLog->Format("%s\n%s: Unexpected JIT error: %s\n", logger.getString(), sfunc->PrintableName, e.what());
+			return nullptr;
+		}
 		OutputJitLog(logger);
 		Printf("%s: Unexpected JIT error: %s\n",sfunc->PrintableName, e.what());
 		return nullptr;
@@ -274,6 +279,7 @@ void JitCompiler::Setup()
 
 	CreateRegisters();
 	IncrementVMCalls();
+	EmitProfileEnter();
 	SetupFrame();
 }
 
@@ -433,6 +439,12 @@ void JitCompiler::EmitPopFrame()
 		auto popFrame = CreateCall<void, VMFrameStack *>(PopFullVMFrame);
 		popFrame->setArg(0, stack);
 	}
+
+	if (profile)
+	{
+		auto exitCall = CreateCall<void, VMScriptFunction *>(VMProfileExit);
+		exitCall->setArg(0, asmjit::imm_ptr(sfunc));
+	}
 }
 
 void JitCompiler::IncrementVMCalls()
@@ -446,6 +458,17 @@ void JitCompiler::IncrementVMCalls()
 	cc.mov(asmjit::x86::dword_ptr(vmcallsptr), vmcalls);
 }
 
+void JitCompiler::EmitProfileEnter()
+{
+	// Only code compiled while the profiler runs calls it, vm_profile start and stop switch between both kinds of code.
+	profile = VMProfiling;
+	if (profile)
+	{
+		auto enterCall = CreateCall<void, VMScriptFunction *>(VMProfileEnter);
+		enterCall->setArg(0, asmjit::imm_ptr(sfunc));
+	}
+}
+
 void JitCompiler::CreateRegisters()
 {
 	regD.Resize(sfunc->NumRegD);
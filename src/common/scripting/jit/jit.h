@@ -3,6 +3,7 @@
 
 #include "vmintern.h"
 
-JitFuncPtr JitCompile(VMScriptFunction *func);
+// Thread safe. With errorLog set, errors are stored there instead of being printed.
+JitFuncPtr JitCompile(VMScriptFunction *func, FString *errorLog = nullptr);
 void JitDumpLog(FILE *file, VMScriptFunction *func);
 FString JitCaptureStackTrace(int framesToSkip, bool includeNativeFrames, int maxFrames = -1);
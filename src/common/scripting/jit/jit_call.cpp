@@ -2,6 +2,7 @@
 #include "jitintern.h"
 #include <map>
 #include <memory>
+#include <mutex>
 
 void JitCompiler::EmitPARAM()
 {
@@ -590,6 +591,7 @@ void JitCompiler::EmitNativeCall(VMNativeFunction *target)
 }
 
 static std::map<FString, std::unique_ptr<TArray<uint8_t>>> argsCache;
+static std::mutex argsCacheLock;
 
 asmjit::FuncSignature JitCompiler::CreateFuncSignature()
 {
@@ -712,6 +714,7 @@ asmjit::FuncSignature JitCompiler::CreateFuncSignature()
 	}
 
 	// FuncSignature only keeps a pointer to its args array. Store a copy of each args array variant.
+	std::lock_guard<std::mutex> lock(argsCacheLock);
 	std::unique_ptr<TArray<uint8_t>> &cachedArgs = argsCache[key];
 	if (!cachedArgs) cachedArgs.reset(new TArray<uint8_t>(args));
 
@@ -1,5 +1,6 @@
 
 #include <memory>
+#include <mutex>
 #include "jit.h"
 #include "jitintern.h"
 
@@ -29,17 +30,17 @@ static TArray<uint8_t*> JitFrames;
 static size_t JitBlockPos = 0;
 static size_t JitBlockSize = 0;
 
+// Functions may be compiled on several threads at once. Code generation is independent,
+// but the executable memory blocks and the unwind/debug info lists are shared.
+static std::mutex JitMemoryLock;
+
 asmjit::CodeInfo GetHostCodeInfo()
 {
-	static bool firstCall = true;
-	static asmjit::CodeInfo codeInfo;
-
-	if (firstCall)
+	static const asmjit::CodeInfo codeInfo = []()
 	{
 		asmjit::JitRuntime rt;
-		codeInfo = rt.getCodeInfo();
-		firstCall = false;
-	}
+		return rt.getCodeInfo();
+	}();
 
 	return codeInfo;
 }
@@ -263,6 +264,8 @@ void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
 	if (codeSize == 0)
 		return nullptr;
 
+	std::lock_guard<std::mutex> lock(JitMemoryLock);
+
 #ifdef _WIN64
 	TArray<uint16_t> unwindInfo = CreateUnwindInfoWindows(func);
 	size_t unwindInfoSize = unwindInfo.Size() * sizeof(uint16_t);
@@ -659,6 +662,8 @@ void *AddJitFunction(asmjit::CodeHolder* code, JitCompiler *compiler)
 	if (codeSize == 0)
 		return nullptr;
 
+	std::lock_guard<std::mutex> lock(JitMemoryLock);
+
 	unsigned int fdeFunctionStart = 0;
 	TArray<uint8_t> unwindInfo = CreateUnwindInfoUnix(func, fdeFunctionStart);
 	size_t unwindInfoSize = unwindInfo.Size();
@@ -53,6 +53,7 @@ private:
 	void Setup();
 	void CreateRegisters();
 	void IncrementVMCalls();
+	void EmitProfileEnter();
 	void SetupFrame();
 	void SetupSimpleFrame();
 	void SetupFullVMFrame();
@@ -281,6 +282,8 @@ private:
 	asmjit::CBNode *callReturnsCursor = nullptr;
 	asmjit::X86Gp callReturns;
 
+	bool profile = false;	// Calls the profiler hooks on entry and exit
+
 	const int *konstd;
 	const double *konstf;
 	const FString *konsts;
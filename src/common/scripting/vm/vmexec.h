@@ -2307,8 +2307,11 @@ static void SetReturn(const VMRegisters &reg, VMFrame *frame, VMReturn *ret, VM_
 static int Exec(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret)
 {
 	VMCalls[0]++;
+	auto sfunc = static_cast<VMScriptFunction*>(func);
+	bool profiled = VMProfiling;
+	if (profiled) VMProfileEnter(sfunc);
 	VMFrameStack *stack = &GlobalVMStack;
-	VMFrame *newf = stack->AllocFrame(static_cast<VMScriptFunction*>(func));
+	VMFrame *newf = stack->AllocFrame(sfunc);
 	VMFillParams(params, newf, numparams);
 	try
 	{
@@ -2317,8 +2320,10 @@ static int Exec(VMFunction *func, VMValue *params, int numparams, VMReturn *ret,
 	catch (...)
 	{
 		stack->PopFrame();
+		if (profiled) VMProfileExit(sfunc);
 		throw;
 	}
 	stack->PopFrame();
+	if (profiled) VMProfileExit(sfunc);
 	return numret;
 }
@@ -33,6 +33,10 @@
 */
 
 #include <new>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <exception>
 #include "dobject.h"
 #include "v_text.h"
 #include "stats.h"
@@ -59,6 +63,8 @@ CUSTOM_CVAR(Bool, vm_jit_aot, true, CVAR_NOINITCALL)
 	Printf("You must restart " GAMENAME " for this change to take effect.\n");
 	Printf("This cvar is currently not saved. You must specify it on the command line.");
 }
+CVARD(Int, vm_jit_threshold, 8, CVAR_ARCHIVE | CVAR_GLOBALCONFIG, "without vm_jit_aot, number of calls a function runs in the VM before it is compiled")
+CVARD(Int, vm_jit_threads, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG, "number of threads used by vm_jit_aot, 0 uses all cores")
 #else
 CVAR(Bool, vm_jit, false, CVAR_NOINITCALL|CVAR_NOSET)
 CVAR(Bool, vm_jit_aot, false, CVAR_NOINITCALL|CVAR_NOSET)
@@ -281,7 +287,7 @@ static bool CanJit(VMScriptFunction *func)
 
 	if(func->blockJit) return false;
 
-	int maxregs = 200;
+	int maxregs = JIT_MAX_REGISTERS;
 	if (func->NumRegA + func->NumRegD + func->NumRegF + func->NumRegS < maxregs)
 		return true;
 
@@ -297,9 +303,10 @@ void VMScriptFunction::JitCompile()
 	#ifdef HAVE_VM_JIT
 		if (vm_jit && CanJit(this))
 		{
-			ScriptCall = ::JitCompile(this);
-			if (!ScriptCall)
-				ScriptCall = VMExec;
+			auto &code = JitCode[VMProfiling];
+			if (!code)
+				code = ::JitCompile(this);
+			ScriptCall = code ? code : VMExec;
 		}
 		else
 	#endif // HAVE_VM_JIT
@@ -309,6 +316,115 @@ void VMScriptFunction::JitCompile()
 	}
 }
 
+//==========================================================================
+//
+// Compiles the functions collected by the build list ahead of time. Every
+// function gets its own code holder, so they are spread over a few threads.
+// Nothing can call into the scripts while this runs, so the results are
+// only published once all workers are done.
+//
+//==========================================================================
+
+void VMScriptFunction::JitCompileAll(const TArray<VMScriptFunction*> &functions)
+{
+#ifdef HAVE_VM_JIT
+	// Decide on this thread which functions go to the JIT, CanJit may print
+	TArray<VMScriptFunction*> jitFunctions;
+	for (auto func : functions)
+	{
+		if (func->VarFlags & VARF_Abstract)
+			continue;
+
+		if (vm_jit && CanJit(func))
+			jitFunctions.Push(func);
+		else
+			func->ScriptCall = VMExec;
+	}
+
+	TArray<JitFuncPtr> results(jitFunctions.Size(), true);
+	TArray<FString> errors(jitFunctions.Size(), true);
+	std::atomic<unsigned> next = 0;
+
+	// The JIT reports some errors with I_FatalError. That must not escape a worker
+	// thread, so the first one is kept and thrown again once all threads are done.
+	std::mutex errorLock;
+	std::exception_ptr fatal;
+	auto work = [&]()
+	{
+		try
+		{
+			for (unsigned i = next++; i < jitFunctions.Size(); i = next++)
+				results[i] = ::JitCompile(jitFunctions[i], &errors[i]);
+		}
+		catch (...)
+		{
+			std::lock_guard<std::mutex> lock(errorLock);
+			if (!fatal) fatal = std::current_exception();
+			next = jitFunctions.Size();
+		}
+	};
+
+	int numThreads = vm_jit_threads > 0 ? vm_jit_threads : (int)std::thread::hardware_concurrency();
+	numThreads = clamp<int>(numThreads, 1, max(jitFunctions.Size() / 16, 1u));
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < numThreads; i++)
+		threads.emplace_back(work);
+	work();
+	for (auto &thread : threads)
+		thread.join();
+
+	if (fatal)
+		std::rethrow_exception(fatal);
+
+	for (unsigned i = 0; i < jitFunctions.Size(); i++)
+	{
+		if (errors[i].IsNotEmpty())
+			Printf("%s", errors[i].GetChars());
+		jitFunctions[i]->JitCode[VMProfiling] = results[i];
+		jitFunctions[i]->ScriptCall = results[i] ? results[i] : VMExec;
+	}
+#else
+	for (auto func : functions)
+		func->JitCompile();
+#endif
+}
+
+//==========================================================================
+//
+// Switches all functions that were compiled to their code for the current
+// VMProfiling state. Each function is compiled at most once per state, so
+// starting and stopping the profiler again reuses the earlier code instead
+// of piling up new copies until JitRelease. Functions without code for this
+// state yet get it on their next call through FirstScriptCall.
+//
+//==========================================================================
+
+void VMScriptFunction::ResetJitCode()
+{
+#ifdef HAVE_VM_JIT
+	for (auto func : VMFunction::AllFunctions)
+	{
+		if (func->VarFlags & (VARF_Native | VARF_Abstract))
+			continue;
+
+		auto sfunc = static_cast<VMScriptFunction*>(func);
+		if (sfunc->ScriptCall != VMExec && sfunc->ScriptCall != &VMScriptFunction::FirstScriptCall)
+		{
+			if (sfunc->JitCode[VMProfiling])
+			{
+				sfunc->ScriptCall = sfunc->JitCode[VMProfiling];
+			}
+			else
+			{
+				sfunc->ScriptCall = &VMScriptFunction::FirstScriptCall;
+				sfunc->CallCount = vm_jit_threshold;
+			}
+		}
+	}
+#endif
+}
+
 int VMScriptFunction::FirstScriptCall(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret)
 {
 	// [Player701] Check that we aren't trying to call an abstract function.
@@ -318,8 +434,16 @@ int VMScriptFunction::FirstScriptCall(VMFunction *func, VMValue *params, int num
 	{
 		ThrowAbortException(X_OTHER, "attempt to call abstract function %s.", func->PrintableName);
 	}
-	
-	static_cast<VMScriptFunction*>(func)->JitCompile();
+
+	auto sfunc = static_cast<VMScriptFunction*>(func);
+#ifdef HAVE_VM_JIT
+	// Most functions are only called a handful of times, if at all. Those stay in the VM.
+	if (vm_jit && ++sfunc->CallCount < vm_jit_threshold)
+	{
+		return VMExec(func, params, numparams, ret, numret);
+	}
+#endif
+	sfunc->JitCompile();
 
 	return func->ScriptCall(func, params, numparams, ret, numret);
 }
@@ -751,6 +875,7 @@ void ClearGlobalVMStack()
 	while (GlobalVMStack.PopFrame() != nullptr)
 	{
 	}
+	VMProfileUnwind();
 }
 
 
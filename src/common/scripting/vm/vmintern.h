@@ -440,10 +440,19 @@ void VMDisasm(FILE *out, const VMOP *code, int codesize, const VMScriptFunction
 
 extern thread_local VMFrameStack GlobalVMStack;
 
+// Call tree profiler for script functions, see vmprofile.cpp
+extern bool VMProfiling;
+void VMProfileEnter(VMScriptFunction *func);
+void VMProfileExit(VMScriptFunction *func);
+void VMProfileUnwind();
+
 typedef std::pair<const class PType *, unsigned> FTypeAndOffset;
 
 typedef int(*JitFuncPtr)(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret);
 
+// Functions with this many registers of all types together are left to the VM, see CanJit.
+enum { JIT_MAX_REGISTERS = 200 };
+
 class VMScriptFunction : public VMFunction
 {
 public:
@@ -475,14 +484,20 @@ public:
 	TArray<FTypeAndOffset> SpecialInits;	// list of all contents on the extra stack which require construction and destruction
 
 	bool blockJit = false; // function triggers Jit bugs, block compilation until bugs are fixed
+	int CallCount = 0;		// Calls through FirstScriptCall, until the function gets compiled
+	JitFuncPtr JitCode[2] = {};	// Compiled code without and with profiler calls, so vm_profile can switch back and forth
 
 	void InitExtra(void *addr);
 	void DestroyExtra(void *addr);
 	int AllocExtraStack(PType *type);
 	int PCToLine(const VMOP *pc);
 
+	// Compiled functions switch to the code for the current VMProfiling state
+	static void ResetJitCode();
+
 private:
 	static int FirstScriptCall(VMFunction *func, VMValue *params, int numparams, VMReturn *ret, int numret);
 	void JitCompile();
+	static void JitCompileAll(const TArray<VMScriptFunction*> &functions);
 	friend class FFunctionBuildList;
 };
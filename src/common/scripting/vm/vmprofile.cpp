@@ -0,0 +1,337 @@
+/*
+** vmprofile.cpp
+** Call tree profiler for script functions
+**
+**---------------------------------------------------------------------------
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see http://www.gnu.org/licenses/
+**
+**---------------------------------------------------------------------------
+**
+** While the profiler runs, every call of a script function enters a node
+** of a call tree, one node per path of functions that led to the call.
+** A node counts its calls and the time spent in it including its callees,
+** the exclusive time is what is left after taking out the children.
+**
+** The VM calls the hooks for every function it executes. JIT compiled
+** code only calls them if it was compiled while the profiler was running,
+** so starting and stopping it sends all functions back to the compiler.
+** Calls that were inlined are counted as part of their caller.
+**
+** Only the thread that started the profiler is recorded.
+**
+*/
+
+#include <thread>
+#include <algorithm>
+#include "vmintern.h"
+#include "types.h"
+#include "stats.h"
+#include "c_dispatch.h"
+#include "printf.h"
+#include "v_text.h"
+
+bool VMProfiling;
+
+class FScriptProfiler
+{
+public:
+	void Start();
+	void Stop();
+	void Enter(VMScriptFunction *func);
+	void Exit(VMScriptFunction *func);
+	void Unwind();
+	bool WriteStacks(const char *filename);
+	void PrintFunctions(unsigned limit);
+	bool HasData() const { return Nodes.Size() > 0; }
+
+	std::thread::id Thread;
+
+private:
+	struct FNode
+	{
+		VMScriptFunction *Func = nullptr;
+		unsigned Parent = 0;
+		unsigned Calls = 0;
+		cycle_t Time;
+		TMap<VMScriptFunction *, unsigned> Children;
+	};
+
+	void GetExclusive(TArray<double> &exclusive);
+
+	TArray<FNode> Nodes;		// 0 is the root, for calls from native code
+	TArray<unsigned> Stack;
+};
+
+static FScriptProfiler Profiler;
+
+//==========================================================================
+//
+// FScriptProfiler :: Start
+//
+//==========================================================================
+
+void FScriptProfiler::Start()
+{
+	Nodes.Clear();
+	Nodes.Reserve(1);
+	Nodes[0].Time.Reset();
+	Stack.Clear();
+	Stack.Push(0);
+	Thread = std::this_thread::get_id();
+}
+
+void FScriptProfiler::Stop()
+{
+	Unwind();
+}
+
+//==========================================================================
+//
+// FScriptProfiler :: Enter
+//
+//==========================================================================
+
+void FScriptProfiler::Enter(VMScriptFunction *func)
+{
+	unsigned parent = Stack.Last();
+	unsigned index;
+	auto child = Nodes[parent].Children.CheckKey(func);
+	if (child != nullptr)
+	{
+		index = *child;
+	}
+	else
+	{
+		index = Nodes.Reserve(1);
+		Nodes[index].Func = func;
+		Nodes[index].Parent = parent;
+		Nodes[index].Time.Reset();
+		Nodes[parent].Children[func] = index;
+	}
+	auto &node = Nodes[index];
+	node.Calls++;
+	node.Time.Clock();
+	Stack.Push(index);
+}
+
+//==========================================================================
+//
+// FScriptProfiler :: Exit
+//
+// Exceptions do not leave JIT compiled code through its exit hook, so
+// its frames are still on the stack when the next function in the VM
+// or with hooks returns. The time until then is counted for them.
+//
+//==========================================================================
+
+void FScriptProfiler::Exit(VMScriptFunction *func)
+{
+	for (unsigned i = Stack.Size() - 1; i > 0; i--)
+	{
+		if (Nodes[Stack[i]].Func != func) continue;
+
+		while (Stack.Size() > i)
+		{
+			unsigned index;
+			Stack.Pop(index);
+			Nodes[index].Time.Unclock();
+		}
+		return;
+	}
+	// Entered before the profiler was started
+}
+
+void FScriptProfiler::Unwind()
+{
+	while (Stack.Size() > 1)
+	{
+		unsigned index;
+		Stack.Pop(index);
+		Nodes[index].Time.Unclock();
+	}
+}
+
+//==========================================================================
+//
+// FScriptProfiler :: GetExclusive
+//
+// Children are always created after their parent.
+//
+//==========================================================================
+
+void FScriptProfiler::GetExclusive(TArray<double> &exclusive)
+{
+	exclusive.Resize(Nodes.Size());
+	for (unsigned i = 0; i < Nodes.Size(); i++) exclusive[i] = Nodes[i].Time.TimeMS();
+	for (unsigned i = Nodes.Size() - 1; i > 0; i--) exclusive[Nodes[i].Parent] -= Nodes[i].Time.TimeMS();
+}
+
+//==========================================================================
+//
+// FScriptProfiler :: WriteStacks
+//
+// One line per call path with its exclusive time in microseconds, the
+// collapsed stack format flamegraph.pl and speedscope read.
+//
+//==========================================================================
+
+bool FScriptProfiler::WriteStacks(const char *filename)
+{
+	FILE *f = fopen(filename, "w");
+	if (f == nullptr) return false;
+
+	TArray<double> exclusive;
+	GetExclusive(exclusive);
+
+	TArray<FString> paths(Nodes.Size(), true);
+	for (unsigned i = 1; i < Nodes.Size(); i++)
+	{
+		FString name = Nodes[i].Func->PrintableName;
+		name.ReplaceChars(" ;", '_');
+		paths[i] = Nodes[i].Parent == 0 ? name : paths[Nodes[i].Parent] + ";" + name;
+
+		auto usec = (long long)(exclusive[i] * 1000. + 0.5);
+		if (usec > 0) fprintf(f, "%s %lld\n", paths[i].GetChars(), usec);
+	}
+	fclose(f);
+	return true;
+}
+
+//==========================================================================
+//
+// FScriptProfiler :: PrintFunctions
+//
+// Inclusive time is only counted for the outermost call of a recursive
+// function, the inner ones are part of it already.
+//
+//==========================================================================
+
+void FScriptProfiler::PrintFunctions(unsigned limit)
+{
+	struct FFunctionInfo
+	{
+		VMScriptFunction *Func;
+		unsigned Calls;
+		double Inclusive, Exclusive;
+	};
+
+	TArray<double> exclusive;
+	GetExclusive(exclusive);
+
+	TMap<VMScriptFunction *, unsigned> index;
+	TArray<FFunctionInfo> functions;
+	for (unsigned i = 1; i < Nodes.Size(); i++)
+	{
+		auto &node = Nodes[i];
+		auto found = index.CheckKey(node.Func);
+		if (found == nullptr)
+		{
+			found = &index.Insert(node.Func, functions.Push({ node.Func, 0, 0, 0 }));
+		}
+		auto &info = functions[*found];
+		info.Calls += node.Calls;
+		info.Exclusive += exclusive[i];
+
+		unsigned parent = node.Parent;
+		while (parent != 0 && Nodes[parent].Func != node.Func) parent = Nodes[parent].Parent;
+		if (parent == 0) info.Inclusive += node.Time.TimeMS();
+	}
+
+	std::sort(functions.begin(), functions.end(), [](const FFunctionInfo &left, const FFunctionInfo &right)
+	{
+		return right.Exclusive < left.Exclusive;
+	});
+
+	Printf(TEXTCOLOR_YELLOW "Excl, ms    Incl, ms    Calls     Function\n");
+	Printf(TEXTCOLOR_YELLOW "----------  ----------  --------  --------------------\n");
+	for (unsigned i = 0; i < limit && i < functions.Size(); i++)
+	{
+		auto &info = functions[i];
+		Printf("%10.3f  %10.3f  %8u  %s\n", info.Exclusive, info.Inclusive, info.Calls, info.Func->PrintableName);
+	}
+}
+
+//==========================================================================
+//
+// Hooks for the VM and JIT compiled code
+//
+//==========================================================================
+
+void VMProfileEnter(VMScriptFunction *func)
+{
+	if (VMProfiling && std::this_thread::get_id() == Profiler.Thread) Profiler.Enter(func);
+}
+
+void VMProfileExit(VMScriptFunction *func)
+{
+	if (VMProfiling && std::this_thread::get_id() == Profiler.Thread) Profiler.Exit(func);
+}
+
+// Called when the VM stack is thrown away after an error
+void VMProfileUnwind()
+{
+	if (VMProfiling && std::this_thread::get_id() == Profiler.Thread) Profiler.Unwind();
+}
+
+//==========================================================================
+//
+// vm_profile start|stop|dump [file] [count]
+//
+//==========================================================================
+
+CCMD(vm_profile)
+{
+	if (argv.argc() >= 2)
+	{
+		if (stricmp(argv[1], "start") == 0)
+		{
+			Profiler.Start();
+			VMProfiling = true;
+			VMScriptFunction::ResetJitCode();
+			Printf("Script profiling started\n");
+			return;
+		}
+		else if (stricmp(argv[1], "stop") == 0)
+		{
+			if (VMProfiling)
+			{
+				Profiler.Stop();
+				VMProfiling = false;
+				VMScriptFunction::ResetJitCode();
+				Printf("Script profiling stopped\n");
+			}
+			return;
+		}
+		else if (stricmp(argv[1], "dump") == 0)
+		{
+			if (!Profiler.HasData())
+			{
+				Printf("No script profile has been recorded\n");
+				return;
+			}
+			const char *filename = argv.argc() >= 3 ? argv[2] : "vmprofile.txt";
+			int limit = argv.argc() >= 4 ? atoi(argv[3]) : 20;
+			if (!Profiler.WriteStacks(filename))
+			{
+				Printf(TEXTCOLOR_RED "Unable to write %s\n", filename);
+				return;
+			}
+			Profiler.PrintFunctions(limit > 0 ? limit : UINT_MAX);
+			Printf("Call stacks written to %s\n", filename);
+			return;
+		}
+	}
+	Printf("Usage: vm_profile <start|stop|dump [file] [count]>\n");
+}
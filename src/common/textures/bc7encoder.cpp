@@ -0,0 +1,337 @@
+/*
+** bc7encoder.cpp
+** Mode 6 BC7 encoder for the texture transcode cache
+**
+**---------------------------------------------------------------------------
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see http://www.gnu.org/licenses/
+**
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include "bc7encoder.h"
+
+static const int Mode6Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct FBC7Mode6
+{
+	int Endpoint[2][4];		// 7 bit values
+	int PBit[2];
+	uint8_t Index[16];
+	int64_t Error;
+};
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+int BC7_NumMipLevels(int width, int height)
+{
+	int levels = 1;
+	while (width > 1 || height > 1)
+	{
+		width = std::max(1, width >> 1);
+		height = std::max(1, height >> 1);
+		levels++;
+	}
+	return levels;
+}
+
+size_t BC7_LevelSize(int width, int height)
+{
+	return (size_t)((width + 3) / 4) * (size_t)((height + 3) / 4) * 16;
+}
+
+//==========================================================================
+//
+// Picks the best indices for a set of quantized endpoints
+//
+//==========================================================================
+
+static void FitIndices(const int pixels[16][4], FBC7Mode6 &block)
+{
+	int palette[16][4];
+	for (int c = 0; c < 4; c++)
+	{
+		int e0 = (block.Endpoint[0][c] << 1) | block.PBit[0];
+		int e1 = (block.Endpoint[1][c] << 1) | block.PBit[1];
+		for (int i = 0; i < 16; i++)
+		{
+			palette[i][c] = ((64 - Mode6Weights[i]) * e0 + Mode6Weights[i] * e1 + 32) >> 6;
+		}
+	}
+
+	block.Error = 0;
+	for (int p = 0; p < 16; p++)
+	{
+		int best = 0, bestError = INT32_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			int error = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				int d = pixels[p][c] - palette[i][c];
+				error += d * d;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				best = i;
+			}
+		}
+		block.Index[p] = (uint8_t)best;
+		block.Error += bestError;
+	}
+}
+
+//==========================================================================
+//
+// Tries all p-bit combinations for a pair of unquantized endpoints
+//
+//==========================================================================
+
+static void FitEndpoints(const int pixels[16][4], const float e0[4], const float e1[4], FBC7Mode6 &best)
+{
+	for (int pbits = 0; pbits < 4; pbits++)
+	{
+		FBC7Mode6 block;
+		block.PBit[0] = pbits & 1;
+		block.PBit[1] = pbits >> 1;
+		for (int c = 0; c < 4; c++)
+		{
+			block.Endpoint[0][c] = std::clamp((int)lrintf((e0[c] - block.PBit[0]) * 0.5f), 0, 127);
+			block.Endpoint[1][c] = std::clamp((int)lrintf((e1[c] - block.PBit[1]) * 0.5f), 0, 127);
+		}
+		FitIndices(pixels, block);
+		if (block.Error < best.Error) best = block;
+	}
+}
+
+//==========================================================================
+//
+// Endpoints come from the principal axis of the block's colors. After the
+// first fit they get refined once with a least squares solve against the
+// chosen indices.
+//
+//==========================================================================
+
+static void EncodeBlock(const int pixels[16][4], uint8_t *output)
+{
+	float mean[4] = {};
+	for (int p = 0; p < 16; p++)
+	{
+		for (int c = 0; c < 4; c++) mean[c] += pixels[p][c];
+	}
+	for (int c = 0; c < 4; c++) mean[c] /= 16.f;
+
+	float cov[4][4] = {};
+	for (int p = 0; p < 16; p++)
+	{
+		float d[4];
+		for (int c = 0; c < 4; c++) d[c] = pixels[p][c] - mean[c];
+		for (int i = 0; i < 4; i++)
+		{
+			for (int j = 0; j < 4; j++) cov[i][j] += d[i] * d[j];
+		}
+	}
+
+	float axis[4] = { 1, 1, 1, 1 };
+	for (int iter = 0; iter < 8; iter++)
+	{
+		float next[4] = {};
+		for (int i = 0; i < 4; i++)
+		{
+			for (int j = 0; j < 4; j++) next[i] += cov[i][j] * axis[j];
+		}
+		float len = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2] + next[3] * next[3]);
+		if (len < 1e-6f) break;
+		for (int c = 0; c < 4; c++) axis[c] = next[c] / len;
+	}
+
+	float tmin = 0, tmax = 0;
+	for (int p = 0; p < 16; p++)
+	{
+		float t = 0;
+		for (int c = 0; c < 4; c++) t += (pixels[p][c] - mean[c]) * axis[c];
+		tmin = std::min(tmin, t);
+		tmax = std::max(tmax, t);
+	}
+
+	float e0[4], e1[4];
+	for (int c = 0; c < 4; c++)
+	{
+		e0[c] = std::clamp(mean[c] + axis[c] * tmin, 0.f, 255.f);
+		e1[c] = std::clamp(mean[c] + axis[c] * tmax, 0.f, 255.f);
+	}
+
+	FBC7Mode6 best;
+	best.Error = INT64_MAX;
+	FitEndpoints(pixels, e0, e1, best);
+
+	if (best.Error > 0)
+	{
+		float aa = 0, ab = 0, bb = 0, ax[4] = {}, bx[4] = {};
+		for (int p = 0; p < 16; p++)
+		{
+			float b = Mode6Weights[best.Index[p]] / 64.f;
+			float a = 1.f - b;
+			aa += a * a;
+			ab += a * b;
+			bb += b * b;
+			for (int c = 0; c < 4; c++)
+			{
+				ax[c] += a * pixels[p][c];
+				bx[c] += b * pixels[p][c];
+			}
+		}
+
+		float det = aa * bb - ab * ab;
+		if (fabsf(det) > 1e-6f)
+		{
+			for (int c = 0; c < 4; c++)
+			{
+				e0[c] = std::clamp((ax[c] * bb - bx[c] * ab) / det, 0.f, 255.f);
+				e1[c] = std::clamp((bx[c] * aa - ax[c] * ab) / det, 0.f, 255.f);
+			}
+			FitEndpoints(pixels, e0, e1, best);
+		}
+	}
+
+	// The first index is stored with 3 bits, so its top bit must be 0
+	if (best.Index[0] & 8)
+	{
+		for (int c = 0; c < 4; c++) std::swap(best.Endpoint[0][c], best.Endpoint[1][c]);
+		std::swap(best.PBit[0], best.PBit[1]);
+		for (int p = 0; p < 16; p++) best.Index[p] = 15 - best.Index[p];
+	}
+
+	memset(output, 0, 16);
+	int pos = 0;
+	auto put = [&](int value, int bits)
+	{
+		for (int i = 0; i < bits; i++, pos++)
+		{
+			if (value & (1 << i)) output[pos >> 3] |= 1 << (pos & 7);
+		}
+	};
+
+	put(1 << 6, 7);
+	for (int c = 0; c < 4; c++)
+	{
+		put(best.Endpoint[0][c], 7);
+		put(best.Endpoint[1][c], 7);
+	}
+	put(best.PBit[0], 1);
+	put(best.PBit[1], 1);
+	put(best.Index[0], 3);
+	for (int p = 1; p < 16; p++) put(best.Index[p], 4);
+}
+
+//==========================================================================
+//
+// Blocks on the right and bottom edge repeat the last row and column
+//
+//==========================================================================
+
+static void EncodeLevel(const uint8_t *bgra, int width, int height, uint8_t *output)
+{
+	for (int by = 0; by < height; by += 4)
+	{
+		for (int bx = 0; bx < width; bx += 4)
+		{
+			int pixels[16][4];
+			for (int y = 0; y < 4; y++)
+			{
+				for (int x = 0; x < 4; x++)
+				{
+					const uint8_t *src = bgra + ((size_t)std::min(by + y, height - 1) * width + std::min(bx + x, width - 1)) * 4;
+					int *dst = pixels[y * 4 + x];
+					dst[0] = src[2];
+					dst[1] = src[1];
+					dst[2] = src[0];
+					dst[3] = src[3];
+				}
+			}
+			EncodeBlock(pixels, output);
+			output += 16;
+		}
+	}
+}
+
+static void DownsampleLevel(const uint8_t *src, int width, int height, uint8_t *dest, int newWidth, int newHeight)
+{
+	for (int y = 0; y < newHeight; y++)
+	{
+		int y0 = std::min(y * 2, height - 1), y1 = std::min(y * 2 + 1, height - 1);
+		for (int x = 0; x < newWidth; x++)
+		{
+			int x0 = std::min(x * 2, width - 1), x1 = std::min(x * 2 + 1, width - 1);
+			const uint8_t *p00 = src + ((size_t)y0 * width + x0) * 4;
+			const uint8_t *p01 = src + ((size_t)y0 * width + x1) * 4;
+			const uint8_t *p10 = src + ((size_t)y1 * width + x0) * 4;
+			const uint8_t *p11 = src + ((size_t)y1 * width + x1) * 4;
+			for (int c = 0; c < 4; c++)
+			{
+				*dest++ = (uint8_t)((p00[c] + p01[c] + p10[c] + p11[c] + 2) >> 2);
+			}
+		}
+	}
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+size_t BC7_EncodeImage(const uint8_t *bgra, int width, int height, TArray<uint8_t> &output, int &mipLevels)
+{
+	mipLevels = BC7_NumMipLevels(width, height);
+
+	size_t total = 0;
+	for (int level = 0, w = width, h = height; level < mipLevels; level++)
+	{
+		total += BC7_LevelSize(w, h);
+		w = std::max(1, w >> 1);
+		h = std::max(1, h >> 1);
+	}
+	output.Resize((unsigned)total);
+
+	TArray<uint8_t> mip, nextMip;
+	const uint8_t *src = bgra;
+	size_t pos = 0;
+	for (int level = 0, w = width, h = height; level < mipLevels; level++)
+	{
+		EncodeLevel(src, w, h, output.Data() + pos);
+		pos += BC7_LevelSize(w, h);
+
+		if (level + 1 < mipLevels)
+		{
+			int nw = std::max(1, w >> 1), nh = std::max(1, h >> 1);
+			nextMip.Resize(nw * nh * 4);
+			DownsampleLevel(src, w, h, nextMip.Data(), nw, nh);
+			std::swap(mip, nextMip);
+			src = mip.Data();
+			w = nw;
+			h = nh;
+		}
+	}
+	return BC7_LevelSize(width, height);
+}
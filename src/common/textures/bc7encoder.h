@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "tarray.h"
+
+//==========================================================================
+//
+// BC7 encoder for the texture transcode cache
+//
+// Only mode 6 is used: one subset, RGBA endpoints with 7 bits per channel
+// plus a p-bit and 4 bit indices. That covers opaque and translucent images
+// with one code path and encodes fast enough to run while playing.
+//
+//==========================================================================
+
+// Number of levels in a full mip chain, down to 1x1
+int BC7_NumMipLevels(int width, int height);
+
+// Size of one level in bytes, 16 bytes per 4x4 block
+size_t BC7_LevelSize(int width, int height);
+
+// Encodes a BGRA8 image and a box filtered mip chain. The levels are stored
+// one after another, largest first, which is the layout ReadCompressedPixels
+// returns for DDS files. Returns the size of the first level.
+size_t BC7_EncodeImage(const uint8_t *bgra, int width, int height, TArray<uint8_t> &output, int &mipLevels);
@@ -37,6 +37,9 @@
 #include "basics.h"
 #include "tarray.h"
 #include "xs_Float.h"
+#include "c_cvars.h"
+
+EXTERN_CVAR(Int, gl_texture_quality)
 
 //===========================================================================
 // 
@@ -72,6 +75,19 @@ static void ResampleBoxPrecalc(TArray<BoxPrecalc>& boxes, int oldDim)
 	}
 }
 
+//===========================================================================
+// 
+// gl_texture_quality applies to textures that allow quality reduction,
+// the streaming level to everything. Never skips the last mip.
+//
+//===========================================================================
+
+int IHardwareTexture::GetStartMip(int numMips, bool allowQualityReduction) const
+{
+	int start = std::max(allowQualityReduction ? (int)gl_texture_quality : 0, streamLevel);
+	return std::max(0, std::min(start, numMips - 1));
+}
+
 void IHardwareTexture::Resize(int swidth, int sheight, int width, int height, unsigned char *src_data, unsigned char *dst_data)
 {
 
@@ -38,9 +38,18 @@ public:
 
 	void Resize(int swidth, int sheight, int width, int height, unsigned char *src_data, unsigned char *dst_data);
 
+	// First mip level to upload from images that store their own mipmaps
+	int GetStartMip(int numMips, bool allowQualityReduction) const;
+	void SetStreamLevel(int level) { streamLevel = level; }
+	int GetStreamLevel() const { return streamLevel; }
+	void SetCompressed(bool on) { compressed = on; }
+	bool IsCompressed() const { return compressed; }	// Uploaded as BC7 with stored mipmaps
+
 	int GetBufferPitch() const { return bufferpitch; }
 
 protected:
 	int bufferpitch = -1;
+	int streamLevel = 0;	// Mip levels skipped by the texture streamer
+	bool compressed = false;
 	HardwareState hwState = NONE;
 };
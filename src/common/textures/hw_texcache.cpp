@@ -0,0 +1,500 @@
+/*
+** hw_texcache.cpp
+** Keeps BC7 transcoded copies of textures in the cache directory
+**
+**---------------------------------------------------------------------------
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see http://www.gnu.org/licenses/
+**
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <stdio.h>
+#include <sys/types.h>
+#ifdef _WIN32
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+#include <algorithm>
+#include "printf.h"
+#include "files.h"
+#include "filesystem.h"
+#include "cmdlib.h"
+#include "i_specialpaths.h"
+#include "c_cvars.h"
+#include "c_dispatch.h"
+#include "stats.h"
+#include "md5.h"
+#include "bitmap.h"
+#include "image.h"
+#include "textures.h"
+#include "texturemanager.h"
+#include "v_video.h"
+#include "bc7encoder.h"
+#include "fs_findfile.h"
+#include "utf8.h"
+#include "hw_texcache.h"
+
+CVARD(Bool, gl_texture_transcode, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG, "encodes PNG, JPEG and WebP textures to BC7 and keeps them in the cache directory (desktop OpenGL and Vulkan only)")
+CVARD(Int, gl_texture_cache_size, 2048, CVAR_ARCHIVE | CVAR_GLOBALCONFIG, "size limit of the texture transcode cache in MB, 0 = unlimited")
+
+FTextureTranscodeCache TexTranscodeCache;
+
+static const char TranscodeMagic[4] = { 'B', 'C', '7', 'C' };
+static const uint32_t TranscodeVersion = 1;		// Bump when the encoder output changes
+
+struct FTranscodeHeader
+{
+	char Magic[4];
+	uint32_t Version;
+	uint32_t Width, Height;
+	uint32_t MipLevels;
+	uint32_t Translucent;
+	uint32_t UnitSize, TotalSize;
+};
+
+static size_t TotalSize(int width, int height, int mipLevels)
+{
+	size_t total = 0;
+	for (int i = 0; i < mipLevels; i++)
+	{
+		total += BC7_LevelSize(width, height);
+		width = std::max(1, width >> 1);
+		height = std::max(1, height >> 1);
+	}
+	return total;
+}
+
+//==========================================================================
+//
+// Reading a file marks it as recently used
+//
+//==========================================================================
+
+static void TouchFile(const FString &path)
+{
+#ifdef _WIN32
+	_wutime(path.WideString().c_str(), nullptr);
+#else
+	utime(path.GetChars(), nullptr);
+#endif
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void FTextureTranscodeCache::Init(bool supported)
+{
+#ifdef __MOBILE__
+	// GLES devices sample ETC2 and ASTC, the encoder only produces BC7
+	supported = false;
+#endif
+	mSupported = supported;
+	if (mPath.IsEmpty() && supported)
+	{
+		mPath = M_GetCachePath(true);
+		mPath << "/texcache/";
+		CreatePath(mPath.GetChars());
+		Trim();
+	}
+}
+
+//==========================================================================
+//
+// The loaders must be stopped before this is called, so that nothing
+// submits new work. Lump numbers may change after this (restart), so
+// everything keyed by them goes too.
+//
+//==========================================================================
+
+void FTextureTranscodeCache::Shutdown()
+{
+	for (auto &thread : mThreads) thread->stop();
+	mThreads.clear();
+
+	FTranscodeJob job;
+	while (mJobs.dequeue(job))
+	{
+		if (job.Pixels) free(job.Pixels);
+		delete job.Params;
+	}
+
+	std::lock_guard lock(mLock);
+	mDigests.Clear();
+	mQueued.Clear();
+	mCached.Clear();
+}
+
+//==========================================================================
+//
+// Only images whose pixels come from their lump and nothing else can be
+// cached by the lump's hash. Translations, palettes, sprite expansion and
+// trimming all change the result.
+//
+//==========================================================================
+
+bool FTextureTranscodeCache::CanTranscode(FImageSource *img, int translation, bool expand, bool generateSpi)
+{
+	if (!gl_texture_transcode || !mSupported || mPath.IsEmpty() || img == nullptr) return false;
+	if (translation != 0 || expand || generateSpi) return false;
+	if (img->IsGPUOnly() || img->UseGamePalette() || !img->IsLumpImage()) return false;
+
+	int width = img->GetWidth(), height = img->GetHeight();
+	return width >= MIN_SIZE && height >= MIN_SIZE && (width & 3) == 0 && (height & 3) == 0;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+bool FTextureTranscodeCache::GetDigest(int lump, Digest &digest)
+{
+	{
+		std::lock_guard lock(mLock);
+		auto found = mDigests.CheckKey(lump);
+		if (found != nullptr)
+		{
+			digest = *found;
+			return true;
+		}
+	}
+
+	FileReader reader = fileSystem.OpenFileReader(lump, FileSys::EReaderType::READER_NEW, 0);
+	if (!reader.isOpen()) return false;
+
+	MD5Context md5;
+	uint8_t buffer[65536];
+	for (;;)
+	{
+		auto count = reader.Read(buffer, sizeof(buffer));
+		if (count <= 0) break;
+		md5.Update(buffer, (unsigned)count);
+	}
+	md5.Final(digest.Bytes);
+
+	std::lock_guard lock(mLock);
+	mDigests[lump] = digest;
+	return true;
+}
+
+FString FTextureTranscodeCache::CacheFileName(const Digest &digest, int conversion)
+{
+	FString name = mPath;
+	for (auto b : digest.Bytes) name.AppendFormat("%02x", b);
+	name.AppendFormat(".%d.bc7", conversion);
+	return name;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+bool FTextureTranscodeCache::Read(int lump, int conversion, int width, int height, unsigned char **data, size_t &size, size_t &unitSize, int &mipLevels, int &translucent)
+{
+	Digest digest;
+	if (!GetDigest(lump, digest)) return false;
+
+	FileReader fr;
+	FTranscodeHeader header;
+	int numLevels = BC7_NumMipLevels(width, height);
+	size_t total = TotalSize(width, height, numLevels);
+
+	if (!fr.OpenFile(CacheFileName(digest, conversion).GetChars()) ||
+		fr.Read(&header, sizeof(header)) != sizeof(header) ||
+		memcmp(header.Magic, TranscodeMagic, 4) != 0 ||
+		header.Version != TranscodeVersion ||
+		header.Width != (uint32_t)width || header.Height != (uint32_t)height ||
+		header.MipLevels != (uint32_t)numLevels ||
+		header.UnitSize != BC7_LevelSize(width, height) || header.TotalSize != total)
+	{
+		mMisses++;
+		return false;
+	}
+
+	*data = (unsigned char *)malloc(total);
+	if (fr.Read(*data, total) != (ptrdiff_t)total)
+	{
+		// Truncated file, it gets written again
+		free(*data);
+		*data = nullptr;
+		mMisses++;
+		return false;
+	}
+
+	fr.Close();
+	TouchFile(CacheFileName(digest, conversion));
+
+	size = total;
+	unitSize = header.UnitSize;
+	mipLevels = numLevels;
+	translucent = header.Translucent;
+
+	SetCached(lump, conversion);
+	mHits++;
+	mBytesRead += total;
+	mBytesSaved += (size_t)width * height * 4 - header.UnitSize;
+	return true;
+}
+
+void FTextureTranscodeCache::SetCached(int lump, int conversion)
+{
+	std::lock_guard lock(mLock);
+	mCached[JobKey(lump, conversion)] = true;
+}
+
+bool FTextureTranscodeCache::IsCached(int lump, int conversion)
+{
+	std::lock_guard lock(mLock);
+	return mCached.CheckKey(JobKey(lump, conversion)) != nullptr;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+bool FTextureTranscodeCache::Queue(const FTranscodeJob &job, EQueuePriority priority)
+{
+	std::lock_guard lock(mLock);
+	int64_t key = JobKey(job);
+	if (mQueued.CheckKey(key) != nullptr) return false;
+	if (job.Pixels != nullptr && mJobs.size() >= MAX_PENDING) return false;
+	mQueued[key] = true;
+
+	if (mThreads.empty())
+	{
+		// Encoding is slow, but it only happens once per texture. Keep most of the cores for the loaders.
+		int numThreads = std::max(1, ResourceWorkerThreadCount(0) / 2);
+		for (int i = 0; i < numThreads; i++)
+		{
+			std::unique_ptr<FTranscodeThread> ptr(new FTranscodeThread(&mJobs));
+			ptr->start();
+			mThreads.push_back(std::move(ptr));
+		}
+	}
+
+	mJobs.queue(key, job, priority);
+	return true;
+}
+
+void FTextureTranscodeCache::Submit(int lump, int conversion, const uint8_t *pixels, int width, int height, int translucent)
+{
+	size_t size = (size_t)width * height * 4;
+	FTranscodeJob job = { lump, conversion, nullptr, nullptr, (uint8_t *)malloc(size), width, height, translucent };
+	memcpy(job.Pixels, pixels, size);
+
+	if (!Queue(job, QUEUE_Nearby)) free(job.Pixels);
+}
+
+//==========================================================================
+//
+// Fills the cache ahead of time instead of waiting for every texture to
+// be loaded once
+//
+//==========================================================================
+
+int FTextureTranscodeCache::SubmitAll()
+{
+	int count = 0;
+	for (int i = 0; i < TexMan.NumTextures(); i++)
+	{
+		auto tex = TexMan.GameByIndex(i);
+		if (tex == nullptr || !tex->isValid() || tex->GetUseType() == ETextureType::Sprite) continue;
+
+		auto img = tex->GetTexture()->GetImage();
+		if (!CanTranscode(img, 0, false, false)) continue;
+
+		auto imgtex = dynamic_cast<FImageTexture *>(tex->GetTexture());
+		int conversion = imgtex && imgtex->GetNoRemap0() ? FImageSource::noremap0 : FImageSource::normal;
+
+		FTranscodeJob job = { img->LumpNum(), conversion, img, img->NewLoaderParams(conversion, 0, nullptr), nullptr, img->GetWidth(), img->GetHeight(), 0 };
+		if (Queue(job, QUEUE_Precache)) count++;
+		else delete job.Params;
+	}
+	return count;
+}
+
+//==========================================================================
+//
+// Runs on the workers. The file is written under a temporary name first,
+// so a loader never sees half of it.
+//
+//==========================================================================
+
+bool FTextureTranscodeCache::Write(const FTranscodeJob &job)
+{
+	Digest digest;
+	if (!GetDigest(job.Lump, digest)) return false;
+
+	FString path = CacheFileName(digest, job.Conversion);
+	FBitmap bitmap;
+	const uint8_t *pixels = job.Pixels;
+	int translucent = job.Translucent;
+
+	if (pixels == nullptr)
+	{
+		// Queued by SubmitAll, skip what is already there
+		FileReader fr;
+		if (fr.OpenFile(path.GetChars())) return false;
+
+		bitmap.Create(job.Width, job.Height);
+		translucent = job.Image->ReadPixels(job.Params, &bitmap);
+		pixels = bitmap.GetPixels();
+	}
+
+	FTranscodeHeader header;
+	TArray<uint8_t> blocks;
+	int mipLevels;
+	memcpy(header.Magic, TranscodeMagic, 4);
+	header.Version = TranscodeVersion;
+	header.Width = job.Width;
+	header.Height = job.Height;
+	header.Translucent = translucent;
+	header.UnitSize = (uint32_t)BC7_EncodeImage(pixels, job.Width, job.Height, blocks, mipLevels);
+	header.MipLevels = mipLevels;
+	header.TotalSize = blocks.Size();
+
+	FString temp;
+	temp.Format("%s.%d.tmp", path.GetChars(), job.Lump);
+	std::unique_ptr<FileWriter> fw(FileWriter::Open(temp.GetChars()));
+	if (!fw) return false;
+
+	bool ok = fw->Write(&header, sizeof(header)) == sizeof(header) && fw->Write(blocks.Data(), blocks.Size()) == blocks.Size();
+	fw.reset();
+
+	if (!ok || rename(temp.GetChars(), path.GetChars()) != 0)
+	{
+		remove(temp.GetChars());
+		return false;
+	}
+
+	SetCached(job.Lump, job.Conversion);
+	if (++mWritten % TRIM_INTERVAL == 0) Trim();
+	return true;
+}
+
+//==========================================================================
+//
+// Runs on startup and every TRIM_INTERVAL written files. Files that are
+// open elsewhere may fail to delete on Windows, they are tried next time.
+//
+//==========================================================================
+
+void FTextureTranscodeCache::Trim()
+{
+	size_t limit = (size_t)std::max<int>(gl_texture_cache_size, 0) * 1024 * 1024;
+	if (limit == 0 || mPath.IsEmpty()) return;
+
+	// Another worker is already at it
+	std::unique_lock lock(mTrimLock, std::try_to_lock);
+	if (!lock.owns_lock()) return;
+
+	struct CacheFile
+	{
+		std::string Path;
+		size_t Size;
+		time_t Time;
+	};
+	TArray<CacheFile> files;
+	size_t total = 0;
+
+	FileSys::FileList list;
+	FileSys::ScanDirectory(list, mPath.GetChars(), "*.bc7", true);
+	for (auto &entry : list)
+	{
+		if (entry.isDirectory) continue;
+
+		CacheFile file = { entry.FilePath, entry.Length, 0 };
+		GetFileInfo(file.Path.c_str(), &file.Size, &file.Time);
+		files.Push(file);
+		total += file.Size;
+	}
+	if (total <= limit) return;
+
+	std::sort(files.begin(), files.end(), [](const CacheFile &a, const CacheFile &b) { return a.Time < b.Time; });
+	for (auto &file : files)
+	{
+		if (total <= limit) break;
+		if (remove(file.Path.c_str()) == 0)
+		{
+			total -= file.Size;
+			mTrimmed++;
+		}
+	}
+}
+
+bool FTranscodeThread::loadResource(FTranscodeJob &input, FTranscodeJob &output)
+{
+	TexTranscodeCache.Write(input);
+	if (input.Pixels) free(input.Pixels);
+	delete input.Params;
+	return false;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+FTextureTranscodeCache::Stats FTextureTranscodeCache::GetStats()
+{
+	Stats stats;
+	stats.Hits = mHits;
+	stats.Misses = mMisses;
+	stats.Written = mWritten;
+	stats.Trimmed = mTrimmed;
+	stats.Pending = mJobs.size();
+	stats.BytesRead = mBytesRead;
+	stats.BytesSaved = mBytesSaved;
+	return stats;
+}
+
+CCMD(texcache_build)
+{
+	if (!gl_texture_transcode)
+	{
+		Printf("gl_texture_transcode is off\n");
+		return;
+	}
+	if (!(screen->hwcaps & RFL_TEXTURE_COMPRESSION_BPTC))
+	{
+		Printf("BC7 textures are not supported by this device, the cache is for desktop OpenGL and Vulkan only\n");
+		return;
+	}
+	TexTranscodeCache.Init(true);
+	Printf("%d textures queued for transcoding\n", TexTranscodeCache.SubmitAll());
+}
+
+ADD_STAT(texcache)
+{
+	if (!gl_texture_transcode) return "Texture transcoding is off";
+
+	auto stats = TexTranscodeCache.GetStats();
+	FString out;
+	out.Format("Hits: %u  Misses: %u  Written: %u  Pending: %u  Trimmed: %u\nRead: %.1fMB  Upload saved: %.1fMB",
+		stats.Hits, stats.Misses, stats.Written, stats.Pending, stats.Trimmed,
+		stats.BytesRead / (1024. * 1024.), stats.BytesSaved / (1024. * 1024.));
+	return out;
+}
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <mutex>
+#include <memory>
+#include <vector>
+#include "tarray.h"
+#include "zstring.h"
+#include "TSQueue.h"
+
+class FImageSource;
+class FImageLoadParams;
+
+//==========================================================================
+//
+// Texture transcode cache
+//
+// Images that have to be decoded on the CPU every time they load (PNG,
+// JPEG, WebP...) are encoded to BC7 on worker threads after their first
+// load. The blocks are stored in the cache directory, keyed by the MD5 of
+// the lump, and the background loaders read them from there on later runs
+// and upload them as is, like DDS files.
+//
+// This is for the desktop OpenGL and Vulkan renderers only. GLES devices
+// (mobile, Quest) sample ETC2 and ASTC rather than BC7, and the GLES
+// renderer never enables the cache. Mobile builds have it compiled out.
+//
+// The directory is kept below gl_texture_cache_size. Files are touched when
+// they are read, so the least recently used ones are deleted first.
+//
+//==========================================================================
+
+struct FTranscodeJob
+{
+	int Lump;
+	int Conversion;
+	FImageSource *Image;
+	FImageLoadParams *Params;	// Set when the worker has to decode the image itself
+	uint8_t *Pixels;			// BGRA, owned by the job
+	int Width, Height;
+	int Translucent;
+};
+
+class FTranscodeThread : public ResourceLoader2<FTranscodeJob, FTranscodeJob, int64_t>
+{
+public:
+	FTranscodeThread(TSResourceQueue<FTranscodeJob, int64_t> *inQueue) : ResourceLoader2(inQueue, nullptr) {}
+
+protected:
+	bool loadResource(FTranscodeJob &input, FTranscodeJob &output) override;
+	const char *threadName() const override { return "Texture transcoder"; }
+};
+
+class FTextureTranscodeCache
+{
+public:
+	enum
+	{
+		MAX_PENDING = 32,		// Jobs from the loaders hold a copy of the pixels, so don't let them pile up
+		MIN_SIZE = 16,			// Smaller textures are not worth a file
+		TRIM_INTERVAL = 64,		// Files written between checks of the directory size
+	};
+
+	struct Stats
+	{
+		unsigned Hits, Misses, Written, Pending, Trimmed;
+		size_t BytesRead, BytesSaved;
+	};
+
+	// Called by the renderer when it starts and stops its background loader.
+	// Nothing is transcoded if the device can't sample BC7.
+	void Init(bool supported);
+	void Shutdown();
+
+	// Main thread only. Decides if a background load may use the cache.
+	bool CanTranscode(FImageSource *img, int translation, bool expand, bool generateSpi);
+
+	// Thread safe. Reads cached blocks in the layout of ReadCompressedPixels, data is allocated with malloc.
+	bool Read(int lump, int conversion, int width, int height, unsigned char **data, size_t &size, size_t &unitSize, int &mipLevels, int &translucent);
+
+	// Thread safe. Queues decoded BGRA pixels for encoding, the pixels are copied.
+	void Submit(int lump, int conversion, const uint8_t *pixels, int width, int height, int translucent);
+
+	// Main thread only. Queues every eligible texture, the workers decode them on their own.
+	int SubmitAll();
+
+	// Thread safe. Tells if a load of the lump has found or written its blocks, so its next load will be BC7.
+	bool IsCached(int lump, int conversion);
+
+	bool Write(const FTranscodeJob &job);
+	Stats GetStats();
+
+	// Thread safe. Deletes the least recently used files until the directory fits into gl_texture_cache_size.
+	void Trim();
+
+private:
+	struct Digest { uint8_t Bytes[16]; };
+
+	bool GetDigest(int lump, Digest &digest);
+	FString CacheFileName(const Digest &digest, int conversion);
+	bool Queue(const FTranscodeJob &job, EQueuePriority priority);
+
+	// Every conversion of a lump is a file of its own
+	static int64_t JobKey(int lump, int conversion) { return ((int64_t)lump << 16) | conversion; }
+	static int64_t JobKey(const FTranscodeJob &job) { return JobKey(job.Lump, job.Conversion); }
+	void SetCached(int lump, int conversion);
+
+	FString mPath;
+	bool mSupported = false;
+	std::mutex mLock;
+	TMap<int, Digest> mDigests;
+	TMap<int64_t, bool> mQueued;	// Lump and conversion pairs encoded or waiting to be, so nothing is encoded twice
+	TMap<int64_t, bool> mCached;	// Lump and conversion pairs known to have a valid file
+
+	TSResourceQueue<FTranscodeJob, int64_t> mJobs;
+	std::vector<std::unique_ptr<FTranscodeThread>> mThreads;
+
+	std::mutex mTrimLock;
+	std::atomic<unsigned> mHits{ 0 }, mMisses{ 0 }, mWritten{ 0 }, mTrimmed{ 0 };
+	std::atomic<size_t> mBytesRead{ 0 }, mBytesSaved{ 0 };
+};
+
+extern FTextureTranscodeCache TexTranscodeCache;
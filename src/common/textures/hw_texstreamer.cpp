@@ -0,0 +1,319 @@
+/*
+** hw_texstreamer.cpp
+** Picks mip levels for world textures and keeps them inside a memory budget
+**
+**---------------------------------------------------------------------------
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see http://www.gnu.org/licenses/
+**
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <math.h>
+#include <algorithm>
+#include "hw_texstreamer.h"
+
+FTextureStreamer TexStreamer;
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void FTextureStreamer::Unlink(int index)
+{
+	auto &e = mEntries[index];
+	if (e.Prev >= 0) mEntries[e.Prev].Next = e.Next;
+	else mHead = e.Next;
+	if (e.Next >= 0) mEntries[e.Next].Prev = e.Prev;
+	else mTail = e.Prev;
+	e.Prev = e.Next = -1;
+}
+
+void FTextureStreamer::LinkFront(int index)
+{
+	auto &e = mEntries[index];
+	e.Prev = -1;
+	e.Next = mHead;
+	if (mHead >= 0) mEntries[mHead].Prev = index;
+	else mTail = index;
+	mHead = index;
+}
+
+//==========================================================================
+//
+// One level per doubling of texels per pixel, plus the budget bias.
+//
+//==========================================================================
+
+int FTextureStreamer::WantedLevel(const Entry &e) const
+{
+	int level = e.TexelsPerPixel > 1.f ? (int)floorf(log2f(e.TexelsPerPixel)) : 0;
+	level += mBias;
+	return std::clamp(level, 0, e.NumLevels - 1);
+}
+
+//==========================================================================
+//
+// Whether a texture has mipmaps to skip and how large it is depends on the
+// format it was uploaded in, which is only certain once it is loaded.
+// Called for loaded textures only.
+//
+//==========================================================================
+
+void FTextureStreamer::Measure(Entry &e)
+{
+	e.NumLevels = std::max(1, mBackend->NumLevels(e.Texture));
+	e.Level = std::min(e.Level, e.NumLevels - 1);	// Uploads never skip the last level
+	mResident -= e.Size;
+	e.Size = mBackend->LevelSize(e.Texture, e.Level);
+	mResident += e.Size;
+	e.Measured = true;
+}
+
+//==========================================================================
+//
+// Returns false if the per-frame change limit has been reached or the
+// texture is busy.
+//
+//==========================================================================
+
+bool FTextureStreamer::ChangeLevel(Entry &e, int level)
+{
+	if (mChangesLeft <= 0 || !mBackend->SetLevel(e.Texture, level)) return false;
+	mChangesLeft--;
+	mChanges++;
+
+	if (e.Level >= 0) mResident -= e.Size;
+	e.Level = level;
+	e.Size = mBackend->LevelSize(e.Texture, level);
+	e.Measured = false;
+	mResident += e.Size;
+	return true;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+bool FTextureStreamer::Release(int index, bool evict)
+{
+	auto &e = mEntries[index];
+	if (evict)
+	{
+		if (!mBackend->Evict(e.Texture)) return false;
+		mEvictions++;
+	}
+	if (e.Level >= 0) mResident -= e.Size;
+	Unlink(index);
+	mIndex.Remove(e.Texture);
+	e.Texture = nullptr;
+	mFree.Push(index);
+	return true;
+}
+
+//==========================================================================
+//
+// Draws come in large numbers, so this only touches the entry. The level
+// is only set here for textures that are not loaded yet, so that the
+// draw that follows loads them at the right size.
+//
+//==========================================================================
+
+void FTextureStreamer::MarkUsed(FGameTexture *tex, float texelsPerPixel)
+{
+	if (mBackend == nullptr || tex == nullptr) return;
+
+	int index;
+	auto found = mIndex.CheckKey(tex);
+	if (found == nullptr)
+	{
+		if (mFree.Size() > 0) mFree.Pop(index);
+		else index = mEntries.Reserve(1);
+
+		auto &e = mEntries[index];
+		e.Texture = tex;
+		e.LastUsed = mFrame;
+		e.TexelsPerPixel = texelsPerPixel;
+		e.NumLevels = std::max(1, mBackend->NumLevels(tex));
+		e.Level = -1;
+		e.Size = 0;
+		e.Measured = false;
+		LinkFront(index);
+		mIndex[tex] = index;
+		mVisible++;
+
+		if (mBackend->IsLoaded(tex))
+		{
+			// Loaded before we knew about it, most likely by the precacher
+			e.Level = 0;
+			e.Size = mBackend->LevelSize(tex, 0);
+			e.Measured = true;
+			mResident += e.Size;
+		}
+		else
+		{
+			e.Level = mBackend->SetLevel(tex, WantedLevel(e)) ? WantedLevel(e) : 0;
+			e.Size = mBackend->LevelSize(tex, e.Level);
+			mResident += e.Size;
+		}
+		return;
+	}
+
+	index = *found;
+	auto &e = mEntries[index];
+	if (e.LastUsed != mFrame)
+	{
+		e.LastUsed = mFrame;
+		e.TexelsPerPixel = texelsPerPixel;
+		if (index != mHead)
+		{
+			Unlink(index);
+			LinkFront(index);
+		}
+		mVisible++;
+	}
+	else if (texelsPerPixel < e.TexelsPerPixel)
+	{
+		e.TexelsPerPixel = texelsPerPixel;
+	}
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void FTextureStreamer::Update()
+{
+	if (mBackend == nullptr) return;
+
+	mChangesLeft = MAX_CHANGES_PER_FRAME;
+
+	// Textures that were drawn last frame sit at the front of the list.
+	// Raise detail right away, but only lower it when it is two levels off
+	// so that textures near a level boundary do not keep reloading.
+	// Over budget, any drop is taken.
+	bool overBudget = mBudget > 0 && mResident > mBudget;
+	for (int i = mHead; i >= 0; i = mEntries[i].Next)
+	{
+		auto &e = mEntries[i];
+		if (e.LastUsed != mFrame) break;
+
+		if (e.Level < 0 || !mBackend->IsLoaded(e.Texture))
+		{
+			// Not loaded yet or unloaded by someone else. The next draw loads it.
+			e.NumLevels = std::max(1, mBackend->NumLevels(e.Texture));
+			int wanted = WantedLevel(e);
+			if (!mBackend->SetLevel(e.Texture, wanted)) continue;
+			if (e.Level >= 0) mResident -= e.Size;
+			e.Level = wanted;
+			e.Size = mBackend->LevelSize(e.Texture, wanted);
+			e.Measured = false;
+			mResident += e.Size;
+			continue;
+		}
+
+		if (!e.Measured) Measure(e);
+
+		int wanted = WantedLevel(e);
+		if (wanted < e.Level || wanted >= e.Level + (overBudget ? 1 : 2))
+		{
+			ChangeLevel(e, wanted);
+		}
+	}
+
+	if (mBudget > 0)
+	{
+		// Evict from the back of the list until we fit, but keep anything
+		// that was drawn recently.
+		while (mResident > mBudget && mTail >= 0 && mEntries[mTail].LastUsed < mFrame - EVICT_AGE)
+		{
+			if (!Release(mTail, true)) break;
+		}
+
+		// If the recent textures alone do not fit, everything has to lose detail.
+		if (mFrame - mLastBiasChange >= BIAS_DELAY)
+		{
+			if (mResident > mBudget && mBias < MAX_BIAS)
+			{
+				mBias++;
+				mLastBiasChange = mFrame;
+			}
+			else if (mBias > 0 && mResident < mBudget / 2)
+			{
+				// Going up a level takes four times the memory, so wait until
+				// there is plenty of room.
+				mBias--;
+				mLastBiasChange = mFrame;
+			}
+		}
+	}
+	else if (mBias > 0)
+	{
+		mBias = 0;
+	}
+
+	mFrame++;
+	mLastVisible = mVisible;
+	mVisible = 0;
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+void FTextureStreamer::Forget(FGameTexture *tex)
+{
+	auto found = mIndex.CheckKey(tex);
+	if (found != nullptr) Release(*found, false);
+}
+
+void FTextureStreamer::Clear()
+{
+	if (mBackend != nullptr)
+	{
+		for (int i = mHead; i >= 0; i = mEntries[i].Next)
+		{
+			if (mEntries[i].Level > 0) mBackend->SetLevel(mEntries[i].Texture, 0);
+		}
+	}
+	mEntries.Clear();
+	mFree.Clear();
+	mIndex.Clear();
+	mHead = mTail = -1;
+	mResident = 0;
+	mBias = 0;
+	mVisible = mLastVisible = 0;
+}
+
+FTextureStreamer::Stats FTextureStreamer::GetStats() const
+{
+	Stats stats;
+	stats.Textures = mIndex.CountUsed();
+	stats.Visible = mLastVisible;
+	stats.Resident = mResident;
+	stats.Budget = mBudget;
+	stats.Bias = mBias;
+	stats.Changes = mChanges;
+	stats.Evictions = mEvictions;
+	return stats;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <stddef.h>
+#include "tarray.h"
+
+class FGameTexture;
+
+//==========================================================================
+//
+// Texture streaming
+//
+// The renderer reports which textures it draws each frame and how many
+// texels end up on one screen pixel. From that the streamer picks a mip
+// level for each texture, and when a memory budget is set it evicts the
+// least recently used textures and lowers detail until everything fits.
+//
+// All device access goes through ITextureStreamBackend so the streamer
+// can be driven without a renderer.
+//
+//==========================================================================
+
+class ITextureStreamBackend
+{
+public:
+	virtual ~ITextureStreamBackend() = default;
+
+	// Number of mip levels the texture can be loaded at. 1 means full size only.
+	// Before the texture is loaded this may only be a guess, the streamer asks
+	// again once it is.
+	virtual int NumLevels(FGameTexture *tex) = 0;
+
+	// Memory the texture takes when loaded at the given level. Same as above.
+	virtual size_t LevelSize(FGameTexture *tex, int level) = 0;
+
+	virtual bool IsLoaded(FGameTexture *tex) = 0;
+
+	// Makes the next load of the texture start at this level. Loaded data at
+	// a different level gets released so that it will be reloaded.
+	// Returns false if the texture is busy loading and cannot be changed yet.
+	virtual bool SetLevel(FGameTexture *tex, int level) = 0;
+
+	// Releases all loaded data for the texture. Same return value as SetLevel.
+	virtual bool Evict(FGameTexture *tex) = 0;
+};
+
+class FTextureStreamer
+{
+public:
+	enum
+	{
+		MAX_BIAS = 4,				// Budget pressure never drops more levels than this
+		MAX_CHANGES_PER_FRAME = 8,	// Level changes reload textures, so spread them out
+		EVICT_AGE = 2,				// Frames a texture must be unused before it can be evicted
+		BIAS_DELAY = 35,			// Frames between changes of the budget bias
+	};
+
+	struct Stats
+	{
+		unsigned Textures, Visible;
+		size_t Resident, Budget;
+		int Bias;
+		unsigned Changes, Evictions;
+	};
+
+	void SetBackend(ITextureStreamBackend *backend) { Clear(); mBackend = backend; }
+	void SetBudget(size_t bytes) { mBudget = bytes; }
+
+	// Called for every draw. texelsPerPixel is how many texels of the full
+	// size texture fall on one screen pixel at the closest point.
+	void MarkUsed(FGameTexture *tex, float texelsPerPixel);
+
+	// Called once per frame before the scene is drawn.
+	void Update();
+
+	// Stops tracking the texture without touching its data.
+	void Forget(FGameTexture *tex);
+
+	// Stops tracking all textures and resets their levels to full size.
+	void Clear();
+
+	Stats GetStats() const;
+
+private:
+	struct Entry
+	{
+		FGameTexture *Texture;
+		int LastUsed;
+		float TexelsPerPixel;	// Smallest value of the frame
+		int Level;				// Level it is loaded at, -1 when not loaded
+		int NumLevels;
+		size_t Size;
+		bool Measured;			// NumLevels and Size were taken from the loaded data, not guessed before the load
+		int Prev, Next;			// LRU list, most recent first
+	};
+
+	int WantedLevel(const Entry &e) const;
+	void Measure(Entry &e);
+	bool ChangeLevel(Entry &e, int level);
+	bool Release(int index, bool evict);
+	void Unlink(int index);
+	void LinkFront(int index);
+
+	ITextureStreamBackend *mBackend = nullptr;
+	TArray<Entry> mEntries;
+	TArray<int> mFree;
+	TMap<FGameTexture *, int> mIndex;
+	int mHead = -1, mTail = -1;
+	int mFrame = 0;
+	int mBias = 0, mLastBiasChange = 0;
+	int mChangesLeft = 0;
+	size_t mBudget = 0, mResident = 0;
+	unsigned mVisible = 0, mLastVisible = 0, mChanges = 0, mEvictions = 0;
+};
+
+extern FTextureStreamer TexStreamer;
@@ -216,6 +216,12 @@ public:
 		return SourceLump;
 	}
 
+	// The image was created straight from its lump, so the lump alone defines its pixels. Main thread only.
+	bool IsLumpImage() const
+	{
+		return SourceLump >= 0 && (unsigned)SourceLump < ImageForLump.Size() && ImageForLump[SourceLump] == this;
+	}
+
 	bool UseGamePalette() const
 	{
 		return bUseGamePalette;
@@ -562,6 +562,7 @@ IHardwareTexture* FTexture::GetHardwareTexture(int translation, int scaleflags)
 	if (hwtex == nullptr)
 	{
 		hwtex = screen->CreateHardwareTexture(indexed? 1 : 4);
+		hwtex->SetStreamLevel(StreamLevel);
 		SystemTextures.AddHardwareTexture(translation, scaleflags, hwtex);
 	}
 	return hwtex;
@@ -18,6 +18,7 @@ class FTextureManager
 {
 	void (*progressFunc)();
 	friend class FxAddSub;	// needs access to do a bounds check on the texture ID.
+	friend class FScriptCache;	// and so does the script cache, to find the count again.
 public:
 	FTextureManager ();
 	~FTextureManager ();
@@ -224,6 +224,7 @@ protected:
 	bool bHdr = false; 				// only canvas textures for now.
 	int8_t bTranslucent = -1;
 	int8_t areacount = 0;			// this is capped at 4 sections.
+	int8_t StreamLevel = 0;			// Mip level new hardware textures start at, set by the texture streamer
 
 
 public:
@@ -252,6 +253,16 @@ public:
 		SystemTextures.CleanUnused();
 	}
 
+	bool HasHardwareTextures()
+	{
+		bool found = false;
+		SystemTextures.Iterate([&](IHardwareTexture*) { found = true; });
+		return found;
+	}
+
+	int GetStreamLevel() const { return StreamLevel; }
+	void SetStreamLevel(int level) { StreamLevel = (int8_t)level; }
+
 	int GetWidth() { return Width; }
 	int GetHeight() { return Height; }
 
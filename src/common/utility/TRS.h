@@ -48,7 +48,7 @@ public:
 		scaling = FVector3(0,0,0);
 	}
 
-	bool Equals(TRS& compare)
+	bool Equals(const TRS& compare) const
 	{
 		return compare.translation == this->translation && compare.rotation == this->rotation && compare.scaling == this->scaling;
 	}
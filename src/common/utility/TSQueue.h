@@ -6,12 +6,15 @@
 #include <mutex>
 #include <atomic>
 #include <algorithm>
+#include <deque>
+#include <unordered_map>
 
 #ifdef __linux__
 #include <condition_variable>
 #endif
 #include <chrono>
 #include "stats.h"
+#include "profiler.h"
 #include "tarray.h"
 
 
@@ -75,45 +78,44 @@ public:
 
 	bool dequeue(T &item) {
 		std::lock_guard lock(mQLock);
-		return mQueue.Pop(item);
+		if (mQueue.empty()) return false;
+		item = std::move(mQueue.front());
+		mQueue.pop_front();
+		return true;
 	}
 
 	void queue(T &item) {
 		std::lock_guard lock(mQLock);
-		mQueue.Insert(0, item);
+		mQueue.push_back(item);
 	}
 
 	void clear() {
 		std::lock_guard lock(mQLock);
-		mQueue.Clear();
+		mQueue.clear();
 	}
 
 	// Delete all items from the queue that match
 	// based on search function
 	int deleteSearch(const std::function <bool(T&)>func) {
 		std::lock_guard lock(mQLock);
-		int size = mQueue.Size();
-		for (unsigned int x = 0; x < mQueue.Size(); x++) {
-			if (func(mQueue[x])) {
-				mQueue.Delete(x);
-				x--;
-			}
-		}
-
-		return size - mQueue.Size();
+		int size = (int)mQueue.size();
+		mQueue.erase(std::remove_if(mQueue.begin(), mQueue.end(), func), mQueue.end());
+		return size - (int)mQueue.size();
 	}
 
 	// Run this func for all elements in the queue
 	void foreach(const std::function <void(T&)>func) {
 		std::lock_guard lock(mQLock);
-		for (unsigned int x = 0; x < mQueue.Size(); x++) { func(mQueue[x]); }
+		for (auto &item : mQueue) { func(item); }
 	}
 
+	// Remove the oldest item that matches
 	bool dequeueSearch(T &item, void *cmp, const std::function <bool(void *a,T&)>func) {
 		std::lock_guard lock(mQLock);
-		for (int x = (int)mQueue.Size() - 1; x >= 0; x--) { 
-			if(func(cmp,mQueue[x])) {
-				mQueue.Pop(item);
+		for (auto it = mQueue.begin(); it != mQueue.end(); ++it) {
+			if(func(cmp, *it)) {
+				item = std::move(*it);
+				mQueue.erase(it);
 				return true;
 			}
 		}
@@ -123,18 +125,185 @@ public:
 
 	int size() {
 		std::lock_guard lock(mQLock);
-		return mQueue.Size();
+		return (int)mQueue.size();
 	}
 
 protected:
-	TArray<T> mQueue;
+	std::deque<T> mQueue;
 	std::mutex mQLock;
 };
 
 
 
-// ResourceLoader<InputType, OutputType>
-template <typename IP, typename OP>
+// Priority classes for background resource loads, most urgent first
+enum EQueuePriority {
+	QUEUE_Visible,			// Needed to draw the current frame
+	QUEUE_Nearby,			// Likely to be needed in the next few frames
+	QUEUE_Precache,			// Level start precaching, load whenever there is nothing else to do
+
+	NUM_QUEUE_PRIORITIES
+};
+
+// Input queue for the resource loaders. Every item is stored under a key
+// (usually the resource it loads) so duplicates are caught with one hash
+// lookup and an item can be moved to another priority class without
+// searching for it. Each class is a FIFO linked through a node pool, so
+// queueing, dequeueing and reprioritizing are all O(1).
+template <typename T, typename K = const void *>
+class TSResourceQueue {
+public:
+	TSResourceQueue() {
+		resetLists();
+	}
+
+	// Returns false if the key was already queued. In that case the queued
+	// item is kept and only moved up if the new priority is more urgent.
+	bool queue(const K &key, const T &item, EQueuePriority priority = QUEUE_Visible) {
+		std::lock_guard lock(mQLock);
+		auto it = mIndex.find(key);
+		if (it != mIndex.end()) {
+			if (priority < mNodes[it->second].priority) {
+				unlink(it->second);
+				link(it->second, priority);
+			}
+			return false;
+		}
+
+		int index = allocNode();
+		mNodes[index].item = item;
+		mNodes[index].key = key;
+		link(index, priority);
+		mIndex.emplace(key, index);
+		return true;
+	}
+
+	// Takes the oldest item of the most urgent class
+	bool dequeue(T &item, EQueuePriority *priority = nullptr) {
+		std::lock_guard lock(mQLock);
+		for (int p = 0; p < NUM_QUEUE_PRIORITIES; p++) {
+			int index = mHead[p];
+			if (index >= 0) {
+				if (priority) *priority = (EQueuePriority)p;
+				item = std::move(mNodes[index].item);
+				mIndex.erase(mNodes[index].key);
+				unlink(index);
+				freeNode(index);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Moves a queued item to the back of another priority class
+	bool reprioritize(const K &key, EQueuePriority priority) {
+		std::lock_guard lock(mQLock);
+		auto it = mIndex.find(key);
+		if (it == mIndex.end()) return false;
+
+		if (mNodes[it->second].priority != priority) {
+			unlink(it->second);
+			link(it->second, priority);
+		}
+		return true;
+	}
+
+	bool remove(const K &key) {
+		std::lock_guard lock(mQLock);
+		auto it = mIndex.find(key);
+		if (it == mIndex.end()) return false;
+
+		int index = it->second;
+		mIndex.erase(it);
+		unlink(index);
+		freeNode(index);
+		return true;
+	}
+
+	bool contains(const K &key) {
+		std::lock_guard lock(mQLock);
+		return mIndex.find(key) != mIndex.end();
+	}
+
+	void clear() {
+		std::lock_guard lock(mQLock);
+		mNodes.Clear();
+		mIndex.clear();
+		resetLists();
+	}
+
+	int size() {
+		std::lock_guard lock(mQLock);
+		return (int)mIndex.size();
+	}
+
+	int size(EQueuePriority priority) {
+		std::lock_guard lock(mQLock);
+		return mCount[priority];
+	}
+
+protected:
+	struct Node {
+		T item;
+		K key;
+		int prev, next;
+		int priority;
+	};
+
+	TArray<Node> mNodes;
+	std::unordered_map<K, int> mIndex;
+	int mHead[NUM_QUEUE_PRIORITIES], mTail[NUM_QUEUE_PRIORITIES], mCount[NUM_QUEUE_PRIORITIES];
+	int mFree;
+	std::mutex mQLock;
+
+	void resetLists() {
+		for (int p = 0; p < NUM_QUEUE_PRIORITIES; p++) {
+			mHead[p] = mTail[p] = -1;
+			mCount[p] = 0;
+		}
+		mFree = -1;
+	}
+
+	int allocNode() {
+		if (mFree >= 0) {
+			int index = mFree;
+			mFree = mNodes[index].next;
+			return index;
+		}
+		return mNodes.Reserve(1);
+	}
+
+	void freeNode(int index) {
+		mNodes[index].item = T();
+		mNodes[index].next = mFree;
+		mFree = index;
+	}
+
+	// Appends a node to the back of a priority class
+	void link(int index, int priority) {
+		Node &node = mNodes[index];
+		node.priority = priority;
+		node.prev = mTail[priority];
+		node.next = -1;
+		if (node.prev >= 0) mNodes[node.prev].next = index;
+		else mHead[priority] = index;
+		mTail[priority] = index;
+		mCount[priority]++;
+	}
+
+	void unlink(int index) {
+		Node &node = mNodes[index];
+		if (node.prev >= 0) mNodes[node.prev].next = node.next;
+		else mHead[node.priority] = node.next;
+		if (node.next >= 0) mNodes[node.next].prev = node.prev;
+		else mTail[node.priority] = node.prev;
+		mCount[node.priority]--;
+	}
+};
+
+
+
+// ResourceLoader<InputType, OutputType, InputKeyType>
+template <typename IP, typename OP, typename K = const void *>
 class ResourceLoader {
 public:
 	ResourceLoader() { }
@@ -142,7 +311,7 @@ public:
 
 	void start() {
 		if (mThread.get_id() == std::thread::id()) {
-			mThread = std::thread(&ResourceLoader<IP, OP>::bgproc, this);
+			mThread = std::thread(&ResourceLoader<IP, OP, K>::bgproc, this);
 		}
 	}
 
@@ -150,10 +319,6 @@ public:
 		mInputQ.clear();
 	}
 
-	void clearSecondaryInputQueue() {
-		mInputSecondaryQ.clear();
-	}
-
 	void stop() {
 		// Kill and finish the thread
 		if (mThread.joinable()) {
@@ -164,28 +329,24 @@ public:
 	}
 
 
-	virtual void queue(IP input) {
-		mInputQ.queue(input);
+	// Returns false if the key was already queued
+	virtual bool queue(const K &key, IP input, EQueuePriority priority = QUEUE_Visible) {
+		if (!mInputQ.queue(key, input, priority)) return false;
 		mMaxQueue = std::max(mMaxQueue.load(), mInputQ.size());
 		mWake.notify_all();
+		return true;
 	}
 
-	virtual void queueSecondary(IP input) {
-		mInputSecondaryQ.queue(input);
-		mMaxQueueSecondary = std::max(mMaxQueueSecondary.load(), mInputSecondaryQ.size());
-		mWake.notify_all();
+	bool reprioritize(const K &key, EQueuePriority priority) {
+		return mInputQ.reprioritize(key, priority);
 	}
 
 	int numQueued() {
 		return mInputQ.size();
 	}
 
-	int numQueuedTotal() {
-		return mInputQ.size() + mInputSecondaryQ.size();
-	}
-
-	int numQueuedSecondary() {
-		return mInputSecondaryQ.size();
+	int numQueued(EQueuePriority priority) {
+		return mInputQ.size(priority);
 	}
 
 	int numFinished() {
@@ -203,7 +364,6 @@ public:
 	void resetStats() {
 		// TODO: Block stat updates
 		mMaxQueue = 0;
-		mMaxQueueSecondary = 0;
 		mStatLoadTime = 0;
 		mStatLoadCount = 0;
 		mStatTotalLoaded = 0;
@@ -215,10 +375,6 @@ public:
 		return mMaxQueue.load();
 	}
 
-	int statMaxSecondaryQueued() {
-		return mMaxQueueSecondary.load();
-	}
-
 	double statAvgLoadTime() {
 		return mStatAvgTime;
 	}
@@ -241,10 +397,11 @@ protected:
 	virtual void prepareLoad() {}		// Before load
 	virtual void completeLoad() {}		// After load
 	virtual void cancelLoad() {}		// Load was cancelled
+	virtual const char *threadName() const { return "Resource loader"; }	// For the profiler timeline
 
 	std::atomic<bool> mActive{ true };
 	std::atomic<bool> mRunning{ false };
-	std::atomic<int> mMaxQueue{ 0 }, mStatTotalLoaded{ 0 }, mMaxQueueSecondary{ 0 };
+	std::atomic<int> mMaxQueue{ 0 }, mStatTotalLoaded{ 0 };
 	std::atomic<double> mStatAvgTime{ 0 }, mStatMinTime{ 999999 }, mStatMaxTime{ 0 };
 
 	double mStatLoadTime = 0, mStatLoadCount = 0;
@@ -253,21 +410,21 @@ protected:
 	std::mutex mWakeLock, mStatsLock;
 	std::condition_variable mWake;
 
-	TSQueue<IP> mInputQ;
-	TSQueue<IP> mInputSecondaryQ;
+	TSResourceQueue<IP, K> mInputQ;
 	TSQueue<OP> mOutputQ;
 
 
 private:
 	void bgproc() {
 		std::unique_lock<std::mutex> lock(mWakeLock);
+		Profile_SetThreadName(threadName());
 
 		while (mActive.load()) {
 			bool processed = false;
 
 			// Process the queue
 			while (true) {
-				if (mInputQ.size() > 0 || mInputSecondaryQ.size() > 0) {
+				if (mInputQ.size() > 0) {
 					mRunning.store(true);
 
 					cycle_t lTime;
@@ -278,13 +435,11 @@ private:
 
 					IP input;
 					if (!mInputQ.dequeue(input)) {
-						// Always load from secondary queue only if the primary queue has items
-						if(!mInputSecondaryQ.dequeue(input)) {
-							cancelLoad();
-							break;
-						}
+						cancelLoad();
+						break;
 					}
 
+					PROFILE_ZONE("Load resource");
 					OP output;
 					if (loadResource(input, output)) {
 						mOutputQ.queue(output);
@@ -318,21 +473,21 @@ private:
 
 
 // @Cockatrice - Redesigning resource loader to work with an arbitrary set of queues
-template <typename IP, typename OP>
+// The input queue is shared by all loaders of one kind and hands out the most urgent item first
+template <typename IP, typename OP, typename K = const void *>
 class ResourceLoader2 {
 public:
 	ResourceLoader2() { }
 
-	ResourceLoader2(TSQueue<IP>* inputQueue, TSQueue<IP>* secondaryInputQueue, TSQueue<OP>* outputQueue) {
+	ResourceLoader2(TSResourceQueue<IP, K>* inputQueue, TSQueue<OP>* outputQueue) {
 		mInputQ = inputQueue;
-		mInputQSecondary = secondaryInputQueue;
 		mOutputQ = outputQueue;
 	}
 	virtual ~ResourceLoader2() { stop(); }
 
 	void start() {
 		if (mThread.get_id() == std::thread::id()) {
-			mThread = std::thread(&ResourceLoader2<IP, OP>::bgproc, this);
+			mThread = std::thread(&ResourceLoader2<IP, OP, K>::bgproc, this);
 		}
 	}
 
@@ -380,10 +535,14 @@ protected:
 	virtual void prepareLoad() {}		// Before load
 	virtual void completeLoad() {}		// After load
 	virtual void cancelLoad() {}		// Load was cancelled
+	virtual const char *threadName() const { return "Resource loader"; }	// For the profiler timeline
+	virtual void submitOutput(OP& output) { mOutputQ->queue(output); }	// Replace to feed another stage instead
+	virtual bool canLoad() { return true; }		// Return false to leave the input queued while the next stage is full
 
 	std::atomic<bool> mActive{ true };
 	std::atomic<bool> mRunning{ false };
 	std::atomic<int> mStatTotalLoaded{ 0 };
+	EQueuePriority mLoadPriority = QUEUE_Visible;	// Priority of the item being loaded
 	std::atomic<double> mStatAvgTime{ 0 }, mStatMinTime{ 999999 }, mStatMaxTime{ 0 };
 
 	double mStatLoadTime = 0, mStatLoadCount = 0;
@@ -392,20 +551,20 @@ protected:
 	std::mutex mWakeLock, mStatsLock;
 	std::condition_variable mWake;
 
-	TSQueue<IP>* mInputQ = nullptr;
-	TSQueue<IP>* mInputQSecondary = nullptr;
+	TSResourceQueue<IP, K>* mInputQ = nullptr;
 	TSQueue<OP>* mOutputQ = nullptr;
 
 protected:
 	virtual void bgproc() {
 		std::unique_lock<std::mutex> lock(mWakeLock);
+		Profile_SetThreadName(threadName());
 
 		while (mActive.load()) {
 			bool processed = false;
 
 			// Process the queue
 			while (true) {
-				if (mInputQ->size() > 0 || (mInputQSecondary != nullptr && mInputQSecondary->size() > 0)) {
+				if (mInputQ->size() > 0 && canLoad()) {
 					mRunning.store(true);
 
 					cycle_t lTime;
@@ -415,17 +574,16 @@ protected:
 					prepareLoad();
 
 					IP input;
-					if (!mInputQ->dequeue(input)) {
-						// Always load from secondary queue only if the primary queue has no items
-						if (mInputQSecondary == nullptr || !mInputQSecondary->dequeue(input)) {
-							cancelLoad();
-							continue;
-						}
+					if (!mInputQ->dequeue(input, &mLoadPriority)) {
+						// Another loader took the last item
+						cancelLoad();
+						continue;
 					}
 
+					PROFILE_ZONE("Load resource");
 					OP output;
 					if (loadResource(input, output)) {
-						mOutputQ->queue(output);
+						submitOutput(output);
 					}
 					processed = true;
 
@@ -452,4 +610,12 @@ protected:
 			}
 		}
 	}
-};
\ No newline at end of file
+};
+
+
+// Number of threads for a CPU-bound loader stage, like texture decoding.
+// 0 picks half the cores, leaving the rest for the game, render and upload threads.
+inline int ResourceWorkerThreadCount(int requested) {
+	if (requested > 0) return requested;
+	return std::clamp((int)std::thread::hardware_concurrency() / 2, 1, 8);
+}
@@ -65,6 +65,17 @@ FString DumpCPUInfo(const CPUInfo *cpu, bool brief)
 #define __cpuid(output, func) __cpuidex(output, func, 0)
 #endif
 
+static uint64_t GetXCR0()
+{
+#ifdef _MSC_VER
+	return _xgetbv(0);
+#else
+	uint32_t eax, edx;
+	__asm__ __volatile__("xgetbv" : "=a" (eax), "=d" (edx) : "c" (0));
+	return ((uint64_t)edx << 32) | eax;
+#endif
+}
+
 void CheckCPUID(CPUInfo *cpu)
 {
 	int foo[4];
@@ -159,6 +170,21 @@ void CheckCPUID(CPUInfo *cpu)
 		__cpuidex(foo, 7, 1);
 		cpu->FeatureFlags[7] = foo[0];
 	}
+
+	// The CPU may report AVX while the OS does not save the extended
+	// registers on a context switch. Only report what code can actually use.
+	uint64_t xcr0 = cpu->bOSXSAVE ? GetXCR0() : 0;
+	if ((xcr0 & 0x06) != 0x06)
+	{
+		cpu->bAVX = false;
+		cpu->bAVX2 = false;
+		cpu->bFMA3 = false;
+		cpu->bF16C = false;
+	}
+	if ((xcr0 & 0xe6) != 0xe6)
+	{
+		cpu->bAVX512_F = false;
+	}
 }
 
 FString DumpCPUInfo(const CPUInfo *cpu, bool brief)
@@ -122,6 +122,7 @@
 #include "fs_findfile.h"
 
 #include "statdb.h"
+#include "profiler.h"
 
 #include "hw_vrmodes.h"
 #include "profiledef.h"
@@ -296,6 +297,7 @@ CUSTOM_CVAR (Int, fraglimit, 0, CVAR_SERVERINFO)
 
 CVAR (Float, timelimit, 0.f, CVAR_SERVERINFO);
 CVAR (Int, wipetype, 1, CVAR_ARCHIVE);
+CVAR (Bool, fs_cachedirectory, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
 CVAR (Int, snd_drawoutput, 0, 0);
 CUSTOM_CVAR (String, vid_cursor, "None", CVAR_ARCHIVE | CVAR_NOINITCALL)
 {
@@ -964,6 +966,7 @@ float QzDoom_GetFOV();
 
 void D_Display ()
 {
+	PROFILE_ZONE("D_Display");
 	FTexture *wipestart = nullptr;
 	int wipe_type;
 	sector_t *viewsec;
@@ -1346,6 +1349,7 @@ void D_DoomLoop ()
 			D_ProcessEvents();
 			D_Display ();
 			S_UpdateMusic();
+			Profile_EndFrame();
 			if (wantToRestart)
 			{
 				wantToRestart = false;
@@ -3516,6 +3520,15 @@ static int D_InitGame(const FIWADInfo* iwad_info, std::vector<std::string>& allw
 
 	AddModFiles(allwads);
 
+	// Only the main file system may use the lump directory cache, everything else would just keep replacing it.
+	if (fs_cachedirectory)
+	{
+		FString cachepath = M_GetCachePath(true);
+		CreatePath(cachepath.GetChars());
+		lfi.cachePath = cachepath.GetChars();
+		lfi.cachePath += '/';
+	}
+
 	bool allowduplicates = Args->CheckParm("-allowduplicates");
 	auto hashfile = D_GetHashFile();
 	if (!fileSystem.InitMultipleFiles(allwads, &lfi, FileSystemPrintf, allowduplicates, hashfile))
@@ -4189,6 +4202,9 @@ void VR_DoomMain(int argc, char** argv)
 
 void D_Cleanup()
 {
+	// Don't quit or restart in the middle of writing a savegame.
+	G_FinishPendingSave(true);
+
 	if (demorecording)
 	{
 		G_CheckDemoStatus();
@@ -27,6 +27,8 @@
 #include <stdio.h>
 #include <stddef.h>
 #include <memory>
+#include <thread>
+#include <atomic>
 
 #include "i_time.h"
 
@@ -87,11 +89,13 @@
 #include "c_buttons.h"
 #include "d_buttons.h"
 #include "hwrenderer/scene/hw_drawinfo.h"
+#include "hwrenderer/doom_lightbaker.h"
 #include "doommenu.h"
 #include "screenjob.h"
 #include "i_interface.h"
 #include "fs_findfile.h"
 #include "hw_vrmodes.h"
+#include "profiler.h"
 
 #include <QzDoom/VrCommon.h>
 #include <cmath>
@@ -120,11 +124,13 @@ void STAT_Serialize(FSerializer &file);
 
 CVARD_NAMED(Int, gameskill, skill, 2, CVAR_SERVERINFO|CVAR_LATCH, "sets the skill for the next newly started game")
 CVAR(Bool, save_formatted, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)	// use formatted JSON for saves (more readable but a larger files and a bit slower.
+CVAR(Bool, save_binary, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)	// use the binary serializer format for saves (smaller and faster, but not human readable.)
 CVAR (Int, deathmatch, 0, CVAR_SERVERINFO|CVAR_LATCH);
 CVAR (Bool, chasedemo, false, 0);
 CVAR (Bool, storesavepic, true, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
 CVAR (Bool, longsavemessages, false, CVAR_ARCHIVE|CVAR_GLOBALCONFIG)
 CVAR (Bool, cl_waitforsave, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
+CVAR (Bool, save_async, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)	// compress and write savegames on a background thread.
 CVAR (Bool, enablescriptscreenshot, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
 CVAR (Bool, cl_restartondeath, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
 CVAR (Bool, puristmode, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
@@ -1238,6 +1244,7 @@ static uint32_t StaticSumSeeds()
 //
 void G_Ticker ()
 {
+	PROFILE_ZONE("G_Ticker");
 	int i;
 	gamestate_t	oldgamestate;
 
@@ -1263,6 +1270,8 @@ void G_Ticker ()
 		AddCommandString ("toggle vid_fullscreen");
 	}
 
+	G_FinishPendingSave(false);
+
 	// do things to change the game state
 	oldgamestate = gamestate;
 	while (gameaction != ga_nothing)
@@ -1426,6 +1435,8 @@ void G_Ticker ()
 	case GS_LEVEL:
 		P_Ticker ();
 		primaryLevel->automap->Ticker ();
+		// Light things attach their lights on their first tick
+		if (primaryLevel->maptime == 1) CheckBakeLightmaps(primaryLevel);
 		break;
 
 	case GS_TITLELEVEL:
@@ -2124,6 +2135,7 @@ void FinishLoadingCVars();
 
 void G_DoLoadGame ()
 {
+	G_FinishPendingSave(true);
 	SetupLoadingCVars();
 	bool hidecon;
 
@@ -2411,6 +2423,9 @@ FString G_FindSaveFilename(const char* header, int count = 1) {
 	FString filename, file;
 	int i, firstValidIndex = -1;
 
+	// The rotation depends on the files on disk so anything still being written must be done first.
+	G_FinishPendingSave(true);
+
 	for (i = 0; i < 50; ++i)
 	{
 		FString savnam(header);
@@ -2626,13 +2641,102 @@ static void PutSavePic (FileWriter *file, int width, int height)
 	}
 }
 
+//==========================================================================
+//
+// Savegame writing
+//
+// The game thread only serializes the world into uncompressed buffers.
+// Compressing them, writing the zip and checking the result is done by
+// a worker thread. There is never more than one save in flight, anything
+// that needs the save to be on disk waits for it.
+//
+//==========================================================================
+
+struct FPendingSave
+{
+	std::thread thread;
+	std::atomic<bool> done = false;
+	bool succeeded = false;
+
+	TArray<FCompressedBuffer> content;	// owned by this.
+	TArray<FString> filenames;
+	TArray<bool> compress;				// which of the buffers still need to be compressed.
+	FString filename;
+	FString description;
+	int date = 0;
+	bool okForQuicksave = false;
+	bool forceQuicksave = false;
+
+	~FPendingSave()
+	{
+		if (thread.joinable()) thread.join();
+		for (auto& buf : content) buf.Clean();
+	}
+
+	void Write()
+	{
+		for (unsigned i = 0; i < content.Size(); i++)
+		{
+			if (compress[i]) FSerializer::CompressOutput(content[i]);
+		}
+
+		if (WriteZip(filename.GetChars(), content.Data(), content.Size()))
+		{
+			// Check whether the file is ok by trying to open it.
+			FResourceFile *test = FResourceFile::OpenResourceFile(filename.GetChars(), true);
+			if (test != nullptr)
+			{
+				delete test;
+				succeeded = true;
+			}
+		}
+		done = true;
+	}
+};
+
+static std::unique_ptr<FPendingSave> PendingSave;
+
+void G_FinishPendingSave(bool wait)
+{
+	if (PendingSave == nullptr || (!wait && !PendingSave->done)) return;
+
+	if (PendingSave->thread.joinable()) PendingSave->thread.join();
+	auto save = std::move(PendingSave);
+
+	if (save->succeeded)
+	{
+		savegameManager.NotifyNewSave(save->filename, save->description.GetChars(), save->date, save->okForQuicksave, save->forceQuicksave);
+		BackupSaveName = save->filename;
+
+		if (longsavemessages) Printf("%s (%s)\n", GStrings.GetString("GGSAVED"), save->filename.GetChars());
+		else Printf("%s\n", GStrings.GetString("GGSAVED"));
+	}
+	else
+	{
+		Printf(PRINT_HIGH, "%s\n", GStrings.GetString("TXT_SAVEFAILED"));
+	}
+}
+
+static FCompressedBuffer CopyCompressedBuffer(const FCompressedBuffer& src)
+{
+	FCompressedBuffer copy = src;
+	copy.mBuffer = new char[src.mCompressedSize];
+	memcpy(copy.mBuffer, src.mBuffer, src.mCompressedSize);
+	return copy;
+}
+
 void G_DoSaveGame (bool okForQuicksave, bool forceQuicksave, FString filename, const char *description)
 {
 	TArray<FCompressedBuffer> savegame_content;
 	TArray<FString> savegame_filenames;
+	TArray<bool> savegame_owned;	// Buffers that were made for this save. The writer takes them over and compresses them.
 
 	char buf[100];
 
+	// A save that is still being written has to be finished first, both
+	// to have only one in flight and to get the notifications in order.
+	G_FinishPendingSave(true);
+
 	// Do not even try, if we're not in a level. (Can happen after
 	// a demo finishes playback.)
 	if (primaryLevel->lines.Size() == 0 || primaryLevel->sectors.Size() == 0 || gamestate != GS_LEVEL)
@@ -2651,7 +2755,7 @@ void G_DoSaveGame (bool okForQuicksave, bool forceQuicksave, FString filename, c
 	insave = true;
 	try
 	{
-		level.SnapshotLevel();
+		level.SnapshotLevel(false);
 	}
 	catch(CRecoverableError &err)
 	{
@@ -2678,7 +2782,7 @@ void G_DoSaveGame (bool okForQuicksave, bool forceQuicksave, FString filename, c
 	FSerializer savegameglobals;	// and this for non-level related info that must be saved.
 
 	savegameinfo.OpenWriter(true);
-	savegameglobals.OpenWriter(save_formatted);
+	savegameglobals.OpenWriter(save_formatted, save_binary);
 
 	SaveVersion = SAVEVER;
 	PutSavePic(&savepic, SAVEPICWIDTH, SAVEPICHEIGHT);
@@ -2734,54 +2838,57 @@ void G_DoSaveGame (bool okForQuicksave, bool forceQuicksave, FString filename, c
 
 	savegame_content.Push(bufpng);
 	savegame_filenames.Push("savepic.png");
-	savegame_content.Push(savegameinfo.GetCompressedOutput());
+	savegame_owned.Push(false);
+	savegame_content.Push(savegameinfo.GetUncompressedOutput());
 	savegame_filenames.Push("info.json");
-	savegame_content.Push(savegameglobals.GetCompressedOutput());
+	savegame_owned.Push(true);
+	savegame_content.Push(savegameglobals.GetUncompressedOutput());
 	savegame_filenames.Push("globals.json");
+	savegame_owned.Push(true);
 	G_WriteSnapshots (savegame_filenames, savegame_content);
-	
+	// Of the snapshots only the current level's is new, the others still belong to their levels.
+	while (savegame_owned.Size() < savegame_content.Size())
+		savegame_owned.Push(savegame_content[savegame_owned.Size()].mBuffer == level.info->Snapshot.mBuffer);
+
+	// Everything the writer needs gets handed over to it. The current level's snapshot
+	// and the JSON buffers created above are taken over, everything else gets copied
+	// because the game may change it while the save is still being written.
+	auto save = std::make_unique<FPendingSave>();
 	for (unsigned i = 0; i < savegame_content.Size(); i++)
-		savegame_content[i].filename = savegame_filenames[i].GetChars();
-
-	bool succeeded = false;
-
-	if (WriteZip(filename.GetChars(), savegame_content.Data(), savegame_content.Size()))
 	{
-		// Check whether the file is ok by trying to open it.
-		FResourceFile *test = FResourceFile::OpenResourceFile(filename.GetChars(), true);
-		if (test != nullptr)
-		{
-			delete test;
-			succeeded = true;
-		}
+		auto& content = savegame_content[i];
+		save->content.Push(savegame_owned[i] ? content : CopyCompressedBuffer(content));
+		save->compress.Push(savegame_owned[i]);
 	}
+	save->filenames = std::move(savegame_filenames);
+	for (unsigned i = 0; i < save->content.Size(); i++)
+		save->content[i].filename = save->filenames[i].GetChars();
 
-	if (succeeded)
-	{
-		savegameManager.NotifyNewSave(filename, description, cdatei, okForQuicksave, forceQuicksave);
-		BackupSaveName = filename;
-
-		if (longsavemessages) Printf("%s (%s)\n", GStrings.GetString("GGSAVED"), filename.GetChars());
-		else Printf("%s\n", GStrings.GetString("GGSAVED"));
-	}
-	else
-	{
-		Printf(PRINT_HIGH, "%s\n", GStrings.GetString("TXT_SAVEFAILED"));
-	}
+	save->filename = filename;
+	save->description = description;
+	save->date = cdatei;
+	save->okForQuicksave = okForQuicksave;
+	save->forceQuicksave = forceQuicksave;
 
-
-	// delete the JSON buffers we created just above. Everything else will
-	// either still be needed or taken care of automatically.
-	savegame_content[1].Clean();
-	savegame_content[2].Clean();
-
-	// We don't need the snapshot any longer.
+	// The snapshot belongs to the writer now.
+	level.info->Snapshot.mBuffer = nullptr;
 	level.info->Snapshot.Clean();
 		
 	insave = false;
 
 	if (cl_waitforsave)
 		I_FreezeTime(false);
+
+	PendingSave = std::move(save);
+	if (save_async)
+	{
+		PendingSave->thread = std::thread([save = PendingSave.get()]() { save->Write(); });
+	}
+	else
+	{
+		PendingSave->Write();
+		G_FinishPendingSave(true);
+	}
 }
 
 
@@ -173,7 +173,7 @@ private:
 	void PlayerSpawnPickClass (int playernum);
 
 public:
-	void SnapshotLevel();
+	void SnapshotLevel(bool compress = true);
 	void UnSnapshotLevel(bool hubLoad);
 
 	void FinalizePortals();
@@ -479,6 +479,7 @@ public:
 	int LPHeight = 0;
 	static const int LPCellSize = 32;
 	TArray<LightProbeCell> LPCells;
+	TMap<uint64_t, bool> LMBakedLights;	// Lights the lightmap was baked from, they don't light anything on their own
 
 	// Portal information.
 	FDisplacementTable Displacements;
@@ -85,6 +85,7 @@
 #include "hw_vertexbuilder.h"
 #include "version.h"
 #include "fs_decompress.h"
+#include "a_dynlight.h"
 
 enum
 {
@@ -3358,6 +3359,7 @@ void MapLoader::LoadLightmap(MapData *map)
 	Level->LPMinY = 0;
 	Level->LPWidth = 0;
 	Level->LPHeight = 0;
+	Level->LMBakedLights.Clear();
 
 	if (!Args->CheckParm("-enablelightmaps"))
 		return;		// this feature is still too early WIP to allow general access
@@ -3531,6 +3533,16 @@ void MapLoader::LoadLightmap(MapData *map)
 	Level->LMTextureData.Resize((numTexBytes + 1) / 2);
 	uint8_t* data = (uint8_t*)&Level->LMTextureData[0];
 	fr.Read(data, numTexBytes);
+
+	// Lumps written by bakelightmaps end with the positions of the lights they contain
+	uint32_t numBakedLights = fr.ReadUInt32();	// 0 if the lump ends here
+	for (uint32_t i = 0; i < numBakedLights; i++)
+	{
+		float pos[3];
+		if (fr.Read(pos, sizeof(pos)) != sizeof(pos))
+			break;
+		Level->LMBakedLights[FDynamicLight::LightmapKey(pos[0], pos[1], pos[2])] = true;
+	}
 #if 0
 	// Apply compression predictor
 	for (uint32_t i = 1; i < numTexBytes; i++)
@@ -61,6 +61,9 @@
 // @Cockatrice - TODO: Honor the savedir folder! We completely ignore it here
 void FSavegameManager::ReadSaveStrings()
 {
+	// A save still being written would be missing from the list or show up broken.
+	G_FinishPendingSave(true);
+
 	if (SaveGames.Size() == 0)
 	{
 		FString filter;
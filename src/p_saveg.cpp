@@ -65,6 +65,7 @@
 #include "d_net.h"
 
 EXTERN_CVAR(Bool, save_formatted)
+EXTERN_CVAR(Bool, save_binary)
 
 //==========================================================================
 //
@@ -1117,10 +1118,12 @@ void FLevelLocals::Serialize(FSerializer &arc, bool hubload)
 //==========================================================================
 //
 // Archives the current level
+// Without 'compress' the snapshot is left as a stored buffer for the
+// savegame writer to compress on its own thread.
 //
 //==========================================================================
 
-void FLevelLocals::SnapshotLevel()
+void FLevelLocals::SnapshotLevel(bool compress)
 {
 	info->Snapshot.Clean();
 
@@ -1128,11 +1131,11 @@ void FLevelLocals::SnapshotLevel()
 	{
 		FDoomSerializer arc(this);
 
-		if (arc.OpenWriter(save_formatted))
+		if (arc.OpenWriter(save_formatted, save_binary))
 		{
 			SaveVersion = SAVEVER;
 			Serialize(arc, false);
-			info->Snapshot = arc.GetCompressedOutput();
+			info->Snapshot = compress ? arc.GetCompressedOutput() : arc.GetUncompressedOutput();
 		}
 	}
 }
@@ -39,6 +39,7 @@
 #include "actorinlines.h"
 #include "g_game.h"
 #include "i_interface.h"
+#include "profiler.h"
 
 extern gamestate_t wipegamestate;
 extern uint8_t globalfreeze, globalchangefreeze;
@@ -77,6 +78,7 @@ bool P_CheckTickerPaused ()
 //
 void P_Ticker (void)
 {
+	PROFILE_ZONE("P_Ticker");
 	int i;
 
 	for (auto Level : AllLevels())
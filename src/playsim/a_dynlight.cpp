@@ -831,6 +831,28 @@ void FDynamicLight::CollectWithinRadiusSP(const DVector3 &opos, const DVector3 &
 }
 
 
+//==========================================================================
+//
+// Lights that bakelightmaps puts into the lightmap. Only light things can
+// be relied on to stay where they are, and additive and subtractive lights
+// are applied differently from the lightmap.
+//
+//==========================================================================
+
+bool FDynamicLight::IsBakeable()
+{
+	if (!IsActive() || lighttype != PointLight || IsAdditive() || IsSubtractive())
+		return false;
+
+	AActor *owner = target;
+	return owner != nullptr && owner->IsKindOf(NAME_DynamicLight);
+}
+
+bool FDynamicLight::IsBaked()
+{
+	return Level->LMBakedLights.CountUsed() > 0 && IsBakeable() && Level->LMBakedLights.CheckKey(LightmapKey((float)X(), (float)Y(), (float)Z())) != nullptr;
+}
+
 //==========================================================================
 //
 // Link the light into the world
@@ -855,7 +877,8 @@ void FDynamicLight::LinkLight()
 		node = node->nextTarget;
 	}
 
-	if (radius>0)
+	// Lights in the lightmap are left unlinked, or they would be applied twice
+	if (radius>0 && !IsBaked())
 	{
 		// passing in radius*radius allows us to do a distance check without any calls to sqrt
 		
@@ -245,6 +245,15 @@ struct FDynamicLight
 	bool DontLightActors() const { return !!((*pLightFlags) & LF_DONTLIGHTACTORS); }
 	bool DontLightOthers() const { return !!((*pLightFlags) & (LF_DONTLIGHTOTHERS)); }
 	bool DontLightMap() const { return !!((*pLightFlags) & (LF_DONTLIGHTMAP)); }
+	bool IsBakeable();
+	bool IsBaked();
+
+	// Lights that were baked into the level's lightmap are found by their position
+	static uint64_t LightmapKey(float x, float y, float z)
+	{
+		auto quantize = [](float v) { return uint64_t(int64_t(lround(v)) & 0x1fffff); };
+		return (quantize(x) << 42) | (quantize(y) << 21) | quantize(z);
+	}
 	void Deactivate() { m_active = false; }
 	void Activate();
 
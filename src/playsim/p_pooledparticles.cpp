@@ -9,6 +9,15 @@
 #include "texturemanager.h"
 #include "d_player.h"
 #include "actorinlines.h"
+#include "ctpl.h"
+#include <thread>
+
+#ifndef NO_SSE
+#include <emmintrin.h>
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define PARTICLES_NEON
+#endif
 
 // NL: This is a helper to make sure that the particles are all linked correctly.
 //     If something breaks the chain, it can cause particles to stop updating and spawning
@@ -24,6 +33,21 @@ static int PARTICLE_COUNT = 0;
 // Taken from p_mobj.cpp
 #define WATER_SINK_SPEED		0.5
 
+enum
+{
+	MAX_PARTICLE_THREADS = 8,
+	MIN_PARTICLES_PER_THREAD = 256,	// Below this the threading overhead eats up the gains.
+	MAX_PARTICLE_BATCH = 256,
+};
+
+CUSTOM_CVAR(Int, r_particlethreads, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+{
+	if (self < 0) self = 0;
+	else if (self > MAX_PARTICLE_THREADS) self = MAX_PARTICLE_THREADS;
+}
+
+static ctpl::thread_pool particleThreadPool;
+
 const float DParticleDefinition::INVALID = -99999;
 const float DParticleDefinition::BOUNCE_SOUND_ATTENUATION = 1.5f;
 
@@ -1125,6 +1149,18 @@ void DParticleDefinition::Emit(AActor* master, double chance, int numTries, doub
 	}
 }
 
+//==========================================================================
+//
+// Anything a particle computed ahead of its turn in the tic is only valid if
+// no script code ran in between, so the pool counts the script callbacks.
+//
+//==========================================================================
+
+static void CountParticleScript(DParticleDefinition* definition, VMFunction* func)
+{
+	if (!(func->VarFlags & VARF_Native)) definition->Level->DefinedParticlePool.ScriptCalls++;
+}
+
 void DParticleDefinition::CallInit()
 {
 	IFVIRTUAL(DParticleDefinition, Init)
@@ -1138,6 +1174,7 @@ void DParticleDefinition::CallOnCreateParticle(particledata_t* particle)
 {
 	IFVIRTUAL(DParticleDefinition, OnCreateParticle)
 	{
+		CountParticleScript(this, func);
 		VMValue params[] = { this, particle };
 		VMCall(func, params, 3, nullptr, 0);
 	}
@@ -1149,6 +1186,7 @@ bool DParticleDefinition::CallOnParticleDeath(particledata_t* particle)
 
 	IFVIRTUAL(DParticleDefinition, OnParticleDeath)
 	{
+		CountParticleScript(this, func);
 		VMValue params[] = { this, particle };
 		VMReturn ret(&result);
 
@@ -1162,6 +1200,7 @@ void DParticleDefinition::CallThinkParticle(particledata_t* particle)
 {
 	IFVIRTUAL(DParticleDefinition, ThinkParticle)
 	{
+		CountParticleScript(this, func);
 		VMValue params[] = { this, particle };
 		VMCall(func, params, 2, nullptr, 0);
 	}
@@ -1171,6 +1210,7 @@ void DParticleDefinition::CallOnParticleBounce(particledata_t* particle)
 {
 	IFVIRTUAL(DParticleDefinition, OnParticleBounce)
 	{
+		CountParticleScript(this, func);
 		VMValue params[] = { this, particle };
 		VMCall(func, params, 2, nullptr, 0);
 	}
@@ -1184,6 +1224,7 @@ void DParticleDefinition::CallOnParticleSleep(particledata_t* particle)
 {
 	IFVIRTUAL(DParticleDefinition, OnParticleSleep)
 	{
+		CountParticleScript(this, func);
 		VMValue params[] = { this, particle };
 		VMCall(func, params, 2, nullptr, 0);
 	}
@@ -1193,6 +1234,7 @@ void DParticleDefinition::CallOnParticleCollideWithPlayer(particledata_t* partic
 {
 	IFVIRTUAL(DParticleDefinition, OnParticleCollideWithPlayer)
 	{
+		CountParticleScript(this, func);
 		VMValue params[] = { this, particle, player };
 		VMCall(func, params, 3, nullptr, 0);
 	}
@@ -1202,6 +1244,7 @@ void DParticleDefinition::CallOnParticleEnterWater(particledata_t* particle, dou
 {
 	IFVIRTUAL(DParticleDefinition, OnParticleEnterWater)
 	{
+		CountParticleScript(this, func);
 		VMValue params[] = { this, particle, surfaceHeight };
 		VMCall(func, params, 3, nullptr, 0);
 	}
@@ -1211,6 +1254,7 @@ void DParticleDefinition::CallOnParticleExitWater(particledata_t* particle, doub
 {
 	IFVIRTUAL(DParticleDefinition, OnParticleExitWater)
 	{
+		CountParticleScript(this, func);
 		VMValue params[] = { this, particle, surfaceHeight };
 		VMCall(func, params, 3, nullptr, 0);
 	}
@@ -1220,7 +1264,12 @@ void DParticleDefinition::HandleFading(particledata_t* particle)
 {
 	float velocityFade = HasFlag(PDF_VELOCITYFADE) ? ((float)particle->vel.Length() - MinFadeVel) / (MaxFadeVel - MinFadeVel) : 1.0f;
 	float lifeFade = HasFlag(PDF_LIFEFADE) ? float(particle->life - MinFadeLife) / float(MaxFadeLife - MinFadeLife) : 1.0f;
-	particle->fadeAlpha = std::clamp(velocityFade * lifeFade, 0.0f, 1.0f);
+	SetFadeAlpha(particle, std::clamp(velocityFade * lifeFade, 0.0f, 1.0f));
+}
+
+void DParticleDefinition::SetFadeAlpha(particledata_t* particle, float fadeAlpha)
+{
+	particle->fadeAlpha = fadeAlpha;
 
 	if (particle->fadeAlpha < 0.999 && particle->renderStyle != STYLE_Translucent) 
 	{
@@ -1491,6 +1540,8 @@ particledata_t* NewDefinedParticle(FLevelLocals* Level, DParticleDefinition* def
 			result->tnext = tnext;
 			result->tprev = tprev;
 
+			if (pool.Thinking) pool.SpawnedThisTic.Set(result - pool.Particles.Data());
+
 #if ENABLE_CONTINUITY_CHECKS
 			CheckContinuity(Level);
 #endif
@@ -1519,6 +1570,8 @@ particledata_t* NewDefinedParticle(FLevelLocals* Level, DParticleDefinition* def
 		pool.OldestParticle = pool.ActiveParticles;
 	}
 
+	if (pool.Thinking) pool.SpawnedThisTic.Set(pool.ActiveParticles);
+
 #if ENABLE_CONTINUITY_CHECKS
 	PARTICLE_COUNT++;
 	CheckContinuity(Level);
@@ -1713,357 +1766,1245 @@ bool P_DestroyDefinedParticle(FLevelLocals* Level, int particleIndex)
 	return true;
 }
 
-void P_ThinkDefinedParticles(FLevelLocals* Level)
+//==========================================================================
+//
+// particlekinematics_t
+//
+// The results must be identical to the scalar code in P_ThinkDefinedParticle.
+// Single and double precision adds, multiplies, divides and square roots are
+// exact in SSE2 and NEON, so this is the case as long as every operation is
+// done in the same order.
+//
+//==========================================================================
+
+void particlekinematics_t::Resize(unsigned count)
+{
+	Subsector.Resize(count);
+	PosX.Resize(count); PosY.Resize(count);
+	VelX.Resize(count); VelY.Resize(count); VelZ.Resize(count);
+	Drag.Resize(count); Gravity.Resize(count);
+	Alpha.Resize(count); AlphaStep.Resize(count);
+	ScaleX.Resize(count); ScaleY.Resize(count); ScaleStepX.Resize(count); ScaleStepY.Resize(count);
+	Angle.Resize(count); AngleStep.Resize(count);
+	Pitch.Resize(count); PitchStep.Resize(count);
+	Roll.Resize(count); RollStep.Resize(count);
+	Finished.Resize(count);
+	Life.Resize(count); StartLife.Resize(count);
+	Speed.Resize(count); FadeAlpha.Resize(count); FadeScaleX.Resize(count); FadeScaleY.Resize(count);
+}
+
+// The alpha, scale and rotation steps and the horizontal movement. Only particles
+// that cannot cross a line portal are batched, so the movement is a plain add.
+void particlekinematics_t::IntegrateSteps()
+{
+	unsigned count = Index.Size();
+	unsigned n = 0, m = 0;
+
+#ifndef NO_SSE
+	for (; n + 4 <= count; n += 4)
+	{
+		_mm_storeu_ps(&Alpha[n], _mm_add_ps(_mm_loadu_ps(&Alpha[n]), _mm_loadu_ps(&AlphaStep[n])));
+		_mm_storeu_ps(&ScaleX[n], _mm_mul_ps(_mm_loadu_ps(&ScaleX[n]), _mm_loadu_ps(&ScaleStepX[n])));
+		_mm_storeu_ps(&ScaleY[n], _mm_mul_ps(_mm_loadu_ps(&ScaleY[n]), _mm_loadu_ps(&ScaleStepY[n])));
+		_mm_storeu_ps(&Angle[n], _mm_add_ps(_mm_loadu_ps(&Angle[n]), _mm_loadu_ps(&AngleStep[n])));
+		_mm_storeu_ps(&Pitch[n], _mm_add_ps(_mm_loadu_ps(&Pitch[n]), _mm_loadu_ps(&PitchStep[n])));
+		_mm_storeu_ps(&Roll[n], _mm_add_ps(_mm_loadu_ps(&Roll[n]), _mm_loadu_ps(&RollStep[n])));
+	}
+	for (; m + 2 <= count; m += 2)
+	{
+		__m128d x = _mm_loadu_pd(&PosX[m]), y = _mm_loadu_pd(&PosY[m]);
+		_mm_storeu_pd(&PosX[m], _mm_add_pd(x, _mm_add_pd(_mm_sub_pd(x, x), _mm_loadu_pd(&VelX[m]))));
+		_mm_storeu_pd(&PosY[m], _mm_add_pd(y, _mm_add_pd(_mm_sub_pd(y, y), _mm_loadu_pd(&VelY[m]))));
+	}
+#elif defined(PARTICLES_NEON)
+	for (; n + 4 <= count; n += 4)
+	{
+		vst1q_f32(&Alpha[n], vaddq_f32(vld1q_f32(&Alpha[n]), vld1q_f32(&AlphaStep[n])));
+		vst1q_f32(&ScaleX[n], vmulq_f32(vld1q_f32(&ScaleX[n]), vld1q_f32(&ScaleStepX[n])));
+		vst1q_f32(&ScaleY[n], vmulq_f32(vld1q_f32(&ScaleY[n]), vld1q_f32(&ScaleStepY[n])));
+		vst1q_f32(&Angle[n], vaddq_f32(vld1q_f32(&Angle[n]), vld1q_f32(&AngleStep[n])));
+		vst1q_f32(&Pitch[n], vaddq_f32(vld1q_f32(&Pitch[n]), vld1q_f32(&PitchStep[n])));
+		vst1q_f32(&Roll[n], vaddq_f32(vld1q_f32(&Roll[n]), vld1q_f32(&RollStep[n])));
+	}
+	for (; m + 2 <= count; m += 2)
+	{
+		float64x2_t x = vld1q_f64(&PosX[m]), y = vld1q_f64(&PosY[m]);
+		vst1q_f64(&PosX[m], vaddq_f64(x, vaddq_f64(vsubq_f64(x, x), vld1q_f64(&VelX[m]))));
+		vst1q_f64(&PosY[m], vaddq_f64(y, vaddq_f64(vsubq_f64(y, y), vld1q_f64(&VelY[m]))));
+	}
+#endif
+
+	for (; n < count; n++)
+	{
+		Alpha[n] += AlphaStep[n];
+		ScaleX[n] *= ScaleStepX[n];
+		ScaleY[n] *= ScaleStepY[n];
+		Angle[n] += AngleStep[n];
+		Pitch[n] += PitchStep[n];
+		Roll[n] += RollStep[n];
+	}
+	for (; m < count; m++)
+	{
+		// Same as GetPortalOffsetPosition with the movement since prevpos
+		PosX[m] += (PosX[m] - PosX[m]) + VelX[m];
+		PosY[m] += (PosY[m] - PosY[m]) + VelY[m];
+	}
+}
+
+// Drag and gravity. Particles without gravity get a drag of 1 and particles at
+// rest a gravity of 0, which leaves their velocity as it is.
+void particlekinematics_t::IntegrateVelocity()
 {
-	particlelevelpool_t* pool = &Level->DefinedParticlePool;
+	unsigned count = Index.Size();
+	unsigned n = 0;
 
-	int particleCount = 0;
-	int particleLimit = DParticleDefinition::GetParticleLimit();
-	int cullLimit = DParticleDefinition::GetParticleCullLimit();
+#ifndef NO_SSE
+	for (; n + 2 <= count; n += 2)
+	{
+		__m128d drag = _mm_loadu_pd(&Drag[n]);
+		_mm_storeu_pd(&VelX[n], _mm_mul_pd(_mm_loadu_pd(&VelX[n]), drag));
+		_mm_storeu_pd(&VelY[n], _mm_mul_pd(_mm_loadu_pd(&VelY[n]), drag));
+		_mm_storeu_pd(&VelZ[n], _mm_sub_pd(_mm_mul_pd(_mm_loadu_pd(&VelZ[n]), drag), _mm_loadu_pd(&Gravity[n])));
+	}
+#elif defined(PARTICLES_NEON)
+	for (; n + 2 <= count; n += 2)
+	{
+		float64x2_t drag = vld1q_f64(&Drag[n]);
+		vst1q_f64(&VelX[n], vmulq_f64(vld1q_f64(&VelX[n]), drag));
+		vst1q_f64(&VelY[n], vmulq_f64(vld1q_f64(&VelY[n]), drag));
+		vst1q_f64(&VelZ[n], vsubq_f64(vmulq_f64(vld1q_f64(&VelZ[n]), drag), vld1q_f64(&Gravity[n])));
+	}
+#endif
 
-	if (particleLimit != pool->Particles.Size())
+	for (; n < count; n++)
 	{
-		P_ResizeDefinedParticlePool(Level, particleLimit);
+		VelX[n] *= Drag[n];
+		VelY[n] *= Drag[n];
+		VelZ[n] *= Drag[n];
+		VelZ[n] -= Gravity[n];
 	}
+}
 
-	int i = pool->ActiveParticles;
-	particledata_t* particle = nullptr;
-	while (i != NO_PARTICLE)
+// HandleFading and HandleScaling for the whole run, from the velocity and life
+// the particles had when they finished their tic.
+void particlekinematics_t::Fade()
+{
+	unsigned count = Index.Size();
+	bool velocityFade = Flags & PDF_VELOCITYFADE;
+	bool lifeFade = Flags & PDF_LIFEFADE;
+	float fadeVelRange = MaxFadeVel - MinFadeVel;
+	float fadeLifeRange = float(MaxFadeLife - MinFadeLife);
+	float scaleLifeRange = MaxScaleLife - MinScaleLife;
+	FVector2 scaleRange = MinFadeScale - MaxFadeScale;
+	FVector2 scaleMin(min(MaxFadeScale.X, MinFadeScale.X), min(MaxFadeScale.Y, MinFadeScale.Y));
+	FVector2 scaleMax(max(MaxFadeScale.X, MinFadeScale.X), max(MaxFadeScale.Y, MinFadeScale.Y));
+	unsigned n = 0, m = 0;
+
+#ifndef NO_SSE
+	for (; m + 2 <= count; m += 2)
 	{
-		particle = &pool->Particles[i];
-		DParticleDefinition* definition = particle->definition;
+		__m128d x = _mm_loadu_pd(&VelX[m]), y = _mm_loadu_pd(&VelY[m]), z = _mm_loadu_pd(&VelZ[m]);
+		__m128d length = _mm_sqrt_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(x, x), _mm_mul_pd(y, y)), _mm_mul_pd(z, z)));
+		_mm_storel_pi((__m64*)&Speed[m], _mm_cvtpd_ps(length));
+	}
 
-		int particleIndex = i;
-		i = particle->tnext;
-		if (Level->isFrozen() && !(particle->flags & DPF_NOTIMEFREEZE))
-		{
-			continue;
-		}
+	const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+	for (; n + 4 <= count; n += 4)
+	{
+		__m128i life = _mm_loadu_si128((const __m128i*)&Life[n]);
+		__m128i startLife = _mm_loadu_si128((const __m128i*)&StartLife[n]);
+
+		__m128 velocity = velocityFade ? _mm_div_ps(_mm_sub_ps(_mm_loadu_ps(&Speed[n]), _mm_set1_ps(MinFadeVel)), _mm_set1_ps(fadeVelRange)) : one;
+		__m128 lifeAlpha = lifeFade ? _mm_div_ps(_mm_cvtepi32_ps(_mm_sub_epi32(life, _mm_set1_epi32(MinFadeLife))), _mm_set1_ps(fadeLifeRange)) : one;
+		_mm_storeu_ps(&FadeAlpha[n], _mm_max_ps(zero, _mm_min_ps(one, _mm_mul_ps(velocity, lifeAlpha))));
+
+		__m128 started = _mm_castsi128_ps(_mm_cmpgt_epi32(startLife, _mm_setzero_si128()));
+		__m128 lifeDelta = _mm_div_ps(_mm_cvtepi32_ps(life), _mm_cvtepi32_ps(startLife));
+		lifeDelta = _mm_or_ps(_mm_and_ps(started, lifeDelta), _mm_andnot_ps(started, one));
+		__m128 lifeScale = _mm_div_ps(_mm_sub_ps(lifeDelta, _mm_set1_ps(MinScaleLife)), _mm_set1_ps(scaleLifeRange));
+		__m128 x = _mm_add_ps(_mm_set1_ps(MaxFadeScale.X), _mm_mul_ps(lifeScale, _mm_set1_ps(scaleRange.X)));
+		__m128 y = _mm_add_ps(_mm_set1_ps(MaxFadeScale.Y), _mm_mul_ps(lifeScale, _mm_set1_ps(scaleRange.Y)));
+		_mm_storeu_ps(&FadeScaleX[n], _mm_max_ps(_mm_set1_ps(scaleMin.X), _mm_min_ps(_mm_set1_ps(scaleMax.X), x)));
+		_mm_storeu_ps(&FadeScaleY[n], _mm_max_ps(_mm_set1_ps(scaleMin.Y), _mm_min_ps(_mm_set1_ps(scaleMax.Y), y)));
+	}
+#elif defined(PARTICLES_NEON)
+	for (; m + 2 <= count; m += 2)
+	{
+		float64x2_t x = vld1q_f64(&VelX[m]), y = vld1q_f64(&VelY[m]), z = vld1q_f64(&VelZ[m]);
+		float64x2_t length = vsqrtq_f64(vaddq_f64(vaddq_f64(vmulq_f64(x, x), vmulq_f64(y, y)), vmulq_f64(z, z)));
+		vst1_f32(&Speed[m], vcvt_f32_f64(length));
+	}
+
+	const float32x4_t zero = vdupq_n_f32(0.0f), one = vdupq_n_f32(1.0f);
+	for (; n + 4 <= count; n += 4)
+	{
+		int32x4_t life = vld1q_s32(&Life[n]);
+		int32x4_t startLife = vld1q_s32(&StartLife[n]);
+
+		float32x4_t velocity = velocityFade ? vdivq_f32(vsubq_f32(vld1q_f32(&Speed[n]), vdupq_n_f32(MinFadeVel)), vdupq_n_f32(fadeVelRange)) : one;
+		float32x4_t lifeAlpha = lifeFade ? vdivq_f32(vcvtq_f32_s32(vsubq_s32(life, vdupq_n_s32(MinFadeLife))), vdupq_n_f32(fadeLifeRange)) : one;
+		vst1q_f32(&FadeAlpha[n], vmaxq_f32(zero, vminq_f32(one, vmulq_f32(velocity, lifeAlpha))));
+
+		uint32x4_t started = vcgtq_s32(startLife, vdupq_n_s32(0));
+		float32x4_t lifeDelta = vbslq_f32(started, vdivq_f32(vcvtq_f32_s32(life), vcvtq_f32_s32(startLife)), one);
+		float32x4_t lifeScale = vdivq_f32(vsubq_f32(lifeDelta, vdupq_n_f32(MinScaleLife)), vdupq_n_f32(scaleLifeRange));
+		float32x4_t x = vaddq_f32(vdupq_n_f32(MaxFadeScale.X), vmulq_f32(lifeScale, vdupq_n_f32(scaleRange.X)));
+		float32x4_t y = vaddq_f32(vdupq_n_f32(MaxFadeScale.Y), vmulq_f32(lifeScale, vdupq_n_f32(scaleRange.Y)));
+		vst1q_f32(&FadeScaleX[n], vmaxq_f32(vdupq_n_f32(scaleMin.X), vminq_f32(vdupq_n_f32(scaleMax.X), x)));
+		vst1q_f32(&FadeScaleY[n], vmaxq_f32(vdupq_n_f32(scaleMin.Y), vminq_f32(vdupq_n_f32(scaleMax.Y), y)));
+	}
+#endif
 
-		particle->prevpos = particle->pos;
-		float prevFloorZ = particle->floorz;
+	for (; m < count; m++)
+	{
+		Speed[m] = (float)DVector3(VelX[m], VelY[m], VelZ[m]).Length();
+	}
+	for (; n < count; n++)
+	{
+		float velocity = velocityFade ? (Speed[n] - MinFadeVel) / fadeVelRange : 1.0f;
+		float lifeAlpha = lifeFade ? float(Life[n] - MinFadeLife) / fadeLifeRange : 1.0f;
+		FadeAlpha[n] = std::clamp(velocity * lifeAlpha, 0.0f, 1.0f);
+
+		float lifeDelta = StartLife[n] > 0 ? Life[n] / float(StartLife[n]) : 1.0f;
+		float lifeScale = (lifeDelta - MinScaleLife) / scaleLifeRange;
+		FadeScaleX[n] = std::clamp(MaxFadeScale.X + lifeScale * scaleRange.X, scaleMin.X, scaleMax.X);
+		FadeScaleY[n] = std::clamp(MaxFadeScale.Y + lifeScale * scaleRange.Y, scaleMin.Y, scaleMax.Y);
+	}
+}
+
+//==========================================================================
+//
+// Collects the particles to process this tic into a packed array so that the
+// main loop does not depend on the linked list which its callbacks may alter.
+//
+//==========================================================================
+
+static bool P_HasThinkScript(DParticleDefinition* definition)
+{
+	if (definition->HasFlag(PDF_NOTHINK)) return false;
+
+	IFVIRTUALPTR(definition, DParticleDefinition, ThinkParticle)
+	{
+		return !(func->VarFlags & VARF_Native);
+	}
+	return false;
+}
+
+static void P_PrepareDefinedParticles(FLevelLocals* Level)
+{
+	particlelevelpool_t& pool = Level->DefinedParticlePool;
+
+	pool.ActiveList.Clear();
+	pool.ScriptFree.Clear();
+	pool.NumScriptFree = 0;
+
+	for (uint32_t i = pool.ActiveParticles; i != NO_PARTICLE; i = pool.Particles[i].tnext)
+	{
+		particledata_t& particle = pool.Particles[i];
+		bool scriptFree = particle.definition && !P_HasThinkScript(particle.definition);
+
+		pool.ActiveList.Push(uint16_t(i));
+		pool.ScriptFree.Push(scriptFree);
+		pool.NumScriptFree += scriptFree;
+	}
+
+	if (pool.SpawnedThisTic.Size() != pool.Particles.Size())
+	{
+		pool.SpawnedThisTic.Resize(pool.Particles.Size());
+	}
+	if (pool.SpawnedThisTic.Size() > 0)
+	{
+		pool.SpawnedThisTic.Zero();
+	}
+}
+
+//==========================================================================
+//
+// Line portal traversal uses the global validcount and cannot run on a worker
+// thread. This mirrors the early-out in GetPortalOffsetPosition to tell whether
+// the traversal would be skipped anyway.
+//
+//==========================================================================
 
-		if (particle->sleepFor > 0)
+static bool P_PortalOffsetIsTrivial(FLevelLocals* Level, double x, double y, double dx, double dy)
+{
+	if (!Level->PortalBlockmap.containsLines) return true;
+	if (dx < 128 && dy < 128)
+	{
+		int blockx = Level->blockmap.GetBlockX(x);
+		int blocky = Level->blockmap.GetBlockY(y);
+		if (blockx < 0 || blocky < 0 || blockx >= Level->PortalBlockmap.dx || blocky >= Level->PortalBlockmap.dy || !Level->PortalBlockmap(blockx, blocky).neighborContainsLines) return true;
+	}
+	return false;
+}
+
+enum EParticleThinkResult
+{
+	PTR_SKIPPED,	// Frozen, sleeping or destroyed. Does not count towards the cull limit.
+	PTR_PROCESSED,
+	PTR_DEFERRED,	// A speculative run hit something with side effects and must be redone on the game thread.
+};
+
+//==========================================================================
+//
+// Pieces of a particle's tic shared by the scalar and the batched paths.
+//
+//==========================================================================
+
+static void P_AnimateDefinedParticle(DParticleDefinition* definition, particledata_t* particle, int prevAnimFrame)
+{
+	if (particle->HasFlag(DPF_ANIMATING))
+	{
+		uint8_t animFrameCount = (uint8_t)definition->AnimationFrames.Size();
+		if (definition->AnimationSequences.size() > 0 && particle->animFrame < animFrameCount)
 		{
-			particle->sleepFor--;
+			const particleanimframe_t& animFrame = definition->AnimationFrames[particle->animFrame];
 
-			if (particle->HasFlag(DPF_ATREST))
+			uint8_t sequenceIndex = animFrame.sequence;
+			const particleanimsequence_t& sequence = definition->AnimationSequences[sequenceIndex];
+
+			// Don't update the frame on the first update, or if the animFrame has been changed during CallThinkParticle
+			if (!particle->HasFlag(DPF_FIRSTUPDATE) && particle->animFrame == prevAnimFrame)
 			{
-				particle->floorz = (float)particle->restplane->ZatPoint(particle->pos) + 0.1f;
+				if (++particle->animTick >= animFrame.duration)
+				{
+					particle->animTick = 0;
+					particle->animFrame++;
 
-				// We're setting the vel rather than the pos so that we get proper interpolation for moving floors
-				particle->pos.Z += particle->vel.Z;
-				particle->vel.Z = (particle->floorz - prevFloorZ);
-			}
+					if (particle->animFrame >= sequence.endFrame)
+					{
+						if (particle->HasFlag(DPF_LOOPANIMATION))
+						{
+							// Loop the animation if it's finished
+							particle->animFrame = sequence.startFrame;
+						}
+						else
+						{
+							// Go back to the previous frame and stop
+							particle->animFrame--;
+							particle->ClearFlag(DPF_ANIMATING);
+						}
+					}
 
-			continue;
+					particle->texture = definition->AnimationFrames[particle->animFrame].frame;
+				}
+			}
+			else
+			{
+				particle->texture = definition->AnimationFrames[particle->animFrame].frame;
+			}
 		}
+	}
+}
 
-		int prevAnimFrame = particle->animFrame;
+static void P_MoveDefinedParticleZ(particledata_t* particle, sector_t* s, float prevFloorZ)
+{
+	particle->floorz = particle->GetFloorHeight();
+	particle->ceilingz = (float)s->ceilingplane.ZatPoint(particle->pos);
 
-		definition->CallThinkParticle(particle);
+	if (particle->HasFlag(DPF_ATREST))
+	{
+		// We're setting the vel rather than the pos so that we get proper interpolation for moving floors
+		particle->pos.Z += particle->vel.Z;
+		particle->vel.Z = (particle->floorz - prevFloorZ);
+	}
+	else
+	{
+		particle->pos.Z += particle->vel.Z;
+	}
+}
+
+static void P_FadeDefinedParticle(DParticleDefinition* definition, particledata_t* particle)
+{
+	if (definition->HasFlag(PDF_VELOCITYFADE) || definition->HasFlag(PDF_LIFEFADE))
+	{
+		definition->HandleFading(particle);
+	}
+
+	if (definition->HasFlag(PDF_LIFESCALE))
+	{
+		definition->HandleScaling(particle);
+	}
+}
+
+//==========================================================================
+//
+// The rest of a particle's tic once it has moved: sector portals, collisions
+// and bouncing. Batched particles leave their fading and scaling to the batch.
+//
+//==========================================================================
+
+static EParticleThinkResult P_FinishDefinedParticle(FLevelLocals* Level, particledata_t* particle, int particleIndex, bool speculative, bool batched)
+{
+	DParticleDefinition* definition = particle->definition;
+	sector_t* s = particle->subsector->sector;
+
+	// Crossing a sector portal leaves the particle without a subsector, so its result could not be validated.
+	if (speculative && (!s->PortalBlocksMovement(sector_t::ceiling) || !s->PortalBlocksMovement(sector_t::floor)))
+	{
+		return PTR_DEFERRED;
+	}
 
-		if (particle->life > 0)
+	// Handle crossing a sector portal.
+	if (!s->PortalBlocksMovement(sector_t::ceiling))
+	{
+		if (particle->pos.Z > s->GetPortalPlaneZ(sector_t::ceiling))
 		{
-			particle->life--;
+			particle->pos += s->GetPortalDisplacement(sector_t::ceiling);
+			particle->subsector = NULL;
 		}
+	}
+	else if (!s->PortalBlocksMovement(sector_t::floor))
+	{
+		if (particle->pos.Z < s->GetPortalPlaneZ(sector_t::floor))
+		{
+			particle->pos += s->GetPortalDisplacement(sector_t::floor);
+			particle->subsector = NULL;
+		}
+	}
+
+	bool bounced = false;
 
-		if ((particle->life == 0) || particle->HasFlag(DPF_DESTROYED))
-		{ // The particle has expired, so free it
-			if (P_DestroyDefinedParticle(Level, particleIndex))
+	if (!particle->HasFlag(DPF_NOPROCESS))
+	{
+		if (particle->flags & DPF_COLLIDEWITHPLAYER)
+		{
+			player_t* player = Level->Players[0];
+			if (player && player->mo)
 			{
-				continue;
+				DVector3 pos = player->mo->Pos();
+				double radius = player->mo->radius;
+				double height = player->mo->Height;
+
+				double minx = pos.X - radius;
+				double maxx = pos.X + radius;
+				double miny = pos.Y - radius;
+				double maxy = pos.Y + radius;
+				double minz = pos.Z;
+				double maxz = pos.Z + height;
+
+				if (particle->pos.X >= minx && particle->pos.X <= maxx &&
+					particle->pos.Y >= miny && particle->pos.Y <= maxy &&
+					particle->pos.Z >= minz && particle->pos.Z <= maxz)
+				{
+					if (speculative) return PTR_DEFERRED;
+					definition->CallOnParticleCollideWithPlayer(particle, player->mo);
+				}
 			}
 		}
 
-		if (particle->HasFlag(DPF_ANIMATING))
+		if (definition->Flags & PDF_BOUNCEONFLOORS)
 		{
-			uint8_t animFrameCount = (uint8_t)definition->AnimationFrames.Size();
-			if (definition->AnimationSequences.size() > 0 && particle->animFrame < animFrameCount)
+			// Bouncing needs random numbers which must be generated in a fixed order.
+			if (speculative && ((particle->pos.Z < particle->floorz && particle->vel.Z < 0) || (particle->pos.Z > particle->ceilingz && particle->vel.Z > 0)))
 			{
-				const particleanimframe_t& animFrame = definition->AnimationFrames[particle->animFrame];
+				return PTR_DEFERRED;
+			}
 
-				uint8_t sequenceIndex = animFrame.sequence;
-				const particleanimsequence_t& sequence = definition->AnimationSequences[sequenceIndex];
+			if (particle->pos.Z < particle->floorz && particle->vel.Z < 0)
+			{
+				float bounceFactor = ParticleRandom(definition->MinBounceFactor, definition->MaxBounceFactor);
 
-				// Don't update the frame on the first update, or if the animFrame has been changed during CallThinkParticle
-				if (!particle->HasFlag(DPF_FIRSTUPDATE) && particle->animFrame == prevAnimFrame)
+				if (particle->pos.Z - particle->vel.Z - particle->floorz >= -definition->MaxStepHeight)
 				{
-					if (++particle->animTick >= animFrame.duration)
-					{
-						particle->animTick = 0;
-						particle->animFrame++;
+					particle->pos.Z = particle->floorz;
+					particle->vel.Z *= -(bounceFactor * ParticleRandom(1.0f - definition->BounceFudge, 1.0f));
+					bounced = true;
+					particle->invalidateTicks = 0;
+				}
+				else
+				{
+					particle->vel.Z = 0;
+					particle->invalidateTicks++;
+				}
 
-						if (particle->animFrame >= sequence.endFrame)
-						{
-							if (particle->HasFlag(DPF_LOOPANIMATION))
-							{
-								// Loop the animation if it's finished
-								particle->animFrame = sequence.startFrame;
-							}
-							else
-							{
-								// Go back to the previous frame and stop
-								particle->animFrame--;
-								particle->ClearFlag(DPF_ANIMATING);
-							}
-						}
+				particle->vel.X *= bounceFactor;
+				particle->vel.Y *= bounceFactor;
 
-						particle->texture = definition->AnimationFrames[particle->animFrame].frame;
-					}
+				DVector2 deflected = particle->vel.XY().Rotated(ParticleRandom(definition->MinBounceDeflect, definition->MaxBounceDeflect));
+				particle->vel.X = deflected.X;
+				particle->vel.Y = deflected.Y;
+			}
+			else if (particle->pos.Z > particle->ceilingz && particle->vel.Z > 0)
+			{
+				float bounceFactor = ParticleRandom(definition->MinBounceFactor, definition->MaxBounceFactor);
+
+				if (particle->pos.Z - particle->vel.Z - particle->ceilingz <= -definition->MaxStepHeight)
+				{
+					particle->pos.Z = particle->ceilingz;
+					particle->vel.Z *= -(bounceFactor * ParticleRandom(1.0f - definition->BounceFudge, 1.0f));
+					bounced = true;
+					particle->invalidateTicks = 0;
 				}
 				else
 				{
-					particle->texture = definition->AnimationFrames[particle->animFrame].frame;
+					particle->vel.Z = 0;
+					particle->invalidateTicks++;
 				}
-			}
-		}
 
-		particle->alpha += particle->alphaStep;
-		particle->scale = FVector2(particle->scale.X * particle->scaleStep.X, particle->scale.Y * particle->scaleStep.Y);
-		particle->angle += particle->angleStep;
-		particle->pitch += particle->pitchStep;
-		particle->roll += particle->rollStep;
+				particle->vel.X *= bounceFactor;
+				particle->vel.Y *= bounceFactor;
 
-		// Handle crossing a line portal
-		double movex = (particle->pos.X - particle->prevpos.X) + particle->vel.X;
-		double movey = (particle->pos.Y - particle->prevpos.Y) + particle->vel.Y;
-		DVector2 newxy = Level->GetPortalOffsetPosition(particle->prevpos.X, particle->prevpos.Y, movex, movey);
-		particle->pos.X = newxy.X;
-		particle->pos.Y = newxy.Y;
+				DVector2 deflected = particle->vel.XY().Rotated(ParticleRandom(definition->MinBounceDeflect, definition->MaxBounceDeflect));
+				particle->vel.X = deflected.X;
+				particle->vel.Y = deflected.Y;
+			}
+			else
+			{
+				particle->invalidateTicks = 0;
+			}
 
-		particle->subsector = Level->PointInRenderSubsector(particle->pos);
-		sector_t* s = particle->subsector->sector;
+			if (bounced)
+			{
+				definition->CallOnParticleBounce(particle);
+			}
 
-		if (particle->gravity != 0)
-		{
-			particle->vel *= 1.0f - definition->Drag;
+			bool onFloor = abs(particle->pos.Z - particle->floorz) < 0.01 || abs(particle->prevpos.Z - particle->floorz) < 0.01;
 
-			if (!particle->HasFlag(DPF_ATREST))
+			// Check for becoming at rest while on the floor
+			if (!bounced && !particle->HasFlag(DPF_ATREST) && onFloor)
 			{
-				if ((definition->HasFlag(PDF_CHECKWATERSPAWN) && particle->HasFlag(DPF_SPAWNEDUNDERWATER)) || definition->HasFlag(PDF_CHECKWATER))
-				{
-					particle->UpdateUnderwater();
-				}
-
-				if (particle->HasFlag(DPF_UNDERWATER))
+				if (particle->vel.Length() < definition->StopSpeed) 
 				{
-					// Do sinking logic, cut down from AActor::FallAndSink
-					double sinkspeed = -WATER_SINK_SPEED * 0.01;
+					if (speculative) return PTR_DEFERRED;
+					particle->vel.Zero();
 
-					if (particle->vel.Z < sinkspeed)
-					{ // Dropping too fast, so slow down toward sinkspeed.
-						particle->vel.Z -= max(sinkspeed * 2, -8.);
-						if (particle->vel.Z > sinkspeed)
-						{
-							particle->vel.Z = sinkspeed;
-						}
+					if (definition->HasFlag(PDF_KILLSTOP)) 
+					{
+						definition->CleanupParticle(particle);
+						return PTR_SKIPPED;
 					}
-					else if (particle->vel.Z > sinkspeed)
-					{ // Dropping too slow/going up, so trend toward sinkspeed.
-						particle->vel.Z += max(sinkspeed / 3, -8.);
-						if (particle->vel.Z < sinkspeed)
-						{
-							particle->vel.Z = sinkspeed;
-						}
+					else 
+					{
+						definition->RestParticle(particle);
 					}
 				}
-				else
-				{
-					float gravity = (float)(Level->gravity * s->gravity * (double)particle->gravity * 0.00125);
-					particle->vel.Z -= gravity;
-				}
+			}
+
+
+			if (particle->invalidateTicks > 5)
+			{
+				if (speculative) return PTR_DEFERRED;
+				if (P_DestroyDefinedParticle(Level, particleIndex)) return PTR_SKIPPED;
 			}
 		}
+	}
 
-		particle->floorz = particle->GetFloorHeight();
-		particle->ceilingz = (float)s->ceilingplane.ZatPoint(particle->pos);
+	if (particle->HasFlag(DPF_DESTROYED))
+	{
+		if (speculative) return PTR_DEFERRED;
+		P_DestroyDefinedParticle(Level, particleIndex);
+		return PTR_SKIPPED;
+	}
+
+	if (!batched)
+	{
+		P_FadeDefinedParticle(definition, particle);
+	}
+
+	if (definition->HasFlag(PDF_DIRFROMMOMENTUM))
+	{
+		DVector3 dir = particle->vel.Unit();
+		particle->angle = (float)datan2(dir.Y, dir.X);
+		particle->pitch = -(float)dasin(dir.Z);
+		particle->roll = 90;
+
+		if (bounced && definition->HasFlag(PDF_INSTANTBOUNCE))
+		{
+			particle->prevpos = particle->pos;
+		}
+	}
+
+	return PTR_PROCESSED;
+}
+
+//==========================================================================
+//
+// Runs one particle for one tic, except for the cull limit check which depends
+// on the processing order.
+//
+// With 'speculative' set this may be called from a worker thread on a copy of
+// the particle. In that case it must not have any side effects outside the copy:
+// no script callbacks, no sounds, no random numbers and no changes to the pool.
+// As soon as one of those would be needed PTR_DEFERRED is returned and the
+// game thread processes the particle regularly. Everything else it reads is
+// captured beforehand and compared again before the result is used, so the
+// outcome is the same as if everything ran serially.
+//
+//==========================================================================
+
+static EParticleThinkResult P_ThinkDefinedParticle(FLevelLocals* Level, particledata_t* particle, int particleIndex, bool speculative)
+{
+	DParticleDefinition* definition = particle->definition;
+
+	if (Level->isFrozen() && !(particle->flags & DPF_NOTIMEFREEZE))
+	{
+		return PTR_SKIPPED;
+	}
+
+	particle->prevpos = particle->pos;
+	float prevFloorZ = particle->floorz;
+
+	if (particle->sleepFor > 0)
+	{
+		particle->sleepFor--;
 
 		if (particle->HasFlag(DPF_ATREST))
 		{
+			// The plane it rests on may belong to any sector, which the speculation snapshot can't map back to.
+			if (speculative) return PTR_DEFERRED;
+			particle->floorz = (float)particle->restplane->ZatPoint(particle->pos) + 0.1f;
+
 			// We're setting the vel rather than the pos so that we get proper interpolation for moving floors
 			particle->pos.Z += particle->vel.Z;
 			particle->vel.Z = (particle->floorz - prevFloorZ);
 		}
-		else
-		{
-			particle->pos.Z += particle->vel.Z;
-		}
 
-		// Handle crossing a sector portal.
-		if (!s->PortalBlocksMovement(sector_t::ceiling))
-		{
-			if (particle->pos.Z > s->GetPortalPlaneZ(sector_t::ceiling))
-			{
-				particle->pos += s->GetPortalDisplacement(sector_t::ceiling);
-				particle->subsector = NULL;
-			}
-		}
-		else if (!s->PortalBlocksMovement(sector_t::floor))
+		return PTR_SKIPPED;
+	}
+
+	int prevAnimFrame = particle->animFrame;
+
+	// Worker threads only get particles that don't run any ThinkParticle script code.
+	if (!speculative && !definition->HasFlag(PDF_NOTHINK))
+	{
+		definition->CallThinkParticle(particle);
+	}
+
+	if (particle->life > 0)
+	{
+		particle->life--;
+	}
+
+	if ((particle->life == 0) || particle->HasFlag(DPF_DESTROYED))
+	{ // The particle has expired, so free it
+		if (speculative) return PTR_DEFERRED;
+		if (P_DestroyDefinedParticle(Level, particleIndex))
 		{
-			if (particle->pos.Z < s->GetPortalPlaneZ(sector_t::floor))
-			{
-				particle->pos += s->GetPortalDisplacement(sector_t::floor);
-				particle->subsector = NULL;
-			}
+			return PTR_SKIPPED;
 		}
+	}
 
-		bool bounced = false;
+	P_AnimateDefinedParticle(definition, particle, prevAnimFrame);
 
-		if (!particle->HasFlag(DPF_NOPROCESS))
+	particle->alpha += particle->alphaStep;
+	particle->scale = FVector2(particle->scale.X * particle->scaleStep.X, particle->scale.Y * particle->scaleStep.Y);
+	particle->angle += particle->angleStep;
+	particle->pitch += particle->pitchStep;
+	particle->roll += particle->rollStep;
+
+	// Handle crossing a line portal
+	double movex = (particle->pos.X - particle->prevpos.X) + particle->vel.X;
+	double movey = (particle->pos.Y - particle->prevpos.Y) + particle->vel.Y;
+	if (speculative && !P_PortalOffsetIsTrivial(Level, particle->prevpos.X, particle->prevpos.Y, movex, movey))
+	{
+		return PTR_DEFERRED;
+	}
+	DVector2 newxy = Level->GetPortalOffsetPosition(particle->prevpos.X, particle->prevpos.Y, movex, movey);
+	particle->pos.X = newxy.X;
+	particle->pos.Y = newxy.Y;
+
+	particle->subsector = Level->PointInRenderSubsector(particle->pos);
+	sector_t* s = particle->subsector->sector;
+
+	if (particle->gravity != 0)
+	{
+		particle->vel *= 1.0f - definition->Drag;
+
+		if (!particle->HasFlag(DPF_ATREST))
 		{
-			if (particle->flags & DPF_COLLIDEWITHPLAYER)
+			if ((definition->HasFlag(PDF_CHECKWATERSPAWN) && particle->HasFlag(DPF_SPAWNEDUNDERWATER)) || definition->HasFlag(PDF_CHECKWATER))
 			{
-				player_t* player = Level->Players[0];
-				if (player && player->mo)
-				{
-					DVector3 pos = player->mo->Pos();
-					double radius = player->mo->radius;
-					double height = player->mo->Height;
-
-					double minx = pos.X - radius;
-					double maxx = pos.X + radius;
-					double miny = pos.Y - radius;
-					double maxy = pos.Y + radius;
-					double minz = pos.Z;
-					double maxz = pos.Z + height;
-
-					if (particle->pos.X >= minx && particle->pos.X <= maxx &&
-						particle->pos.Y >= miny && particle->pos.Y <= maxy &&
-						particle->pos.Z >= minz && particle->pos.Z <= maxz)
-					{
-						definition->CallOnParticleCollideWithPlayer(particle, player->mo);
-					}
-				}
+				// Entering or leaving water calls into the definition's script.
+				if (speculative && particle->CheckWater(nullptr) != particle->HasFlag(DPF_UNDERWATER)) return PTR_DEFERRED;
+				particle->UpdateUnderwater();
 			}
 
-			if (definition->Flags & PDF_BOUNCEONFLOORS)
+			if (particle->HasFlag(DPF_UNDERWATER))
 			{
-				if (particle->pos.Z < particle->floorz && particle->vel.Z < 0)
-				{
-					float bounceFactor = ParticleRandom(definition->MinBounceFactor, definition->MaxBounceFactor);
+				// Do sinking logic, cut down from AActor::FallAndSink
+				double sinkspeed = -WATER_SINK_SPEED * 0.01;
 
-					if (particle->pos.Z - particle->vel.Z - particle->floorz >= -definition->MaxStepHeight)
+				if (particle->vel.Z < sinkspeed)
+				{ // Dropping too fast, so slow down toward sinkspeed.
+					particle->vel.Z -= max(sinkspeed * 2, -8.);
+					if (particle->vel.Z > sinkspeed)
 					{
-						particle->pos.Z = particle->floorz;
-						particle->vel.Z *= -(bounceFactor * ParticleRandom(1.0f - definition->BounceFudge, 1.0f));
-						bounced = true;
-						particle->invalidateTicks = 0;
+						particle->vel.Z = sinkspeed;
 					}
-					else
+				}
+				else if (particle->vel.Z > sinkspeed)
+				{ // Dropping too slow/going up, so trend toward sinkspeed.
+					particle->vel.Z += max(sinkspeed / 3, -8.);
+					if (particle->vel.Z < sinkspeed)
 					{
-						particle->vel.Z = 0;
-						particle->invalidateTicks++;
+						particle->vel.Z = sinkspeed;
 					}
+				}
+			}
+			else
+			{
+				float gravity = (float)(Level->gravity * s->gravity * (double)particle->gravity * 0.00125);
+				particle->vel.Z -= gravity;
+			}
+		}
+	}
 
-					particle->vel.X *= bounceFactor;
-					particle->vel.Y *= bounceFactor;
+	P_MoveDefinedParticleZ(particle, s, prevFloorZ);
 
-					DVector2 deflected = particle->vel.XY().Rotated(ParticleRandom(definition->MinBounceDeflect, definition->MaxBounceDeflect));
-					particle->vel.X = deflected.X;
-					particle->vel.Y = deflected.Y;
-				}
-				else if (particle->pos.Z > particle->ceilingz && particle->vel.Z > 0)
-				{
-					float bounceFactor = ParticleRandom(definition->MinBounceFactor, definition->MaxBounceFactor);
+	return P_FinishDefinedParticle(Level, particle, particleIndex, speculative, false);
+}
 
-					if (particle->pos.Z - particle->vel.Z - particle->ceilingz <= -definition->MaxStepHeight)
-					{
-						particle->pos.Z = particle->ceilingz;
-						particle->vel.Z *= -(bounceFactor * ParticleRandom(1.0f - definition->BounceFudge, 1.0f));
-						bounced = true;
-						particle->invalidateTicks = 0;
-					}
-					else
-					{
-						particle->vel.Z = 0;
-						particle->invalidateTicks++;
-					}
+//==========================================================================
+//
+// Runs of PDF_NOTHINK particles with the same definition are integrated in
+// batches. A particle can be batched if nothing before its vertical
+// movement can call into a script or traverse a line portal.
+//
+//==========================================================================
 
-					particle->vel.X *= bounceFactor;
-					particle->vel.Y *= bounceFactor;
+static bool P_CanBatchDefinedParticle(FLevelLocals* Level, const particledata_t& particle)
+{
+	DParticleDefinition* definition = particle.definition;
 
-					DVector2 deflected = particle->vel.XY().Rotated(ParticleRandom(definition->MinBounceDeflect, definition->MaxBounceDeflect));
-					particle->vel.X = deflected.X;
-					particle->vel.Y = deflected.Y;
-				}
-				else
-				{
-					particle->invalidateTicks = 0;
-				}
+	if (!definition->HasFlag(PDF_NOTHINK)) return false;
+	if (Level->isFrozen() && !(particle.flags & DPF_NOTIMEFREEZE)) return false;
+	if (particle.sleepFor > 0 || particle.life == 0 || particle.life == 1 || particle.HasFlag(DPF_DESTROYED | DPF_UNDERWATER)) return false;
+	if (definition->HasFlag(PDF_CHECKWATER) || (definition->HasFlag(PDF_CHECKWATERSPAWN) && particle.HasFlag(DPF_SPAWNEDUNDERWATER))) return false;
+	return P_PortalOffsetIsTrivial(Level, particle.pos.X, particle.pos.Y, particle.vel.X, particle.vel.Y);
+}
 
-				if (bounced)
-				{
-					definition->CallOnParticleBounce(particle);
-				}
+static void P_BatchDefinedParticles(FLevelLocals* Level, unsigned start)
+{
+	particlelevelpool_t& pool = Level->DefinedParticlePool;
+	particlekinematics_t& kin = pool.Kinematics;
+	DParticleDefinition* definition = pool.Particles[pool.ActiveList[start]].definition;
 
-				bool onFloor = abs(particle->pos.Z - particle->floorz) < 0.01 || abs(particle->prevpos.Z - particle->floorz) < 0.01;
+	kin.Index.Clear();
+	for (unsigned n = start; n < pool.ActiveList.Size() && kin.Index.Size() < MAX_PARTICLE_BATCH; n++)
+	{
+		int particleIndex = pool.ActiveList[n];
+		const particledata_t& particle = pool.Particles[particleIndex];
 
-				// Check for becoming at rest while on the floor
-				if (!bounced && !particle->HasFlag(DPF_ATREST) && onFloor)
-				{
-					if (particle->vel.Length() < definition->StopSpeed) 
-					{
-						particle->vel.Zero();
+		if (particle.definition != definition || pool.SpawnedThisTic[particleIndex] || !P_CanBatchDefinedParticle(Level, particle)) break;
+		kin.Index.Push(uint16_t(particleIndex));
+	}
 
-						if (definition->HasFlag(PDF_KILLSTOP)) 
-						{
-							definition->CleanupParticle(particle);
-							continue;
-						}
-						else 
-						{
-							definition->RestParticle(particle);
-						}
-					}
-				}
+	unsigned count = kin.Index.Size();
+	kin.Start = start;
+	kin.End = start + count;
+	kin.ScriptCalls = pool.ScriptCalls;
+	if (count == 0) return;
 
+	kin.Definition = definition;
+	kin.Flags = definition->Flags;
+	kin.MinFadeVel = definition->MinFadeVel;
+	kin.MaxFadeVel = definition->MaxFadeVel;
+	kin.MinFadeLife = definition->MinFadeLife;
+	kin.MaxFadeLife = definition->MaxFadeLife;
+	kin.MinScaleLife = definition->MinScaleLife;
+	kin.MaxScaleLife = definition->MaxScaleLife;
+	kin.MinFadeScale = definition->MinFadeScale;
+	kin.MaxFadeScale = definition->MaxFadeScale;
 
-				if (particle->invalidateTicks > 5 && P_DestroyDefinedParticle(Level, particleIndex))
-				{
-					continue;
-				}
-			}
-		}
+	kin.Resize(count);
+	for (unsigned k = 0; k < count; k++)
+	{
+		const particledata_t& particle = pool.Particles[kin.Index[k]];
+		kin.PosX[k] = particle.pos.X; kin.PosY[k] = particle.pos.Y;
+		kin.VelX[k] = particle.vel.X; kin.VelY[k] = particle.vel.Y; kin.VelZ[k] = particle.vel.Z;
+		kin.Alpha[k] = particle.alpha; kin.AlphaStep[k] = particle.alphaStep;
+		kin.ScaleX[k] = particle.scale.X; kin.ScaleY[k] = particle.scale.Y;
+		kin.ScaleStepX[k] = particle.scaleStep.X; kin.ScaleStepY[k] = particle.scaleStep.Y;
+		kin.Angle[k] = particle.angle; kin.AngleStep[k] = particle.angleStep;
+		kin.Pitch[k] = particle.pitch; kin.PitchStep[k] = particle.pitchStep;
+		kin.Roll[k] = particle.roll; kin.RollStep[k] = particle.rollStep;
+		kin.Finished[k] = false;
+	}
+
+	kin.IntegrateSteps();
+
+	// Drag and gravity depend on the sector the particle moved into.
+	double drag = 1.0f - definition->Drag;
+	for (unsigned k = 0; k < count; k++)
+	{
+		const particledata_t& particle = pool.Particles[kin.Index[k]];
+		kin.Subsector[k] = Level->PointInRenderSubsector(DVector2(kin.PosX[k], kin.PosY[k]));
+		sector_t* s = kin.Subsector[k]->sector;
+
+		kin.Drag[k] = particle.gravity != 0 ? drag : 1.0;
+		kin.Gravity[k] = particle.gravity != 0 && !particle.HasFlag(DPF_ATREST) ? (float)(Level->gravity * s->gravity * (double)particle.gravity * 0.00125) : 0.0f;
+	}
+
+	kin.IntegrateVelocity();
+}
+
+//==========================================================================
+//
+// Runs the tic of a particle from the current batch. The batch has already
+// done what P_ThinkDefinedParticle does before the vertical movement.
+//
+//==========================================================================
+
+static EParticleThinkResult P_ThinkBatchedParticle(FLevelLocals* Level, unsigned k)
+{
+	particlelevelpool_t& pool = Level->DefinedParticlePool;
+	particlekinematics_t& kin = pool.Kinematics;
+	int particleIndex = kin.Index[k];
+	particledata_t* particle = &pool.Particles[particleIndex];
+
+	particle->prevpos = particle->pos;
+	float prevFloorZ = particle->floorz;
 
-		if (particle->HasFlag(DPF_DESTROYED))
+	if (particle->life > 0)
+	{
+		particle->life--;
+	}
+
+	P_AnimateDefinedParticle(particle->definition, particle, particle->animFrame);
+
+	particle->alpha = kin.Alpha[k];
+	particle->scale = FVector2(kin.ScaleX[k], kin.ScaleY[k]);
+	particle->angle = kin.Angle[k];
+	particle->pitch = kin.Pitch[k];
+	particle->roll = kin.Roll[k];
+	particle->pos.X = kin.PosX[k];
+	particle->pos.Y = kin.PosY[k];
+	particle->vel = DVector3(kin.VelX[k], kin.VelY[k], kin.VelZ[k]);
+	particle->subsector = kin.Subsector[k];
+
+	P_MoveDefinedParticleZ(particle, particle->subsector->sector, prevFloorZ);
+
+	EParticleThinkResult result = P_FinishDefinedParticle(Level, particle, particleIndex, false, true);
+	if (result == PTR_PROCESSED)
+	{
+		if (pool.ScriptCalls == kin.ScriptCalls)
 		{
-			P_DestroyDefinedParticle(Level, particleIndex);
-			continue;
+			kin.Finished[k] = true;
+			kin.VelX[k] = particle->vel.X;
+			kin.VelY[k] = particle->vel.Y;
+			kin.VelZ[k] = particle->vel.Z;
+			kin.Life[k] = particle->life;
+			kin.StartLife[k] = particle->startLife;
+		}
+		else
+		{
+			// Its own callbacks ran script code which may have changed the definition's settings.
+			P_FadeDefinedParticle(particle->definition, particle);
 		}
+	}
+	return result;
+}
 
-		if (definition->HasFlag(PDF_VELOCITYFADE) || definition->HasFlag(PDF_LIFEFADE))
+//==========================================================================
+//
+// Fades and scales the particles of the current batch that finished their
+// tic. Nothing else reads what this sets until the next tic.
+//
+//==========================================================================
+
+static void P_FadeBatchedParticles(FLevelLocals* Level)
+{
+	particlelevelpool_t& pool = Level->DefinedParticlePool;
+	particlekinematics_t& kin = pool.Kinematics;
+	bool fade = kin.Flags & (PDF_VELOCITYFADE | PDF_LIFEFADE);
+	bool scale = kin.Flags & PDF_LIFESCALE;
+
+	if (kin.Index.Size() > 0 && (fade || scale))
+	{
+		kin.Fade();
+
+		for (unsigned k = 0; k < kin.Index.Size(); k++)
 		{
-			definition->HandleFading(particle);
+			int particleIndex = kin.Index[k];
+			particledata_t& particle = pool.Particles[particleIndex];
+
+			// A later particle's callbacks may have destroyed or replaced it.
+			if (!kin.Finished[k] || particle.definition != kin.Definition || pool.SpawnedThisTic[particleIndex]) continue;
+
+			if (fade) DParticleDefinition::SetFadeAlpha(&particle, kin.FadeAlpha[k]);
+			if (scale) particle.fadeScale = FVector2(kin.FadeScaleX[k], kin.FadeScaleY[k]);
 		}
+	}
+
+	kin.Index.Clear();
+	kin.Start = kin.End = 0;
+}
+
+//==========================================================================
+//
+// Captures what the worker threads are going to read besides the particles
+// themselves: the global state, every sector with its 3D floors and the
+// definitions of the particles they get.
+//
+//==========================================================================
 
-		if (definition->HasFlag(PDF_LIFESCALE)) 
+static void P_SnapshotDefinedParticleWorld(FLevelLocals* Level)
+{
+	particlelevelpool_t& pool = Level->DefinedParticlePool;
+	particlespecsnapshot_t& snap = pool.SpecSnapshot;
+
+	snap.ScriptCalls = snap.CheckedCalls = pool.ScriptCalls;
+	snap.WorldValid = snap.PlayerValid = true;
+	snap.Frozen = Level->isFrozen();
+	snap.Gravity = Level->gravity;
+	snap.Player = Level->Players[0];
+	snap.PlayerMo = snap.Player ? snap.Player->mo : nullptr;
+	if (snap.PlayerMo)
+	{
+		snap.PlayerPos = snap.PlayerMo->Pos();
+		snap.PlayerRadius = snap.PlayerMo->radius;
+		snap.PlayerHeight = snap.PlayerMo->Height;
+	}
+
+	snap.Sectors.Resize(Level->sectors.Size());
+	snap.FFloors.Clear();
+	for (unsigned i = 0; i < Level->sectors.Size(); i++)
+	{
+		sector_t& sec = Level->sectors[i];
+		particlespecsector_t& ss = snap.Sectors[i];
+
+		ss.FloorPlane = sec.floorplane;
+		ss.CeilingPlane = sec.ceilingplane;
+		ss.Gravity = sec.gravity;
+		ss.MoreFlags = sec.MoreFlags;
+		ss.PortalsBlock = uint8_t(sec.PortalBlocksMovement(sector_t::ceiling) | (sec.PortalBlocksMovement(sector_t::floor) << 1));
+		ss.FirstFFloor = snap.FFloors.Size();
+		ss.NumFFloors = sec.e->XFloor.ffloors.Size();
+		for (auto rover : sec.e->XFloor.ffloors)
 		{
-			definition->HandleScaling(particle);
+			particlespecffloor_t& sf = snap.FFloors[snap.FFloors.Reserve(1)];
+			sf.Flags = rover->flags;
+			sf.Top = *rover->top.plane;
+			sf.Bottom = *rover->bottom.plane;
 		}
+	}
 
-		if (definition->HasFlag(PDF_DIRFROMMOMENTUM))
+	snap.Definitions.Clear();
+	snap.DefinitionIndex.Clear();
+	snap.Definition.Resize(pool.ActiveList.Size());
+
+	DParticleDefinition* last = nullptr;
+	unsigned lastIndex = 0;
+	for (unsigned n = 0; n < pool.ActiveList.Size(); n++)
+	{
+		if (!pool.ScriptFree[n]) continue;
+
+		DParticleDefinition* definition = pool.Particles[pool.ActiveList[n]].definition;
+		if (definition != last)
 		{
-			DVector3 dir = particle->vel.Unit();
-			particle->angle = (float)datan2(dir.Y, dir.X);
-			particle->pitch = -(float)dasin(dir.Z);
-			particle->roll = 90;
+			unsigned* found = snap.DefinitionIndex.CheckKey(definition);
+			if (found)
+			{
+				lastIndex = *found;
+			}
+			else
+			{
+				lastIndex = snap.Definitions.Reserve(1);
+				snap.DefinitionIndex[definition] = lastIndex;
+
+				particlespecdefinition_t& sd = snap.Definitions[lastIndex];
+				sd.Definition = definition;
+				sd.Flags = definition->Flags;
+				sd.Drag = definition->Drag;
+				sd.StopSpeed = definition->StopSpeed;
+				sd.MinFadeVel = definition->MinFadeVel;
+				sd.MaxFadeVel = definition->MaxFadeVel;
+				sd.MinFadeLife = definition->MinFadeLife;
+				sd.MaxFadeLife = definition->MaxFadeLife;
+				sd.MinScaleLife = definition->MinScaleLife;
+				sd.MaxScaleLife = definition->MaxScaleLife;
+				sd.MinFadeScale = definition->MinFadeScale;
+				sd.MaxFadeScale = definition->MaxFadeScale;
+				sd.AnimationFrames = definition->AnimationFrames;
+				sd.AnimationSequences = definition->AnimationSequences;
+				sd.CheckedCalls = pool.ScriptCalls;
+				sd.Valid = true;
+			}
+			last = definition;
+		}
+		snap.Definition[n] = uint16_t(lastIndex);
+	}
+}
 
-			if (bounced && definition->HasFlag(PDF_INSTANTBOUNCE))
+static bool P_SpecDefinitionUnchanged(const particlespecdefinition_t& sd)
+{
+	DParticleDefinition* definition = sd.Definition;
+
+	if (sd.Flags != definition->Flags || sd.Drag != definition->Drag || sd.StopSpeed != definition->StopSpeed ||
+		sd.MinFadeVel != definition->MinFadeVel || sd.MaxFadeVel != definition->MaxFadeVel ||
+		sd.MinFadeLife != definition->MinFadeLife || sd.MaxFadeLife != definition->MaxFadeLife ||
+		sd.MinScaleLife != definition->MinScaleLife || sd.MaxScaleLife != definition->MaxScaleLife ||
+		sd.MinFadeScale != definition->MinFadeScale || sd.MaxFadeScale != definition->MaxFadeScale)
+	{
+		return false;
+	}
+
+	if (sd.AnimationFrames.Size() != definition->AnimationFrames.Size() || sd.AnimationSequences.Size() != definition->AnimationSequences.Size())
+	{
+		return false;
+	}
+	for (unsigned i = 0; i < sd.AnimationFrames.Size(); i++)
+	{
+		const particleanimframe_t& a = sd.AnimationFrames[i];
+		const particleanimframe_t& b = definition->AnimationFrames[i];
+		if (a.frame != b.frame || a.duration != b.duration || a.sequence != b.sequence) return false;
+	}
+	for (unsigned i = 0; i < sd.AnimationSequences.Size(); i++)
+	{
+		const particleanimsequence_t& a = sd.AnimationSequences[i];
+		const particleanimsequence_t& b = definition->AnimationSequences[i];
+		if (a.startFrame != b.startFrame || a.endFrame != b.endFrame) return false;
+	}
+	return true;
+}
+
+static bool P_SpecSectorUnchanged(const particlespecsnapshot_t& snap, sector_t* sec)
+{
+	const particlespecsector_t& ss = snap.Sectors[sec->Index()];
+
+	if (ss.FloorPlane != sec->floorplane || ss.CeilingPlane != sec->ceilingplane || ss.Gravity != sec->gravity || ss.MoreFlags != sec->MoreFlags)
+	{
+		return false;
+	}
+	if (ss.PortalsBlock != uint8_t(sec->PortalBlocksMovement(sector_t::ceiling) | (sec->PortalBlocksMovement(sector_t::floor) << 1)))
+	{
+		return false;
+	}
+
+	auto& ffloors = sec->e->XFloor.ffloors;
+	if (ss.NumFFloors != ffloors.Size())
+	{
+		return false;
+	}
+	for (unsigned i = 0; i < ss.NumFFloors; i++)
+	{
+		const particlespecffloor_t& sf = snap.FFloors[ss.FirstFFloor + i];
+		F3DFloor* rover = ffloors[i];
+		if (sf.Flags != rover->flags || sf.Top != *rover->top.plane || sf.Bottom != *rover->bottom.plane) return false;
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// Tells whether a worker thread's result for ActiveList entry n can be taken
+// over. The particle itself must be exactly as the worker found it. If any
+// script code ran since the workers started, everything else it read must
+// be unchanged as well.
+//
+//==========================================================================
+
+static bool P_SpeculationIsValid(FLevelLocals* Level, unsigned n, const particledata_t& particle, const particledata_t& result)
+{
+	particlelevelpool_t& pool = Level->DefinedParticlePool;
+	particlespecsnapshot_t& snap = pool.SpecSnapshot;
+
+	// This also catches callbacks that relinked, replaced or modified it through a ParticleData reference.
+	if (memcmp(&particle, &snap.Input[n], sizeof(particledata_t)) != 0)
+	{
+		return false;
+	}
+
+	// Without script code nothing else a worker reads can change while the particles think.
+	if (pool.ScriptCalls == snap.ScriptCalls)
+	{
+		return true;
+	}
+
+	if (snap.CheckedCalls != pool.ScriptCalls)
+	{
+		snap.CheckedCalls = pool.ScriptCalls;
+		snap.WorldValid = snap.Frozen == Level->isFrozen() && snap.Gravity == Level->gravity;
+
+		player_t* player = Level->Players[0];
+		AActor* mo = player ? player->mo : nullptr;
+		snap.PlayerValid = player == snap.Player && mo == snap.PlayerMo &&
+			(!mo || (mo->Pos() == snap.PlayerPos && mo->radius == snap.PlayerRadius && mo->Height == snap.PlayerHeight));
+	}
+	if (!snap.WorldValid || (!snap.PlayerValid && (particle.flags & DPF_COLLIDEWITHPLAYER)))
+	{
+		return false;
+	}
+
+	particlespecdefinition_t& sd = snap.Definitions[snap.Definition[n]];
+	if (sd.CheckedCalls != pool.ScriptCalls)
+	{
+		sd.CheckedCalls = pool.ScriptCalls;
+		sd.Valid = P_SpecDefinitionUnchanged(sd);
+	}
+	if (!sd.Valid)
+	{
+		return false;
+	}
+
+	// A processed particle only ever looked at the sector it ended up in.
+	return result.subsector == nullptr || P_SpecSectorUnchanged(snap, result.subsector->sector);
+}
+
+//==========================================================================
+//
+// Speculatively runs the script-less particles on worker threads.
+// Each worker gets a contiguous range of the active list and writes its
+// results into that range of the result arrays only, so the game thread can
+// consume them in list order afterwards.
+//
+//==========================================================================
+
+static bool P_SpeculateDefinedParticles(FLevelLocals* Level)
+{
+	particlelevelpool_t& pool = Level->DefinedParticlePool;
+	unsigned count = pool.ActiveList.Size();
+
+	pool.SpecResult.Resize(count);
+	memset(pool.SpecResult.Data(), PTR_DEFERRED, count);
+
+	int numThreads = r_particlethreads;
+	if (numThreads <= 0)
+	{
+		numThreads = clamp<int>(std::thread::hardware_concurrency() - 1, 1, MAX_PARTICLE_THREADS);
+	}
+	numThreads = min<int>(numThreads, count / MIN_PARTICLES_PER_THREAD);
+	if (numThreads <= 1 || pool.NumScriptFree < MIN_PARTICLES_PER_THREAD)
+	{
+		return false;
+	}
+
+	pool.SpecState.Resize(count);
+	pool.SpecSnapshot.Input.Resize(count);
+	P_SnapshotDefinedParticleWorld(Level);
+	if (particleThreadPool.size() < numThreads) particleThreadPool.resize(numThreads);
+
+	std::future<void> futures[MAX_PARTICLE_THREADS];
+	for (int t = 0; t < numThreads; t++)
+	{
+		unsigned start = count * t / numThreads;
+		unsigned end = count * (t + 1) / numThreads;
+		futures[t] = particleThreadPool.push([Level, &pool, start, end](int id)
+		{
+			for (unsigned n = start; n < end; n++)
 			{
-				particle->prevpos = particle->pos;
+				if (!pool.ScriptFree[n]) continue;	// only particles without script code can be run here.
+
+				int particleIndex = pool.ActiveList[n];
+				memcpy(&pool.SpecSnapshot.Input[n], &pool.Particles[particleIndex], sizeof(particledata_t));
+				pool.SpecState[n] = pool.Particles[particleIndex];
+				pool.SpecResult[n] = P_ThinkDefinedParticle(Level, &pool.SpecState[n], particleIndex, true);
 			}
+		});
+	}
+	for (int t = 0; t < numThreads; t++)
+	{
+		futures[t].wait();
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// Takes over the result of a worker thread. Only what the particle's own
+// simulation changes is copied, the links belong to the pool.
+//
+//==========================================================================
+
+static void P_ApplySpeculativeParticle(particledata_t& particle, const particledata_t& result)
+{
+	particle.prevpos = result.prevpos;
+	particle.pos = result.pos;
+	particle.vel = result.vel;
+	particle.life = result.life;
+	particle.sleepFor = result.sleepFor;
+	particle.alpha = result.alpha;
+	particle.fadeAlpha = result.fadeAlpha;
+	particle.renderStyle = result.renderStyle;
+	particle.scale = result.scale;
+	particle.fadeScale = result.fadeScale;
+	particle.angle = result.angle;
+	particle.pitch = result.pitch;
+	particle.roll = result.roll;
+	particle.floorz = result.floorz;
+	particle.ceilingz = result.ceilingz;
+	particle.subsector = result.subsector;
+	particle.invalidateTicks = result.invalidateTicks;
+	particle.animFrame = result.animFrame;
+	particle.animTick = result.animTick;
+	particle.texture = result.texture;
+	particle.flags = result.flags;
+}
+
+void P_ThinkDefinedParticles(FLevelLocals* Level)
+{
+	particlelevelpool_t* pool = &Level->DefinedParticlePool;
+	particlekinematics_t& kin = pool->Kinematics;
+
+	int particleCount = 0;
+	int particleLimit = DParticleDefinition::GetParticleLimit();
+	int cullLimit = DParticleDefinition::GetParticleCullLimit();
+
+	if (particleLimit != pool->Particles.Size())
+	{
+		P_ResizeDefinedParticlePool(Level, particleLimit);
+	}
+
+	P_PrepareDefinedParticles(Level);
+	// Batching is only worth it when the script-free particles aren't run on worker threads already.
+	bool batching = !P_SpeculateDefinedParticles(Level);
+	pool->Thinking = true;
+
+	for (unsigned n = 0; n < pool->ActiveList.Size(); n++)
+	{
+		int particleIndex = pool->ActiveList[n];
+		particledata_t* particle = &pool->Particles[particleIndex];
+
+		// Skip particles that were destroyed or newly created by another particle's callbacks during this tic.
+		// The linked list traversal this replaces would never have reached them.
+		if (particle->definition == nullptr || pool->SpawnedThisTic[particleIndex])
+		{
+			continue;
+		}
+
+		if (batching && n >= kin.End)
+		{
+			P_FadeBatchedParticles(Level);
+			P_BatchDefinedParticles(Level, n);
+		}
+
+		EParticleThinkResult result = (EParticleThinkResult)pool->SpecResult[n];
+		if (n < kin.End && kin.ScriptCalls == pool->ScriptCalls)
+		{
+			// No script code ran since the batch was integrated, so nothing it used can have changed.
+			result = P_ThinkBatchedParticle(Level, n - kin.Start);
+		}
+		else if (result != PTR_DEFERRED && P_SpeculationIsValid(Level, n, *particle, pool->SpecState[n]))
+		{
+			P_ApplySpeculativeParticle(*particle, pool->SpecState[n]);
+		}
+		else
+		{
+			result = P_ThinkDefinedParticle(Level, particle, particleIndex, false);
+		}
+
+		if (result == PTR_SKIPPED)
+		{
+			continue;
 		}
 
 		if (particleCount > cullLimit)
 		{
-			definition->CullParticle(particle);
+			particle->definition->CullParticle(particle);
 		}
 
 		particle->ClearFlag(DPF_FIRSTUPDATE);
 
 		particleCount++;
 	}
+
+	if (batching)
+	{
+		P_FadeBatchedParticles(Level);
+	}
+
+	pool->Thinking = false;
 }
 
 particledata_t* P_SpawnDefinedParticle(FLevelLocals* Level, DParticleDefinition* definition, const DVector3& pos, const DVector3& vel, double scale, int flags, AActor* refActor)
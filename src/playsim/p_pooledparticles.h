@@ -7,6 +7,7 @@
 #include "palettecontainer.h"
 #include "animations.h"
 #include "p_local.h"
+#include "r_defs.h"
 #include "p_effect.h"
 #include "actor.h"
 #include "dobject.h"
@@ -221,6 +222,7 @@ public:
 	void CallOnParticleExitWater(particledata_t* particle, double surfaceHeight);
 
 	void HandleFading(particledata_t* particle);
+	static void SetFadeAlpha(particledata_t* particle, float fadeAlpha);
 	void HandleScaling(particledata_t* particle);
 	void OnParticleBounce(particledata_t* particle);
 
@@ -246,12 +248,117 @@ public:
 	FRandom randomBounce;
 };
 
+// Structure-of-arrays working set for a run of PDF_NOTHINK particles of one definition. Their steps,
+// movement, drag and gravity are integrated for the whole run at once, and so is their fading and
+// scaling once the run is done. particledata_t stays the canonical record since ZScript and the
+// renderer access its fields directly.
+struct particlekinematics_t
+{
+	DParticleDefinition*		Definition = nullptr;
+	unsigned					Start = 0, End = 0;		// Range of the ActiveList this run covers
+	unsigned					ScriptCalls = 0;		// Script calls made by the pool when the run was integrated
+
+	TArray<uint16_t>			Index;
+	TArray<subsector_t*>		Subsector;
+	TArray<double>				PosX, PosY;
+	TArray<double>				VelX, VelY, VelZ;
+	TArray<double>				Drag, Gravity;
+	TArray<float>				Alpha, AlphaStep;
+	TArray<float>				ScaleX, ScaleY, ScaleStepX, ScaleStepY;
+	TArray<float>				Angle, AngleStep;
+	TArray<float>				Pitch, PitchStep;
+	TArray<float>				Roll, RollStep;
+
+	// Fading and scaling settings of the definition when the run was integrated
+	uint32_t					Flags = 0;
+	float						MinFadeVel = 0, MaxFadeVel = 0;
+	int							MinFadeLife = 0, MaxFadeLife = 0;
+	float						MinScaleLife = 0, MaxScaleLife = 0;
+	FVector2					MinFadeScale, MaxFadeScale;
+
+	// Filled in as the particles finish their tic
+	TArray<uint8_t>				Finished;
+	TArray<int>					Life, StartLife;
+	TArray<float>				Speed, FadeAlpha, FadeScaleX, FadeScaleY;
+
+	void Resize(unsigned count);
+	void IntegrateSteps();
+	void IntegrateVelocity();
+	void Fade();
+};
+
+// Everything besides the particle itself that the worker threads read, captured before they start.
+// Script callbacks earlier in the serial pass may change any of it, so a worker's result is only
+// taken over if all it depended on is still the same.
+struct particlespecsector_t
+{
+	secplane_t					FloorPlane, CeilingPlane;
+	double						Gravity = 0;
+	uint16_t					MoreFlags = 0;
+	uint8_t						PortalsBlock = 0;		// Bit 0 for the ceiling, bit 1 for the floor
+	unsigned					FirstFFloor = 0, NumFFloors = 0;
+};
+
+struct particlespecffloor_t
+{
+	unsigned int				Flags = 0;
+	secplane_t					Top, Bottom;
+};
+
+struct particlespecdefinition_t
+{
+	DParticleDefinition*		Definition = nullptr;
+	uint32_t					Flags = 0;
+	float						Drag = 0, StopSpeed = 0;
+	float						MinFadeVel = 0, MaxFadeVel = 0;
+	int							MinFadeLife = 0, MaxFadeLife = 0;
+	float						MinScaleLife = 0, MaxScaleLife = 0;
+	FVector2					MinFadeScale, MaxFadeScale;
+	TArray<particleanimframe_t>	AnimationFrames;
+	TArray<particleanimsequence_t> AnimationSequences;
+	unsigned					CheckedCalls = 0;
+	bool						Valid = true;
+};
+
+struct particlespecsnapshot_t
+{
+	unsigned					ScriptCalls = 0;		// Script calls made by the pool when the workers started
+	unsigned					CheckedCalls = 0;		// When Frozen, Gravity and the player were last compared
+	bool						WorldValid = true, PlayerValid = true;
+
+	bool						Frozen = false;
+	double						Gravity = 0;
+	player_t*					Player = nullptr;
+	AActor*						PlayerMo = nullptr;
+	DVector3					PlayerPos;
+	double						PlayerRadius = 0, PlayerHeight = 0;
+
+	TArray<particlespecsector_t>	Sectors;
+	TArray<particlespecffloor_t>	FFloors;
+	TArray<particlespecdefinition_t> Definitions;
+	TMap<DParticleDefinition*, unsigned> DefinitionIndex;
+	TArray<uint16_t>			Definition;				// Parallel to ActiveList, index into Definitions
+	TArray<particledata_t>		Input;					// Parallel to ActiveList, the particles as the workers found them
+};
+
 struct particlelevelpool_t
 {
 	uint32_t					OldestParticle; // Oldest particle for replacing with SPF_REPLACE
 	uint32_t					ActiveParticles;
 	uint32_t					InactiveParticles;
 	TArray<particledata_t>		Particles;
+
+	// Transient per-tic data for P_ThinkDefinedParticles, not serialized.
+	TArray<uint16_t>			ActiveList;			// Packed indices of the particles being processed this tic, newest first
+	TArray<uint8_t>				ScriptFree;			// Parallel to ActiveList, set if the definition does not override ThinkParticle
+	unsigned					NumScriptFree = 0;
+	unsigned					ScriptCalls = 0;	// Counts the script callbacks, anything computed ahead of them may be stale
+	particlekinematics_t		Kinematics;
+	BitArray					SpawnedThisTic;		// Particles created while thinking must not be processed until the next tic
+	TArray<particledata_t>		SpecState;			// Parallel to ActiveList, results of running particles on worker threads
+	TArray<uint8_t>				SpecResult;			// Parallel to ActiveList, EParticleThinkResult of the worker threads
+	particlespecsnapshot_t		SpecSnapshot;
+	bool						Thinking = false;
 };
 
 inline particledata_t* NewDefinedParticle(FLevelLocals* Level, DParticleDefinition* definition, bool replace = false);
@@ -63,7 +63,7 @@ EXTERN_CVAR(Float, vr_3dweaponOffsetZ);
 extern TDeletingArray<FVoxel *> Voxels;
 extern TDeletingArray<FVoxelDef *> VoxelDefs;
 
-void RenderFrameModels(FModelRenderer* renderer, FLevelLocals* Level, const FSpriteModelFrame *smf, const FState* curState, const int curTics, FTranslationID translation, AActor* actor);
+void RenderFrameModels(FModelRenderer* renderer, FLevelLocals* Level, const FSpriteModelFrame *smf, const FState* curState, const int curTics, FTranslationID translation, AActor* actor, TArray<FModelBoneJob>* boneJobs = nullptr);
 
 
 void RenderModel(FModelRenderer *renderer, float x, float y, float z, FSpriteModelFrame *smf, AActor *actor, double ticFrac)
@@ -314,7 +314,22 @@ static void calcFrame(const AnimOverride &anim, double tic, double &inter, int &
 	next = int(ceil(frame));
 }
 
-void RenderFrameModels(FModelRenderer *renderer, FLevelLocals *Level, const FSpriteModelFrame *smf, const FState *curState, const int curTics, FTranslationID translation, AActor* actor)
+static const TArray<VSMatrix> NoBones;
+
+//===========================================================================
+//
+// Goes through the same frame selection as rendering, but only records
+// which bones need to be evaluated. The renderer runs these in parallel
+// before it draws anything.
+//
+//===========================================================================
+
+void CollectModelBones(FSpriteModelFrame *smf, AActor *actor, TArray<FModelBoneJob> &jobs)
+{
+	RenderFrameModels(nullptr, actor->Level, smf, actor->state, actor->tics, NO_TRANSLATION, actor, &jobs);
+}
+
+void RenderFrameModels(FModelRenderer *renderer, FLevelLocals *Level, const FSpriteModelFrame *smf, const FState *curState, const int curTics, FTranslationID translation, AActor* actor, TArray<FModelBoneJob>* boneJobs)
 {
 	// [BB] Frame interpolation: Find the FSpriteModelFrame smfNext which follows after smf in the animation
 	// and the scalar value inter ( element of [0,1) ), both necessary to determine the interpolated frame.
@@ -421,7 +436,7 @@ void RenderFrameModels(FModelRenderer *renderer, FLevelLocals *Level, const FSpr
 
 	TArray<FTextureID> surfaceskinids;
 
-	TArray<VSMatrix> boneData;
+	const TArray<VSMatrix>* boneData = &NoBones;
 	int boneStartingPosition = 0;
 	bool evaluatedSingle = false;
 
@@ -537,14 +552,6 @@ void RenderFrameModels(FModelRenderer *renderer, FLevelLocals *Level, const FSpr
 		if (modelid >= 0 && modelid < Models.size())
 		{
 			FModel * mdl = Models[modelid];
-			auto tex = skinid.isValid() ? TexMan.GetGameTexture(skinid, true) : nullptr;
-			mdl->BuildVertexBuffer(renderer);
-
-			auto ssidp = surfaceskinids.Size() > 0
-					   ? surfaceskinids.Data()
-					   : (((i * MD3_MAX_SURFACES) < smf->surfaceskinIDs.Size()) ? &smf->surfaceskinIDs[i * MD3_MAX_SURFACES] : nullptr);
-
-
 			bool nextFrame = smfNext && modelframe != modelframenext;
 
 			if (actor->boneComponentData == nullptr)
@@ -559,44 +566,58 @@ void RenderFrameModels(FModelRenderer *renderer, FLevelLocals *Level, const FSpr
 			// [RL0] while per-model animations aren't done, DECOUPLEDANIMATIONS does the same as MODELSAREATTACHMENTS
 			if ((!(smf_flags & MDL_MODELSAREATTACHMENTS) && !is_decoupled) || !evaluatedSingle)
 			{
-				if (animationid >= 0)
+				FModel* boneModel = animationid >= 0 ? Models[animationid] : mdl;
+				const TArray<TRS>* animationData = animationid >= 0 ? boneModel->AttachAnimationData() : nullptr;
+
+				FBonePose pose;
+				bool evaluate = true;
+				if (is_decoupled)
 				{
-					FModel* animation = Models[animationid];
-					const TArray<TRS>* animationData = animation->AttachAnimationData();
+					pose = { animationData, decoupled_main_frame, decoupled_next_frame, (float)inter, decoupled_main_prev_frame, (float)inter_main, decoupled_next_prev_frame, (float)inter_next };
+					evaluate = decoupled_main_frame != -1;
+				}
+				else
+				{
+					pose = { animationData, modelframe, modelframenext, nextFrame ? (float)inter : -1.f, 0, -1.f, 0, -1.f };
+				}
 
-					if(is_decoupled)
-					{
-						if(decoupled_main_frame != -1)
-						{
-							boneData = animation->CalculateBones(decoupled_main_frame, decoupled_next_frame, inter, decoupled_main_prev_frame, inter_main, decoupled_next_prev_frame, inter_next, animationData, actor->boneComponentData, i);
-						}
-					}
-					else
-					{
-						boneData = animation->CalculateBones(modelframe, modelframenext, nextFrame ? inter : -1.f, 0, -1.f, 0, -1.f, animationData, actor->boneComponentData, i);
-					}
-					boneStartingPosition = renderer->SetupFrame(animation, 0, 0, 0, boneData, -1);
+				if (boneJobs != nullptr)
+				{
+					if (evaluate) boneJobs->Push({ boneModel, pose, actor->boneComponentData, (int)i });
 					evaluatedSingle = true;
+					continue;
+				}
+
+				// Instances in the same pose can share the bones that were uploaded for the first one
+				int cached = evaluate ? renderer->FindBonePose(boneModel, pose) : -1;
+				if (cached >= 0)
+				{
+					boneData = &NoBones;
+					boneStartingPosition = renderer->SetupFrame(boneModel, 0, 0, 0, NoBones, cached);
 				}
 				else
 				{
-					if(is_decoupled)
+					if (evaluate)
 					{
-						if(decoupled_main_frame != -1)
-						{
-							boneData = mdl->CalculateBones(decoupled_main_frame, decoupled_next_frame, inter, decoupled_main_prev_frame, inter_main, decoupled_next_prev_frame, inter_next, nullptr, actor->boneComponentData, i);
-						}
+						auto bones = boneModel->CalculateBones(pose, actor->boneComponentData, i);
+						boneData = bones ? bones : &NoBones;
 					}
-					else
-					{
-						boneData = mdl->CalculateBones(modelframe, modelframenext, nextFrame ? inter : -1.f, 0, -1.f, 0, -1.f, nullptr, actor->boneComponentData, i);
-					}
-					boneStartingPosition = renderer->SetupFrame(mdl, 0, 0, 0, boneData, -1);
-					evaluatedSingle = true;
+					boneStartingPosition = renderer->SetupFrame(boneModel, 0, 0, 0, *boneData, -1);
+					if (evaluate && boneStartingPosition >= 0) renderer->StoreBonePose(boneModel, pose, boneStartingPosition);
 				}
+				evaluatedSingle = true;
 			}
 
-			mdl->RenderFrame(renderer, tex, modelframe, nextFrame ? modelframenext : modelframe, nextFrame ? inter : -1.f, translation, ssidp, boneData, boneStartingPosition);
+			if (boneJobs != nullptr) continue;
+
+			auto tex = skinid.isValid() ? TexMan.GetGameTexture(skinid, true) : nullptr;
+			mdl->BuildVertexBuffer(renderer);
+
+			auto ssidp = surfaceskinids.Size() > 0
+					   ? surfaceskinids.Data()
+					   : (((i * MD3_MAX_SURFACES) < smf->surfaceskinIDs.Size()) ? &smf->surfaceskinIDs[i * MD3_MAX_SURFACES] : nullptr);
+
+			mdl->RenderFrame(renderer, tex, modelframe, nextFrame ? modelframenext : modelframe, nextFrame ? inter : -1.f, translation, ssidp, *boneData, boneStartingPosition);
 		}
 	}
 }
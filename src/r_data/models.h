@@ -116,6 +116,17 @@ void BSPWalkCircle(FLevelLocals *Level, float x, float y, float radiusSquared, c
 void RenderModel(FModelRenderer* renderer, float x, float y, float z, FSpriteModelFrame* smf, AActor* actor, double ticFrac);
 void RenderHUDModel(FModelRenderer* renderer, DPSprite* psp, FVector3 translation, FVector3 rotation, FVector3 rotation_pivot, FSpriteModelFrame *smf);
 
+// A bone palette that RenderModel would evaluate for an actor, so that it can be done ahead of the draw pass
+struct FModelBoneJob
+{
+	FModel* model;
+	FBonePose pose;
+	DBoneComponents* bones;
+	int index;
+};
+
+void CollectModelBones(FSpriteModelFrame* smf, AActor* actor, TArray<FModelBoneJob>& jobs);
+
 EXTERN_CVAR(Float, cl_scaleweaponfov)
 
 #endif
@@ -0,0 +1,834 @@
+//
+//---------------------------------------------------------------------------
+//
+// CPU light baker for lightmaps and light probes
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/
+//
+//--------------------------------------------------------------------------
+//
+/*
+** The baker traces the lights that never change (light things without
+** pulsing or flickering) against the level mesh and stores the result in
+** the same LIGHTMAP lump the map loader reads. The lighting model is the
+** one of the dynamic light shaders, so a baked light looks the same as the
+** dynamic one it replaces. The lump lists the lights it contains, and the
+** map loader keeps those from lighting anything on their own.
+*/
+
+#include <thread>
+#include <atomic>
+#include <miniz.h>
+#include "doom_lightbaker.h"
+#include "doom_levelmesh.h"
+#include "g_levellocals.h"
+#include "a_dynlight.h"
+#include "actor.h"
+#include "c_dispatch.h"
+#include "c_cvars.h"
+#include "m_argv.h"
+#include "m_swap.h"
+#include "cmdlib.h"
+#include "files.h"
+#include "i_time.h"
+#include "printf.h"
+#include "doomstat.h"
+#include "g_game.h"
+
+EXTERN_CVAR(Float, gl_light_max_intensity)
+
+//==========================================================================
+//
+// Triangle tree
+//
+//==========================================================================
+
+LightBakerTriangleTree::LightBakerTriangleTree(const DoomLevelMesh &mesh) : vertices(mesh.MeshVertices), elements(mesh.MeshElements)
+{
+	int num_triangles = (int)elements.Size() / 3;
+	if (num_triangles == 0)
+		return;
+
+	TArray<FVector3> centroids(num_triangles, true);
+	for (int i = 0; i < num_triangles; i++)
+	{
+		centroids[i] = (vertices[elements[i * 3]] + vertices[elements[i * 3 + 1]] + vertices[elements[i * 3 + 2]]) / 3.0f;
+	}
+
+	triangles.Resize(num_triangles);
+	for (int i = 0; i < num_triangles; i++)
+		triangles[i] = i;
+
+	TArray<int> work_buffer(num_triangles * 2, true);
+	GenerateTreeNode(triangles.Data(), num_triangles, centroids.Data(), work_buffer.Data());
+}
+
+int LightBakerTriangleTree::GenerateTreeNode(int *tris, int num_triangles, const FVector3 *centroids, int *work_buffer)
+{
+	// Find bounding box and median of the triangles
+	FVector3 median(0.0f, 0.0f, 0.0f);
+	FVector3 aabb_min = vertices[elements[tris[0] * 3]];
+	FVector3 aabb_max = aabb_min;
+	for (int i = 0; i < num_triangles; i++)
+	{
+		for (int j = 0; j < 3; j++)
+		{
+			const FVector3 &v = vertices[elements[tris[i] * 3 + j]];
+			aabb_min = FVector3(min(aabb_min.X, v.X), min(aabb_min.Y, v.Y), min(aabb_min.Z, v.Z));
+			aabb_max = FVector3(max(aabb_max.X, v.X), max(aabb_max.Y, v.Y), max(aabb_max.Z, v.Z));
+		}
+		median += centroids[tris[i]];
+	}
+	median /= (float)num_triangles;
+
+	// Leaf nodes keep a few triangles, testing those is cheaper than descending further
+	if (num_triangles <= 4)
+	{
+		nodes.Push({ aabb_min, aabb_max, -1, -1, (int)(tris - triangles.Data()), num_triangles });
+		return (int)nodes.Size() - 1;
+	}
+
+	// Find the longest axis
+	float axis_lengths[3] = { aabb_max.X - aabb_min.X, aabb_max.Y - aabb_min.Y, aabb_max.Z - aabb_min.Z };
+	int axis_order[3] = { 0, 1, 2 };
+	std::sort(axis_order, axis_order + 3, [&](int a, int b) { return axis_lengths[a] > axis_lengths[b]; });
+
+	// Try to split at the median of the longest axis, then the others.
+	// The sorted triangles go into work_buffer and are moved back when done.
+	int left_count = 0, right_count = 0;
+	for (int attempt = 0; attempt < 3; attempt++)
+	{
+		int axis = axis_order[attempt];
+
+		left_count = 0;
+		right_count = 0;
+		for (int i = 0; i < num_triangles; i++)
+		{
+			if (centroids[tris[i]][axis] >= median[axis])
+				work_buffer[left_count++] = tris[i];
+			else
+				work_buffer[num_triangles + right_count++] = tris[i];
+		}
+
+		if (left_count != 0 && right_count != 0)
+			break;
+	}
+
+	if (left_count == 0 || right_count == 0)
+	{
+		// All centroids are in the same place, split the list in the middle
+		left_count = num_triangles / 2;
+		right_count = num_triangles - left_count;
+	}
+	else
+	{
+		for (int i = 0; i < left_count; i++)
+			tris[i] = work_buffer[i];
+		for (int i = 0; i < right_count; i++)
+			tris[i + left_count] = work_buffer[num_triangles + i];
+	}
+
+	int left_index = GenerateTreeNode(tris, left_count, centroids, work_buffer);
+	int right_index = GenerateTreeNode(tris + left_count, right_count, centroids, work_buffer);
+	nodes.Push({ aabb_min, aabb_max, left_index, right_index, 0, 0 });
+	return (int)nodes.Size() - 1;
+}
+
+bool LightBakerTriangleTree::OverlapRayAABB(const FVector3 &origin, const FVector3 &invdir, float tmax, const Node &node)
+{
+	float tmin = 0.0f;
+	for (int i = 0; i < 3; i++)
+	{
+		float t1 = (node.aabb_min[i] - origin[i]) * invdir[i];
+		float t2 = (node.aabb_max[i] - origin[i]) * invdir[i];
+		tmin = max(tmin, min(t1, t2));
+		tmax = min(tmax, max(t1, t2));
+	}
+	return tmin <= tmax;
+}
+
+bool LightBakerTriangleTree::IntersectTriangle(const FVector3 &origin, const FVector3 &dir, float tmax, int triangle) const
+{
+	// Moeller-Trumbore, both sides of the triangle block the ray
+	const FVector3 &v0 = vertices[elements[triangle * 3]];
+	const FVector3 &v1 = vertices[elements[triangle * 3 + 1]];
+	const FVector3 &v2 = vertices[elements[triangle * 3 + 2]];
+
+	FVector3 e1 = v1 - v0;
+	FVector3 e2 = v2 - v0;
+	FVector3 p = dir ^ e2;
+	float det = e1 | p;
+	if (fabsf(det) < 1e-8f)
+		return false;
+
+	float invdet = 1.0f / det;
+	FVector3 s = origin - v0;
+	float u = (s | p) * invdet;
+	if (u < 0.0f || u > 1.0f)
+		return false;
+
+	FVector3 q = s ^ e1;
+	float v = (dir | q) * invdet;
+	if (v < 0.0f || u + v > 1.0f)
+		return false;
+
+	float t = (e2 | q) * invdet;
+	return t > 0.0f && t < tmax;
+}
+
+bool LightBakerTriangleTree::Visible(const FVector3 &from, const FVector3 &to) const
+{
+	if (nodes.Size() == 0)
+		return true;
+
+	FVector3 dir = to - from;
+	float length = dir.Length();
+	if (length < 1.0f)
+		return true;
+	dir /= length;
+
+	// Stop a bit short of the light, in case it sits right on a surface
+	float tmax = length - 0.5f;
+	FVector3 invdir(1.0f / dir.X, 1.0f / dir.Y, 1.0f / dir.Z);
+
+	int stack[64];
+	int stacksize = 0;
+	stack[stacksize++] = nodes.Size() - 1;
+	while (stacksize > 0)
+	{
+		const Node &node = nodes[stack[--stacksize]];
+		if (!OverlapRayAABB(from, invdir, tmax, node))
+			continue;
+
+		if (node.left_node == -1)
+		{
+			for (int i = 0; i < node.num_triangles; i++)
+			{
+				if (IntersectTriangle(from, dir, tmax, triangles[node.first_triangle + i]))
+					return false;
+			}
+		}
+		else if (stacksize + 2 <= (int)countof(stack))
+		{
+			stack[stacksize++] = node.left_node;
+			stack[stacksize++] = node.right_node;
+		}
+	}
+	return true;
+}
+
+//==========================================================================
+//
+// Lights
+//
+//==========================================================================
+
+struct FBakeLight
+{
+	FVector3 Pos;
+	FVector3 Color;
+	float Radius;
+	bool Attenuated;
+	bool Shadows;
+	bool LightSurfaces;
+	bool LightActors;
+	bool Spot;
+	FVector3 SpotDir;		// Points from the light's target back to the light, like in the shaders
+	float SpotInnerCos, SpotOuterCos;
+};
+
+static void CollectStaticLights(FLevelLocals *Level, TArray<FBakeLight> &lights)
+{
+	for (auto light = Level->lights; light; light = light->next)
+	{
+		// The map loader turns these off when it loads the lump, so both have to agree on them
+		if (!light->IsBakeable())
+			continue;
+
+		AActor *owner = light->target;
+
+		FBakeLight bake;
+		bake.Pos = FVector3((float)light->X(), (float)light->Y(), (float)light->Z());
+		bake.Color = FVector3(light->GetRed() / 255.0f, light->GetGreen() / 255.0f, light->GetBlue() / 255.0f);
+		bake.Radius = min<float>((float)light->GetIntensity(), gl_light_max_intensity) * 2.0f;
+		bake.Attenuated = light->IsAttenuated();
+		bake.Shadows = !light->DontShadowmap();
+		bake.LightSurfaces = !light->DontLightMap();
+		bake.LightActors = !light->DontLightActors();
+		bake.Spot = light->IsSpot();
+		if (bake.Spot)
+		{
+			DAngle negPitch = -*light->pPitch;
+			DAngle angle = owner->Angles.Yaw;
+			double xyLen = negPitch.Cos();
+			bake.SpotDir = FVector3(float(-angle.Cos() * xyLen), float(-angle.Sin() * xyLen), float(-negPitch.Sin()));
+			bake.SpotInnerCos = (float)light->pSpotInnerAngle->Cos();
+			bake.SpotOuterCos = (float)light->pSpotOuterAngle->Cos();
+		}
+
+		if (bake.Radius > 0 && (bake.LightSurfaces || bake.LightActors) && !bake.Color.isZero())
+			lights.Push(bake);
+	}
+}
+
+static float SmoothStep(float edge0, float edge1, float x)
+{
+	float t = clamp((x - edge0) / (edge1 - edge0), 0.0f, 1.0f);
+	return t * t * (3.0f - 2.0f * t);
+}
+
+// Light arriving at a point. Surfaces pass their normal, probes don't have one.
+static FVector3 LightAt(const LightBakerTriangleTree &tree, const FBakeLight &light, const FVector3 &pos, const FVector3 *normal)
+{
+	FVector3 L = light.Pos - pos;
+	float dist = L.Length();
+	if (dist >= light.Radius)
+		return FVector3(0.0f, 0.0f, 0.0f);
+	if (dist > 0.0f)
+		L /= dist;
+
+	float dotprod = 1.0f;
+	if (normal)
+	{
+		dotprod = *normal | L;
+		if (dotprod < -0.0001f)
+			return FVector3(0.0f, 0.0f, 0.0f);
+	}
+
+	float attenuation = (light.Radius - dist) / light.Radius;
+	if (light.Spot)
+		attenuation *= SmoothStep(light.SpotOuterCos, light.SpotInnerCos, L | light.SpotDir);
+	if (normal && light.Attenuated)
+		attenuation *= clamp(dotprod, 0.0f, 1.0f);
+
+	if (attenuation <= 0.0f || (light.Shadows && !tree.Visible(pos, light.Pos)))
+		return FVector3(0.0f, 0.0f, 0.0f);
+
+	return light.Color * attenuation;
+}
+
+//==========================================================================
+//
+// Surfaces
+//
+// Flats are mapped straight down onto the XY plane, walls along their
+// length and height. Every surface gets its own rectangle in one of the
+// atlas pages, with a one texel border against filtering seams.
+//
+//==========================================================================
+
+struct FBakeSurface
+{
+	int MeshSurface;
+	bool Flat;
+	FVector3 Normal;
+	FVector2 Origin;		// Walls: first vertex
+	FVector2 Tangent;		// Walls: unit direction along the wall
+	float MinU, MinV;
+	float Step;				// Map units per texel
+	int Width, Height;		// Texels without the border
+	int Page, X, Y;			// Atlas position of the border's top left corner
+	FVector3 AabbMin, AabbMax;
+	TArray<int> Lights;
+};
+
+static FVector2 ProjectSurface(const FBakeSurface &surf, const FVector3 &pos)
+{
+	if (surf.Flat)
+		return FVector2(pos.X, pos.Y);
+	return FVector2((FVector2(pos.X, pos.Y) - surf.Origin) | surf.Tangent, pos.Z);
+}
+
+static FVector3 UnprojectSurface(const FBakeSurface &surf, const Surface &meshsurf, float u, float v)
+{
+	if (surf.Flat)
+		return FVector3(u, v, (float)meshsurf.plane.ZatPoint(u, v));
+	FVector2 pos = surf.Origin + surf.Tangent * u;
+	return FVector3(pos.X, pos.Y, v);
+}
+
+static FVector2 LightmapUV(const FBakeSurface &surf, const FVector3 &pos, int textureSize)
+{
+	FVector2 uv = ProjectSurface(surf, pos);
+	return FVector2(
+		(surf.X + 1.5f + (uv.X - surf.MinU) / surf.Step) / textureSize,
+		(surf.Y + 1.5f + (uv.Y - surf.MinV) / surf.Step) / textureSize);
+}
+
+static bool SetupSurface(const DoomLevelMesh &mesh, int index, const FLightBakeSettings &settings, FBakeSurface &surf)
+{
+	const Surface &meshsurf = mesh.Surfaces[index];
+	if (meshsurf.bSky || meshsurf.numVerts < 3)
+		return false;
+
+	const FVector3 *verts = &mesh.MeshVertices[meshsurf.startVertIndex];
+	surf.MeshSurface = index;
+	surf.Flat = meshsurf.type == ST_FLOOR || meshsurf.type == ST_CEILING;
+	surf.Normal = FVector3(meshsurf.plane.Normal());
+
+	if (!surf.Flat)
+	{
+		surf.Origin = FVector2(verts[0].X, verts[0].Y);
+		surf.Tangent = FVector2(verts[1].X - verts[0].X, verts[1].Y - verts[0].Y);
+		if (surf.Tangent.LengthSquared() < 1e-6f)
+			return false;
+		surf.Tangent.MakeUnit();
+	}
+
+	FVector2 uvmin = ProjectSurface(surf, verts[0]), uvmax = uvmin;
+	surf.AabbMin = surf.AabbMax = verts[0];
+	for (int i = 1; i < meshsurf.numVerts; i++)
+	{
+		FVector2 uv = ProjectSurface(surf, verts[i]);
+		uvmin = FVector2(min(uvmin.X, uv.X), min(uvmin.Y, uv.Y));
+		uvmax = FVector2(max(uvmax.X, uv.X), max(uvmax.Y, uv.Y));
+		surf.AabbMin = FVector3(min(surf.AabbMin.X, verts[i].X), min(surf.AabbMin.Y, verts[i].Y), min(surf.AabbMin.Z, verts[i].Z));
+		surf.AabbMax = FVector3(max(surf.AabbMax.X, verts[i].X), max(surf.AabbMax.Y, verts[i].Y), max(surf.AabbMax.Z, verts[i].Z));
+	}
+	if (uvmax.X - uvmin.X <= 0.0f || uvmax.Y - uvmin.Y <= 0.0f)
+		return false;
+
+	// Surfaces that don't fit into a page at the requested density get a coarser one
+	int maxTexels = settings.TextureSize - 3;
+	surf.Step = max(settings.SampleDistance, max(uvmax.X - uvmin.X, uvmax.Y - uvmin.Y) / maxTexels);
+	surf.MinU = uvmin.X;
+	surf.MinV = uvmin.Y;
+	surf.Width = (int)ceilf((uvmax.X - uvmin.X) / surf.Step) + 1;
+	surf.Height = (int)ceilf((uvmax.Y - uvmin.Y) / surf.Step) + 1;
+	return true;
+}
+
+// Shelf packing, tallest surfaces first
+static int PackSurfaces(TArray<FBakeSurface> &surfaces, int textureSize)
+{
+	TArray<FBakeSurface *> sorted(surfaces.Size(), true);
+	for (unsigned i = 0; i < surfaces.Size(); i++)
+		sorted[i] = &surfaces[i];
+	std::sort(sorted.begin(), sorted.end(), [](FBakeSurface *a, FBakeSurface *b) { return a->Height > b->Height; });
+
+	int page = 0, x = 0, y = 0, shelfHeight = 0;
+	for (auto surf : sorted)
+	{
+		int w = surf->Width + 2, h = surf->Height + 2;
+		if (x + w > textureSize)
+		{
+			x = 0;
+			y += shelfHeight;
+			shelfHeight = 0;
+		}
+		if (y + h > textureSize)
+		{
+			page++;
+			x = y = shelfHeight = 0;
+		}
+		surf->Page = page;
+		surf->X = x;
+		surf->Y = y;
+		x += w;
+		shelfHeight = max(shelfHeight, h);
+	}
+	return surfaces.Size() > 0 ? page + 1 : 0;
+}
+
+static bool SphereTouchesBox(const FVector3 &center, float radius, const FVector3 &aabbMin, const FVector3 &aabbMax)
+{
+	float dx = max(max(aabbMin.X - center.X, center.X - aabbMax.X), 0.0f);
+	float dy = max(max(aabbMin.Y - center.Y, center.Y - aabbMax.Y), 0.0f);
+	float dz = max(max(aabbMin.Z - center.Z, center.Z - aabbMax.Z), 0.0f);
+	return dx * dx + dy * dy + dz * dz < radius * radius;
+}
+
+static void BakeSurface(const DoomLevelMesh &mesh, const LightBakerTriangleTree &tree, const TArray<FBakeLight> &lights, const FBakeSurface &surf, int textureSize, float *pages)
+{
+	const Surface &meshsurf = mesh.Surfaces[surf.MeshSurface];
+	float *page = pages + (size_t)surf.Page * textureSize * textureSize * 3;
+
+	auto texel = [&](int x, int y) { return page + ((size_t)(surf.Y + 1 + y) * textureSize + surf.X + 1 + x) * 3; };
+
+	for (int y = 0; y < surf.Height; y++)
+	{
+		for (int x = 0; x < surf.Width; x++)
+		{
+			// Sample slightly in front of the surface, so that it doesn't shadow itself
+			FVector3 pos = UnprojectSurface(surf, meshsurf, surf.MinU + x * surf.Step, surf.MinV + y * surf.Step) + surf.Normal;
+
+			FVector3 color(0.0f, 0.0f, 0.0f);
+			for (int index : surf.Lights)
+				color += LightAt(tree, lights[index], pos, &surf.Normal);
+
+			float *dest = texel(x, y);
+			dest[0] = color.X;
+			dest[1] = color.Y;
+			dest[2] = color.Z;
+		}
+	}
+
+	// Border texels repeat the edge
+	for (int y = -1; y <= surf.Height; y++)
+	{
+		for (int x = -1; x <= surf.Width; x++)
+		{
+			if (x >= 0 && y >= 0 && x < surf.Width && y < surf.Height)
+				continue;
+			const float *src = texel(clamp(x, 0, surf.Width - 1), clamp(y, 0, surf.Height - 1));
+			float *dest = texel(x, y);
+			dest[0] = src[0];
+			dest[1] = src[1];
+			dest[2] = src[2];
+		}
+	}
+}
+
+//==========================================================================
+//
+// Light probes
+//
+// One column of probes per grid cell whose center is inside the level,
+// from just above the floor to the ceiling.
+//
+//==========================================================================
+
+static bool PointInSubsector(const subsector_t *sub, const DVector2 &pos)
+{
+	for (uint32_t i = 0; i < sub->numlines; i++)
+	{
+		const seg_t &seg = sub->firstline[i];
+		DVector2 v1 = seg.v1->fPos();
+		DVector2 d = seg.v2->fPos() - v1;
+		if (d.X * (pos.Y - v1.Y) - d.Y * (pos.X - v1.X) > 0.01)
+			return false;
+	}
+	return true;
+}
+
+static void PlaceLightProbes(FLevelLocals *Level, const DoomLevelMesh &mesh, const FLightBakeSettings &settings, TArray<LightProbe> &probes)
+{
+	if (Level->vertexes.Size() == 0)
+		return;
+
+	DVector2 bmin = Level->vertexes[0].fPos(), bmax = bmin;
+	for (auto &v : Level->vertexes)
+	{
+		bmin = DVector2(min(bmin.X, v.fX()), min(bmin.Y, v.fY()));
+		bmax = DVector2(max(bmax.X, v.fX()), max(bmax.Y, v.fY()));
+	}
+
+	double spacing = settings.ProbeSpacing;
+	for (double y = floor(bmin.Y / spacing) * spacing + spacing * 0.5; y < bmax.Y; y += spacing)
+	{
+		for (double x = floor(bmin.X / spacing) * spacing + spacing * 0.5; x < bmax.X; x += spacing)
+		{
+			DVector2 pos(x, y);
+			subsector_t *sub = Level->PointInRenderSubsector(pos);
+			if (sub == nullptr || sub->sector == nullptr || !PointInSubsector(sub, pos))
+				continue;
+
+			double floorz = sub->sector->floorplane.ZatPoint(pos);
+			double ceilingz = sub->sector->ceilingplane.ZatPoint(pos);
+			for (double z = floorz + settings.ProbeHeight * 0.5; z < ceilingz; z += settings.ProbeHeight)
+			{
+				LightProbe probe = { (float)x, (float)y, (float)z, 0.0f, 0.0f, 0.0f };
+				probes.Push(probe);
+			}
+		}
+	}
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+template<class Func>
+static void RunParallel(unsigned count, int numThreads, const Func &func)
+{
+	std::atomic<unsigned> next = 0;
+	auto work = [&]()
+	{
+		for (unsigned i = next++; i < count; i = next++)
+			func(i);
+	};
+
+	std::vector<std::thread> threads;
+	for (int i = 1; i < numThreads; i++)
+		threads.emplace_back(work);
+	work();
+	for (auto &thread : threads)
+		thread.join();
+}
+
+static uint16_t FloatToHalf(float value)
+{
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	uint32_t sign = (bits >> 16) & 0x8000;
+	int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	if (exponent <= 0)
+		return (uint16_t)sign;				// Too small for a normalized half, light values this low don't matter
+	if (exponent >= 31)
+		return (uint16_t)(sign | 0x7bff);	// Clamp to the largest finite value
+
+	uint32_t half = sign | (exponent << 10) | (mantissa >> 13);
+	if (mantissa & 0x1000) half++;			// Round to nearest
+	return (uint16_t)half;
+}
+
+bool BakeLightmapLump(FLevelLocals *Level, const FLightBakeSettings &settings, TArray<uint8_t> &lump)
+{
+	if (Level->levelMesh == nullptr)
+		return false;
+
+	const DoomLevelMesh &mesh = *Level->levelMesh;
+	int textureSize = settings.TextureSize;
+	int numThreads = settings.NumThreads > 0 ? settings.NumThreads : max<int>(std::thread::hardware_concurrency(), 1);
+
+	TArray<FBakeLight> lights;
+	CollectStaticLights(Level, lights);
+	if (lights.Size() == 0)
+		return false;
+
+	LightBakerTriangleTree tree(mesh);
+
+	// Only surfaces that are reached by a light need a lightmap
+	TArray<FBakeSurface> surfaces;
+	for (unsigned i = 0; i < mesh.Surfaces.Size(); i++)
+	{
+		FBakeSurface surf;
+		if (!SetupSurface(mesh, i, settings, surf))
+			continue;
+
+		for (unsigned j = 0; j < lights.Size(); j++)
+		{
+			const FBakeLight &light = lights[j];
+			if (light.LightSurfaces && SphereTouchesBox(light.Pos, light.Radius, surf.AabbMin, surf.AabbMax) && ((light.Pos - surf.AabbMin) | surf.Normal) > -light.Radius)
+				surf.Lights.Push(j);
+		}
+		if (surf.Lights.Size() > 0)
+			surfaces.Push(std::move(surf));
+	}
+
+	int numPages = PackSurfaces(surfaces, textureSize);
+
+	TArray<float> pages((size_t)numPages * textureSize * textureSize * 3, true);
+	memset(pages.Data(), 0, pages.Size() * sizeof(float));
+	RunParallel(surfaces.Size(), numThreads, [&](unsigned i) { BakeSurface(mesh, tree, lights, surfaces[i], textureSize, pages.Data()); });
+
+	TArray<LightProbe> probes;
+	PlaceLightProbes(Level, mesh, settings, probes);
+	RunParallel(probes.Size(), numThreads, [&](unsigned i)
+	{
+		LightProbe &probe = probes[i];
+		FVector3 pos(probe.X, probe.Y, probe.Z);
+		FVector3 color(0.0f, 0.0f, 0.0f);
+		for (auto &light : lights)
+		{
+			if (light.LightActors) color += LightAt(tree, light, pos, nullptr);
+		}
+		probe.Red = color.X;
+		probe.Green = color.Y;
+		probe.Blue = color.Z;
+	});
+
+	if (surfaces.Size() == 0)
+		return false;	// The loader ignores lumps without surfaces
+
+	// Texture coordinates in the order the renderer reads them: walls go
+	// lower left, upper left, upper right, lower right, flats follow their
+	// subsector's segs.
+	TArray<float> texCoords;
+	for (auto &surf : surfaces)
+	{
+		const Surface &meshsurf = mesh.Surfaces[surf.MeshSurface];
+		const FVector3 *verts = &mesh.MeshVertices[meshsurf.startVertIndex];
+		if (surf.Flat)
+		{
+			const subsector_t *sub = &Level->subsectors[meshsurf.typeIndex];
+			for (uint32_t j = 0; j < sub->numlines; j++)
+			{
+				DVector2 v = sub->firstline[j].v1->fPos();
+				FVector2 uv = LightmapUV(surf, FVector3((float)v.X, (float)v.Y, 0.0f), textureSize);
+				texCoords.Push(uv.X);
+				texCoords.Push(uv.Y);
+			}
+		}
+		else
+		{
+			const side_t *side = &Level->sides[meshsurf.typeIndex];
+			FVector2 v1((float)side->V1()->fX(), (float)side->V1()->fY());
+			FVector2 v2((float)side->V2()->fX(), (float)side->V2()->fY());
+
+			float zmin[2] = { FLT_MAX, FLT_MAX }, zmax[2] = { -FLT_MAX, -FLT_MAX };
+			for (int j = 0; j < 4; j++)
+			{
+				int end = (FVector2(verts[j].X, verts[j].Y) - v1).LengthSquared() <= (FVector2(verts[j].X, verts[j].Y) - v2).LengthSquared() ? 0 : 1;
+				zmin[end] = min(zmin[end], verts[j].Z);
+				zmax[end] = max(zmax[end], verts[j].Z);
+			}
+
+			FVector3 corners[4] = { FVector3(v1, zmin[0]), FVector3(v1, zmax[0]), FVector3(v2, zmax[1]), FVector3(v2, zmin[1]) };
+			for (auto &corner : corners)
+			{
+				FVector2 uv = LightmapUV(surf, corner, textureSize);
+				texCoords.Push(uv.X);
+				texCoords.Push(uv.Y);
+			}
+		}
+	}
+
+	TArray<uint8_t> data;
+	auto write = [&](const void *src, size_t size) { memcpy(&data[data.Reserve((unsigned)size)], src, size); };
+	auto write16 = [&](uint16_t value) { value = LittleShort(value); write(&value, 2); };
+	auto write32 = [&](uint32_t value) { value = LittleLong(value); write(&value, 4); };
+
+	write32(0);		// Version
+	write16((uint16_t)textureSize);
+	write16((uint16_t)numPages);
+	write32(surfaces.Size());
+	write32(texCoords.Size() / 2);
+	write32(probes.Size());
+	write32(Level->subsectors.Size());
+
+	for (auto &probe : probes)
+	{
+		for (float f : { probe.X, probe.Y, probe.Z, probe.Red, probe.Green, probe.Blue })
+		{
+			uint32_t bits;
+			memcpy(&bits, &f, 4);
+			write32(bits);
+		}
+	}
+
+	uint32_t firstTexCoord = 0;
+	for (auto &surf : surfaces)
+	{
+		const Surface &meshsurf = mesh.Surfaces[surf.MeshSurface];
+		write32(meshsurf.type);
+		write32(meshsurf.typeIndex);
+		write32(meshsurf.controlSector ? meshsurf.controlSector->Index() : 0xffffffff);
+		write32(surf.Page);
+		write32(firstTexCoord);
+		firstTexCoord += meshsurf.numVerts;
+	}
+
+	for (float f : texCoords)
+	{
+		uint32_t bits;
+		memcpy(&bits, &f, 4);
+		write32(bits);
+	}
+
+	for (float f : pages)
+	{
+		write16(FloatToHalf(f));
+	}
+
+	// Not part of the format ZDRay writes. Readers that don't know it stop before it.
+	write32(lights.Size());
+	for (auto &light : lights)
+	{
+		for (float f : { light.Pos.X, light.Pos.Y, light.Pos.Z })
+		{
+			uint32_t bits;
+			memcpy(&bits, &f, 4);
+			write32(bits);
+		}
+	}
+
+	mz_ulong size = compressBound(data.Size());
+	lump.Resize((unsigned)size);
+	if (compress2(lump.Data(), &size, data.Data(), data.Size(), 9) != Z_OK)
+		return false;
+	lump.Clamp((unsigned)size);
+
+	Printf("Baked %u lights into %u surfaces on %d lightmap pages and %u light probes\n", lights.Size(), surfaces.Size(), numPages, probes.Size());
+	return true;
+}
+
+//==========================================================================
+//
+// The lump is written next to the executable's working directory. It has
+// to be added to the map as its LIGHTMAP lump, and is only loaded with
+// -enablelightmaps for now.
+//
+//==========================================================================
+
+static bool BakeLightmapFile(FLevelLocals *Level, const FLightBakeSettings &settings)
+{
+	uint64_t start = I_msTime();
+
+	TArray<uint8_t> lump;
+	if (!BakeLightmapLump(Level, settings, lump))
+	{
+		Printf("%s has no static lights to bake\n", Level->MapName.GetChars());
+		return false;
+	}
+
+	FString filename;
+	filename.Format("%s_lightmap.lmp", Level->MapName.GetChars());
+	std::unique_ptr<FileWriter> fw(FileWriter::Open(filename.GetChars()));
+	if (!fw || fw->Write(lump.Data(), lump.Size()) != lump.Size())
+	{
+		Printf(TEXTCOLOR_RED "Could not write %s\n", filename.GetChars());
+		return false;
+	}
+
+	Printf("Wrote %s (%u bytes) in %.1f seconds\n", filename.GetChars(), lump.Size(), (I_msTime() - start) / 1000.);
+	return true;
+}
+
+static void ParseBakeSettings(FLightBakeSettings &settings, const char *sampleDistance)
+{
+	if (sampleDistance != nullptr && *sampleDistance != 0)
+	{
+		settings.SampleDistance = clamp((float)atof(sampleDistance), 1.0f, 256.0f);
+	}
+}
+
+CCMD(bakelightmaps)
+{
+	if (gamestate != GS_LEVEL || primaryLevel->levelMesh == nullptr)
+	{
+		Printf("bakelightmaps can only be used while playing a level\n");
+		return;
+	}
+
+	FLightBakeSettings settings;
+	ParseBakeSettings(settings, argv.argc() > 1 ? argv[1] : nullptr);
+	BakeLightmapFile(primaryLevel, settings);
+}
+
+//==========================================================================
+//
+// -bakelightmaps [sample distance] bakes the level started with +map
+// after its first tic, when all light things have their lights, and quits.
+//
+//==========================================================================
+
+void CheckBakeLightmaps(FLevelLocals *Level)
+{
+	int arg = Args->CheckParm("-bakelightmaps");
+	if (arg == 0)
+		return;
+
+	FLightBakeSettings settings;
+	const char *value = arg + 1 < Args->NumArgs() ? Args->GetArg(arg + 1) : nullptr;
+	ParseBakeSettings(settings, value && value[0] != '-' && value[0] != '+' ? value : nullptr);
+
+	bool ok = BakeLightmapFile(Level, settings);
+	throw CExitEvent(ok ? 0 : 1);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "tarray.h"
+#include "vectors.h"
+
+struct FLevelLocals;
+class DoomLevelMesh;
+
+// Bounding volume hierarchy over the triangles of a level mesh, used for shadow rays by the light baker
+class LightBakerTriangleTree
+{
+public:
+	LightBakerTriangleTree(const DoomLevelMesh &mesh);
+
+	// Returns true if nothing blocks the segment between the two points
+	bool Visible(const FVector3 &from, const FVector3 &to) const;
+
+private:
+	struct Node
+	{
+		FVector3 aabb_min, aabb_max;
+		int left_node, right_node;		// -1 for leaf nodes
+		int first_triangle, num_triangles;
+	};
+
+	int GenerateTreeNode(int *triangles, int num_triangles, const FVector3 *centroids, int *work_buffer);
+	static bool OverlapRayAABB(const FVector3 &origin, const FVector3 &invdir, float tmax, const Node &node);
+	bool IntersectTriangle(const FVector3 &origin, const FVector3 &dir, float tmax, int triangle) const;
+
+	// Last node is the root node
+	TArray<Node> nodes;
+	TArray<int> triangles;
+	const TArray<FVector3> &vertices;
+	const TArray<uint32_t> &elements;
+};
+
+struct FLightBakeSettings
+{
+	float SampleDistance = 16.f;	// Map units per lightmap texel
+	int TextureSize = 1024;
+	float ProbeSpacing = 32.f;		// Horizontal distance between light probes, one per probe grid cell by default
+	float ProbeHeight = 64.f;		// Vertical distance between light probes
+	int NumThreads = 0;				// 0 uses all cores
+};
+
+// Traces the static lights of a level into lightmaps and light probes and returns them
+// in the layout of the LIGHTMAP map lump, compressed. Returns false if there is nothing to bake.
+bool BakeLightmapLump(FLevelLocals *Level, const FLightBakeSettings &settings, TArray<uint8_t> &lump);
+
+// Headless mode, see -bakelightmaps
+void CheckBakeLightmaps(FLevelLocals *Level);
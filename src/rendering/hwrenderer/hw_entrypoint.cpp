@@ -53,13 +53,14 @@
 #include "hw_vrmodes.h"
 
 EXTERN_CVAR(Bool, cl_capfps)
+CVAR(Bool, gl_stereo_singlepass, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)	// build the scene once and draw it for both eyes
 extern bool NoInterpolateView;
 
 extern int flatVerticesPerEye;
 extern int wallVerticesPerEye;
 extern int portalsPerEye;
-extern int lightsFlatPerEye;
-extern int lightsWallPerEye;
+extern std::atomic<int> lightsFlatPerEye;
+extern std::atomic<int> lightsWallPerEye;
 
 static SWSceneDrawer *swdrawer;
 
@@ -142,10 +143,13 @@ sector_t* RenderViewpoint(FRenderViewpoint& mainvp, AActor* camera, IntRect* bou
 	auto vrmode = VRMode::GetVRMode(mainview && toscreen);
 	vrmode->SetUp();
 	const int eyeCount = vrmode->mEyeCount;
+	const bool singlepass = gl_stereo_singlepass && mainview && eyeCount == 2;
+	HWDrawInfo* stereodi = nullptr;
 	screen->FirstEye();
 	for (int eye_ix = 0; eye_ix < eyeCount; ++eye_ix)
 	{
-		flatVerticesPerEye = wallVerticesPerEye = portalsPerEye = lightsFlatPerEye = lightsWallPerEye = 0;
+		flatVerticesPerEye = wallVerticesPerEye = portalsPerEye = 0;
+		lightsFlatPerEye = lightsWallPerEye = 0;
 		const auto& eye = vrmode->mEyes[eye_ix];
 		eye->SetUp();
 		screen->SetViewportRects(bounds);
@@ -158,7 +162,7 @@ sector_t* RenderViewpoint(FRenderViewpoint& mainvp, AActor* camera, IntRect* bou
 			RenderState.EnableDrawBuffers(RenderState.GetPassDrawBufferCount(), true);
 		}
 
-		auto di = HWDrawInfo::StartDrawInfo(mainvp.ViewLevel, nullptr, mainvp, nullptr);
+		auto di = stereodi ? stereodi : HWDrawInfo::StartDrawInfo(mainvp.ViewLevel, nullptr, mainvp, nullptr);
 		auto& vp = di->Viewpoint;
 
 		di->Set3DViewport(RenderState);
@@ -177,6 +181,21 @@ sector_t* RenderViewpoint(FRenderViewpoint& mainvp, AActor* camera, IntRect* bou
 		if (iso_ortho && (camera->ViewPos->Offset.Length() > 0)) inv_iso_dist = 1.0/camera->ViewPos->Offset.Length();
 		di->VPUniforms.mProjectionMatrix = eye->GetProjection(fov, ratio, fovratio * inv_iso_dist, iso_ortho);
 
+		if (singlepass && stereodi == nullptr)
+		{
+			// Build the draw lists once from the midpoint between the eyes. Both eyes draw them.
+			// The second eye is set up here as well so that its shift is the one it gets drawn with.
+			const auto& eye1 = vrmode->mEyes[1];
+			eye1->SetUp();
+			auto shift0 = eye->GetViewShift(vp), shift1 = eye1->GetViewShift(vp);
+			eye1->TearDown();
+			vp.Pos += (shift0 + shift1) / 2;
+			di->SetupView(RenderState, vp.Pos.X, vp.Pos.Y, vp.Pos.Z, false, false);
+			di->CreateStereoScene(toscreen, toscreen || isSavePic, (shift1 - shift0).XY().Length() / 2);
+			stereodi = di;
+		}
+		if (singlepass) vp.Pos = mainvp.Pos;
+
 		// Stereo mode specific viewpoint adjustment
 		vp.Pos += eye->GetViewShift(vp);
 		di->SetupView(RenderState, vp.Pos.X, vp.Pos.Y, vp.Pos.Z, false, false);
@@ -203,7 +222,7 @@ sector_t* RenderViewpoint(FRenderViewpoint& mainvp, AActor* camera, IntRect* bou
 		// Reset colormap so 2D drawing isn't affected
 		RenderState.SetSpecialColormap(CM_DEFAULT, 1);
 
-		di->EndDrawInfo();
+		if (!singlepass || eye_ix == eyeCount - 1) di->EndDrawInfo();
 		eye->TearDown();
 		screen->NextEye(eyeCount);
 	}
@@ -348,6 +367,7 @@ sector_t* RenderView(player_t* player)
 	else
 	{
 		hw_ClearFakeFlat();
+		hw_UpdateTextureStreaming();
 
 		iter_dlightf = iter_dlight = draw_dlight = draw_dlightf = 0;
 
@@ -43,9 +43,11 @@
 #include "hwrenderer/scene/hw_portal.h"
 #include "hw_bonebuffer.h"
 #include "hw_models.h"
+#include "ctpl.h"
 
 CVAR(Bool, gl_light_models, true, CVAR_ARCHIVE)
 CVAR(Bool, gl_cull_backfaces, true, CVAR_ARCHIVE)
+CVARD(Bool, gl_multithread_bones, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG, "evaluates the bones of visible animated models on worker threads")
 
 float gldepthmin, gldepthmax;
 
@@ -165,3 +167,187 @@ int FHWModelRenderer::SetupFrame(FModel *model, unsigned int frame1, unsigned in
 	return boneIndexBase;
 }
 
+
+//===========================================================================
+//
+// Animated models that share model and pose within a frame, like a group
+// of monsters walking in step, upload their bones only once. The cache is
+// dropped whenever the bone buffer gets cleared.
+//
+//===========================================================================
+
+struct FBonePoseKey
+{
+	FModel *model;
+	FBonePose pose;
+};
+
+template<> struct THashTraits<FBonePoseKey>
+{
+	hash_t Hash(const FBonePoseKey &key)
+	{
+		auto mix = [](hash_t h, uint32_t v) { return (h ^ v) * 16777619u; };
+		auto bits = [](float f) { uint32_t u; memcpy(&u, &f, sizeof(u)); return u; };
+
+		hash_t h = 2166136261u;
+		h = mix(h, (uint32_t)(uintptr_t)key.model);
+		h = mix(h, (uint32_t)(uintptr_t)key.pose.animationData);
+		h = mix(h, key.pose.frame1);
+		h = mix(h, key.pose.frame2);
+		h = mix(h, bits(key.pose.inter));
+		h = mix(h, key.pose.frame1_prev);
+		h = mix(h, bits(key.pose.inter1_prev));
+		h = mix(h, key.pose.frame2_prev);
+		h = mix(h, bits(key.pose.inter2_prev));
+		return h;
+	}
+	int Compare(const FBonePoseKey &left, const FBonePoseKey &right) { return left.model != right.model || !(left.pose == right.pose); }
+};
+
+static TMap<FBonePoseKey, int> BonePoses;
+static unsigned int BonePoseGeneration;
+static std::mutex BonePoseLock;
+
+static int LookupBonePose(FModel *model, const FBonePose &pose)
+{
+	std::lock_guard lock(BonePoseLock);
+	if (BonePoseGeneration != screen->mBones->GetGeneration())
+	{
+		BonePoses.Clear();
+		BonePoseGeneration = screen->mBones->GetGeneration();
+		return -1;
+	}
+
+	auto found = BonePoses.CheckKey({ model, pose });
+	return found ? *found : -1;
+}
+
+static void InsertBonePose(FModel *model, const FBonePose &pose, int boneStartIndex)
+{
+	std::lock_guard lock(BonePoseLock);
+	if (BonePoseGeneration == screen->mBones->GetGeneration())
+	{
+		BonePoses[{ model, pose }] = boneStartIndex;
+	}
+}
+
+int FHWModelRenderer::FindBonePose(FModel *model, const FBonePose &pose)
+{
+	return LookupBonePose(model, pose);
+}
+
+void FHWModelRenderer::StoreBonePose(FModel *model, const FBonePose &pose, int boneStartIndex)
+{
+	InsertBonePose(model, pose, boneStartIndex);
+}
+
+//===========================================================================
+//
+// Bone pre-pass
+//
+// Once the draw lists are complete, the bones of every visible animated
+// model are evaluated and uploaded on a job pool. The uploads go into the
+// pose cache, so when the models get drawn they only look up their offset.
+//
+//===========================================================================
+
+enum
+{
+	MAX_BONE_WORKERS = 8,
+	MIN_BONE_JOBS_PER_WORKER = 2,	// Below that, waking up the workers costs more than it saves
+};
+
+static ctpl::thread_pool bonePool;
+static TArray<FModelBoneJob> boneJobs;
+static TMap<FBonePoseKey, bool> boneJobPoses;
+static cycle_t bonePrepassTime;
+static int bonePrepassJobs, bonePrepassShared, bonePrepassWorkers;
+
+static void EvaluateBoneJob(const FModelBoneJob &job)
+{
+	auto bones = job.model->CalculateBones(job.pose, job.bones, job.index);
+	if (bones == nullptr) return;
+
+	int boneStartIndex = screen->mBones->UploadBones(*bones);
+	if (boneStartIndex >= 0) InsertBonePose(job.model, job.pose, boneStartIndex);
+}
+
+void hw_PrepareModelBones(HWDrawInfo *di)
+{
+	bonePrepassTime.Reset();
+	bonePrepassTime.Clock();
+
+	// Collecting runs on the main thread, it may create the actors' bone components.
+	boneJobs.Clear();
+	for (auto &list : di->drawlists)
+	{
+		for (auto sprite : list.sprites)
+		{
+			if (sprite->modelframe != nullptr && sprite->actor != nullptr)
+			{
+				CollectModelBones(sprite->modelframe, sprite->actor, boneJobs);
+			}
+		}
+	}
+
+	// Every pose only needs to be evaluated once, no matter how many actors share it.
+	boneJobPoses.Clear();
+	unsigned count = 0;
+	for (auto &job : boneJobs)
+	{
+		FBonePoseKey key = { job.model, job.pose };
+		if (boneJobPoses.CheckKey(key) != nullptr || LookupBonePose(job.model, job.pose) >= 0) continue;
+		boneJobPoses[key] = true;
+		boneJobs[count++] = job;
+	}
+	bonePrepassJobs = count;
+	bonePrepassShared = boneJobs.Size() - count;
+	boneJobs.Clamp(count);
+
+	int numworkers = 1;
+	if (gl_multithread_bones)
+	{
+		int maxworkers = clamp<int>(std::thread::hardware_concurrency() / 2, 1, MAX_BONE_WORKERS);
+		numworkers = clamp<int>(count / MIN_BONE_JOBS_PER_WORKER, 1, maxworkers);
+	}
+	bonePrepassWorkers = numworkers;
+
+	if (numworkers == 1)
+	{
+		for (auto &job : boneJobs) EvaluateBoneJob(job);
+	}
+	else
+	{
+		// The main thread works along with the pool.
+		if (bonePool.size() < numworkers - 1) bonePool.resize(numworkers - 1);
+
+		std::atomic<unsigned> next = 0;
+		auto work = [&next]()
+		{
+			for (unsigned n = next++; n < boneJobs.Size(); n = next++)
+			{
+				EvaluateBoneJob(boneJobs[n]);
+			}
+		};
+
+		std::future<void> futures[MAX_BONE_WORKERS];
+		for (int i = 0; i < numworkers - 1; i++)
+		{
+			futures[i] = bonePool.push([&work](int id) { work(); });
+		}
+		work();
+		for (int i = 0; i < numworkers - 1; i++)
+		{
+			futures[i].wait();
+		}
+	}
+
+	bonePrepassTime.Unclock();
+}
+
+ADD_STAT(bones)
+{
+	FString out;
+	out.Format("Bone jobs: %d, shared poses: %d, workers: %d, time: %2.3f ms", bonePrepassJobs, bonePrepassShared, bonePrepassWorkers, bonePrepassTime.TimeMS());
+	return out;
+}
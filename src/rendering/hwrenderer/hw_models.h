@@ -57,6 +57,8 @@ public:
 	void DrawArrays(int start, int count) override;
 	void DrawElements(int numIndices, size_t offset) override;
 	int SetupFrame(FModel *model, unsigned int frame1, unsigned int frame2, unsigned int size, const TArray<VSMatrix>& bones, int boneStartIndex) override;
+	int FindBonePose(FModel *model, const FBonePose &pose) override;
+	void StoreBonePose(FModel *model, const FBonePose &pose, int boneStartIndex) override;
 
 };
 
@@ -40,6 +40,7 @@
 #include "modelrenderer.h"
 #include "hw_models.h"
 #include "d_main.h"
+#include "hw_texstreamer.h"
 
 EXTERN_CVAR(Bool, gl_precache)
 EXTERN_CVAR(Bool, gl_precache_actors)
@@ -167,6 +168,9 @@ void hw_PrecacheTexture(uint8_t *texhitlist, TMap<PClassActor*, bool> &actorhitl
 	TMap<FTexture*, bool> allTextures;
 	TArray<FTexture*> layers;
 
+	// The streamer starts over with the new texture set
+	TexStreamer.Clear();
+
 	// First collect the potential max. texture set 
 	for (int i = 1; i < TexMan.NumTextures(); i++)
 	{
@@ -0,0 +1,288 @@
+//
+//---------------------------------------------------------------------------
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with this program.  If not, see http://www.gnu.org/licenses/
+//
+//--------------------------------------------------------------------------
+//
+/*
+** Feeds the texture streamer from the draw lists
+**
+*/
+
+#include "c_cvars.h"
+#include "stats.h"
+#include "v_video.h"
+#include "texturemanager.h"
+#include "image.h"
+#include "hw_texstreamer.h"
+#include "hw_texcache.h"
+#include "hw_ihwtexture.h"
+#include "bc7encoder.h"
+#include "hw_drawinfo.h"
+#include "hw_drawstructs.h"
+
+extern void hw_unloadTexture(FGameTexture* tex);
+
+//==========================================================================
+//
+// Streaming only manages world textures: walls, flats and sprites.
+// Everything else is loaded and released like before.
+//
+//==========================================================================
+
+class FHWTextureStreamBackend : public ITextureStreamBackend
+{
+	// A texture must not be released while the background loader is working on it
+	static bool IsBusy(FTexture *layer)
+	{
+		bool busy = false;
+		layer->SystemTextures.Iterate([&](IHardwareTexture *hwtex)
+		{
+			auto state = hwtex->GetState();
+			if (state == IHardwareTexture::LOADING || state == IHardwareTexture::CACHING || state == IHardwareTexture::UPLOADING) busy = true;
+		});
+		return busy;
+	}
+
+	static bool IsBusy(FGameTexture *tex)
+	{
+		TArray<FTexture*> layers;
+		tex->GetLayers(layers);
+		for (auto layer : layers)
+		{
+			if (IsBusy(layer)) return true;
+		}
+		return false;
+	}
+
+	// DDS images are always uploaded as BC7 with their stored mipmaps. Transcoded
+	// images are once their blocks are in the cache, until then they are RGBA8.
+	static bool IsBlockCompressed(FGameTexture *tex, FTexture *layer)
+	{
+		auto image = layer->GetImage();
+		if (image == nullptr) return false;
+		if (image->IsGPUOnly()) return true;
+
+		// If it is loaded, go by what was actually uploaded
+		bool ready = false, compressed = false;
+		layer->SystemTextures.Iterate([&](IHardwareTexture *hwtex)
+		{
+			if (hwtex->GetState() == IHardwareTexture::READY)
+			{
+				ready = true;
+				if (hwtex->IsCompressed()) compressed = true;
+			}
+		});
+		if (ready) return compressed;
+
+		// Sprites get expanded and trimmed, which the cache does not handle
+		if (tex->GetUseType() == ETextureType::Sprite || !TexTranscodeCache.CanTranscode(image, 0, false, false)) return false;
+		auto imgtex = dynamic_cast<FImageTexture *>(layer);
+		int conversion = imgtex && imgtex->GetNoRemap0() ? FImageSource::noremap0 : FImageSource::normal;
+		return TexTranscodeCache.IsCached(image->LumpNum(), conversion);
+	}
+
+public:
+	// Only textures with stored mipmaps can start at a lower level
+	int NumLevels(FGameTexture *tex) override
+	{
+		auto layer = tex->GetTexture();
+		if (!IsBlockCompressed(tex, layer)) return 1;
+		return BC7_NumMipLevels(layer->GetWidth(), layer->GetHeight());
+	}
+
+	size_t LevelSize(FGameTexture *tex, int level) override
+	{
+		TArray<FTexture*> layers;
+		tex->GetLayers(layers);
+
+		size_t size = 0;
+		for (auto layer : layers)
+		{
+			int w = layer->GetWidth(), h = layer->GetHeight();
+			if (IsBlockCompressed(tex, layer))
+			{
+				// The stored mipmaps from the start level down, the last one is always uploaded
+				int numLevels = BC7_NumMipLevels(w, h);
+				int start = std::min(level, numLevels - 1);
+				for (int i = 0; i < numLevels; i++)
+				{
+					if (i >= start) size += BC7_LevelSize(w, h);
+					w = std::max(1, w >> 1);
+					h = std::max(1, h >> 1);
+				}
+			}
+			else
+			{
+				// RGBA8 with generated mipmaps, always at full size
+				size += (size_t)w * h * 4 * 4 / 3;
+			}
+		}
+		return size;
+	}
+
+	bool IsLoaded(FGameTexture *tex) override
+	{
+		return tex->GetTexture()->HasHardwareTextures();
+	}
+
+	bool SetLevel(FGameTexture *tex, int level) override
+	{
+		TArray<FTexture*> layers;
+		tex->GetLayers(layers);
+
+		bool reload = false;
+		for (auto layer : layers)
+		{
+			if (layer->GetStreamLevel() != level && layer->HasHardwareTextures()) reload = true;
+		}
+		if (reload && IsBusy(tex)) return false;
+
+		for (auto layer : layers) layer->SetStreamLevel(level);
+		if (reload) hw_unloadTexture(tex);
+		return true;
+	}
+
+	bool Evict(FGameTexture *tex) override
+	{
+		if (IsBusy(tex)) return false;
+		hw_unloadTexture(tex);
+		return true;
+	}
+};
+
+static FHWTextureStreamBackend HWStreamBackend;
+
+CUSTOM_CVARD(Bool, gl_texture_streaming, false, CVAR_ARCHIVE | CVAR_GLOBALCONFIG, "picks the mip level of world textures by their size on screen")
+{
+	TexStreamer.SetBackend(self ? &HWStreamBackend : nullptr);
+}
+
+CUSTOM_CVARD(Int, gl_texture_budget, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG, "texture memory budget for streamed textures in MB, 0 = unlimited")
+{
+	if (self < 0) self = 0;
+	else TexStreamer.SetBudget((size_t)self * 1024 * 1024);
+}
+
+//==========================================================================
+//
+// Called once per frame, before anything is drawn
+//
+//==========================================================================
+
+void hw_UpdateTextureStreaming()
+{
+	if (gl_texture_streaming) TexStreamer.Update();
+}
+
+//==========================================================================
+//
+// Texels per screen pixel at the closest point of each draw item.
+// This is a rough estimate, the streamer only needs the power of two.
+//
+//==========================================================================
+
+static float TexelsPerPixel(float texelsPerUnit, float distance, float focal)
+{
+	return texelsPerUnit * std::max(distance, 1.f) / focal;
+}
+
+static float WallDistance(const HWWall *wall, const DVector3 &pos)
+{
+	float dx = wall->glseg.x2 - wall->glseg.x1;
+	float dy = wall->glseg.y2 - wall->glseg.y1;
+	float len2 = dx * dx + dy * dy;
+	float t = len2 > 0 ? std::clamp((((float)pos.X - wall->glseg.x1) * dx + ((float)pos.Y - wall->glseg.y1) * dy) / len2, 0.f, 1.f) : 0.f;
+	float cx = wall->glseg.x1 + dx * t - (float)pos.X;
+	float cy = wall->glseg.y1 + dy * t - (float)pos.Y;
+	float zmin = std::min(wall->zbottom[0], wall->zbottom[1]);
+	float zmax = std::max(wall->ztop[0], wall->ztop[1]);
+	float cz = std::clamp((float)pos.Z, zmin, zmax) - (float)pos.Z;
+	return sqrtf(cx * cx + cy * cy + cz * cz);
+}
+
+void hw_MarkStreamedTextures(HWDrawInfo *di)
+{
+	if (!gl_texture_streaming) return;
+
+	const auto &vp = di->Viewpoint;
+	const DVector3 &pos = vp.Pos;
+	float focal = screen->mSceneViewport.width * 0.5f / (float)tan(vp.GetFieldOfView().Radians() / 2);
+	if (focal <= 0) return;
+
+	for (auto &list : di->drawlists)
+	{
+		for (auto wall : list.walls)
+		{
+			auto tex = wall->texture;
+			if (tex == nullptr) continue;
+
+			float dx = wall->glseg.x2 - wall->glseg.x1;
+			float dy = wall->glseg.y2 - wall->glseg.y1;
+			float length = sqrtf(dx * dx + dy * dy);
+			float height = std::max(wall->ztop[0] - wall->zbottom[0], wall->ztop[1] - wall->zbottom[1]);
+			float du = fabsf(wall->tcs[HWWall::UPRGT].u - wall->tcs[HWWall::UPLFT].u);
+			float dv = fabsf(wall->tcs[HWWall::LOLFT].v - wall->tcs[HWWall::UPLFT].v);
+
+			float density = 0;
+			if (length > 0) density = du * tex->GetTexelWidth() / length;
+			if (height > 0) density = std::max(density, dv * tex->GetTexelHeight() / height);
+			if (density > 0) TexStreamer.MarkUsed(tex, TexelsPerPixel(density, WallDistance(wall, pos), focal));
+		}
+
+		for (auto flat : list.flats)
+		{
+			auto tex = flat->texture;
+			if (tex == nullptr || tex->GetDisplayWidth() <= 0) continue;
+
+			// The closest point of a plane is straight above or below the viewer
+			float density = tex->GetTexelWidth() / tex->GetDisplayWidth();
+			TexStreamer.MarkUsed(tex, TexelsPerPixel(density, fabsf(flat->z - (float)pos.Z), focal));
+		}
+
+		for (auto sprite : list.sprites)
+		{
+			auto tex = sprite->texture;
+			if (tex == nullptr || sprite->modelframe != nullptr) continue;
+
+			float dx = sprite->x2 - sprite->x1;
+			float dy = sprite->y2 - sprite->y1;
+			float width = sqrtf(dx * dx + dy * dy);
+			if (width <= 0) continue;
+
+			DVector3 delta(sprite->x - pos.X, sprite->y - pos.Y, sprite->z - pos.Z);
+			TexStreamer.MarkUsed(tex, TexelsPerPixel(tex->GetTexelWidth() / width, (float)delta.Length(), focal));
+		}
+	}
+}
+
+//==========================================================================
+//
+//
+//
+//==========================================================================
+
+ADD_STAT(texstream)
+{
+	if (!gl_texture_streaming) return "Texture streaming is off";
+
+	auto stats = TexStreamer.GetStats();
+	FString out;
+	out.Format("Textures: %u  Drawn: %u  Resident: %.1fMB / %s\nBias: %d  Level changes: %u  Evictions: %u",
+		stats.Textures, stats.Visible, stats.Resident / (1024. * 1024.),
+		stats.Budget > 0 ? FStringf("%.0fMB", stats.Budget / (1024. * 1024.)).GetChars() : "unlimited",
+		stats.Bias, stats.Changes, stats.Evictions);
+	return out;
+}
@@ -25,6 +25,8 @@
 **
 **/
 
+#include <thread>
+#include <condition_variable>
 #include "p_lnspec.h"
 #include "p_local.h"
 #include "a_sharedglobal.h"
@@ -40,24 +42,38 @@
 #include "hwrenderer/scene/hw_drawinfo.h"
 #include "hwrenderer/scene/hw_portal.h"
 #include "hw_clock.h"
+#include "i_time.h"
+#include "profiler.h"
 #include "flatvertices.h"
 #include "hw_vertexbuilder.h"
 #include "hw_walldispatcher.h"
 
 #ifdef ARCH_IA32
 #include <immintrin.h>
+#elif defined(_MSC_VER)
+#include <intrin.h>
 #endif // ARCH_IA32
 
 CVAR(Bool, gl_multithread, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+CUSTOM_CVAR(Int, gl_multithread_workers, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+{
+	if (self < 0) self = 0;
+	else if (self > MAX_RENDER_WORKERS) self = MAX_RENDER_WORKERS;
+}
 
 EXTERN_CVAR(Float, r_actorspriteshadowdist)
 EXTERN_CVAR(Bool, r_radarclipper)
 EXTERN_CVAR(Bool, r_dithertransparency)
 
 thread_local bool isWorkerThread;
+thread_local HWDrawListShard *workerShard;	// only set if several workers are running.
+thread_local int workerJob;					// queue position of the job currently being processed.
 ctpl::thread_pool renderPool(4);
 bool inited = false;
 
+static HWDrawListShard workerShards[MAX_RENDER_WORKERS];
+static std::recursive_mutex sharedLock;
+
 const int MAXDITHERACTORS = 20; // Maximum number of enemies that can set dither-transparency flags
 AActor* RenderedTargets[MAXDITHERACTORS];
 int RTnum;
@@ -69,6 +85,23 @@ void ClearDitherTargets()
 	  RenderedTargets[ii] = nullptr;
 }
 
+//==========================================================================
+//
+// Number of threads consuming the job queue.
+// 0 picks a value based on the available cores, leaving room for the main thread.
+//
+//==========================================================================
+
+static int GetRenderWorkerCount()
+{
+	int count = gl_multithread_workers;
+	if (count <= 0)
+	{
+		count = std::thread::hardware_concurrency() / 2;
+	}
+	return clamp(count, 1, (int)MAX_RENDER_WORKERS);
+}
+
 struct RenderJob
 {
 	enum
@@ -88,78 +121,324 @@ struct RenderJob
 };
 
 
+//==========================================================================
+//
+// Bounded multi-producer/multi-consumer ring buffer for the render jobs.
+// Every slot carries a sequence number telling whether it is ready to be
+// written or read, so neither side needs a lock. If the ring is full the
+// producer waits for the workers to catch up instead of overrunning it.
+//
+//==========================================================================
+
+static inline void CPUPause()
+{
+#if defined(ARCH_IA32)
+	_mm_pause();
+#elif defined(_MSC_VER) && (defined(_M_ARM) || defined(_M_ARM64))
+	__yield();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
 class RenderJobQueue
 {
-	RenderJob pool[300000];	// Way more than ever needed. The largest ever seen on a single viewpoint is around 40000.
-	std::atomic<int> readindex{};
-	std::atomic<int> writeindex{};
+	enum
+	{
+		QUEUE_SIZE = 65536,	// must be a power of 2. The largest ever seen on a single viewpoint is around 40000 jobs and the workers consume them while they are being added.
+		QUEUE_MASK = QUEUE_SIZE - 1
+	};
+
+	struct Slot
+	{
+		std::atomic<unsigned> sequence;
+		RenderJob job;
+	};
+
+	Slot ring[QUEUE_SIZE];
+	alignas(64) std::atomic<unsigned> writeindex{};
+	alignas(64) std::atomic<unsigned> readindex{};
+	alignas(64) std::atomic<int> parked{};
+	std::atomic<int> wakeups{};		// notifications sent to parked workers that have not woken up yet
+	unsigned baseindex = 0;
+	int highwater = 0;
+	std::mutex parkmutex;
+	std::condition_variable parkcv;
+
+	bool TryAdd(const RenderJob &newjob)
+	{
+		unsigned pos = writeindex.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot &slot = ring[pos & QUEUE_MASK];
+			int diff = int(slot.sequence.load(std::memory_order_acquire) - pos);
+			if (diff == 0)
+			{
+				// This must be sequentially consistent for the parking logic in AddJob and Park to work.
+				if (writeindex.compare_exchange_weak(pos, pos + 1))
+				{
+					slot.job = newjob;
+					slot.sequence.store(pos + 1, std::memory_order_release);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;	// full
+			}
+			else
+			{
+				pos = writeindex.load(std::memory_order_relaxed);
+			}
+		}
+	}
+
 public:
+	RenderJobQueue()
+	{
+		for (unsigned i = 0; i < QUEUE_SIZE; i++) ring[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
 	void AddJob(int type, subsector_t *sub, seg_t *seg = nullptr)
 	{
-		// This does not check for array overflows. The pool should be large enough that it never hits the limit.
+		RenderJob newjob = { type, sub, seg };
+		while (!TryAdd(newjob))
+		{
+			// Backpressure: the workers are too far behind. Give them a chance to drain the queue.
+			for (int i = 0; i < 16; i++) CPUPause();
+			if (parked.load() > 0) WakeAll();
+		}
+
+		int pending = int(writeindex.load(std::memory_order_relaxed) - readindex.load(std::memory_order_relaxed));
+		if (pending > highwater) highwater = pending;
 
-		pool[writeindex] = { type, sub, seg };
-		writeindex++;	// update index only after the value has been written.
+		// seq_cst load so this cannot be reordered with the store above. Together with the check in Park this avoids lost wakeups.
+		// Only one worker is woken per job, and none while every parked worker already has a wakeup coming,
+		// so a batch of jobs does not take the mutex for each of them.
+		if (parked.load() > wakeups.load()) WakeOne();
 	}
 
-	RenderJob *GetJob()
+	// The job's position in the queue since the last call to Begin is returned in 'position' so that the output can be put back in order later.
+	bool GetJob(RenderJob &job, int &position)
 	{
-		if (readindex < writeindex) return &pool[readindex++];
-		return nullptr;
+		unsigned pos = readindex.load(std::memory_order_relaxed);
+		while (true)
+		{
+			Slot &slot = ring[pos & QUEUE_MASK];
+			int diff = int(slot.sequence.load(std::memory_order_acquire) - (pos + 1));
+			if (diff == 0)
+			{
+				if (readindex.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+				{
+					job = slot.job;
+					slot.sequence.store(pos + QUEUE_SIZE, std::memory_order_release);
+					position = int(pos - baseindex);
+					return true;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;	// empty
+			}
+			else
+			{
+				pos = readindex.load(std::memory_order_relaxed);
+			}
+		}
 	}
-	
-	void ReleaseAll()
+
+	bool IsEmpty()
+	{
+		return readindex.load() == writeindex.load();
+	}
+
+	// Puts the calling worker to sleep until new jobs arrive.
+	void Park()
+	{
+		std::unique_lock<std::mutex> lock(parkmutex);
+		parked++;
+		while (IsEmpty())
+		{
+			parkcv.wait(lock);
+			// Also when another worker got to the job first, or else no one would wake this worker for the next one.
+			if (wakeups.load() > 0) wakeups--;
+		}
+		parked--;
+	}
+
+	void WakeOne()
+	{
+		std::lock_guard<std::mutex> lock(parkmutex);
+		if (parked.load() > wakeups.load())
+		{
+			wakeups++;
+			parkcv.notify_one();
+		}
+	}
+
+	void WakeAll()
 	{
-		readindex = 0;
-		writeindex = 0;
+		// Taking the mutex ensures that a worker that is just about to park either sees the new job or is already waiting.
+		std::lock_guard<std::mutex> lock(parkmutex);
+		parkcv.notify_all();
+	}
+
+	// Must only be called while no workers are running.
+	void Begin()
+	{
+		baseindex = writeindex.load();
+	}
+
+	int HighWaterMark()
+	{
+		return highwater;
+	}
+
+	void ResetHighWaterMark()
+	{
+		highwater = 0;
+	}
+
+	static constexpr int Capacity()
+	{
+		return QUEUE_SIZE;
 	}
 };
 
 static RenderJobQueue jobQueue;	// One static queue is sufficient here. This code will never be called recursively.
 
-void HWDrawInfo::WorkerThread()
+CUSTOM_CVAR(Int, gl_multithread_spin, 2000, CVAR_ARCHIVE | CVAR_GLOBALCONFIG)
+{
+	if (self < 0) self = 0;
+}
+
+struct RenderWorkerStats
+{
+	cycle_t SpinTime;
+	cycle_t ParkTime;
+	int Parks;
+	int SpinLimit;	// adapts to how long the worker usually needs to wait for new jobs.
+};
+
+static RenderWorkerStats workerStats[MAX_RENDER_WORKERS];
+static int statWorkers;
+
+//==========================================================================
+//
+// Waits for the next job. The worker first spins for a while because new jobs
+// usually arrive quickly while the BSP is being traversed. If nothing shows up
+// it gets parked so that it does not burn a core that the main thread may need.
+// The spin limit grows when spinning was successful and shrinks when the
+// worker had to be parked anyway.
+//
+//==========================================================================
+
+static void WaitForJob(int worker)
+{
+	auto &stats = workerStats[worker];
+	if (stats.SpinLimit <= 0) stats.SpinLimit = max(1, (int)gl_multithread_spin);
+
+	stats.SpinTime.Clock();
+	for (int i = 0; i < stats.SpinLimit; i++)
+	{
+		if (!jobQueue.IsEmpty())
+		{
+			stats.SpinTime.Unclock();
+			stats.SpinLimit = min(stats.SpinLimit * 2, max(1, gl_multithread_spin * 8));
+			return;
+		}
+		CPUPause();
+	}
+	stats.SpinTime.Unclock();
+
+	stats.SpinLimit = max(stats.SpinLimit / 2, max(1, gl_multithread_spin / 8));
+	stats.Parks++;
+	stats.ParkTime.Clock();
+	jobQueue.Park();
+	stats.ParkTime.Unclock();
+}
+
+ADD_STAT(renderworkers)
+{
+	static FString buff;
+	static uint64_t lasttime = 0;
+	uint64_t t = I_msTime();
+	if (t - lasttime > 1000)
+	{
+		// Values are accumulated over the last second.
+		buff.Format("Job queue high water mark: %d / %d\n", jobQueue.HighWaterMark(), RenderJobQueue::Capacity());
+		for (int i = 0; i < statWorkers; i++)
+		{
+			auto &stats = workerStats[i];
+			buff.AppendFormat("Worker %d: spin = %2.3f ms, parked = %2.3f ms (%d times), spin limit = %d\n", i, stats.SpinTime.TimeMS(), stats.ParkTime.TimeMS(), stats.Parks, stats.SpinLimit);
+			stats.SpinTime.Reset();
+			stats.ParkTime.Reset();
+			stats.Parks = 0;
+		}
+		jobQueue.ResetHighWaterMark();
+		lasttime = t;
+	}
+	return buff;
+}
+
+//==========================================================================
+//
+// Shared state that the worker threads may modify (portals, decals, missing texture info)
+// must be protected when more than one of them is running. With a single worker
+// the main thread never touches this data so no locking is needed then.
+//
+//==========================================================================
+
+std::unique_lock<std::recursive_mutex> HWDrawInfo::LockShared()
+{
+	if (numworkers > 1) return std::unique_lock<std::recursive_mutex>(sharedLock);
+	return std::unique_lock<std::recursive_mutex>();
+}
+
+void HWDrawInfo::WorkerThread(int worker)
 {
 	sector_t *front, *back;
 	HWWallDispatcher disp(this);
 
-	WTTotal.Clock();
+	// Only the first worker feeds the global timers. They are not thread safe and the secondary
+	// workers mostly overlap with it anyway.
+	glcycle_t localTimers[4];
+	glcycle_t &wtTotal = worker == 0 ? WTTotal : localTimers[0];
+	glcycle_t &setupWall = worker == 0 ? SetupWall : localTimers[1];
+	glcycle_t &setupFlat = worker == 0 ? SetupFlat : localTimers[2];
+	glcycle_t &setupSprite = worker == 0 ? SetupSprite : localTimers[3];
+
+	Profile_SetThreadName("BSP worker");
+	PROFILE_ZONE("BSP worker");
+	wtTotal.Clock();
 	isWorkerThread = true;	// for adding asserts in GL API code. The worker thread may never call any GL API.
+	workerShard = numworkers > 1 ? &workerShards[worker] : nullptr;
+	SetWorkerRenderDataAllocator(worker);
 	while (true)
 	{
-		auto job = jobQueue.GetJob();
-		if (job == nullptr)
+		RenderJob job;
+		if (!jobQueue.GetJob(job, workerJob))
 		{
-#ifdef ARCH_IA32
-			// The queue is empty. But yielding would be too costly here and possibly cause further delays down the line if the thread is halted.
-			// So instead add a few pause instructions and retry immediately.
-			_mm_pause();
-			_mm_pause();
-			_mm_pause();
-			_mm_pause();
-			_mm_pause();
-			_mm_pause();
-			_mm_pause();
-			_mm_pause();
-			_mm_pause();
-			_mm_pause();
-#endif // ARCH_IA32
+			WaitForJob(worker);
 		}
 		// Note that the main thread MUST have prepared the fake sectors that get used below!
 		// This worker thread cannot prepare them itself without costly synchronization.
-		else switch (job->type)
+		else switch (job.type)
 		{
 		case RenderJob::TerminateJob:
-			WTTotal.Unclock();
+			workerShard = nullptr;
+			SetWorkerRenderDataAllocator(-1);
+			wtTotal.Unclock();
 			return;
 
 		case RenderJob::WallJob:
 		{
 			HWWall wall;
-			SetupWall.Clock();
-			wall.sub = job->sub;
+			setupWall.Clock();
+			wall.sub = job.sub;
 
-			front = hw_FakeFlat(job->sub->sector, in_area, false);
-			auto seg = job->seg;
+			front = hw_FakeFlat(job.sub->sector, in_area, false);
+			auto seg = job.seg;
 			auto backsector = seg->backsector;
 			if (!backsector && seg->linedef->isVisualPortal() && seg->sidedef == seg->linedef->sidedef[0]) // For one-sided portals use the portal's destination sector as backsector.
 			{
@@ -185,50 +464,93 @@ void HWDrawInfo::WorkerThread()
 			}
 			else back = nullptr;
 
-			wall.Process(&disp, job->seg, front, back);
+			wall.Process(&disp, job.seg, front, back);
 			rendered_lines++;
-			SetupWall.Unclock();
+			setupWall.Unclock();
 			break;
 		}
 
 		case RenderJob::FlatJob:
 		{
 			HWFlat flat;
-			SetupFlat.Clock();
-			flat.section = job->sub->section;
-			front = hw_FakeFlat(job->sub->render_sector, in_area, false);
+			setupFlat.Clock();
+			flat.section = job.sub->section;
+			front = hw_FakeFlat(job.sub->render_sector, in_area, false);
 			flat.ProcessSector(this, front);
-			SetupFlat.Unclock();
+			setupFlat.Unclock();
 			break;
 		}
 
 		case RenderJob::SpriteJob:
-			SetupSprite.Clock();
-			front = hw_FakeFlat(job->sub->sector, in_area, false);
-			RenderThings(job->sub, front);
-			SetupSprite.Unclock();
+			setupSprite.Clock();
+			front = hw_FakeFlat(job.sub->sector, in_area, false);
+			RenderThings(job.sub, front);
+			setupSprite.Unclock();
 			break;
 
 		case RenderJob::ParticleJob:
-			SetupSprite.Clock();
-			front = hw_FakeFlat(job->sub->sector, in_area, false);
-			RenderParticles(job->sub, front);
-			SetupSprite.Unclock();
+			setupSprite.Clock();
+			front = hw_FakeFlat(job.sub->sector, in_area, false);
+			RenderParticles(job.sub, front);
+			setupSprite.Unclock();
 			break;
 
 		case RenderJob::ParticlePoolJob:
-			front = hw_FakeFlat(job->sub->sector, in_area, false);
-			RenderDefinedParticles(job->sub, front);
+			front = hw_FakeFlat(job.sub->sector, in_area, false);
+			RenderDefinedParticles(job.sub, front);
 			break;
 
 		case RenderJob::PortalJob:
-			AddSubsectorToPortal((FSectorPortalGroup *)job->seg, job->sub);
+			AddSubsectorToPortal((FSectorPortalGroup *)job.seg, job.sub);
 			break;
 		}
 
 	}
 }
 
+//==========================================================================
+//
+// Merges the worker shards into the real draw lists.
+// Each worker took its jobs in queue order so every shard is already sorted
+// by job position and a simple k-way merge restores the order the single
+// threaded code would have produced. This keeps the sort results stable
+// regardless of which worker picked up which job.
+//
+//==========================================================================
+
+void HWDrawInfo::MergeWorkerShards()
+{
+	for (int list = 0; list < GLDL_TYPES; list++)
+	{
+		unsigned pos[MAX_RENDER_WORKERS] = {};
+		while (true)
+		{
+			int best = -1;
+			int bestjob = INT_MAX;
+			for (int w = 0; w < numworkers; w++)
+			{
+				auto &jobs = workerShards[w].jobs[list];
+				if (pos[w] < jobs.Size() && jobs[pos[w]] < bestjob)
+				{
+					best = w;
+					bestjob = jobs[pos[w]];
+				}
+			}
+			if (best < 0) break;
+
+			// Take everything this job produced in one go.
+			auto &shard = workerShards[best];
+			do
+			{
+				drawlists[list].AppendItem(shard.lists[list], pos[best]++);
+			} while (pos[best] < shard.jobs[list].Size() && shard.jobs[list][pos[best]] == bestjob);
+		}
+	}
+	for (int w = 0; w < numworkers; w++)
+	{
+		workerShards[w].Reset();
+	}
+}
 
 
 
@@ -260,6 +582,44 @@ void HWDrawInfo::UnclipSubsector(subsector_t *sub)
 	}
 }
 
+//==========================================================================
+//
+// A stereo scene is clipped from the midpoint between the eyes. Seen from
+// one of them, whatever is behind an occluder moves against it by at most
+// the angle the eye's offset covers at the occluder's nearest point, so
+// its range is narrowed by that much on both sides.
+//
+//==========================================================================
+
+void HWDrawInfo::AddOccluder(seg_t *seg, angle_t startAngle, angle_t endAngle)
+{
+	auto &clipper = *mClipper;
+	if (StereoEyeShift > 0)
+	{
+		if (Viewpoint.IsOrtho()) return;
+
+		DVector2 view = Viewpoint.Pos.XY();
+		DVector2 v1 = seg->v1->fPos() - view;
+		DVector2 v2 = seg->v2->fPos() - view;
+		DVector2 dir = v2 - v1;
+		double len = dir.LengthSquared();
+		double t = len > 0 ? clamp(-(v1 | dir) / len, 0., 1.) : 0.;
+		double dist = (v1 + dir * t).Length();
+		if (dist <= StereoEyeShift) return;
+
+		double hyp = sqrt(dist * dist + StereoEyeShift * StereoEyeShift);
+		double cosval = dist / hyp, sinval = StereoEyeShift / hyp;
+		DVector2 start = view + v2.Rotated(cosval, sinval);
+		DVector2 end = view + v1.Rotated(cosval, -sinval);
+		angle_t narrowStart = clipper.PointToPseudoAngle(start.X, start.Y);
+		angle_t narrowEnd = clipper.PointToPseudoAngle(end.X, end.Y);
+		if (narrowEnd - narrowStart > endAngle - startAngle) return;	// Nothing left
+		startAngle = narrowStart;
+		endAngle = narrowEnd;
+	}
+	clipper.SafeAddClipRange(startAngle, endAngle);
+}
+
 //==========================================================================
 //
 // R_AddLine
@@ -387,14 +747,14 @@ void HWDrawInfo::AddLine (seg_t *seg, bool portalclip)
 			wall.sub = currentsubsector;
 			wall.Process(&disp, seg, seg->frontsector, seg->backsector, true);
 		}
-		clipper.SafeAddClipRange(startAngle, endAngle);
+		AddOccluder(seg, startAngle, endAngle);
 		return;
 	}
 
 	if (!seg->backsector)
 	{
 		if(!Viewpoint.IsAllowedOoB())
-			if (!(seg->sidedef->Flags & WALLF_DITHERTRANS)) clipper.SafeAddClipRange(startAngle, endAngle);
+			if (!(seg->sidedef->Flags & WALLF_DITHERTRANS)) AddOccluder(seg, startAngle, endAngle);
 	}
 	else if (!ispoly)	// Two-sided polyobjects never obstruct the view
 	{
@@ -422,7 +782,7 @@ void HWDrawInfo::AddLine (seg_t *seg, bool portalclip)
 			if (hw_CheckClip(seg->sidedef, currentsector, backsector))
 			{
 				if(!Viewpoint.IsAllowedOoB() && !(seg->sidedef->Flags & WALLF_DITHERTRANS))
-					clipper.SafeAddClipRange(startAngle, endAngle);
+					AddOccluder(seg, startAngle, endAngle);
 			}
 		}
 	}
@@ -627,8 +987,12 @@ void HWDrawInfo::RenderThings(subsector_t * sub, sector_t * sector)
 	for (auto p = sec->touching_renderthings; p != nullptr; p = p->m_snext)
 	{
 		auto thing = p->m_thing;
-		if (thing->validcount == validcount) continue;
-		thing->validcount = validcount;
+		{
+			// Things touching multiple sectors may be seen by several workers at once.
+			auto lock = LockShared();
+			if (thing->validcount == validcount) continue;
+			thing->validcount = validcount;
+		}
 
 		if(Viewpoint.IsAllowedOoB() && thing->Sector->isSecret() && thing->Sector->wasSecret() && !r_radarclipper) continue; // This covers things that are touching non-secret sectors
 		FIntCVar *cvar = thing->GetInfo()->distancecheck;
@@ -1079,6 +1443,7 @@ void HWDrawInfo::RenderOrthoNoFog()
 
 void HWDrawInfo::RenderBSP(void *node, bool drawpsprites)
 {
+	PROFILE_ZONE("RenderBSP");
 	ClearDitherTargets();
 	Bsp.Clock();
 
@@ -1104,21 +1469,39 @@ void HWDrawInfo::RenderBSP(void *node, bool drawpsprites)
 	multithread = gl_multithread;
 	if (multithread)
 	{
-		jobQueue.ReleaseAll();
-		auto future = renderPool.push([&](int id) {
-			WorkerThread();
-		});
+		numworkers = GetRenderWorkerCount();
+		if (renderPool.size() < numworkers) renderPool.resize(numworkers);
+
+		jobQueue.Begin();
+		statWorkers = max(statWorkers, numworkers);
+		std::future<void> futures[MAX_RENDER_WORKERS];
+		for (int i = 0; i < numworkers; i++)
+		{
+			futures[i] = renderPool.push([this, i](int id) {
+				WorkerThread(i);
+			});
+		}
 		if (Viewpoint.IsOrtho() && ((Level->flags3 & LEVEL3_NOFOGOFWAR) || !r_radarclipper)) RenderOrthoNoFog();
 		else RenderBSPNode(node);
 
-		jobQueue.AddJob(RenderJob::TerminateJob, nullptr, nullptr);
+		// Each worker exits after taking one of these so every one needs its own.
+		for (int i = 0; i < numworkers; i++)
+		{
+			jobQueue.AddJob(RenderJob::TerminateJob, nullptr, nullptr);
+		}
 		Bsp.Unclock();
 		MTWait.Clock();
-		future.wait();
+		for (int i = 0; i < numworkers; i++)
+		{
+			futures[i].wait();
+		}
+		if (numworkers > 1) MergeWorkerShards();
 		MTWait.Unclock();
+		numworkers = 0;
 	}
 	else
 	{
+		numworkers = 0;
 		if (Viewpoint.IsOrtho() && ((Level->flags3 & LEVEL3_NOFOGOFWAR) || !r_radarclipper)) RenderOrthoNoFog();
 		else RenderBSPNode(node);
 		Bsp.Unclock();
@@ -188,6 +188,7 @@ void HWDrawInfo::StartScene(FRenderViewpoint &parentvp, HWViewpointUniforms *uni
 
 	for (int i = 0; i < GLDL_TYPES; i++) drawlists[i].Reset();
 	hudsprites.Clear();
+	mStereoScene = false;
 //	Coronas.Clear();
 	vpIndex = 0;
 
@@ -210,6 +211,10 @@ HWDrawInfo *HWDrawInfo::EndDrawInfo()
 {
 	assert(this == gl_drawinfo);
 	for (int i = 0; i < GLDL_TYPES; i++) drawlists[i].Reset();
+	for (auto p : StereoPortals) delete p;
+	StereoPortals.Clear();
+	mStereoScene = false;
+	StereoEyeShift = 0;
 	gl_drawinfo = outer;
 	di_list.Release(this);
 	if (gl_drawinfo == nullptr)
@@ -445,7 +450,8 @@ HWPortal * HWDrawInfo::FindPortal(const void * src)
 
 HWDecal *HWDrawInfo::AddDecal(bool onmirror)
 {
-	auto decal = (HWDecal*)RenderDataAllocator.Alloc(sizeof(HWDecal));
+	auto decal = (HWDecal*)GetRenderDataAllocator().Alloc(sizeof(HWDecal));
+	auto lock = LockShared();
 	Decals[onmirror ? 1 : 0].Push(decal);
 	return decal;
 }
@@ -458,10 +464,14 @@ HWDecal *HWDrawInfo::AddDecal(bool onmirror)
 //
 //-----------------------------------------------------------------------------
 
-void HWDrawInfo::CreateScene(bool drawpsprites)
+void HWDrawInfo::CreateScene(bool drawpsprites, angle_t frustummargin)
 {
 	const auto &vp = Viewpoint;
 	angle_t a1 = FrustumAngle(); // horizontally clip the back of the viewport
+	if (a1 != 0xffffffff && frustummargin > 0)
+	{
+		a1 = a1 < ANGLE_90 - frustummargin ? a1 + frustummargin : 0xffffffff;
+	}
 	mClipper->SafeAddClipRangeRealAngles(vp.Angles.Yaw.BAMs() + a1, vp.Angles.Yaw.BAMs() - a1);
 	Viewpoint.FrustAngle = a1;
 	if (Viewpoint.IsAllowedOoB()) // No need for vertical clipper if viewpoint not allowed out of bounds
@@ -495,6 +505,9 @@ void HWDrawInfo::CreateScene(bool drawpsprites)
 
 	ProcessAll.Unclock();
 
+	// Everything that will be drawn is known now, so the animated models can get their bones all at once.
+	hw_PrepareModelBones(this);
+
 }
 
 //-----------------------------------------------------------------------------
@@ -510,6 +523,8 @@ void HWDrawInfo::RenderScene(FRenderState &state)
 	const auto &vp = Viewpoint;
 	RenderAll.Clock();
 
+	hw_MarkStreamedTextures(this);
+
 	state.SetDepthMask(true);
 
 	state.EnableFog(true);
@@ -934,7 +949,7 @@ void HWDrawInfo::DrawScene(int drawmode, bool drawpsprites)
 	{
 		ssao_portals_available = gl_ssao_portals;
 		applySSAO = true;
-		if (r_dithertransparency && vp.IsAllowedOoB())
+		if (r_dithertransparency && vp.IsAllowedOoB() && !mStereoScene)
 		{
 			vp.camera->tracer ? SetDitherTransFlags(vp.camera->tracer) : SetDitherTransFlags(players[consoleplayer].mo);
 		}
@@ -949,7 +964,15 @@ void HWDrawInfo::DrawScene(int drawmode, bool drawpsprites)
 		ssao_portals_available--;
 	}
 
-	if (vp.camera != nullptr)
+	if (mStereoScene)
+	{
+		// The draw lists were built by CreateStereoScene. Each eye only needs its own
+		// copy of the portal list and a translucency sort for its own position.
+		portalState.StartFrame();
+		Portals = StereoPortals;
+		drawlists[GLDL_TRANSLUCENT].Unsort();
+	}
+	else if (vp.camera != nullptr)
 	{
 		ActorRenderFlags savedflags = vp.camera->renderflags;
 		CreateScene(drawmode == DM_MAINVIEW || drawpsprites);
@@ -995,7 +1018,7 @@ void HWDrawInfo::DrawScene(int drawmode, bool drawpsprites)
 
 void HWDrawInfo::ProcessScene(bool toscreen, bool drawpsprites)
 {
-	portalState.BeginScene();
+	if (!mStereoScene) portalState.BeginScene();	// the portals of a stereo scene still reference these.
 
 	int mapsection = Level->PointInRenderSubsector(Viewpoint.Pos)->mapsection;
 	if (Viewpoint.IsAllowedOoB())
@@ -1006,6 +1029,55 @@ void HWDrawInfo::ProcessScene(bool toscreen, bool drawpsprites)
 	screen->mBones->Unmap();
 }
 
+//-----------------------------------------------------------------------------
+//
+// CreateStereoScene
+//
+// Builds the draw lists once for both eyes of a stereo view. The BSP is
+// traversed from the midpoint between the eyes with a frustum widened by
+// what the eyes' offset adds to it, and with occluders that only hide what they hide for both eyes,
+// so that it covers what either eye can see. ProcessScene then only draws
+// the lists for each eye. The portals are kept until EndDrawInfo because
+// every eye needs to render them.
+//
+//-----------------------------------------------------------------------------
+
+void HWDrawInfo::CreateStereoScene(bool toscreen, bool drawpsprites, double eyeshift)
+{
+	auto& vp = Viewpoint;
+	portalState.BeginScene();
+
+	int mapsection = Level->PointInRenderSubsector(vp.Pos)->mapsection;
+	if (vp.IsAllowedOoB())
+		mapsection = Level->PointInRenderSubsector(vp.camera->Pos())->mapsection;
+	CurrentMapSections.Set(mapsection);
+
+	if (toscreen && r_dithertransparency && vp.IsAllowedOoB())
+	{
+		vp.camera->tracer ? SetDitherTransFlags(vp.camera->tracer) : SetDitherTransFlags(players[consoleplayer].mo);
+	}
+
+	screen->mBones->Map();
+	ActorRenderFlags savedflags = vp.camera->renderflags;
+	// Seen from the midpoint, something on the edge of an eye's frustum is off by the angle the eye's
+	// offset covers at its distance. Nothing the camera collides with gets closer than its radius.
+	double nearest = max(vp.camera->radius, eyeshift);
+	angle_t margin = eyeshift > 0 ? DAngle::fromRad(asin(eyeshift / nearest)).BAMs() : 0;
+
+	StereoEyeShift = eyeshift;
+	CreateScene(toscreen || drawpsprites, margin);
+	StereoEyeShift = 0;
+	vp.camera->renderflags = savedflags;
+	screen->mBones->Unmap();
+
+	// Each eye's DrawScene starts and ends its own portal frame.
+	portalState.renderdepth--;
+
+	StereoPortals = std::move(Portals);
+	Portals.Clear();
+	mStereoScene = true;
+}
+
 //==========================================================================
 //
 //
@@ -1014,6 +1086,7 @@ void HWDrawInfo::ProcessScene(bool toscreen, bool drawpsprites)
 
 void HWDrawInfo::AddSubsectorToPortal(FSectorPortalGroup *ptg, subsector_t *sub)
 {
+	auto lock = LockShared();
 	auto portal = FindPortal(ptg);
 	if (!portal)
 	{
@@ -2,6 +2,7 @@
 
 #include <atomic>
 #include <functional>
+#include <mutex>
 #include "vectors.h"
 #include "r_defs.h"
 #include "r_utility.h"
@@ -96,6 +97,30 @@ enum DrawListType
 	GLDL_TYPES,
 };
 
+//==========================================================================
+//
+// Draw lists of one BSP worker thread.
+// Every item is tagged with the queue position of the job that created it
+// so that the shards can be merged into the same order a single worker
+// would have produced.
+//
+//==========================================================================
+
+struct HWDrawListShard
+{
+	HWDrawList lists[GLDL_TYPES];
+	TArray<int> jobs[GLDL_TYPES];
+
+	void Reset()
+	{
+		for (int i = 0; i < GLDL_TYPES; i++)
+		{
+			lists[i].Reset();
+			jobs[i].Clear();
+		}
+	}
+};
+
 
 struct HWDrawInfo
 {
@@ -152,6 +177,9 @@ struct HWDrawInfo
 	FRenderViewpoint Viewpoint;
 	HWViewpointUniforms VPUniforms;	// per-viewpoint uniform state
 	TArray<HWPortal *> Portals;
+	TArray<HWPortal *> StereoPortals;	// Portals of a scene that is drawn for both eyes. They are only deleted by EndDrawInfo.
+	bool mStereoScene = false;			// The draw lists were built by CreateStereoScene and are reused for each eye.
+	double StereoEyeShift = 0;			// Distance of the eyes from the viewpoint while CreateStereoScene clips, see AddOccluder.
 	TArray<HWDecal *> Decals[2];	// the second slot is for mirrors which get rendered in a separate pass.
 	TArray<HUDSprite> hudsprites;	// These may just be stored by value.
 	//TArray<ACorona*> Coronas;
@@ -184,6 +212,7 @@ struct HWDrawInfo
 	area_t	in_area;
 	fixed_t viewx, viewy;	// since the nodes are still fixed point, keeping the view position  also fixed point for node traversal is faster.
 	bool multithread;
+	int numworkers = 0;	// number of worker threads consuming the job queue. With more than one, shared state needs to be locked.
 
 private:
     // For ProcessLowerMiniseg
@@ -194,11 +223,16 @@ private:
 	subsector_t *currentsubsector;	// used by the line processing code.
 	sector_t *currentsector;
 
-	void WorkerThread();
+	void WorkerThread(int worker);
+	void MergeWorkerShards();
+	HWWall *NewWall(int list);
+	HWFlat *NewFlat(int list);
+	HWSprite *NewSprite(int list);
 
 	void UnclipSubsector(subsector_t *sub);
 	
 	void AddLine(seg_t *seg, bool portalclip);
+	void AddOccluder(seg_t *seg, angle_t startAngle, angle_t endAngle);
 	void PolySubsector(subsector_t * sub);
 	void RenderPolyBSPNode(void *node);
 	void AddPolyobjs(subsector_t *sub);
@@ -236,6 +270,8 @@ public:
 		VPUniforms.mClipHeight = 0;
 	}
 
+	std::unique_lock<std::recursive_mutex> LockShared();
+
 	HWPortal * FindPortal(const void * src);
 	void RenderBSPNode(void *node);
 	void RenderOrthoNoFog();
@@ -249,7 +285,8 @@ public:
 	int SetFullbrightFlags(player_t *player);
 
 	void DrawScene(int drawmode, bool drawpsprites = false);
-	void CreateScene(bool drawpsprites);
+	void CreateScene(bool drawpsprites, angle_t frustummargin = 0);
+	void CreateStereoScene(bool toscreen, bool drawpsprites, double eyeshift);
 	void RenderScene(FRenderState &state);
 	void RenderTranslucent(FRenderState &state);
 	void RenderPortal(HWPortal *p, FRenderState &state, bool usestencil);
@@ -331,6 +368,9 @@ void CleanSWDrawer();
 sector_t* RenderViewpoint(FRenderViewpoint& mainvp, AActor* camera, IntRect* bounds, float fov, float ratio, float fovratio, bool mainview, bool toscreen, bool isSavePic = false);
 void WriteSavePic(player_t* player, FileWriter* file, int width, int height);
 sector_t* RenderView(player_t* player);
+void hw_UpdateTextureStreaming();
+void hw_MarkStreamedTextures(HWDrawInfo *di);
+void hw_PrepareModelBones(HWDrawInfo *di);
 
 
 inline bool isSoftwareLighting(ELightMode lightmode)
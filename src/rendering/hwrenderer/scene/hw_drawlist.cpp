@@ -41,9 +41,25 @@
 
 FMemArena RenderDataAllocator(1024*1024);	// Use large blocks to reduce allocation time.
 
+// The BSP worker threads cannot share an arena so each one gets its own.
+// These only get freed together with the main one because the allocated data must survive until the frame is done.
+static FMemArena WorkerDataAllocator[MAX_RENDER_WORKERS];
+static thread_local FMemArena *CurrentDataAllocator;
+
 void ResetRenderDataAllocator()
 {
 	RenderDataAllocator.FreeAll();
+	for (auto &arena : WorkerDataAllocator) arena.FreeAll();
+}
+
+void SetWorkerRenderDataAllocator(int worker)
+{
+	CurrentDataAllocator = worker < 0 ? nullptr : &WorkerDataAllocator[worker];
+}
+
+FMemArena &GetRenderDataAllocator()
+{
+	return CurrentDataAllocator ? *CurrentDataAllocator : RenderDataAllocator;
 }
 
 //==========================================================================
@@ -719,6 +735,20 @@ void HWDrawList::Sort(HWDrawInfo *di)
 	sorted = DoSort(di, SortNodes[SortNodeStart]);
 }
 
+//==========================================================================
+//
+// Discards the sort tree so that the next DrawSorted sorts again for the
+// current viewpoint. Any items split by the previous sort stay split, which
+// is harmless. This list's nodes must be the last ones allocated.
+//
+//==========================================================================
+
+void HWDrawList::Unsort()
+{
+	if (sorted) SortNodes.Release(SortNodeStart);
+	sorted = nullptr;
+}
+
 //==========================================================================
 //
 // Sorting the drawitems first by texture and then by light level
@@ -763,7 +793,7 @@ void HWDrawList::SortFlats()
 
 HWWall *HWDrawList::NewWall()
 {
-	auto wall = (HWWall*)RenderDataAllocator.Alloc(sizeof(HWWall));
+	auto wall = (HWWall*)GetRenderDataAllocator().Alloc(sizeof(HWWall));
 	drawitems.Push(HWDrawItem(DrawType_WALL, walls.Push(wall)));
 	return wall;
 }
@@ -775,7 +805,7 @@ HWWall *HWDrawList::NewWall()
 //==========================================================================
 HWFlat *HWDrawList::NewFlat()
 {
-	auto flat = (HWFlat*)RenderDataAllocator.Alloc(sizeof(HWFlat));
+	auto flat = (HWFlat*)GetRenderDataAllocator().Alloc(sizeof(HWFlat));
 	drawitems.Push(HWDrawItem(DrawType_FLAT,flats.Push(flat)));
 	return flat;
 }
@@ -787,11 +817,36 @@ HWFlat *HWDrawList::NewFlat()
 //==========================================================================
 HWSprite *HWDrawList::NewSprite()
 {	
-	auto sprite = (HWSprite*)RenderDataAllocator.Alloc(sizeof(HWSprite));
+	auto sprite = (HWSprite*)GetRenderDataAllocator().Alloc(sizeof(HWSprite));
 	drawitems.Push(HWDrawItem(DrawType_SPRITE, sprites.Push(sprite)));
 	return sprite;
 }
 
+//==========================================================================
+//
+// Moves one item from a worker's draw list shard into this list.
+// The item itself stays where it is, only the pointer is taken over.
+//
+//==========================================================================
+void HWDrawList::AppendItem(HWDrawList &src, unsigned index)
+{
+	auto &item = src.drawitems[index];
+	switch (item.rendertype)
+	{
+	case DrawType_WALL:
+		drawitems.Push(HWDrawItem(DrawType_WALL, walls.Push(src.walls[item.index])));
+		break;
+
+	case DrawType_FLAT:
+		drawitems.Push(HWDrawItem(DrawType_FLAT, flats.Push(src.flats[item.index])));
+		break;
+
+	case DrawType_SPRITE:
+		drawitems.Push(HWDrawItem(DrawType_SPRITE, sprites.Push(src.sprites[item.index])));
+		break;
+	}
+}
+
 //==========================================================================
 //
 //
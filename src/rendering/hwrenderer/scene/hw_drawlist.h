@@ -4,6 +4,13 @@
 
 extern FMemArena RenderDataAllocator;
 void ResetRenderDataAllocator();
+void SetWorkerRenderDataAllocator(int worker);
+FMemArena &GetRenderDataAllocator();
+
+enum
+{
+	MAX_RENDER_WORKERS = 8	// upper limit for BSP worker threads. Each one gets its own allocator and draw list shard.
+};
 struct HWDrawInfo;
 class HWWall;
 class HWFlat;
@@ -91,6 +98,7 @@ public:
 	HWWall *NewWall();
 	HWFlat *NewFlat();
 	HWSprite *NewSprite();
+	void AppendItem(HWDrawList &src, unsigned index);
 	void Reset();
 	void SortWalls();
 	void SortFlats();
@@ -108,6 +116,7 @@ public:
 	SortNode * SortSpriteList(SortNode * head);
 	SortNode * DoSort(HWDrawInfo *di, SortNode * head);
 	void Sort(HWDrawInfo *di);
+	void Unsort();
 
 	void DoDraw(HWDrawInfo *di, FRenderState &state, bool translucent, int i);
 	void Draw(HWDrawInfo *di, FRenderState &state, bool translucent);
@@ -29,6 +29,37 @@
 #include "actor.h"
 #include "g_levellocals.h"
 
+extern thread_local HWDrawListShard *workerShard;
+extern thread_local int workerJob;
+
+//==========================================================================
+//
+// When running on a BSP worker all new items go into that worker's
+// shard and get merged into the real draw lists once the BSP is done.
+//
+//==========================================================================
+
+HWWall *HWDrawInfo::NewWall(int list)
+{
+	if (workerShard == nullptr) return drawlists[list].NewWall();
+	workerShard->jobs[list].Push(workerJob);
+	return workerShard->lists[list].NewWall();
+}
+
+HWFlat *HWDrawInfo::NewFlat(int list)
+{
+	if (workerShard == nullptr) return drawlists[list].NewFlat();
+	workerShard->jobs[list].Push(workerJob);
+	return workerShard->lists[list].NewFlat();
+}
+
+HWSprite *HWDrawInfo::NewSprite(int list)
+{
+	if (workerShard == nullptr) return drawlists[list].NewSprite();
+	workerShard->jobs[list].Push(workerJob);
+	return workerShard->lists[list].NewSprite();
+}
+
 //==========================================================================
 //
 // 
@@ -39,7 +70,7 @@ void HWDrawInfo::AddWall(HWWall *wall)
 {
 	if (wall->flags & HWWall::HWF_TRANSLUCENT)
 	{
-		auto newwall = drawlists[GLDL_TRANSLUCENT].NewWall();
+		auto newwall = NewWall(GLDL_TRANSLUCENT);
 		*newwall = *wall;
 	}
 	else
@@ -55,7 +86,7 @@ void HWDrawInfo::AddWall(HWWall *wall)
 		{
 			list = masked ? GLDL_MASKEDWALLS : GLDL_PLAINWALLS;
 		}
-		auto newwall = drawlists[list].NewWall();
+		auto newwall = NewWall(list);
 		*newwall = *wall;
 	}
 }
@@ -69,7 +100,7 @@ void HWDrawInfo::AddWall(HWWall *wall)
 void HWDrawInfo::AddMirrorSurface(HWWall *w)
 {
 	w->type = RENDERWALL_MIRRORSURFACE;
-	auto newwall = drawlists[GLDL_TRANSLUCENTBORDER].NewWall();
+	auto newwall = NewWall(GLDL_TRANSLUCENTBORDER);
 	*newwall = *w;
 
 	// Invalidate vertices to allow setting of texture coordinates
@@ -128,7 +159,7 @@ void HWDrawInfo::AddFlat(HWFlat *flat, bool fog)
 		bool masked = flat->texture->isMasked() && ((flat->renderflags&SSRF_RENDER3DPLANES) || flat->stack);
 		list = masked ? GLDL_MASKEDFLATS : GLDL_PLAINFLATS;
 	}
-	auto newflat = drawlists[list].NewFlat();
+	auto newflat = NewFlat(list);
 	*newflat = *flat;
 }
 
@@ -151,7 +182,7 @@ void HWDrawInfo::AddSprite(HWSprite *sprite, bool translucent)
 		list = GLDL_MODELS;
 	}
 
-	auto newsprt = drawlists[list].NewSprite();
+	auto newsprt = NewSprite(list);
 	*newsprt = *sprite;
 }
 
@@ -409,8 +409,8 @@ public:
 public:
 
 	void CreateVertices(HWDrawInfo *di);
-	void PutSprite(HWDrawInfo *di, bool translucent, double ticFrac = 1.0);
-	void Process(HWDrawInfo *di, AActor* thing,sector_t * sector, area_t in_area, int thruportal = false, bool isSpriteShadow = false);
+	void PutSprite(HWDrawInfo *di, bool translucent, double ticFrac = 1.0, const DVector3 &portalshift = DVector3(0, 0, 0));
+	void Process(HWDrawInfo *di, AActor* thing,sector_t * sector, area_t in_area, int thruportal = false, bool isSpriteShadow = false, const DVector3 &portalshift = DVector3(0, 0, 0), DAngle portalangle = nullAngle);
 	void ProcessParticle(HWDrawInfo* di, particle_t* particle, sector_t* sector, class DVisualThinker* spr);//, int shade, int fakeside)
 	void ProcessDefinedParticle(HWDrawInfo *di, particledata_t *particle, sector_t *sector);
 	void AdjustVisualThinker(HWDrawInfo *di, DVisualThinker *spr, sector_t *sector);
@@ -456,7 +456,7 @@ inline float Dist2(float x1,float y1,float x2,float y2)
 }
 
 bool hw_SetPlaneTextureRotation(const ::HWSectorPlane * secplane, FGameTexture * gltexture, VSMatrix &mat);
-void hw_GetDynModelLight(AActor *self, FDynLightData &modellightdata, double ticFrac = 1.0);
+void hw_GetDynModelLight(AActor *self, FDynLightData &modellightdata, double ticFrac = 1.0, const DVector3 &portalshift = DVector3(0, 0, 0));
 LightProbe* FindLightProbe(FLevelLocals* level, float x, float y, float z);
 
 extern const float LARGE_VALUE;
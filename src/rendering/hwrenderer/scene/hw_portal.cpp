@@ -106,7 +106,7 @@ void FPortalSceneState::EndFrame(HWDrawInfo *di, FRenderState &state)
 		{
 			RenderPortal(p, state, true, di);
 		}
-		delete p;
+		if (!di->mStereoScene) delete p;
 	}
 	renderdepth--;
 
@@ -163,7 +163,7 @@ bool FPortalSceneState::RenderFirstSkyPortal(int recursion, HWDrawInfo *outer_di
 	{
 		portals.Delete(bestindex);
 		RenderPortal(best, state, false, outer_di);
-		delete best;
+		if (!outer_di->mStereoScene) delete best;
 		return true;
 	}
 	return false;
@@ -43,7 +43,7 @@
 #include "hw_fakeflat.h"
 #include "hw_walldispatcher.h"
 
-extern int lightsFlatPerEye;
+extern std::atomic<int> lightsFlatPerEye;
 
 //==========================================================================
 //
@@ -120,7 +120,7 @@ int HWDrawInfo::SetupLightsForOtherPlane(subsector_t * sub, FDynLightData &light
 		FLightNode * node = sub->section->lighthead;
 
 		lightdata.Clear();
-		while (node && (!gl_light_flat_max_lights || lightsFlatPerEye < gl_light_flat_max_lights))
+		while (node)
 		{
 			FDynamicLight * light = node->lightsource;
 
@@ -129,7 +129,7 @@ int HWDrawInfo::SetupLightsForOtherPlane(subsector_t * sub, FDynLightData &light
 				node = node->nextLight;
 				continue;
 			}
-			lightsFlatPerEye++;
+			if (lightsFlatPerEye++ >= gl_light_flat_max_lights && gl_light_flat_max_lights) break;
 			iter_dlightf++;
 
 			p.Set(plane->Normal(), plane->fD());
@@ -199,6 +199,7 @@ void HWDrawInfo::AddOtherCeilingPlane(int sector, gl_subsectorrendernode * node)
 void HWDrawInfo::AddUpperMissingTexture(side_t * side, subsector_t *sub, float Backheight)
 {
 	if (!side->segs[0]->backsector) return;
+	auto lock = LockShared();
 
 	for (int i = 0; i < side->numsegs; i++)
 	{
@@ -258,6 +259,7 @@ void HWDrawInfo::AddLowerMissingTexture(side_t * side, subsector_t *sub, float B
 		// process the missing texture for them.
 		if (backsec->transdoorheight == backsec->GetPlaneTexZ(sector_t::floor)) return;
 	}
+	auto lock = LockShared();
 
 	// we need to check all segs of this sidedef
 	for (int i = 0; i < side->numsegs; i++)
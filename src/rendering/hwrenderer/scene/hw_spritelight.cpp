@@ -209,29 +209,33 @@ void HWDrawInfo::GetDynSpriteLight(AActor *thing, HWSprite *particleSprite, floa
 
 // static so that we build up a reserve (memory allocations stop)
 // For multithread processing each worker thread needs its own copy, though.
+// The sections that were already walked are kept here too, dl_validcount and the sections themselves are shared by all BSP workers.
 static thread_local TArray<FDynamicLight*> addedLightsArray; 
+static thread_local TArray<FSection*> visitedSectionsArray;
 
-void hw_GetDynModelLight(AActor *self, FDynLightData &modellightdata, double ticFrac)
+void hw_GetDynModelLight(AActor *self, FDynLightData &modellightdata, double ticFrac, const DVector3 &portalshift)
 {
 	modellightdata.Clear();
 
 	if (self)
 	{
 		auto &addedLights = addedLightsArray;	// avoid going through the thread local storage for each use.
+		auto &visitedSections = visitedSectionsArray;
 
 		addedLights.Clear();
+		visitedSections.Clear();
 
-		float x = (float)self->X();
-		float y = (float)self->Y();
-		float z = (float)self->Center();
+		float x = (float)(self->X() + portalshift.X);
+		float y = (float)(self->Y() + portalshift.Y);
+		float z = (float)(self->Center() + portalshift.Z);
 		float actorradius = (float)self->RenderRadius();
 		float radiusSquared = actorradius * actorradius;
-		dl_validcount++;
 
 		BSPWalkCircle(self->Level, x, y, radiusSquared, [&](subsector_t *subsector) // Iterate through all subsectors potentially touched by actor
 		{
 			auto section = subsector->section;
-			if (section->validcount == dl_validcount) return;	// already done from a previous subsector.
+			if (std::find(visitedSections.begin(), visitedSections.end(), section) != visitedSections.end()) return;	// already done from a previous subsector.
+			visitedSections.Push(section);
 			FLightNode * node = section->lighthead;
 			while (node) // check all lights touching a subsector
 			{
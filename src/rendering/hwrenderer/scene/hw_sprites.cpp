@@ -566,12 +566,12 @@ bool HWSprite::CalculateVertices(HWDrawInfo* di, FVector3* v, DVector3* vp)
 //
 //==========================================================================
 
-inline void HWSprite::PutSprite(HWDrawInfo *di, bool translucent, double ticFrac)
+inline void HWSprite::PutSprite(HWDrawInfo *di, bool translucent, double ticFrac, const DVector3 &portalshift)
 {
 	// That's a lot of checks...
 	if (modelframe && !modelframe->isVoxel && !(modelframeflags & MDL_NOPERPIXELLIGHTING) && RenderStyle.BlendOp != STYLEOP_Shadow && gl_light_sprites && di->Level->HasDynamicLights && !di->isFullbrightScene() && !fullbright)
 	{
-		hw_GetDynModelLight(actor, lightdata, ticFrac);
+		hw_GetDynModelLight(actor, lightdata, ticFrac, portalshift);
 		dynlightindex = screen->mLights->UploadLights(lightdata);
 	}
 	else
@@ -780,7 +780,7 @@ bool IsDistanceCulled(AActor* thing)
 	return false;
 }
 
-void HWSprite::Process(HWDrawInfo *di, AActor* thing, sector_t * sector, area_t in_area, int thruportal, bool isSpriteShadow)
+void HWSprite::Process(HWDrawInfo *di, AActor* thing, sector_t * sector, area_t in_area, int thruportal, bool isSpriteShadow, const DVector3 &portalshift, DAngle portalangle)
 {
 	sector_t rs;
 	sector_t * rendersector;
@@ -835,6 +835,7 @@ void HWSprite::Process(HWDrawInfo *di, AActor* thing, sector_t * sector, area_t
 	// [RH] Interpolate the sprite's position to make it look smooth
 	DVector3 thingpos = thing->InterpolatedPosition(vp.TicFrac);
 	if (thruportal == 1) thingpos += di->Level->Displacements.getOffset(thing->Sector->PortalGroup, sector->PortalGroup);
+	else if (thruportal == 2) thingpos += portalshift;
 
 	AActor *viewmaster = thing;
 	if ((thing->flags8 & MF8_MASTERNOSEE) && thing->master != nullptr)
@@ -857,6 +858,7 @@ void HWSprite::Process(HWDrawInfo *di, AActor* thing, sector_t * sector, area_t
 	{
 		if (vp.bForceNoViewer || (viewmaster->player && viewmaster->player->crossingPortal)) return;
 		DVector3 vieworigin = viewmaster->Pos();
+		if (viewmaster == thing) vieworigin += portalshift;
 
 		//If we get here, then we want to override the location of the camera actor
 		auto vrmode = VRMode::GetVRMode(true);
@@ -885,6 +887,7 @@ void HWSprite::Process(HWDrawInfo *di, AActor* thing, sector_t * sector, area_t
 	if (viewmaster->renderflags & RF_MAYBEINVISIBLE)
 	{
 		DVector3 viewpos = viewmaster->InterpolatedPosition(vp.TicFrac);
+		if (viewmaster == thing) viewpos += portalshift;
 		if (thruportal == 1) viewpos += di->Level->Displacements.getOffset(viewmaster->Sector->PortalGroup, sector->PortalGroup);
 		if (fabs(viewpos.X - vp.CenterEyePos.X) < 32 && fabs(viewpos.Y - vp.CenterEyePos.Y) < 32) return;
 	}
@@ -925,6 +928,7 @@ void HWSprite::Process(HWDrawInfo *di, AActor* thing, sector_t * sector, area_t
 		Angles = thing->InterpolatedAngles(vp.TicFrac);
 	else
 		Angles = thing->Angles;
+	Angles.Yaw += portalangle;
 
 	if (sector->sectornum != thing->Sector->sectornum && !thruportal)
 	{
@@ -979,21 +983,21 @@ void HWSprite::Process(HWDrawInfo *di, AActor* thing, sector_t * sector, area_t
 			{
 				// choose a different rotation based on player view
 				spriteframe_t* sprframe = &SpriteFrames[tex->GetRotations()];
-				DAngle sprang = thing->GetSpriteAngle(ang, vp.TicFrac);
+				DAngle sprang = thing->GetSpriteAngle(ang, vp.TicFrac) - portalangle;
 				angle_t rot;
 				if (sprframe->Texture[0] == sprframe->Texture[1])
 				{
 					if (thing->flags7 & MF7_SPRITEANGLE)
 						rot = (thing->SpriteAngle + DAngle::fromDeg(45.0 / 2 * 9)).BAMs() >> 28;
 					else
-						rot = (sprang - (thing->Angles.Yaw + thing->SpriteRotation) + DAngle::fromDeg(45.0 / 2 * 9)).BAMs() >> 28;
+						rot = (sprang - (thing->Angles.Yaw + portalangle + thing->SpriteRotation) + DAngle::fromDeg(45.0 / 2 * 9)).BAMs() >> 28;
 				}
 				else
 				{
 					if (thing->flags7 & MF7_SPRITEANGLE)
 						rot = (thing->SpriteAngle + DAngle::fromDeg(45.0 / 2 * 9 - 180.0 / 16)).BAMs() >> 28;
 					else
-						rot = (sprang - (thing->Angles.Yaw + thing->SpriteRotation) + DAngle::fromDeg(45.0 / 2 * 9 - 180.0 / 16)).BAMs() >> 28;
+						rot = (sprang - (thing->Angles.Yaw + portalangle + thing->SpriteRotation) + DAngle::fromDeg(45.0 / 2 * 9 - 180.0 / 16)).BAMs() >> 28;
 				}
 				// @Cockatrice - This code does not look correct, I'm not 100% sure what it is supposed to do but this picnum value is ignored
 				// and the mirror value is set but the patch is just set to the thing->picnum no matter what :shrug:
@@ -1013,7 +1017,7 @@ void HWSprite::Process(HWDrawInfo *di, AActor* thing, sector_t * sector, area_t
 			int rot;
 			if (!(thing->renderflags & RF_FLATSPRITE) || thing->flags7 & MF7_SPRITEANGLE)
 			{
-				sprangle = thing->GetSpriteAngle(ang, vp.TicFrac);
+				sprangle = thing->GetSpriteAngle(ang, vp.TicFrac) - portalangle;
 				rot = -1;
 			}
 			else
@@ -1536,7 +1540,7 @@ void HWSprite::Process(HWDrawInfo *di, AActor* thing, sector_t * sector, area_t
 	{
 		lightlist = nullptr;
 	}
-	PutSprite(di, hw_styleflags != STYLEHW_Solid, vp.TicFrac);
+	PutSprite(di, hw_styleflags != STYLEHW_Solid, vp.TicFrac, portalshift);
 	rendered_sprites++;
 }
 
@@ -2080,9 +2084,8 @@ void HWDrawInfo::ProcessActorsInPortal(FLinePortalSpan *glport, area_t in_area)
 					if (check && *check) continue;
 					processcheck[th] = true;
 
-					DAngle savedangle = th->Angles.Yaw;
-					DVector3 savedpos = th->Pos();
-					DVector3 newpos = savedpos;
+					DVector3 newpos = th->Pos();
+					DAngle newangle = th->Angles.Yaw;
 					sector_t fakesector;
 
 					if (!vp.showviewer)
@@ -2117,23 +2120,21 @@ void HWDrawInfo::ProcessActorsInPortal(FLinePortalSpan *glport, area_t in_area)
 
 					P_TranslatePortalXY(line, newpos.X, newpos.Y);
 					P_TranslatePortalZ(line, newpos.Z);
-					P_TranslatePortalAngle(line, th->Angles.Yaw);
-					th->SetXYZ(newpos);
-					th->Prev += newpos - savedpos;
+					P_TranslatePortalAngle(line, newangle);
 
+					// The actor is shared with the other workers and the playsim, so it stays where it is and only the sprite is moved.
+					DVector3 portalshift = newpos - th->Pos();
+					DAngle portalangle = newangle - th->Angles.Yaw;
 					HWSprite spr;
 
 					// [Nash] draw sprite shadow
 					if (R_ShouldDrawSpriteShadow(th))
 					{
-						spr.Process(this, th, hw_FakeFlat(th->Sector, in_area, false, &fakesector), in_area, 2, true);
+						spr.Process(this, th, hw_FakeFlat(th->Sector, in_area, false, &fakesector), in_area, 2, true, portalshift, portalangle);
 					}
 
 					// This is called from the worker thread and must not alter the fake sector cache.
-					spr.Process(this, th, hw_FakeFlat(th->Sector, in_area, false, &fakesector), in_area, 2);
-					th->Angles.Yaw = savedangle;
-					th->SetXYZ(savedpos);
-					th->Prev -= newpos - savedpos;
+					spr.Process(this, th, hw_FakeFlat(th->Sector, in_area, false, &fakesector), in_area, 2, false, portalshift, portalangle);
 				}
 			}
 		}
@@ -48,7 +48,7 @@
 EXTERN_CVAR(Int, gl_max_vertices)
 
 extern int wallVerticesPerEye;
-extern int lightsWallPerEye;
+extern std::atomic<int> lightsWallPerEye;
 
 bool IsDistanceCulled(seg_t *line);
 
@@ -442,11 +442,12 @@ void HWWall::SetupLights(HWDrawInfo*di, FDynLightData &lightdata)
 	else node = NULL;
 
 	// Iterate through all dynamic lights which touch this wall and render them
-	while (node && (!gl_light_wall_max_lights || lightsWallPerEye < gl_light_wall_max_lights))
+	while (node)
 	{
 		if (node->lightsource->IsActive() && !node->lightsource->DontLightMap() && !gl_IsDistanceCulled(node->lightsource))
 		{
-			lightsWallPerEye++;
+			// Claim a slot before using the light so that other workers cannot go past the cap
+			if (lightsWallPerEye++ >= gl_light_wall_max_lights && gl_light_wall_max_lights) break;
 			iter_dlight++;
 
 			DVector3 posrel = node->lightsource->PosRelative(seg->frontsector->PortalGroup);
@@ -604,6 +605,7 @@ void HWWall::PutPortal(HWWallDispatcher *di, int ptype, int plane)
 	auto ddi = di->di;
 	if (ddi)
 	{
+		auto lock = ddi->LockShared();
 		MakeVertices(false);
 		switch (ptype)
 		{
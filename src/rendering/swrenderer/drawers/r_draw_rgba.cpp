@@ -47,6 +47,7 @@
 #include "v_palette.h"
 #include "r_data/colormaps.h"
 #include "r_draw_rgba.h"
+#include "r_draw_span32_kernels.h"
 #include "swrenderer/viewport/r_viewport.h"
 #include "swrenderer/scene/r_light.h"
 #ifdef NO_SSE
@@ -80,14 +81,26 @@ CVAR(Float, r_lod_bias, -1.5, 0); // To do: add CVAR_ARCHIVE | CVAR_GLOBALCONFIG
 
 namespace swrenderer
 {
+	// Tries the runtime selected column kernels before the generic wall drawer
+	template<typename DrawerT, bool Masked>
+	class DrawWallKernel32T
+	{
+	public:
+		static void DrawColumn(const WallColumnDrawerArgs &args)
+		{
+			if (!DrawWallKernel(args, Masked))
+				DrawerT::DrawColumn(args);
+		}
+	};
+
 	void SWTruecolorDrawers::DrawWall(const WallDrawerArgs &args)
 	{
-		DrawWallColumns<DrawWall32Command>(args);
+		DrawWallColumns<DrawWallKernel32T<DrawWall32Command, false>>(args);
 	}
 	
 	void SWTruecolorDrawers::DrawWallMasked(const WallDrawerArgs &args)
 	{
-		DrawWallColumns<DrawWallMasked32Command>(args);
+		DrawWallColumns<DrawWallKernel32T<DrawWallMasked32Command, true>>(args);
 	}
 	
 	void SWTruecolorDrawers::DrawWallAdd(const WallDrawerArgs &args)
@@ -206,12 +219,14 @@ namespace swrenderer
 
 	void SWTruecolorDrawers::DrawSpan(const SpanDrawerArgs &args)
 	{
-		DrawSpan32Command::DrawColumn(args);
+		if (!DrawSpanKernel(args, false))
+			DrawSpan32Command::DrawColumn(args);
 	}
 	
 	void SWTruecolorDrawers::DrawSpanMasked(const SpanDrawerArgs &args)
 	{
-		DrawSpanMasked32Command::DrawColumn(args);
+		if (!DrawSpanKernel(args, true))
+			DrawSpanMasked32Command::DrawColumn(args);
 	}
 	
 	void SWTruecolorDrawers::DrawSpanTranslucent(const SpanDrawerArgs &args)
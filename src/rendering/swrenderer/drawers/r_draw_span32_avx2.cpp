@@ -0,0 +1,306 @@
+/*
+**  AVX2 span and wall kernels
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+**
+*/
+
+#include "r_draw_span32_kernels.h"
+
+#ifdef SPAN_KERNELS_AVX2
+
+#include <immintrin.h>
+
+// The rest of the engine is built for SSE2, so these functions are compiled
+// for AVX2 individually and only called when CPUID reports support for it.
+#if defined(__GNUC__) && !defined(__AVX2__)
+#define AVX2_TARGET __attribute__((target("avx2")))
+#else
+#define AVX2_TARGET
+#endif
+
+namespace swrenderer
+{
+	namespace SpanAVX2
+	{
+		// Converts 8 texture coordinates to texel indices
+		AVX2_TARGET static inline __m256i TexelIndex(__m256i xfrac, __m256i yfrac, __m256i width, __m256i height)
+		{
+			__m256i x = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(xfrac, 16), width), 16);
+			__m256i y = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(yfrac, 16), height), 16);
+			return _mm256_add_epi32(_mm256_mullo_epi32(x, height), y);
+		}
+
+		// Multiplies the color channels of 8 pixels by the light level and sets alpha to opaque
+		AVX2_TARGET static inline __m256i Shade(__m256i lo, __m256i hi, __m256i mlight)
+		{
+			lo = _mm256_srli_epi16(_mm256_mullo_epi16(lo, mlight), 8);
+			hi = _mm256_srli_epi16(_mm256_mullo_epi16(hi, mlight), 8);
+			return _mm256_or_si256(_mm256_packus_epi16(lo, hi), _mm256_set1_epi32(0xff000000));
+		}
+
+		// Adds one bilinear tap to the 16-bit accumulators. The weights are 0-256
+		// and sum up to 256 so the accumulators can never overflow.
+		AVX2_TARGET static inline void AddTap(__m256i &lo, __m256i &hi, __m256i texel, __m256i weight)
+		{
+			__m256i weight16 = _mm256_or_si256(weight, _mm256_slli_epi32(weight, 16));
+			lo = _mm256_add_epi16(lo, _mm256_mullo_epi16(_mm256_unpacklo_epi8(texel, _mm256_setzero_si256()), _mm256_unpacklo_epi32(weight16, weight16)));
+			hi = _mm256_add_epi16(hi, _mm256_mullo_epi16(_mm256_unpackhi_epi8(texel, _mm256_setzero_si256()), _mm256_unpackhi_epi32(weight16, weight16)));
+		}
+
+		template<bool Masked>
+		AVX2_TARGET static void DrawNearest(const SpanKernelArgs &args)
+		{
+			const int *source = (const int*)args.source;
+			uint32_t *dest = args.dest;
+
+			__m256i width = _mm256_set1_epi32(args.width);
+			__m256i height = _mm256_set1_epi32(args.height);
+			__m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+			__m256i xfrac = _mm256_add_epi32(_mm256_set1_epi32(args.xfrac), _mm256_mullo_epi32(_mm256_set1_epi32(args.xstep), lanes));
+			__m256i yfrac = _mm256_add_epi32(_mm256_set1_epi32(args.yfrac), _mm256_mullo_epi32(_mm256_set1_epi32(args.ystep), lanes));
+			__m256i xstep = _mm256_set1_epi32(args.xstep * 8);
+			__m256i ystep = _mm256_set1_epi32(args.ystep * 8);
+			__m256i mlight = _mm256_set1_epi64x(((int64_t)256 << 48) | ((int64_t)args.light << 32) | (args.light << 16) | args.light);
+
+			int count = args.count;
+			int index = 0;
+			for (; index + 8 <= count; index += 8)
+			{
+				__m256i texel = _mm256_i32gather_epi32(source, TexelIndex(xfrac, yfrac, width, height), 4);
+				__m256i outcolor = Shade(_mm256_unpacklo_epi8(texel, _mm256_setzero_si256()), _mm256_unpackhi_epi8(texel, _mm256_setzero_si256()), mlight);
+				if (Masked)
+				{
+					__m256i bgcolor = _mm256_loadu_si256((const __m256i*)(dest + index));
+					outcolor = _mm256_blendv_epi8(outcolor, bgcolor, _mm256_cmpeq_epi32(texel, _mm256_setzero_si256()));
+				}
+				_mm256_storeu_si256((__m256i*)(dest + index), outcolor);
+
+				xfrac = _mm256_add_epi32(xfrac, xstep);
+				yfrac = _mm256_add_epi32(yfrac, ystep);
+			}
+
+			if (index < count)
+			{
+				SpanKernelArgs tail = args;
+				tail.dest += index;
+				tail.count -= index;
+				tail.xfrac += args.xstep * index;
+				tail.yfrac += args.ystep * index;
+				DrawSpanNearestScalar(tail, Masked);
+			}
+		}
+
+		template<bool Masked>
+		AVX2_TARGET static void DrawLinear(const SpanKernelArgs &args)
+		{
+			const int *source = (const int*)args.source;
+			uint32_t *dest = args.dest;
+
+			__m256i width = _mm256_set1_epi32(args.width);
+			__m256i height = _mm256_set1_epi32(args.height);
+			__m256i xone = _mm256_set1_epi32(args.xone);
+			__m256i yone = _mm256_set1_epi32(args.yone);
+			__m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+			__m256i xfrac = _mm256_add_epi32(_mm256_set1_epi32(args.xfrac), _mm256_mullo_epi32(_mm256_set1_epi32(args.xstep), lanes));
+			__m256i yfrac = _mm256_add_epi32(_mm256_set1_epi32(args.yfrac), _mm256_mullo_epi32(_mm256_set1_epi32(args.ystep), lanes));
+			__m256i xstep = _mm256_set1_epi32(args.xstep * 8);
+			__m256i ystep = _mm256_set1_epi32(args.ystep * 8);
+			__m256i mlight = _mm256_set1_epi64x(((int64_t)256 << 48) | ((int64_t)args.light << 32) | (args.light << 16) | args.light);
+			__m256i m15 = _mm256_set1_epi32(15);
+			__m256i m16 = _mm256_set1_epi32(16);
+			__m256i round = _mm256_set1_epi16(127);
+
+			int count = args.count;
+			int index = 0;
+			for (; index + 8 <= count; index += 8)
+			{
+				__m256i frac_x = _mm256_mullo_epi32(_mm256_srli_epi32(xfrac, 16), width);
+				__m256i frac_y = _mm256_mullo_epi32(_mm256_srli_epi32(yfrac, 16), height);
+				__m256i x0 = _mm256_mullo_epi32(_mm256_srli_epi32(frac_x, 16), height);
+				__m256i y0 = _mm256_srli_epi32(frac_y, 16);
+				__m256i x1 = _mm256_mullo_epi32(_mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(_mm256_add_epi32(xfrac, xone), 16), width), 16), height);
+				__m256i y1 = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(_mm256_add_epi32(yfrac, yone), 16), height), 16);
+
+				__m256i p00 = _mm256_i32gather_epi32(source, _mm256_add_epi32(x0, y0), 4);
+				__m256i p01 = _mm256_i32gather_epi32(source, _mm256_add_epi32(x0, y1), 4);
+				__m256i p10 = _mm256_i32gather_epi32(source, _mm256_add_epi32(x1, y0), 4);
+				__m256i p11 = _mm256_i32gather_epi32(source, _mm256_add_epi32(x1, y1), 4);
+
+				__m256i inv_b = _mm256_and_si256(_mm256_srli_epi32(frac_x, 12), m15);
+				__m256i inv_a = _mm256_and_si256(_mm256_srli_epi32(frac_y, 12), m15);
+				__m256i a = _mm256_sub_epi32(m16, inv_a);
+				__m256i b = _mm256_sub_epi32(m16, inv_b);
+
+				__m256i lo = round, hi = round;
+				AddTap(lo, hi, p00, _mm256_mullo_epi16(a, b));
+				AddTap(lo, hi, p01, _mm256_mullo_epi16(inv_a, b));
+				AddTap(lo, hi, p10, _mm256_mullo_epi16(a, inv_b));
+				AddTap(lo, hi, p11, _mm256_mullo_epi16(inv_a, inv_b));
+				lo = _mm256_srli_epi16(lo, 8);
+				hi = _mm256_srli_epi16(hi, 8);
+
+				__m256i outcolor = Shade(lo, hi, mlight);
+				if (Masked)
+				{
+					__m256i texel = _mm256_packus_epi16(lo, hi);
+					__m256i bgcolor = _mm256_loadu_si256((const __m256i*)(dest + index));
+					outcolor = _mm256_blendv_epi8(outcolor, bgcolor, _mm256_cmpeq_epi32(texel, _mm256_setzero_si256()));
+				}
+				_mm256_storeu_si256((__m256i*)(dest + index), outcolor);
+
+				xfrac = _mm256_add_epi32(xfrac, xstep);
+				yfrac = _mm256_add_epi32(yfrac, ystep);
+			}
+
+			if (index < count)
+			{
+				SpanKernelArgs tail = args;
+				tail.dest += index;
+				tail.count -= index;
+				tail.xfrac += args.xstep * index;
+				tail.yfrac += args.ystep * index;
+				DrawSpanLinearScalar(tail, Masked);
+			}
+		}
+
+		// The rows of a wall column are a pitch apart and AVX2 has no scatter, so the 8 pixels are stored one by one.
+		template<bool Masked>
+		AVX2_TARGET static inline void StoreColumn(uint32_t *dest, int pitch, __m256i outcolor, __m256i texel)
+		{
+			alignas(32) uint32_t colors[8];
+			_mm256_store_si256((__m256i*)colors, outcolor);
+			int transparent = Masked ? _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(texel, _mm256_setzero_si256()))) : 0;
+			for (int i = 0; i < 8; i++)
+			{
+				if (!(transparent & (1 << i)))
+					dest[i * pitch] = colors[i];
+			}
+		}
+
+		template<bool Masked>
+		AVX2_TARGET static void DrawWallNearest(const WallKernelArgs &args)
+		{
+			const int *source = (const int*)args.source;
+			uint32_t *dest = args.dest;
+			int pitch = args.pitch;
+
+			__m256i height = _mm256_set1_epi32(args.height);
+			__m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+			__m256i frac = _mm256_add_epi32(_mm256_set1_epi32(args.frac), _mm256_mullo_epi32(_mm256_set1_epi32(args.fracstep), lanes));
+			__m256i fracstep = _mm256_set1_epi32(args.fracstep * 8);
+			__m256i mlight = _mm256_set1_epi64x(((int64_t)256 << 48) | ((int64_t)args.light << 32) | (args.light << 16) | args.light);
+
+			int count = args.count;
+			int index = 0;
+			for (; index + 8 <= count; index += 8)
+			{
+				__m256i y = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(frac, 16), height), 16);
+				__m256i texel = _mm256_i32gather_epi32(source, y, 4);
+				__m256i outcolor = Shade(_mm256_unpacklo_epi8(texel, _mm256_setzero_si256()), _mm256_unpackhi_epi8(texel, _mm256_setzero_si256()), mlight);
+				StoreColumn<Masked>(dest, pitch, outcolor, texel);
+				dest += pitch * 8;
+
+				frac = _mm256_add_epi32(frac, fracstep);
+			}
+
+			if (index < count)
+			{
+				WallKernelArgs tail = args;
+				tail.dest = dest;
+				tail.count -= index;
+				tail.frac += args.fracstep * index;
+				DrawWallNearestScalar(tail, Masked);
+			}
+		}
+
+		template<bool Masked>
+		AVX2_TARGET static void DrawWallLinear(const WallKernelArgs &args)
+		{
+			const int *source = (const int*)args.source;
+			const int *source2 = (const int*)args.source2;
+			uint32_t *dest = args.dest;
+			int pitch = args.pitch;
+
+			__m256i height = _mm256_set1_epi32(args.height);
+			__m256i one = _mm256_set1_epi32(args.one);
+			__m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+			__m256i frac = _mm256_add_epi32(_mm256_set1_epi32(args.frac), _mm256_mullo_epi32(_mm256_set1_epi32(args.fracstep), lanes));
+			__m256i fracstep = _mm256_set1_epi32(args.fracstep * 8);
+			__m256i mlight = _mm256_set1_epi64x(((int64_t)256 << 48) | ((int64_t)args.light << 32) | (args.light << 16) | args.light);
+			__m256i inv_b = _mm256_set1_epi32(args.texturefracx);
+			__m256i b = _mm256_set1_epi32(16 - args.texturefracx);
+			__m256i m15 = _mm256_set1_epi32(15);
+			__m256i m16 = _mm256_set1_epi32(16);
+			__m256i round = _mm256_set1_epi16(127);
+
+			int count = args.count;
+			int index = 0;
+			for (; index + 8 <= count; index += 8)
+			{
+				__m256i frac_y1 = _mm256_mullo_epi32(_mm256_srli_epi32(_mm256_add_epi32(frac, one), 16), height);
+				__m256i y0 = _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_srli_epi32(frac, 16), height), 16);
+				__m256i y1 = _mm256_srli_epi32(frac_y1, 16);
+
+				__m256i p00 = _mm256_i32gather_epi32(source, y0, 4);
+				__m256i p01 = _mm256_i32gather_epi32(source, y1, 4);
+				__m256i p10 = _mm256_i32gather_epi32(source2, y0, 4);
+				__m256i p11 = _mm256_i32gather_epi32(source2, y1, 4);
+
+				__m256i inv_a = _mm256_and_si256(_mm256_srli_epi32(frac_y1, 12), m15);
+				__m256i a = _mm256_sub_epi32(m16, inv_a);
+
+				__m256i lo = round, hi = round;
+				AddTap(lo, hi, p00, _mm256_mullo_epi16(a, b));
+				AddTap(lo, hi, p01, _mm256_mullo_epi16(inv_a, b));
+				AddTap(lo, hi, p10, _mm256_mullo_epi16(a, inv_b));
+				AddTap(lo, hi, p11, _mm256_mullo_epi16(inv_a, inv_b));
+				lo = _mm256_srli_epi16(lo, 8);
+				hi = _mm256_srli_epi16(hi, 8);
+
+				StoreColumn<Masked>(dest, pitch, Shade(lo, hi, mlight), _mm256_packus_epi16(lo, hi));
+				dest += pitch * 8;
+
+				frac = _mm256_add_epi32(frac, fracstep);
+			}
+
+			if (index < count)
+			{
+				WallKernelArgs tail = args;
+				tail.dest = dest;
+				tail.count -= index;
+				tail.frac += args.fracstep * index;
+				DrawWallLinearScalar(tail, Masked);
+			}
+		}
+	}
+
+	const SpanKernelSet SpanKernelsAVX2 =
+	{
+		"AVX2",
+		{
+			{ SpanAVX2::DrawNearest<false>, SpanAVX2::DrawNearest<true> },
+			{ SpanAVX2::DrawLinear<false>, SpanAVX2::DrawLinear<true> }
+		},
+		{
+			{ SpanAVX2::DrawWallNearest<false>, SpanAVX2::DrawWallNearest<true> },
+			{ SpanAVX2::DrawWallLinear<false>, SpanAVX2::DrawWallLinear<true> }
+		}
+	};
+}
+
+#endif
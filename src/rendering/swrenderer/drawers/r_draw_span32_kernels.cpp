@@ -0,0 +1,710 @@
+/*
+**  Runtime selected span and wall kernels
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+**
+*/
+
+#include <stdlib.h>
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "r_draw_span32_kernels.h"
+#include "r_draw_rgba.h"
+#include "swrenderer/viewport/r_viewport.h"
+#ifdef NO_SSE
+#include "r_draw_wall32.h"
+#include "r_draw_span32.h"
+#else
+#include "r_draw_wall32_sse2.h"
+#include "r_draw_span32_sse2.h"
+#endif
+#include "doomstat.h"
+#include "c_cvars.h"
+#include "c_dispatch.h"
+#include "i_time.h"
+#include "printf.h"
+#include "x86.h"
+
+#ifdef SPAN_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+// Span and wall kernel selection:
+// 0 = best for this CPU, 1 = generic drawers only, 2 = scalar, 3 = AVX2, 4 = NEON
+CVAR(Int, r_spankernels, 0, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
+
+EXTERN_CVAR(Bool, r_magfilter)
+EXTERN_CVAR(Bool, r_minfilter)
+
+namespace swrenderer
+{
+	//==========================================================================
+	//
+	// Scalar kernels
+	//
+	//==========================================================================
+
+	static inline uint32_t SampleNearest(const SpanKernelArgs &args, uint32_t xfrac, uint32_t yfrac)
+	{
+		uint32_t x = ((xfrac >> 16) * args.width) >> 16;
+		uint32_t y = ((yfrac >> 16) * args.height) >> 16;
+		return args.source[x * args.height + y];
+	}
+
+	static inline uint32_t Bilinear(uint32_t p00, uint32_t p01, uint32_t p10, uint32_t p11, uint32_t inv_a, uint32_t inv_b)
+	{
+		uint32_t a = 16 - inv_a;
+		uint32_t b = 16 - inv_b;
+
+		uint32_t result = 0;
+		for (int shift = 0; shift < 32; shift += 8)
+		{
+			uint32_t c = ((p00 >> shift) & 0xff) * (a * b) + ((p01 >> shift) & 0xff) * (inv_a * b) + ((p10 >> shift) & 0xff) * (a * inv_b) + ((p11 >> shift) & 0xff) * (inv_a * inv_b);
+			result |= ((c + 127) >> 8) << shift;
+		}
+		return result;
+	}
+
+	static inline uint32_t SampleLinear(const SpanKernelArgs &args, uint32_t xfrac, uint32_t yfrac)
+	{
+		uint32_t frac_x = (xfrac >> 16) * args.width;
+		uint32_t frac_y = (yfrac >> 16) * args.height;
+		uint32_t x0 = frac_x >> 16;
+		uint32_t y0 = frac_y >> 16;
+		uint32_t x1 = (((xfrac + args.xone) >> 16) * args.width) >> 16;
+		uint32_t y1 = (((yfrac + args.yone) >> 16) * args.height) >> 16;
+		uint32_t p00 = args.source[y0 + x0 * args.height];
+		uint32_t p01 = args.source[y1 + x0 * args.height];
+		uint32_t p10 = args.source[y0 + x1 * args.height];
+		uint32_t p11 = args.source[y1 + x1 * args.height];
+		return Bilinear(p00, p01, p10, p11, (frac_y >> 12) & 15, (frac_x >> 12) & 15);
+	}
+
+	// Same sampling as DrawWall32T::Sample
+	static inline uint32_t SampleWallNearest(const WallKernelArgs &args, uint32_t frac)
+	{
+		return args.source[((frac >> 16) * args.height) >> 16];
+	}
+
+	static inline uint32_t SampleWallLinear(const WallKernelArgs &args, uint32_t frac)
+	{
+		uint32_t frac_y0 = (frac >> 16) * args.height;
+		uint32_t frac_y1 = ((frac + args.one) >> 16) * args.height;
+		uint32_t y0 = frac_y0 >> 16;
+		uint32_t y1 = frac_y1 >> 16;
+		return Bilinear(args.source[y0], args.source[y1], args.source2[y0], args.source2[y1], (frac_y1 >> 12) & 15, args.texturefracx);
+	}
+
+	static inline uint32_t ShadePixel(uint32_t texel, uint32_t light)
+	{
+		uint32_t red = (RPART(texel) * light) >> 8;
+		uint32_t green = (GPART(texel) * light) >> 8;
+		uint32_t blue = (BPART(texel) * light) >> 8;
+		return 0xff000000 | (red << 16) | (green << 8) | blue;
+	}
+
+	void DrawSpanNearestScalar(const SpanKernelArgs &args, bool masked)
+	{
+		uint32_t xfrac = args.xfrac;
+		uint32_t yfrac = args.yfrac;
+		for (int index = 0; index < args.count; index++)
+		{
+			uint32_t texel = SampleNearest(args, xfrac, yfrac);
+			if (!masked || texel != 0)
+				args.dest[index] = ShadePixel(texel, args.light);
+			xfrac += args.xstep;
+			yfrac += args.ystep;
+		}
+	}
+
+	void DrawSpanLinearScalar(const SpanKernelArgs &args, bool masked)
+	{
+		uint32_t xfrac = args.xfrac;
+		uint32_t yfrac = args.yfrac;
+		for (int index = 0; index < args.count; index++)
+		{
+			uint32_t texel = SampleLinear(args, xfrac, yfrac);
+			if (!masked || texel != 0)
+				args.dest[index] = ShadePixel(texel, args.light);
+			xfrac += args.xstep;
+			yfrac += args.ystep;
+		}
+	}
+
+	void DrawWallNearestScalar(const WallKernelArgs &args, bool masked)
+	{
+		uint32_t *dest = args.dest;
+		uint32_t frac = args.frac;
+		for (int index = 0; index < args.count; index++)
+		{
+			uint32_t texel = SampleWallNearest(args, frac);
+			if (!masked || texel != 0)
+				*dest = ShadePixel(texel, args.light);
+			dest += args.pitch;
+			frac += args.fracstep;
+		}
+	}
+
+	void DrawWallLinearScalar(const WallKernelArgs &args, bool masked)
+	{
+		uint32_t *dest = args.dest;
+		uint32_t frac = args.frac;
+		for (int index = 0; index < args.count; index++)
+		{
+			uint32_t texel = SampleWallLinear(args, frac);
+			if (!masked || texel != 0)
+				*dest = ShadePixel(texel, args.light);
+			dest += args.pitch;
+			frac += args.fracstep;
+		}
+	}
+
+	template<bool Masked> static void NearestScalar(const SpanKernelArgs &args) { DrawSpanNearestScalar(args, Masked); }
+	template<bool Masked> static void LinearScalar(const SpanKernelArgs &args) { DrawSpanLinearScalar(args, Masked); }
+	template<bool Masked> static void WallNearestScalar(const WallKernelArgs &args) { DrawWallNearestScalar(args, Masked); }
+	template<bool Masked> static void WallLinearScalar(const WallKernelArgs &args) { DrawWallLinearScalar(args, Masked); }
+
+	const SpanKernelSet SpanKernelsScalar =
+	{
+		"Scalar",
+		{
+			{ NearestScalar<false>, NearestScalar<true> },
+			{ LinearScalar<false>, LinearScalar<true> }
+		},
+		{
+			{ WallNearestScalar<false>, WallNearestScalar<true> },
+			{ WallLinearScalar<false>, WallLinearScalar<true> }
+		}
+	};
+
+	//==========================================================================
+	//
+	// NEON kernels for ARM builds. NEON has no gather, but the coordinate
+	// math, filtering and shading for four pixels all stay in vectors.
+	//
+	//==========================================================================
+
+#ifdef SPAN_KERNELS_NEON
+	static inline uint32x4_t GatherNEON(const uint32_t *source, uint32x4_t index)
+	{
+		uint32x4_t texel = vdupq_n_u32(0);
+		texel = vsetq_lane_u32(source[vgetq_lane_u32(index, 0)], texel, 0);
+		texel = vsetq_lane_u32(source[vgetq_lane_u32(index, 1)], texel, 1);
+		texel = vsetq_lane_u32(source[vgetq_lane_u32(index, 2)], texel, 2);
+		texel = vsetq_lane_u32(source[vgetq_lane_u32(index, 3)], texel, 3);
+		return texel;
+	}
+
+	static inline uint32x4_t ShadeNEON(uint16x8_t lo, uint16x8_t hi, uint16x8_t mlight)
+	{
+		lo = vshrq_n_u16(vmulq_u16(lo, mlight), 8);
+		hi = vshrq_n_u16(vmulq_u16(hi, mlight), 8);
+		uint32x4_t outcolor = vreinterpretq_u32_u8(vcombine_u8(vqmovn_u16(lo), vqmovn_u16(hi)));
+		return vorrq_u32(outcolor, vdupq_n_u32(0xff000000));
+	}
+
+	static inline void AddTapNEON(uint16x8_t &lo, uint16x8_t &hi, uint32x4_t texel, uint32x4_t weight)
+	{
+		uint32x4_t weight16 = vorrq_u32(weight, vshlq_n_u32(weight, 16));
+		uint32x4x2_t weights = vzipq_u32(weight16, weight16);
+		uint8x16_t texel8 = vreinterpretq_u8_u32(texel);
+		lo = vmlaq_u16(lo, vmovl_u8(vget_low_u8(texel8)), vreinterpretq_u16_u32(weights.val[0]));
+		hi = vmlaq_u16(hi, vmovl_u8(vget_high_u8(texel8)), vreinterpretq_u16_u32(weights.val[1]));
+	}
+
+	template<bool Linear, bool Masked>
+	static void DrawNEON(const SpanKernelArgs &args)
+	{
+		static const uint32_t lanedata[4] = { 0, 1, 2, 3 };
+		static const uint16_t alphadata[8] = { 0, 0, 0, 256, 0, 0, 0, 256 };
+
+		uint32_t *dest = args.dest;
+		uint32x4_t lanes = vld1q_u32(lanedata);
+		uint32x4_t xfrac = vmlaq_n_u32(vdupq_n_u32(args.xfrac), lanes, args.xstep);
+		uint32x4_t yfrac = vmlaq_n_u32(vdupq_n_u32(args.yfrac), lanes, args.ystep);
+		uint32x4_t xstep = vdupq_n_u32(args.xstep * 4);
+		uint32x4_t ystep = vdupq_n_u32(args.ystep * 4);
+		uint32x4_t m15 = vdupq_n_u32(15);
+		uint32x4_t m16 = vdupq_n_u32(16);
+		uint16x8_t mlight = vmaxq_u16(vdupq_n_u16((uint16_t)args.light), vld1q_u16(alphadata));
+
+		int count = args.count;
+		int index = 0;
+		for (; index + 4 <= count; index += 4)
+		{
+			uint32x4_t texel;
+			uint16x8_t lo, hi;
+			if (!Linear)
+			{
+				uint32x4_t x = vshrq_n_u32(vmulq_n_u32(vshrq_n_u32(xfrac, 16), args.width), 16);
+				uint32x4_t y = vshrq_n_u32(vmulq_n_u32(vshrq_n_u32(yfrac, 16), args.height), 16);
+				texel = GatherNEON(args.source, vmlaq_n_u32(y, x, args.height));
+				uint8x16_t texel8 = vreinterpretq_u8_u32(texel);
+				lo = vmovl_u8(vget_low_u8(texel8));
+				hi = vmovl_u8(vget_high_u8(texel8));
+			}
+			else
+			{
+				uint32x4_t frac_x = vmulq_n_u32(vshrq_n_u32(xfrac, 16), args.width);
+				uint32x4_t frac_y = vmulq_n_u32(vshrq_n_u32(yfrac, 16), args.height);
+				uint32x4_t x0 = vmulq_n_u32(vshrq_n_u32(frac_x, 16), args.height);
+				uint32x4_t y0 = vshrq_n_u32(frac_y, 16);
+				uint32x4_t x1 = vmulq_n_u32(vshrq_n_u32(vmulq_n_u32(vshrq_n_u32(vaddq_u32(xfrac, vdupq_n_u32(args.xone)), 16), args.width), 16), args.height);
+				uint32x4_t y1 = vshrq_n_u32(vmulq_n_u32(vshrq_n_u32(vaddq_u32(yfrac, vdupq_n_u32(args.yone)), 16), args.height), 16);
+
+				uint32x4_t inv_b = vandq_u32(vshrq_n_u32(frac_x, 12), m15);
+				uint32x4_t inv_a = vandq_u32(vshrq_n_u32(frac_y, 12), m15);
+				uint32x4_t a = vsubq_u32(m16, inv_a);
+				uint32x4_t b = vsubq_u32(m16, inv_b);
+
+				lo = vdupq_n_u16(127);
+				hi = vdupq_n_u16(127);
+				AddTapNEON(lo, hi, GatherNEON(args.source, vaddq_u32(x0, y0)), vmulq_u32(a, b));
+				AddTapNEON(lo, hi, GatherNEON(args.source, vaddq_u32(x0, y1)), vmulq_u32(inv_a, b));
+				AddTapNEON(lo, hi, GatherNEON(args.source, vaddq_u32(x1, y0)), vmulq_u32(a, inv_b));
+				AddTapNEON(lo, hi, GatherNEON(args.source, vaddq_u32(x1, y1)), vmulq_u32(inv_a, inv_b));
+				lo = vshrq_n_u16(lo, 8);
+				hi = vshrq_n_u16(hi, 8);
+				texel = vreinterpretq_u32_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+			}
+
+			uint32x4_t outcolor = ShadeNEON(lo, hi, mlight);
+			if (Masked)
+			{
+				uint32x4_t bgcolor = vld1q_u32(dest + index);
+				outcolor = vbslq_u32(vceqq_u32(texel, vdupq_n_u32(0)), bgcolor, outcolor);
+			}
+			vst1q_u32(dest + index, outcolor);
+
+			xfrac = vaddq_u32(xfrac, xstep);
+			yfrac = vaddq_u32(yfrac, ystep);
+		}
+
+		if (index < count)
+		{
+			SpanKernelArgs tail = args;
+			tail.dest += index;
+			tail.count -= index;
+			tail.xfrac += args.xstep * index;
+			tail.yfrac += args.ystep * index;
+			if (Linear)
+				DrawSpanLinearScalar(tail, Masked);
+			else
+				DrawSpanNearestScalar(tail, Masked);
+		}
+	}
+
+	template<bool Linear, bool Masked>
+	static void DrawWallNEON(const WallKernelArgs &args)
+	{
+		static const uint32_t lanedata[4] = { 0, 1, 2, 3 };
+		static const uint16_t alphadata[8] = { 0, 0, 0, 256, 0, 0, 0, 256 };
+
+		uint32_t *dest = args.dest;
+		int pitch = args.pitch;
+		uint32x4_t frac = vmlaq_n_u32(vdupq_n_u32(args.frac), vld1q_u32(lanedata), args.fracstep);
+		uint32x4_t fracstep = vdupq_n_u32(args.fracstep * 4);
+		uint32x4_t inv_b = vdupq_n_u32(args.texturefracx);
+		uint32x4_t b = vdupq_n_u32(16 - args.texturefracx);
+		uint32x4_t m15 = vdupq_n_u32(15);
+		uint32x4_t m16 = vdupq_n_u32(16);
+		uint16x8_t mlight = vmaxq_u16(vdupq_n_u16((uint16_t)args.light), vld1q_u16(alphadata));
+
+		int count = args.count;
+		int index = 0;
+		for (; index + 4 <= count; index += 4)
+		{
+			uint32x4_t texel;
+			uint16x8_t lo, hi;
+			if (!Linear)
+			{
+				uint32x4_t y = vshrq_n_u32(vmulq_n_u32(vshrq_n_u32(frac, 16), args.height), 16);
+				texel = GatherNEON(args.source, y);
+				uint8x16_t texel8 = vreinterpretq_u8_u32(texel);
+				lo = vmovl_u8(vget_low_u8(texel8));
+				hi = vmovl_u8(vget_high_u8(texel8));
+			}
+			else
+			{
+				uint32x4_t frac_y1 = vmulq_n_u32(vshrq_n_u32(vaddq_u32(frac, vdupq_n_u32(args.one)), 16), args.height);
+				uint32x4_t y0 = vshrq_n_u32(vmulq_n_u32(vshrq_n_u32(frac, 16), args.height), 16);
+				uint32x4_t y1 = vshrq_n_u32(frac_y1, 16);
+
+				uint32x4_t inv_a = vandq_u32(vshrq_n_u32(frac_y1, 12), m15);
+				uint32x4_t a = vsubq_u32(m16, inv_a);
+
+				lo = vdupq_n_u16(127);
+				hi = vdupq_n_u16(127);
+				AddTapNEON(lo, hi, GatherNEON(args.source, y0), vmulq_u32(a, b));
+				AddTapNEON(lo, hi, GatherNEON(args.source, y1), vmulq_u32(inv_a, b));
+				AddTapNEON(lo, hi, GatherNEON(args.source2, y0), vmulq_u32(a, inv_b));
+				AddTapNEON(lo, hi, GatherNEON(args.source2, y1), vmulq_u32(inv_a, inv_b));
+				lo = vshrq_n_u16(lo, 8);
+				hi = vshrq_n_u16(hi, 8);
+				texel = vreinterpretq_u32_u8(vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+			}
+
+			uint32_t colors[4], texels[4];
+			vst1q_u32(colors, ShadeNEON(lo, hi, mlight));
+			vst1q_u32(texels, texel);
+			for (int i = 0; i < 4; i++)
+			{
+				if (!Masked || texels[i] != 0)
+					dest[i * pitch] = colors[i];
+			}
+			dest += pitch * 4;
+
+			frac = vaddq_u32(frac, fracstep);
+		}
+
+		if (index < count)
+		{
+			WallKernelArgs tail = args;
+			tail.dest = dest;
+			tail.count -= index;
+			tail.frac += args.fracstep * index;
+			if (Linear)
+				DrawWallLinearScalar(tail, Masked);
+			else
+				DrawWallNearestScalar(tail, Masked);
+		}
+	}
+
+	const SpanKernelSet SpanKernelsNEON =
+	{
+		"NEON",
+		{
+			{ DrawNEON<false, false>, DrawNEON<false, true> },
+			{ DrawNEON<true, false>, DrawNEON<true, true> }
+		},
+		{
+			{ DrawWallNEON<false, false>, DrawWallNEON<false, true> },
+			{ DrawWallNEON<true, false>, DrawWallNEON<true, true> }
+		}
+	};
+#endif
+
+	//==========================================================================
+	//
+	// Kernel selection
+	//
+	//==========================================================================
+
+	static const SpanKernelSet *GetBestSpanKernels()
+	{
+#ifdef SPAN_KERNELS_AVX2
+		if (CPU.bAVX2)
+			return &SpanKernelsAVX2;
+#endif
+#ifdef SPAN_KERNELS_NEON
+		return &SpanKernelsNEON;
+#endif
+		// Without AVX2 or NEON the generic SSE2 drawers are as fast as anything here.
+		return nullptr;
+	}
+
+	static const SpanKernelSet *GetSpanKernels()
+	{
+		switch (r_spankernels)
+		{
+		case 1: return nullptr;
+		case 2: return &SpanKernelsScalar;
+#ifdef SPAN_KERNELS_AVX2
+		case 3: if (CPU.bAVX2) return &SpanKernelsAVX2; break;
+#endif
+#ifdef SPAN_KERNELS_NEON
+		case 4: return &SpanKernelsNEON;
+#endif
+		default: break;
+		}
+		return GetBestSpanKernels();
+	}
+
+	// Same texture setup as DrawSpan32T::DrawColumn. Returns whether the span is filtered.
+	static bool GetSpanKernelArgs(const SpanDrawerArgs &args, SpanKernelArgs &kargs)
+	{
+		kargs.width = args.TextureWidth();
+		kargs.height = args.TextureHeight();
+		kargs.xstep = args.TextureUStep();
+		kargs.ystep = args.TextureVStep();
+		kargs.xfrac = args.TextureUPos();
+		kargs.yfrac = args.TextureVPos();
+		kargs.source = (const uint32_t*)args.TexturePixels();
+
+		double lod = args.TextureLOD();
+		bool magnifying = lod < 0.0;
+		if (r_mipmap && args.MipmappedTexture())
+		{
+			int level = (int)lod;
+			while (level > 0)
+			{
+				if (kargs.width <= 2 || kargs.height <= 2)
+					break;
+
+				kargs.source += kargs.width * kargs.height;
+				kargs.width = max<uint32_t>(kargs.width / 2, 1);
+				kargs.height = max<uint32_t>(kargs.height / 2, 1);
+				level--;
+			}
+		}
+
+		kargs.xone = (0x80000000u / kargs.width) << 1;
+		kargs.yone = (0x80000000u / kargs.height) << 1;
+
+		bool is_nearest_filter = (magnifying && !r_magfilter) || (!magnifying && !r_minfilter);
+		if (!is_nearest_filter)
+		{
+			kargs.xfrac -= kargs.xone / 2;
+			kargs.yfrac -= kargs.yone / 2;
+		}
+
+		kargs.light = 256 - (args.Light() >> (FRACBITS - 8));
+		kargs.count = args.DestX2() - args.DestX1() + 1;
+		kargs.dest = (uint32_t*)args.Viewport()->GetDest(args.DestX1(), args.DestY());
+		return !is_nearest_filter;
+	}
+
+	// Same texture setup as DrawWall32T::Loop. Returns whether the column is filtered.
+	static bool GetWallKernelArgs(const WallColumnDrawerArgs &args, WallKernelArgs &kargs)
+	{
+		kargs.count = args.Count();
+		kargs.source = (const uint32_t*)args.TexturePixels();
+		kargs.source2 = (const uint32_t*)args.TexturePixels2();
+		kargs.height = args.TextureHeight();
+		kargs.one = ((0x80000000 + kargs.height - 1) / kargs.height) * 2 + 1;
+		kargs.frac = args.TextureVPos();
+		kargs.fracstep = args.TextureVStep();
+		kargs.texturefracx = args.TextureUPos();
+
+		bool is_nearest_filter = (kargs.source2 == nullptr);
+		if (!is_nearest_filter)
+			kargs.frac -= kargs.one / 2;
+
+		kargs.light = 256 - (args.Light() >> (FRACBITS - 8));
+		kargs.pitch = args.Viewport()->RenderTarget->GetPitch();
+		kargs.dest = (uint32_t*)args.Dest();
+		return !is_nearest_filter;
+	}
+
+	bool DrawSpanKernel(const SpanDrawerArgs &args, bool masked)
+	{
+		const SpanKernelSet *kernels = GetSpanKernels();
+		if (kernels == nullptr || args.dc_num_lights != 0 || !args.ColormapConstants().simple_shade)
+			return false;
+
+		SpanKernelArgs kargs;
+		bool linear = GetSpanKernelArgs(args, kargs);
+		kernels->Kernels[linear][masked](kargs);
+		return true;
+	}
+
+	bool DrawWallKernel(const WallColumnDrawerArgs &args, bool masked)
+	{
+		const SpanKernelSet *kernels = GetSpanKernels();
+		if (kernels == nullptr || args.dc_num_lights != 0 || !args.ColormapConstants().simple_shade)
+			return false;
+
+		if (args.Count() <= 0)
+			return true;
+
+		WallKernelArgs kargs;
+		bool linear = GetWallKernelArgs(args, kargs);
+		kernels->Walls[linear][masked](kargs);
+		return true;
+	}
+}
+
+//==========================================================================
+//
+// Times the DrawSpan32T and DrawWall32T templates and every kernel set this
+// CPU supports on a fixed span and wall column. The kernels get the same
+// drawer args as the templates and their output is checked against them.
+//
+//==========================================================================
+
+CCMD(bench_spankernels)
+{
+	using namespace swrenderer;
+
+	int iterations = argv.argc() > 1 ? max(atoi(argv[1]), 1) : 2000;
+
+	const int texsize = 256;
+	const int count = 1920;
+	const int wallcount = 1080;
+	const uint32_t background = 0xff808080;
+	std::vector<uint32_t> texture(texsize * texsize), reference(max(count, wallcount));
+
+	// Fixed pseudo random texture. Every seventh texel is transparent for the masked kernels.
+	uint32_t seed = 0x2545F491;
+	for (size_t i = 0; i < texture.size(); i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		texture[i] = (i % 7 == 0) ? 0 : (seed | 0xff000000);
+	}
+
+	TArray<const SpanKernelSet *> sets;
+	sets.Push(&SpanKernelsScalar);
+#ifdef SPAN_KERNELS_AVX2
+	if (CPU.bAVX2) sets.Push(&SpanKernelsAVX2);
+#endif
+#ifdef SPAN_KERNELS_NEON
+	sets.Push(&SpanKernelsNEON);
+#endif
+
+	// The drawers write through a viewport, so they get a canvas of their own.
+	// The span goes into the top row and the wall column down the left side.
+	DCanvas canvas(viewwindowx + count, viewwindowy + wallcount, true);
+	auto viewport = std::make_unique<RenderViewport>();
+	viewport->RenderTarget = &canvas;
+	uint32_t *pixels = (uint32_t*)viewport->GetDest(0, 0);
+	int pitch = canvas.GetPitch();
+
+	static const char *filternames[2] = { "nearest", "linear" };
+	static const char *blendnames[2] = { "opaque", "masked" };
+
+	auto report = [&](int linear, int masked, const char *name, uint64_t elapsed, int pixelcount, int mismatches)
+	{
+		Printf("  %-7s %-6s %-11s %7.3f ns/pixel%s\n", filternames[linear], blendnames[masked], name,
+			elapsed / (double)iterations / pixelcount, mismatches ? FStringf(TEXTCOLOR_RED " (%d pixels differ)", mismatches).GetChars() : "");
+	};
+
+	SpanDrawerArgs spanargs;
+	spanargs.SetDestY(viewport.get(), 0);
+	spanargs.SetDestX1(0);
+	spanargs.SetDestX2(count - 1);
+	spanargs.SetTexture((const uint8_t*)texture.data(), texsize, texsize);
+	spanargs.SetTextureUPos(0.0712);
+	spanargs.SetTextureVPos(0.5347);
+	spanargs.SetTextureUStep(1.5 / texsize);
+	spanargs.SetTextureVStep(1.0 / (3 * texsize));
+	spanargs.SetLight(0.0f, 8 << FRACBITS);
+
+	Printf("%d spans of %d pixels:\n", iterations, count);
+	for (int linear = 0; linear < 2; linear++)
+	{
+		// The templates pick the filter from the LOD and r_magfilter/r_minfilter
+		if (r_minfilter == !!linear)
+			spanargs.SetTextureLOD(0.0);
+		else if (r_magfilter == !!linear)
+			spanargs.SetTextureLOD(-1.0);
+		else
+		{
+			Printf("  %-7s skipped with the current r_magfilter and r_minfilter\n", filternames[linear]);
+			continue;
+		}
+
+		for (int masked = 0; masked < 2; masked++)
+		{
+			auto drawcolumn = masked ? &DrawSpanMasked32Command::DrawColumn : &DrawSpan32Command::DrawColumn;
+
+			std::fill(pixels, pixels + count, background);
+			drawcolumn(spanargs);
+			std::copy(pixels, pixels + count, reference.begin());
+
+			uint64_t start = I_nsTime();
+			for (int i = 0; i < iterations; i++)
+				drawcolumn(spanargs);
+			report(linear, masked, "DrawSpan32T", I_nsTime() - start, count, 0);
+
+			SpanKernelArgs kargs;
+			GetSpanKernelArgs(spanargs, kargs);
+			for (auto set : sets)
+			{
+				auto kernel = set->Kernels[linear][masked];
+
+				std::fill(pixels, pixels + count, background);
+				kernel(kargs);
+				int mismatches = 0;
+				for (int i = 0; i < count; i++)
+				{
+					if (pixels[i] != reference[i])
+						mismatches++;
+				}
+
+				start = I_nsTime();
+				for (int i = 0; i < iterations; i++)
+					kernel(kargs);
+				report(linear, masked, set->Name, I_nsTime() - start, count, mismatches);
+			}
+		}
+	}
+
+	// A wall column of a 1080p frame
+	WallDrawerArgs wallargs;
+	wallargs.SetDest(viewport.get());
+
+	WallColumnDrawerArgs colargs;
+	colargs.wallargs = &wallargs;
+	colargs.SetDest(0, 0);
+	colargs.SetCount(wallcount);
+	colargs.SetTextureUPos(5);
+	colargs.SetTextureVPos(0x089abcde);
+	colargs.SetTextureVStep((((0x80000000 + texsize - 1) / texsize) * 2 + 1) / 3);
+	colargs.SetLight(0.0f, 8 << FRACBITS);
+
+	auto fillcolumn = [&]()
+	{
+		for (int i = 0; i < wallcount; i++)
+			pixels[i * pitch] = background;
+	};
+
+	Printf("%d wall columns of %d pixels:\n", iterations, wallcount);
+	for (int linear = 0; linear < 2; linear++)
+	{
+		// The wall templates filter whenever there is a second texture column
+		const uint8_t *column = (const uint8_t*)(texture.data() + 17 * texsize);
+		const uint8_t *column2 = (const uint8_t*)(texture.data() + 18 * texsize);
+		colargs.SetTexture(column, linear ? column2 : nullptr, texsize);
+
+		for (int masked = 0; masked < 2; masked++)
+		{
+			auto drawcolumn = masked ? &DrawWallMasked32Command::DrawColumn : &DrawWall32Command::DrawColumn;
+
+			fillcolumn();
+			drawcolumn(colargs);
+			for (int i = 0; i < wallcount; i++)
+				reference[i] = pixels[i * pitch];
+
+			uint64_t start = I_nsTime();
+			for (int i = 0; i < iterations; i++)
+				drawcolumn(colargs);
+			report(linear, masked, "DrawWall32T", I_nsTime() - start, wallcount, 0);
+
+			WallKernelArgs kargs;
+			GetWallKernelArgs(colargs, kargs);
+			for (auto set : sets)
+			{
+				auto kernel = set->Walls[linear][masked];
+
+				fillcolumn();
+				kernel(kargs);
+				int mismatches = 0;
+				for (int i = 0; i < wallcount; i++)
+				{
+					if (pixels[i * pitch] != reference[i])
+						mismatches++;
+				}
+
+				start = I_nsTime();
+				for (int i = 0; i < iterations; i++)
+					kernel(kargs);
+				report(linear, masked, set->Name, I_nsTime() - start, wallcount, mismatches);
+			}
+		}
+	}
+}
@@ -0,0 +1,108 @@
+/*
+**  Runtime selected span and wall kernels
+**
+**  This software is provided 'as-is', without any express or implied
+**  warranty.  In no event will the authors be held liable for any damages
+**  arising from the use of this software.
+**
+**  Permission is granted to anyone to use this software for any purpose,
+**  including commercial applications, and to alter it and redistribute it
+**  freely, subject to the following restrictions:
+**
+**  1. The origin of this software must not be misrepresented; you must not
+**     claim that you wrote the original software. If you use this software
+**     in a product, an acknowledgment in the product documentation would be
+**     appreciated but is not required.
+**  2. Altered source versions must be plainly marked as such, and must not be
+**     misrepresented as being the original software.
+**  3. This notice may not be removed or altered from any source distribution.
+**
+*/
+
+#pragma once
+
+#include <stdint.h>
+
+#if !defined(NO_SSE) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define SPAN_KERNELS_AVX2
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__) || defined(_M_ARM64)
+#define SPAN_KERNELS_NEON
+#endif
+
+namespace swrenderer
+{
+	class SpanDrawerArgs;
+	class WallColumnDrawerArgs;
+
+	// Everything the span kernels need, already resolved from the drawer
+	// args. The kernels only cover the common case: opaque or masked spans
+	// with simple shading and no dynamic lights. Everything else goes through
+	// the DrawSpan32T templates.
+	struct SpanKernelArgs
+	{
+		uint32_t *dest;
+		int count;
+		const uint32_t *source;
+		uint32_t width;
+		uint32_t height;
+		uint32_t xfrac;
+		uint32_t yfrac;
+		uint32_t xstep;
+		uint32_t ystep;
+		uint32_t xone;		// only used by the linear filter
+		uint32_t yone;
+		uint32_t light;		// 0-256
+	};
+
+	typedef void(*SpanKernelFunc)(const SpanKernelArgs &args);
+
+	// The same for a wall column. Same restrictions as for the spans, the
+	// rest goes through the DrawWall32T templates.
+	struct WallKernelArgs
+	{
+		uint32_t *dest;
+		int pitch;
+		int count;
+		const uint32_t *source;
+		const uint32_t *source2;	// next texture column, only used by the linear filter
+		uint32_t height;
+		uint32_t frac;
+		uint32_t fracstep;
+		uint32_t one;				// only used by the linear filter
+		uint32_t texturefracx;		// 0-15, only used by the linear filter
+		uint32_t light;				// 0-256
+	};
+
+	typedef void(*WallKernelFunc)(const WallKernelArgs &args);
+
+	// Sprite and sky columns have no kernels yet and always go through the
+	// DrawSprite32T and DrawSky32T templates.
+	struct SpanKernelSet
+	{
+		const char *Name;
+		SpanKernelFunc Kernels[2][2];	// [linear][masked]
+		WallKernelFunc Walls[2][2];		// [linear][masked]
+	};
+
+	extern const SpanKernelSet SpanKernelsScalar;
+#ifdef SPAN_KERNELS_AVX2
+	extern const SpanKernelSet SpanKernelsAVX2;
+#endif
+#ifdef SPAN_KERNELS_NEON
+	extern const SpanKernelSet SpanKernelsNEON;
+#endif
+
+	// Draws a span with the best kernel set for this CPU.
+	// Returns false if the span needs the generic drawer instead.
+	bool DrawSpanKernel(const SpanDrawerArgs &args, bool masked);
+	bool DrawWallKernel(const WallColumnDrawerArgs &args, bool masked);
+
+	// The scalar kernels serve CPUs without a vector set and handle the tail pixels
+	// that do not fill a whole vector.
+	void DrawSpanNearestScalar(const SpanKernelArgs &args, bool masked);
+	void DrawSpanLinearScalar(const SpanKernelArgs &args, bool masked);
+	void DrawWallNearestScalar(const WallKernelArgs &args, bool masked);
+	void DrawWallLinearScalar(const WallKernelArgs &args, bool masked);
+}
@@ -61,6 +61,10 @@ namespace swrenderer
 		int X2 = MAXWIDTH;
 		bool MainThread = false;
 
+		// Timing of the last scene slice, used to balance the slices between threads.
+		uint64_t SliceStart = 0;
+		uint64_t SliceEnd = 0;
+
 		std::unique_ptr<RenderMemory> FrameMemory;
 		std::unique_ptr<RenderOpaquePass> OpaquePass;
 		std::unique_ptr<RenderTranslucentPass> TranslucentPass;
@@ -58,16 +58,25 @@
 #include "swrenderer/r_renderthread.h"
 #include "swrenderer/things/r_playersprite.h"
 #include <chrono>
+#include "i_time.h"
 
 EXTERN_CVAR(Int, r_clearbuffer)
 EXTERN_CVAR(Int, r_debug_draw)
 
 CVAR(Int, r_scene_multithreaded, 1, 0);
+CVAR(Bool, r_scene_balance, true, 0);	// move the slice boundaries so that every thread gets the same amount of work
 CVAR(Bool, r_models, true, CVAR_ARCHIVE | CVAR_GLOBALCONFIG);
 
 namespace swrenderer
 {
 	cycle_t WallCycles, PlaneCycles, MaskedCycles;
+
+	struct SliceStat
+	{
+		int X1, X2;
+		double BusyMS, IdleMS;
+	};
+	static std::vector<SliceStat> SliceStats;	// last main view frame, for 'stat swthreads'
 	
 	RenderScene::RenderScene()
 	{
@@ -186,14 +195,27 @@ namespace swrenderer
 			StartThreads(numThreads);
 		}
 
+		// Camera textures have their own size and content, so they must not disturb the balance of the main view.
+		bool canvas = MainThread()->Viewport->RenderingToCanvas;
+		bool balance = r_scene_balance && numThreads > 1;
+		if (canvas)
+		{
+			EvenSlices(CanvasEdges, numThreads);
+		}
+		else
+		{
+			BalanceSlices(numThreads, balance);
+		}
+		const std::vector<int> &edges = canvas ? CanvasEdges : SliceEdges;
+
 		// Setup threads:
 		std::unique_lock<std::mutex> start_lock(start_mutex);
 		for (int i = 0; i < numThreads; i++)
 		{
 			*Threads[i]->Viewport = *MainThread()->Viewport;
 			*Threads[i]->Light = *MainThread()->Light;
-			Threads[i]->X1 = viewwidth * i / numThreads;
-			Threads[i]->X2 = viewwidth * (i + 1) / numThreads;
+			Threads[i]->X1 = edges[i];
+			Threads[i]->X2 = edges[i + 1];
 		}
 		run_id++;
 		FSoftwareTexture::CurrentUpdate = run_id;
@@ -221,13 +243,97 @@ namespace swrenderer
 			finished_threads = 0;
 		}
 
+		if (!canvas)
+		{
+			uint64_t frameend = I_nsTime();
+			SliceStats.resize(numThreads);
+			SliceBusyMS.resize(numThreads);
+			for (int i = 0; i < numThreads; i++)
+			{
+				auto thread = Threads[i].get();
+				SliceBusyMS[i] = (thread->SliceEnd - thread->SliceStart) / 1e6;
+				SliceStats[i] = { thread->X1, thread->X2, SliceBusyMS[i], (frameend - thread->SliceEnd) / 1e6 };
+			}
+			if (!balance) SliceEdges.clear();	// start over with even slices next time.
+		}
+
 		// Change main thread back to covering the whole screen for player sprites
 		MainThread()->X1 = 0;
 		MainThread()->X2 = viewwidth;
 	}
 
+	//==========================================================================
+	//
+	// Sets up the column slices for the threads.
+	//
+	// The time each thread needed for its slice in the last frame gives a
+	// cost per column for that slice. The new boundaries split the total
+	// cost evenly between the threads. They only move halfway there each
+	// frame, so that one expensive frame does not make the slices oscillate.
+	//
+	//==========================================================================
+
+	void RenderScene::BalanceSlices(int numThreads, bool balance)
+	{
+		const int minwidth = std::min(16, viewwidth / numThreads);
+
+		bool valid = balance && SliceEdges.size() == size_t(numThreads + 1) && SliceEdges.back() == viewwidth && SliceBusyMS.size() == size_t(numThreads);
+		for (int i = 0; valid && i < numThreads; i++)
+		{
+			if (SliceBusyMS[i] <= 0 || SliceEdges[i + 1] <= SliceEdges[i]) valid = false;
+		}
+
+		if (!valid)
+		{
+			EvenSlices(SliceEdges, numThreads);
+			return;
+		}
+
+		double total = 0;
+		for (int i = 0; i < numThreads; i++) total += SliceBusyMS[i];
+		double target = total / numThreads;
+
+		std::vector<int> edges(numThreads + 1);
+		edges[0] = 0;
+		edges[numThreads] = viewwidth;
+
+		// Walk the old slices, treating the cost as evenly spread over each one's columns.
+		int slice = 0;
+		double consumed = 0;	// cost of the old slices before 'slice'
+		for (int i = 1; i < numThreads; i++)
+		{
+			double goal = target * i;
+			while (slice < numThreads - 1 && consumed + SliceBusyMS[slice] < goal)
+			{
+				consumed += SliceBusyMS[slice];
+				slice++;
+			}
+			int x1 = SliceEdges[slice], x2 = SliceEdges[slice + 1];
+			double frac = clamp((goal - consumed) / SliceBusyMS[slice], 0., 1.);
+			int wanted = x1 + int((x2 - x1) * frac + 0.5);
+			edges[i] = (SliceEdges[i] + wanted) / 2;
+		}
+
+		// Every thread gets at least a few columns.
+		for (int i = 1; i < numThreads; i++)
+		{
+			edges[i] = clamp(edges[i], edges[i - 1] + minwidth, viewwidth - minwidth * (numThreads - i));
+		}
+		SliceEdges = std::move(edges);
+	}
+
+	void RenderScene::EvenSlices(std::vector<int> &edges, int numThreads)
+	{
+		edges.resize(numThreads + 1);
+		for (int i = 0; i <= numThreads; i++)
+		{
+			edges[i] = viewwidth * i / numThreads;
+		}
+	}
+
 	void RenderScene::RenderThreadSlice(RenderThread *thread)
 	{
+		thread->SliceStart = I_nsTime();
 		thread->FrameMemory->Clear();
 		thread->Clip3D->Cleanup();
 		thread->Clip3D->ResetClip(); // reset clips (floor/ceiling)
@@ -259,6 +365,7 @@ namespace swrenderer
 
 			thread->TranslucentPass->Render();
 		}
+		thread->SliceEnd = I_nsTime();
 
 #if 0 // shows the render slice edges
 		if (thread->Viewport->RenderTarget->IsBgra())
@@ -396,6 +503,17 @@ namespace swrenderer
 		return out;
 	}
 
+	ADD_STAT(swthreads)
+	{
+		FString out;
+		for (size_t i = 0; i < SliceStats.size(); i++)
+		{
+			auto &stat = SliceStats[i];
+			out.AppendFormat("thread %d: columns %d-%d  busy=%04.1f ms  idle=%04.1f ms\n", (int)i, stat.X1, stat.X2, stat.BusyMS, stat.IdleMS);
+		}
+		return out;
+	}
+
 	static double f_acc, w_acc, p_acc, m_acc;
 	static int acc_c;
 
@@ -63,6 +63,8 @@ namespace swrenderer
 
 		void StartThreads(size_t numThreads);
 		void StopThreads();
+		void BalanceSlices(int numThreads, bool balance);
+		void EvenSlices(std::vector<int> &edges, int numThreads);
 		
 		bool dontmaplines = false;
 		int clearcolor = 0;
@@ -75,5 +77,8 @@ namespace swrenderer
 		std::mutex end_mutex;
 		std::condition_variable end_condition;
 		size_t finished_threads = 0;
+		std::vector<int> SliceEdges;	// column boundaries of the main view's thread slices. Thread i renders SliceEdges[i] to SliceEdges[i + 1].
+		std::vector<double> SliceBusyMS;	// time each thread spent on its slice of the last main view frame
+		std::vector<int> CanvasEdges;	// even slices for camera textures, which must not disturb the main view's balance
 	};
 }
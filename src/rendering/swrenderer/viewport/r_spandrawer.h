@@ -20,6 +20,7 @@ namespace swrenderer
 		void SetDestX1(int x) { ds_x1 = x; }
 		void SetDestX2(int x) { ds_x2 = x; }
 		void SetTexture(RenderThread *thread, FSoftwareTexture *tex);
+		void SetTexture(const uint8_t *pixels, int width, int height);
 		void SetTextureLOD(double lod) { ds_lod = lod; }
 		void SetTextureUPos(double u) { ds_xfrac = (uint32_t)(int64_t)(u * 4294967296.0); }
 		void SetTextureVPos(double v) { ds_yfrac = (uint32_t)(int64_t)(v * 4294967296.0); }
@@ -77,10 +78,10 @@ namespace swrenderer
 		uint32_t ds_yfrac;
 		uint32_t ds_xstep;
 		uint32_t ds_ystep;
-		uint32_t *dc_srcblend;
-		uint32_t *dc_destblend;
-		fixed_t dc_srcalpha;
-		fixed_t dc_destalpha;
+		uint32_t *dc_srcblend = nullptr;
+		uint32_t *dc_destblend = nullptr;
+		fixed_t dc_srcalpha = 0;
+		fixed_t dc_destalpha = 0;
 		int ds_color = 0;
 		double ds_lod;
 		RenderViewport *ds_viewport = nullptr;
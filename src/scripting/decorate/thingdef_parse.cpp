@@ -52,6 +52,7 @@
 #ifndef _MSC_VER
 #include "i_system.h"  // for strlwr()
 #endif // !_MSC_VER
+#include "scriptcache.h"
 
 void ParseOldDecoration(FScanner &sc, EDefinitionType def, PNamespace *ns);
 EXTERN_CVAR(Bool, strictdecorate);
@@ -1273,6 +1274,8 @@ static void ParseDamageDefinition(FScanner &sc)
 
 void ParseDecorate (FScanner &sc, PNamespace *ns)
 {
+	ScriptCache.AddSource(sc.LumpNum);
+
 	// Get actor class name.
 	for(;;)
 	{
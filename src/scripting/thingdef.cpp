@@ -55,6 +55,7 @@
 #include "thingdef.h"
 #include "zcc_parser.h"
 #include "zcc_compile_doom.h"
+#include "scriptcache.h"
 
 // EXTERNAL FUNCTION PROTOTYPES --------------------------------------------
 void InitThingdef();
@@ -460,6 +461,16 @@ void LoadActors()
 	ParseAllDecorate();
 	SynthesizeFlagFields();
 
+	// State pointers in the compiled code can only be found again through their class
+	for (auto cls : PClass::AllClasses)
+	{
+		auto info = cls->IsDescendantOf(RUNTIME_CLASS(AActor)) ? static_cast<PClassActor *>(cls)->ActorInfo() : nullptr;
+		if (info != nullptr && info->NumOwnedStates > 0)
+		{
+			ScriptCache.AddAddressRange(FStringf("states:%s", cls->TypeName.GetChars()), info->OwnedStates, info->NumOwnedStates * sizeof(FState));
+		}
+	}
+
 	FunctionBuildList.Build();
 
 	if (FScriptPosition::ErrorCounter > 0)
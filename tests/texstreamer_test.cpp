@@ -0,0 +1,294 @@
+/*
+** texstreamer_test.cpp
+** Drives FTextureStreamer through a fake backend
+**
+**---------------------------------------------------------------------------
+**
+** This program is free software: you can redistribute it and/or modify
+** it under the terms of the GNU General Public License as published by
+** the Free Software Foundation, either version 3 of the License, or
+** (at your option) any later version.
+**
+** This program is distributed in the hope that it will be useful,
+** but WITHOUT ANY WARRANTY; without even the implied warranty of
+** MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+** GNU General Public License for more details.
+**
+** You should have received a copy of the GNU General Public License
+** along with this program.  If not, see http://www.gnu.org/licenses/
+**
+**---------------------------------------------------------------------------
+**
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <vector>
+#include "hw_texstreamer.h"
+
+// tarray.h picks up m_alloc.h, which the engine implements with fatal errors
+void *M_Malloc(size_t size) { return malloc(size); }
+void *M_Realloc(void *memblock, size_t size) { return realloc(memblock, size); }
+void *M_Calloc(size_t v1, size_t v2) { return calloc(v1, v2); }
+void M_Free(void *memblock) { free(memblock); }
+
+static int failures = 0;
+
+#define CHECK(cond) do { if (!(cond)) { printf("%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); failures++; } } while (0)
+
+//==========================================================================
+//
+// Textures are plain numbers, the streamer never looks inside them.
+// A texture loads when it is drawn, at the level it was last set to.
+//
+//==========================================================================
+
+struct FakeTexture
+{
+	int NumLevels = 1;
+	size_t BaseSize = 0;
+	int Level = 0;
+	bool Loaded = false;
+	bool Busy = false;
+	int Loads = 0, Evictions = 0;
+};
+
+class FFakeStreamBackend : public ITextureStreamBackend
+{
+public:
+	std::vector<FakeTexture> Textures;
+
+	FGameTexture *Add(int numLevels, size_t baseSize)
+	{
+		FakeTexture t;
+		t.NumLevels = numLevels;
+		t.BaseSize = baseSize;
+		Textures.push_back(t);
+		return ToTex(Textures.size() - 1);
+	}
+
+	static FGameTexture *ToTex(size_t index) { return reinterpret_cast<FGameTexture *>((index + 1) * 16); }
+	FakeTexture &Get(FGameTexture *tex) { return Textures[reinterpret_cast<uintptr_t>(tex) / 16 - 1]; }
+
+	void Draw(FGameTexture *tex, float texelsPerPixel)
+	{
+		TexStreamer.MarkUsed(tex, texelsPerPixel);
+		auto &t = Get(tex);
+		if (!t.Loaded)
+		{
+			t.Loaded = true;
+			t.Loads++;
+		}
+	}
+
+	int NumLevels(FGameTexture *tex) override { return Get(tex).NumLevels; }
+
+	size_t LevelSize(FGameTexture *tex, int level) override
+	{
+		auto &t = Get(tex);
+		if (t.NumLevels == 1) return t.BaseSize;
+		return t.BaseSize >> (2 * std::min(level, t.NumLevels - 1));
+	}
+
+	bool IsLoaded(FGameTexture *tex) override { return Get(tex).Loaded; }
+
+	bool SetLevel(FGameTexture *tex, int level) override
+	{
+		auto &t = Get(tex);
+		if (t.Level == level) return true;
+		if (t.Loaded && t.Busy) return false;
+		t.Level = level;
+		t.Loaded = false;
+		return true;
+	}
+
+	bool Evict(FGameTexture *tex) override
+	{
+		auto &t = Get(tex);
+		if (t.Busy) return false;
+		t.Loaded = false;
+		t.Evictions++;
+		return true;
+	}
+};
+
+static FFakeStreamBackend Backend;
+
+static void Reset(size_t budget)
+{
+	Backend.Textures.clear();
+	TexStreamer.SetBackend(&Backend);
+	TexStreamer.SetBudget(budget);
+}
+
+//==========================================================================
+//
+// One level per doubling of texels per pixel, clamped to what the texture has
+//
+//==========================================================================
+
+static void TestMipSelection()
+{
+	Reset(0);
+	auto a = Backend.Add(8, 1 << 20);
+	auto b = Backend.Add(8, 1 << 20);
+	auto c = Backend.Add(8, 1 << 20);
+	auto rgba = Backend.Add(1, 1 << 20);
+
+	TexStreamer.Update();
+	Backend.Draw(a, 0.5f);
+	Backend.Draw(b, 4.f);
+	Backend.Draw(c, 1000.f);
+	Backend.Draw(rgba, 16.f);
+
+	CHECK(Backend.Get(a).Level == 0);
+	CHECK(Backend.Get(b).Level == 2);
+	CHECK(Backend.Get(c).Level == 7);
+	CHECK(Backend.Get(rgba).Level == 0);
+	CHECK(TexStreamer.GetStats().Resident == (1u << 20) + (1u << 16) + (1u << 6) + (1u << 20));
+
+	// The smallest value of a frame wins
+	TexStreamer.Update();
+	Backend.Draw(b, 16.f);
+	Backend.Draw(b, 1.f);
+	TexStreamer.Update();
+	CHECK(Backend.Get(b).Level == 0);
+
+	// Detail goes up at once, but only down when two levels off
+	Backend.Draw(b, 2.f);
+	TexStreamer.Update();
+	CHECK(Backend.Get(b).Level == 0);
+	Backend.Draw(b, 4.f);
+	TexStreamer.Update();
+	CHECK(Backend.Get(b).Level == 2);
+	CHECK(!Backend.Get(b).Loaded);
+}
+
+//==========================================================================
+//
+// Over budget, the least recently drawn textures go first, but not the
+// ones drawn in the last EVICT_AGE frames.
+//
+//==========================================================================
+
+static void TestEviction()
+{
+	Reset(3 << 20);
+	auto a = Backend.Add(1, 1 << 20);
+	auto b = Backend.Add(1, 1 << 20);
+	auto c = Backend.Add(1, 1 << 20);
+	auto d = Backend.Add(1, 1 << 20);
+
+	TexStreamer.Update();
+	Backend.Draw(a, 1.f);
+	TexStreamer.Update();
+	Backend.Draw(b, 1.f);
+	TexStreamer.Update();
+	Backend.Draw(c, 1.f);
+	Backend.Draw(d, 1.f);
+	CHECK(TexStreamer.GetStats().Resident == 4u << 20);
+
+	for (int i = 0; i <= FTextureStreamer::EVICT_AGE; i++)
+	{
+		TexStreamer.Update();
+		Backend.Draw(c, 1.f);
+		Backend.Draw(d, 1.f);
+	}
+	TexStreamer.Update();
+
+	CHECK(Backend.Get(a).Evictions == 1);
+	CHECK(Backend.Get(b).Evictions == 0);
+	CHECK(Backend.Get(c).Evictions == 0 && Backend.Get(d).Evictions == 0);
+	CHECK(TexStreamer.GetStats().Resident == 3u << 20);
+	CHECK(TexStreamer.GetStats().Evictions == 1);
+
+	// A texture that is still loading stays, and so does everything in front of it
+	Reset(1 << 20);
+	a = Backend.Add(1, 1 << 20);
+	b = Backend.Add(1, 1 << 20);
+	TexStreamer.Update();
+	Backend.Draw(a, 1.f);
+	Backend.Draw(b, 1.f);
+	Backend.Get(a).Busy = true;
+	for (int i = 0; i <= FTextureStreamer::EVICT_AGE + 1; i++) TexStreamer.Update();
+	CHECK(Backend.Get(a).Evictions == 0);
+	CHECK(Backend.Get(a).Loaded);
+}
+
+//==========================================================================
+//
+// When the textures drawn every frame alone do not fit, everything drops
+// a level after BIAS_DELAY frames.
+//
+//==========================================================================
+
+static void TestBudgetBias()
+{
+	Reset(1 << 20);
+	auto a = Backend.Add(8, 1 << 20);
+	auto b = Backend.Add(8, 1 << 20);
+
+	for (int i = 0; i <= FTextureStreamer::BIAS_DELAY; i++)
+	{
+		TexStreamer.Update();
+		Backend.Draw(a, 1.f);
+		Backend.Draw(b, 1.f);
+	}
+	CHECK(TexStreamer.GetStats().Bias == 1);
+
+	TexStreamer.Update();
+	CHECK(Backend.Get(a).Level == 1 && Backend.Get(b).Level == 1);
+	Backend.Draw(a, 1.f);
+	Backend.Draw(b, 1.f);
+	CHECK(TexStreamer.GetStats().Resident <= 1u << 20);
+
+	// Without a budget the bias goes away
+	TexStreamer.SetBudget(0);
+	TexStreamer.Update();
+	CHECK(TexStreamer.GetStats().Bias == 0);
+}
+
+//==========================================================================
+//
+// A texture that turns out to have stored mipmaps once it is loaded, like
+// one that was transcoded since it was first seen, gets its levels and
+// size from the loaded data.
+//
+//==========================================================================
+
+static void TestFormatChange()
+{
+	Reset(0);
+	auto a = Backend.Add(1, 4 << 20);
+
+	TexStreamer.Update();
+	Backend.Draw(a, 8.f);
+	CHECK(Backend.Get(a).Level == 0);
+	CHECK(TexStreamer.GetStats().Resident == 4u << 20);
+
+	Backend.Get(a).NumLevels = 8;
+	Backend.Get(a).BaseSize = 1 << 20;
+	TexStreamer.Update();
+	CHECK(Backend.Get(a).Level == 3);
+	Backend.Draw(a, 8.f);
+	TexStreamer.Update();
+	CHECK(TexStreamer.GetStats().Resident == (1u << 20) >> 6);
+}
+
+int main()
+{
+	TestMipSelection();
+	TestEviction();
+	TestBudgetBias();
+	TestFormatChange();
+	TexStreamer.SetBackend(nullptr);
+
+	if (failures > 0)
+	{
+		printf("%d checks failed\n", failures);
+		return 1;
+	}
+	printf("All texture streamer checks passed\n");
+	return 0;
+}